@@ -46,12 +46,21 @@ int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
 	int ret = 0;
 	struct kevent ke;
 	short filters = _poll_to_filter_(event->events);
+	unsigned short flags = EV_ADD | EV_ENABLE;
+
+	/*
+	 * EV_DISPATCH disables the event after delivery,
+	 * EV_ENABLE (via EPOLL_CTL_MOD) re-arms it
+	 */
+	if (event->events & EPOLLONESHOT) {
+		flags |= EV_DISPATCH;
+	}
 
 	switch (op) {
 		/* The kevent man page says that EV_ADD also does MOD */
 		case EPOLL_CTL_ADD:
 		case EPOLL_CTL_MOD:
-			EV_SET(&ke, fd, filters, EV_ADD | EV_ENABLE, 0, 0, event->data.ptr);
+			EV_SET(&ke, fd, filters, flags, 0, 0, event->data.ptr);
 			break;
 		case EPOLL_CTL_DEL:
 			EV_SET(&ke, fd, filters, EV_DELETE, 0, 0, event->data.ptr);
@@ -28,6 +28,7 @@
 
 #define EPOLLIN POLLIN
 #define EPOLLOUT POLLOUT
+#define EPOLLONESHOT (1u << 30)
 
 typedef union epoll_data {
 	void        *ptr;
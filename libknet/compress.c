@@ -21,6 +21,80 @@
 #include "threads_common.h"
 #include "common.h"
 
+/*
+ * modules linked into libknet at build time (--enable-static-modules)
+ * are never loaded via dlopen. compress and decompress call them
+ * through their own ops symbol instead of going through
+ * compress_modules_cmds. The ops are const, the function pointers
+ * are fixed at link time and cannot be changed at runtime.
+ */
+
+#if STATIC_COMPRESS_ZLIB
+extern const compress_ops_t compress_zlib_model;
+#define COMPRESS_ZLIB_OPS &compress_zlib_model
+#define COMPRESS_ZLIB_CASE(op, args) case 1: return compress_zlib_model.op args;
+#else
+#define COMPRESS_ZLIB_OPS NULL
+#define COMPRESS_ZLIB_CASE(op, args)
+#endif
+
+#if STATIC_COMPRESS_LZ4
+extern const compress_ops_t compress_lz4_model;
+extern const compress_ops_t compress_lz4hc_model;
+#define COMPRESS_LZ4_OPS &compress_lz4_model
+#define COMPRESS_LZ4HC_OPS &compress_lz4hc_model
+#define COMPRESS_LZ4_CASE(op, args) case 2: return compress_lz4_model.op args; \
+				    case 3: return compress_lz4hc_model.op args;
+#else
+#define COMPRESS_LZ4_OPS NULL
+#define COMPRESS_LZ4HC_OPS NULL
+#define COMPRESS_LZ4_CASE(op, args)
+#endif
+
+#if STATIC_COMPRESS_LZO2
+extern const compress_ops_t compress_lzo2_model;
+#define COMPRESS_LZO2_OPS &compress_lzo2_model
+#define COMPRESS_LZO2_CASE(op, args) case 4: return compress_lzo2_model.op args;
+#else
+#define COMPRESS_LZO2_OPS NULL
+#define COMPRESS_LZO2_CASE(op, args)
+#endif
+
+#if STATIC_COMPRESS_LZMA
+extern const compress_ops_t compress_lzma_model;
+#define COMPRESS_LZMA_OPS &compress_lzma_model
+#define COMPRESS_LZMA_CASE(op, args) case 5: return compress_lzma_model.op args;
+#else
+#define COMPRESS_LZMA_OPS NULL
+#define COMPRESS_LZMA_CASE(op, args)
+#endif
+
+#if STATIC_COMPRESS_BZIP2
+extern const compress_ops_t compress_bzip2_model;
+#define COMPRESS_BZIP2_OPS &compress_bzip2_model
+#define COMPRESS_BZIP2_CASE(op, args) case 6: return compress_bzip2_model.op args;
+#else
+#define COMPRESS_BZIP2_OPS NULL
+#define COMPRESS_BZIP2_CASE(op, args)
+#endif
+
+#if STATIC_COMPRESS_ZSTD
+extern const compress_ops_t compress_zstd_model;
+#define COMPRESS_ZSTD_OPS &compress_zstd_model
+#define COMPRESS_ZSTD_CASE(op, args) case 7: return compress_zstd_model.op args;
+#else
+#define COMPRESS_ZSTD_OPS NULL
+#define COMPRESS_ZSTD_CASE(op, args)
+#endif
+
+#define COMPRESS_STATIC_CASES(op, args) \
+	COMPRESS_ZLIB_CASE(op, args) \
+	COMPRESS_LZ4_CASE(op, args) \
+	COMPRESS_LZO2_CASE(op, args) \
+	COMPRESS_LZMA_CASE(op, args) \
+	COMPRESS_BZIP2_CASE(op, args) \
+	COMPRESS_ZSTD_CASE(op, args)
+
 /*
  * internal module switch data
  */
@@ -34,12 +108,13 @@
 
 compress_model_t compress_modules_cmds[] = {
 	{ "none" , 0, 0, 0, NULL },
-	{ "zlib" , 1, WITH_COMPRESS_ZLIB , 0, NULL },
-	{ "lz4"  , 2, WITH_COMPRESS_LZ4  , 0, NULL },
-	{ "lz4hc", 3, WITH_COMPRESS_LZ4  , 0, NULL },
-	{ "lzo2" , 4, WITH_COMPRESS_LZO2 , 0, NULL },
-	{ "lzma" , 5, WITH_COMPRESS_LZMA , 0, NULL },
-	{ "bzip2", 6, WITH_COMPRESS_BZIP2, 0, NULL },
+	{ "zlib" , 1, WITH_COMPRESS_ZLIB , STATIC_COMPRESS_ZLIB , COMPRESS_ZLIB_OPS  },
+	{ "lz4"  , 2, WITH_COMPRESS_LZ4  , STATIC_COMPRESS_LZ4  , COMPRESS_LZ4_OPS   },
+	{ "lz4hc", 3, WITH_COMPRESS_LZ4  , STATIC_COMPRESS_LZ4  , COMPRESS_LZ4HC_OPS },
+	{ "lzo2" , 4, WITH_COMPRESS_LZO2 , STATIC_COMPRESS_LZO2 , COMPRESS_LZO2_OPS  },
+	{ "lzma" , 5, WITH_COMPRESS_LZMA , STATIC_COMPRESS_LZMA , COMPRESS_LZMA_OPS  },
+	{ "bzip2", 6, WITH_COMPRESS_BZIP2, STATIC_COMPRESS_BZIP2, COMPRESS_BZIP2_OPS },
+	{ "zstd" , 7, WITH_COMPRESS_ZSTD , STATIC_COMPRESS_ZSTD , COMPRESS_ZSTD_OPS  },
 	{ NULL, 255, 0, 0, NULL }
 };
 
@@ -118,6 +193,18 @@ static int compress_check_lib_is_init(knet_handle_t knet_h, int cmp_model)
 	return 0;
 }
 
+/*
+ * compress_load_dict should _always_ be invoked in write lock context
+ */
+static int compress_load_dict(knet_handle_t knet_h, int cmp_model)
+{
+	if (compress_modules_cmds[cmp_model].ops->load_dict == NULL) {
+		return 0;
+	}
+
+	return compress_modules_cmds[cmp_model].ops->load_dict(knet_h, cmp_model);
+}
+
 /*
  * compress_load_lib should _always_ be invoked in write lock context
  */
@@ -184,10 +271,20 @@ static int compress_load_lib(knet_handle_t knet_h, int cmp_model, int rate_limit
 		knet_h->compress_int_data[cmp_model] = (void *)&"1";
 	}
 
+	if (compress_load_dict(knet_h, cmp_model) < 0) {
+		return -1;
+	}
+
+	/*
+	 * publish the model to the RX fast path only once
+	 * it is fully initialized for this handle
+	 */
+	__atomic_store_n(&knet_h->decompress_ops[cmp_model], compress_modules_cmds[cmp_model].ops, __ATOMIC_RELEASE);
+
 	return 0;
 }
 
-static int compress_lib_test(knet_handle_t knet_h)
+static int compress_lib_test(knet_handle_t knet_h, int cmp_model, int compress_level)
 {
 	int savederrno = 0;
 	unsigned char src[KNET_DATABUFSIZE];
@@ -203,14 +300,14 @@ static int compress_lib_test(knet_handle_t knet_h)
 	 * so we need to call directly into the modules
 	 */
 
-	if (compress_modules_cmds[knet_h->compress_model].ops->compress(knet_h, src, KNET_DATABUFSIZE, dst, &dst_comp_len) < 0) {
+	if (compress_modules_cmds[cmp_model].ops->compress(knet_h, src, KNET_DATABUFSIZE, dst, &dst_comp_len, compress_level) < 0) {
 		savederrno = errno;
 		log_err(knet_h, KNET_SUB_COMPRESS, "Unable to compress test buffer. Please check your compression settings: %s", strerror(savederrno));
 		errno = savederrno;
 		return -1;
 	}
 
-	if (compress_modules_cmds[knet_h->compress_model].ops->decompress(knet_h, dst, dst_comp_len, src, &dst_decomp_len) < 0) {
+	if (compress_modules_cmds[cmp_model].ops->decompress(knet_h, dst, dst_comp_len, src, &dst_decomp_len) < 0) {
 		savederrno = errno;
 		log_err(knet_h, KNET_SUB_COMPRESS, "Unable to decompress test buffer. Please check your compression settings: %s", strerror(savederrno));
 		errno = savederrno;
@@ -238,11 +335,270 @@ int compress_init(
 		return -1;
 	}
 
+	/*
+	 * stream flags share khp_data_compress with the model id
+	 */
+	if (max_model > KNET_COMPRESS_MODEL_MASK) {
+		log_err(knet_h, KNET_SUB_COMPRESS, "Too many compress methods to fit the onwire header.");
+		errno = EINVAL;
+		return -1;
+	}
+
 	memset(&last_load_failure, 0, sizeof(struct timespec));
 
 	return 0;
 }
 
+static int compress_cfg_threshold(
+	knet_handle_t knet_h,
+	struct knet_handle_compress_cfg *knet_handle_compress_cfg)
+{
+	if (knet_handle_compress_cfg->compress_threshold > KNET_MAX_PACKET_SIZE) {
+		log_err(knet_h, KNET_SUB_COMPRESS, "compress threshold cannot be higher than KNET_MAX_PACKET_SIZE (%d).",
+			 KNET_MAX_PACKET_SIZE);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (knet_handle_compress_cfg->compress_threshold == 0) {
+		knet_h->compress_threshold = KNET_COMPRESS_THRESHOLD;
+		log_debug(knet_h, KNET_SUB_COMPRESS, "resetting compression threshold to default (%d)", KNET_COMPRESS_THRESHOLD);
+	} else {
+		knet_h->compress_threshold = knet_handle_compress_cfg->compress_threshold;
+	}
+
+	return 0;
+}
+
+/*
+ * automatic compression.
+ *
+ * The handle walks a ladder of model/level pairs ordered from the
+ * cheapest to the most expensive in CPU time (and best compression).
+ * Only the models that are built in and can be loaded are part of the
+ * ladder. compress_auto_check runs about once a second from the
+ * heartbeat thread and moves one step at a time:
+ *
+ * - down, when the TX workers spend more than KNET_COMPRESS_AUTO_CPU_HIGH
+ *   percent of their time compressing (TX is the bottleneck).
+ * - up, when the links push back (sendmsg had to be retried) and
+ *   compression takes less than KNET_COMPRESS_AUTO_CPU_LOW percent
+ *   of the TX workers time (links are the bottleneck).
+ *
+ * receivers decompress any model on demand, changing model does
+ * not require any coordination with the other nodes.
+ */
+
+static struct knet_compress_auto_step compress_auto_ladder[] = {
+	{ 2, 9 },	/* lz4, fastest */
+	{ 2, 1 },	/* lz4 */
+	{ 3, 4 },	/* lz4hc */
+	{ 1, 1 },	/* zlib */
+	{ 3, 9 },	/* lz4hc */
+	{ 1, 6 },	/* zlib */
+	{ 1, 9 },	/* zlib, max compression */
+	{ -1, 0 }
+};
+
+#define KNET_COMPRESS_AUTO_INTERVAL 1000000000	/* ns */
+#define KNET_COMPRESS_AUTO_CPU_HIGH 50		/* percent */
+#define KNET_COMPRESS_AUTO_CPU_LOW  20		/* percent */
+
+static int compress_auto_cfg(
+	knet_handle_t knet_h,
+	struct knet_handle_compress_cfg *knet_handle_compress_cfg)
+{
+	int savederrno = 0, err = 0;
+	int idx, cmp_model;
+	struct knet_compress_auto *state = &knet_h->compress_auto_state;
+
+	if (compress_cfg_threshold(knet_h, knet_handle_compress_cfg) < 0) {
+		return -1;
+	}
+
+	savederrno = pthread_rwlock_wrlock(&shlib_rwlock);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_COMPRESS, "Unable to get write lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	memset(state, 0, sizeof(struct knet_compress_auto));
+
+	for (idx = 0; compress_auto_ladder[idx].model >= 0; idx++) {
+		cmp_model = compress_auto_ladder[idx].model;
+
+		if (compress_modules_cmds[cmp_model].built_in == 0) {
+			continue;
+		}
+
+		if (compress_load_lib(knet_h, cmp_model, 0) < 0) {
+			log_debug(knet_h, KNET_SUB_COMPRESS, "compress auto: skipping %s, unable to load library: %s",
+				  compress_modules_cmds[cmp_model].model_name, strerror(errno));
+			continue;
+		}
+
+		if (val_level(knet_h, cmp_model, compress_auto_ladder[idx].level) < 0) {
+			continue;
+		}
+
+		memmove(&state->steps[state->steps_num], &compress_auto_ladder[idx], sizeof(struct knet_compress_auto_step));
+		state->steps_num++;
+	}
+
+	if (!state->steps_num) {
+		log_err(knet_h, KNET_SUB_COMPRESS, "compress auto: no usable compress model (lz4, lz4hc or zlib) available");
+		savederrno = EINVAL;
+		err = -1;
+		goto out_unlock;
+	}
+
+	knet_h->compress_model = state->steps[0].model;
+	knet_h->compress_level = state->steps[0].level;
+
+	if (compress_load_dict(knet_h, knet_h->compress_model) < 0) {
+		savederrno = errno;
+		err = -1;
+		goto out_unlock;
+	}
+
+	if (compress_lib_test(knet_h, knet_h->compress_model, knet_h->compress_level) < 0) {
+		savederrno = errno;
+		err = -1;
+		goto out_unlock;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &state->last_check);
+	knet_h->compress_auto = 1;
+
+	log_debug(knet_h, KNET_SUB_COMPRESS, "compress auto: %u steps available, starting with %s level %d",
+		  state->steps_num, compress_modules_cmds[knet_h->compress_model].model_name, knet_h->compress_level);
+
+out_unlock:
+	pthread_rwlock_unlock(&shlib_rwlock);
+
+	if (err) {
+		knet_h->compress_model = 0;
+		knet_h->compress_level = 0;
+	}
+
+	errno = savederrno;
+	return err;
+}
+
+/*
+ * compress_auto_check must be invoked without global lock
+ */
+void compress_auto_check(
+	knet_handle_t knet_h)
+{
+	struct knet_compress_auto *state = &knet_h->compress_auto_state;
+	struct knet_host *host;
+	struct knet_link *link;
+	struct timespec clock_now;
+	unsigned long long timediff;
+	uint64_t compress_time = 0, tx_retries = 0, new_retries, busy;
+	int link_idx, step, new_step;
+
+	if (pthread_rwlock_rdlock(&knet_h->global_rwlock) != 0) {
+		log_debug(knet_h, KNET_SUB_COMPRESS, "compress auto: unable to get read lock");
+		return;
+	}
+
+	if (!knet_h->compress_auto) {
+		pthread_rwlock_unlock(&knet_h->global_rwlock);
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &clock_now);
+	timespec_diff(state->last_check, clock_now, &timediff);
+	if (timediff < KNET_COMPRESS_AUTO_INTERVAL) {
+		pthread_rwlock_unlock(&knet_h->global_rwlock);
+		return;
+	}
+
+	if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+		compress_time = state->compress_time;
+		pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+	}
+
+	for (host = knet_h->host_head; host != NULL; host = host->next) {
+		for (link_idx = 0; link_idx < KNET_MAX_LINK; link_idx++) {
+			link = &host->link[link_idx];
+			if (link->status.enabled != 1) {
+				continue;
+			}
+			tx_retries += link->status.stats.tx_data_retries;
+		}
+	}
+
+	/*
+	 * percentage of the TX workers time spent compressing
+	 */
+	busy = ((compress_time - state->last_compress_time) * 100) / (timediff * knet_h->tx_workers_num);
+	/*
+	 * links can be removed and stats go backwards, that's not backpressure
+	 */
+	if (tx_retries < state->last_tx_retries) {
+		state->last_tx_retries = tx_retries;
+	}
+	new_retries = tx_retries - state->last_tx_retries;
+
+	step = new_step = state->step;
+	if ((busy > KNET_COMPRESS_AUTO_CPU_HIGH) && (step > 0)) {
+		new_step = step - 1;
+	} else if ((new_retries) && (busy < KNET_COMPRESS_AUTO_CPU_LOW) &&
+		   (step < state->steps_num - 1)) {
+		new_step = step + 1;
+	}
+
+	state->last_compress_time = compress_time;
+	state->last_tx_retries = tx_retries;
+	state->last_check = clock_now;
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+
+	if (new_step == step) {
+		return;
+	}
+
+	if (get_global_wrlock(knet_h) != 0) {
+		log_debug(knet_h, KNET_SUB_COMPRESS, "compress auto: unable to get write lock");
+		return;
+	}
+
+	/*
+	 * configuration might have changed while we were not holding the lock
+	 */
+	if ((!knet_h->compress_auto) || (state->step != step)) {
+		goto out_unlock;
+	}
+
+	if (pthread_rwlock_wrlock(&shlib_rwlock) != 0) {
+		log_debug(knet_h, KNET_SUB_COMPRESS, "compress auto: unable to get shlib write lock");
+		goto out_unlock;
+	}
+
+	state->step = new_step;
+	knet_h->compress_model = state->steps[new_step].model;
+	knet_h->compress_level = state->steps[new_step].level;
+
+	if (compress_load_dict(knet_h, knet_h->compress_model) < 0) {
+		log_warn(knet_h, KNET_SUB_COMPRESS, "compress auto: unable to load dictionary for %s",
+			 compress_modules_cmds[knet_h->compress_model].model_name);
+	}
+
+	pthread_rwlock_unlock(&shlib_rwlock);
+
+	log_info(knet_h, KNET_SUB_COMPRESS, "compress auto: switching to %s level %d (compress cpu: %llu%%, tx retries: %llu)",
+		 compress_modules_cmds[knet_h->compress_model].model_name, knet_h->compress_level,
+		 (unsigned long long)busy, (unsigned long long)new_retries);
+
+out_unlock:
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+}
+
 int compress_cfg(
 	knet_handle_t knet_h,
 	struct knet_handle_compress_cfg *knet_handle_compress_cfg)
@@ -250,6 +606,15 @@ int compress_cfg(
 	int savederrno = 0, err = 0;
 	int cmp_model;
 
+	knet_h->compress_auto = 0;
+
+	if (!strcmp(knet_handle_compress_cfg->compress_model, "auto")) {
+		log_debug(knet_h, KNET_SUB_COMPRESS,
+			  "Initizializing automatic compression [auto/%u]",
+			  knet_handle_compress_cfg->compress_threshold);
+		return compress_auto_cfg(knet_h, knet_handle_compress_cfg);
+	}
+
 	cmp_model = compress_get_model(knet_handle_compress_cfg->compress_model);
 	if (cmp_model < 0) {
 		log_err(knet_h, KNET_SUB_COMPRESS, "compress model %s not supported", knet_handle_compress_cfg->compress_model);
@@ -268,20 +633,10 @@ int compress_cfg(
 			return -1;
 		}
 
-		if (knet_handle_compress_cfg->compress_threshold > KNET_MAX_PACKET_SIZE) {
-			log_err(knet_h, KNET_SUB_COMPRESS, "compress threshold cannot be higher than KNET_MAX_PACKET_SIZE (%d).",
-				 KNET_MAX_PACKET_SIZE);
-			errno = EINVAL;
+		if (compress_cfg_threshold(knet_h, knet_handle_compress_cfg) < 0) {
 			return -1;
 		}
 
-		if (knet_handle_compress_cfg->compress_threshold == 0) {
-			knet_h->compress_threshold = KNET_COMPRESS_THRESHOLD;
-			log_debug(knet_h, KNET_SUB_COMPRESS, "resetting compression threshold to default (%d)", KNET_COMPRESS_THRESHOLD);
-		} else {
-			knet_h->compress_threshold = knet_handle_compress_cfg->compress_threshold;
-		}
-
 		savederrno = pthread_rwlock_rdlock(&shlib_rwlock);
 		if (savederrno) {
 			log_err(knet_h, KNET_SUB_COMPRESS, "Unable to get read lock: %s",
@@ -324,7 +679,16 @@ int compress_cfg(
 		knet_h->compress_model = cmp_model;
 		knet_h->compress_level = knet_handle_compress_cfg->compress_level;
 
-		if (compress_lib_test(knet_h) < 0) {
+		/*
+		 * dictionaries might depend on compress_level
+		 */
+		if (compress_load_dict(knet_h, cmp_model) < 0) {
+			savederrno = errno;
+			err = -1;
+			goto out_unlock;
+		}
+
+		if (compress_lib_test(knet_h, knet_h->compress_model, knet_h->compress_level) < 0) {
 			savederrno = errno;
 			err = -1;
 			goto out_unlock;
@@ -343,91 +707,69 @@ out_unlock:
 	return err;
 }
 
-void compress_fini(
-	knet_handle_t knet_h,
-	int all)
+/*
+ * models configured on a channel must stay initialized
+ * when the handle configuration changes
+ */
+static int compress_channel_uses_model(knet_handle_t knet_h, int cmp_model)
 {
-	int savederrno = 0;
-	int idx = 0;
-
-	savederrno = pthread_rwlock_wrlock(&shlib_rwlock);
-	if (savederrno) {
-		log_err(knet_h, KNET_SUB_COMPRESS, "Unable to get write lock: %s",
-			strerror(savederrno));
-		return;
-	}
+	int i;
 
-	while (compress_modules_cmds[idx].model_name != NULL) {
-		if ((compress_modules_cmds[idx].built_in == 1) &&
-		    (compress_modules_cmds[idx].loaded == 1) &&
-		    (compress_modules_cmds[idx].model_id > 0) &&
-		    (knet_h->compress_int_data[idx] != NULL) &&
-		    (idx < KNET_MAX_COMPRESS_METHODS)) {
-			if ((all) || (compress_modules_cmds[idx].model_id == knet_h->compress_model)) {
-				if (compress_modules_cmds[idx].ops->fini != NULL) {
-					compress_modules_cmds[idx].ops->fini(knet_h, idx);
-				} else {
-					knet_h->compress_int_data[idx] = NULL;
-				}
-			}
+	for (i = 0; i < KNET_DATAFD_MAX; i++) {
+		if ((knet_h->channel_compress[i].enabled) &&
+		    (knet_h->channel_compress[i].compress_model == cmp_model)) {
+			return 1;
 		}
-		idx++;
 	}
 
-	pthread_rwlock_unlock(&shlib_rwlock);
-	return;
+	return 0;
 }
 
 /*
- * compress does not require compress_check_lib_is_init
- * because it's protected by compress_cfg
+ * compress_channel_cfg must be invoked in global write lock context
  */
-int compress(
-	knet_handle_t knet_h,
-	const unsigned char *buf_in,
-	const ssize_t buf_in_len,
-	unsigned char *buf_out,
-	ssize_t *buf_out_len)
-{
-	return compress_modules_cmds[knet_h->compress_model].ops->compress(knet_h, buf_in, buf_in_len, buf_out, buf_out_len);
-}
-
-int decompress(
+int compress_channel_cfg(
 	knet_handle_t knet_h,
-	int compress_model,
-	const unsigned char *buf_in,
-	const ssize_t buf_in_len,
-	unsigned char *buf_out,
-	ssize_t *buf_out_len)
+	int8_t channel,
+	struct knet_handle_compress_cfg *knet_handle_compress_cfg)
 {
 	int savederrno = 0, err = 0;
+	int cmp_model;
+	struct knet_channel_compress *channel_compress = &knet_h->channel_compress[channel];
 
-	if (compress_model > max_model) {
-		log_err(knet_h,  KNET_SUB_COMPRESS, "Received packet with unknown compress model %d", compress_model);
-		errno = EINVAL;
-		return -1;
+	if (!knet_handle_compress_cfg) {
+		log_debug(knet_h, KNET_SUB_COMPRESS, "Removing compress configuration for channel %d", channel);
+		memset(channel_compress, 0, sizeof(struct knet_channel_compress));
+		return 0;
 	}
 
-	if (compress_is_valid_model(compress_model) < 0) {
-		log_err(knet_h,  KNET_SUB_COMPRESS, "Received packet compressed with %s but support is not built in this version of libknet. Please contact your distribution vendor or fix the build.", compress_modules_cmds[compress_model].model_name);
+	cmp_model = compress_get_model(knet_handle_compress_cfg->compress_model);
+	if (cmp_model < 0) {
+		log_err(knet_h, KNET_SUB_COMPRESS, "compress model %s not supported for channel %d",
+			knet_handle_compress_cfg->compress_model, channel);
 		errno = EINVAL;
 		return -1;
 	}
 
-	savederrno = pthread_rwlock_rdlock(&shlib_rwlock);
-	if (savederrno) {
-		log_err(knet_h, KNET_SUB_COMPRESS, "Unable to get read lock: %s",
-			strerror(savederrno));
-		errno = savederrno;
+	if (knet_handle_compress_cfg->compress_threshold > KNET_MAX_PACKET_SIZE) {
+		log_err(knet_h, KNET_SUB_COMPRESS, "compress threshold cannot be higher than KNET_MAX_PACKET_SIZE (%d).",
+			 KNET_MAX_PACKET_SIZE);
+		errno = EINVAL;
 		return -1;
 	}
 
-	if (!compress_check_lib_is_init(knet_h, compress_model)) {
-		/*
-		 * need to switch to write lock, load the lib, and return with a write lock
-		 * this is not racy because compress_load_lib is written idempotent.
-		 */
-		pthread_rwlock_unlock(&shlib_rwlock);
+	log_debug(knet_h, KNET_SUB_COMPRESS,
+		  "Initizializing compress module for channel %d [%s/%d/%u]",
+		  channel, knet_handle_compress_cfg->compress_model,
+		  knet_handle_compress_cfg->compress_level, knet_handle_compress_cfg->compress_threshold);
+
+	if (cmp_model > 0) {
+		if (compress_modules_cmds[cmp_model].built_in == 0) {
+			log_err(knet_h, KNET_SUB_COMPRESS, "compress model %s support has not been built in. Please contact your vendor or fix the build", knet_handle_compress_cfg->compress_model);
+			errno = EINVAL;
+			return -1;
+		}
+
 		savederrno = pthread_rwlock_wrlock(&shlib_rwlock);
 		if (savederrno) {
 			log_err(knet_h, KNET_SUB_COMPRESS, "Unable to get write lock: %s",
@@ -436,21 +778,810 @@ int decompress(
 			return -1;
 		}
 
-		if (compress_load_lib(knet_h, compress_model, 1) < 0) {
+		if (compress_load_lib(knet_h, cmp_model, 0) < 0) {
 			savederrno = errno;
-			err = -1;
 			log_err(knet_h, KNET_SUB_COMPRESS, "Unable to load library: %s",
 				strerror(savederrno));
+			err = -1;
 			goto out_unlock;
 		}
-	}
 
-	err = compress_modules_cmds[compress_model].ops->decompress(knet_h, buf_in, buf_in_len, buf_out, buf_out_len);
-	savederrno = errno;
-
-out_unlock:
-	pthread_rwlock_unlock(&shlib_rwlock);
+		if (val_level(knet_h, cmp_model, knet_handle_compress_cfg->compress_level) < 0) {
+			log_err(knet_h, KNET_SUB_COMPRESS, "compress level %d not supported for model %s",
+				knet_handle_compress_cfg->compress_level, knet_handle_compress_cfg->compress_model);
+			savederrno = EINVAL;
+			err = -1;
+			goto out_unlock;
+		}
 
+		if (compress_lib_test(knet_h, cmp_model, knet_handle_compress_cfg->compress_level) < 0) {
+			savederrno = errno;
+			err = -1;
+			goto out_unlock;
+		}
+
+out_unlock:
+		pthread_rwlock_unlock(&shlib_rwlock);
+
+		if (err) {
+			errno = savederrno;
+			return err;
+		}
+	}
+
+	channel_compress->compress_model = cmp_model;
+	channel_compress->compress_level = knet_handle_compress_cfg->compress_level;
+	if (knet_handle_compress_cfg->compress_threshold == 0) {
+		channel_compress->compress_threshold = KNET_COMPRESS_THRESHOLD;
+	} else {
+		channel_compress->compress_threshold = knet_handle_compress_cfg->compress_threshold;
+	}
+	channel_compress->enabled = 1;
+
+	return 0;
+}
+
+/*
+ * compress_channel_get_cfg must be invoked in global read lock context
+ */
+void compress_channel_get_cfg(
+	knet_handle_t knet_h,
+	int8_t channel,
+	struct knet_handle_compress_cfg *knet_handle_compress_cfg)
+{
+	struct knet_channel_compress *channel_compress = &knet_h->channel_compress[channel];
+
+	memset(knet_handle_compress_cfg, 0, sizeof(struct knet_handle_compress_cfg));
+
+	if (!channel_compress->enabled) {
+		return;
+	}
+
+	strncpy(knet_handle_compress_cfg->compress_model,
+		compress_modules_cmds[channel_compress->compress_model].model_name,
+		sizeof(knet_handle_compress_cfg->compress_model) - 1);
+	knet_handle_compress_cfg->compress_level = channel_compress->compress_level;
+	knet_handle_compress_cfg->compress_threshold = channel_compress->compress_threshold;
+}
+
+void compress_fini(
+	knet_handle_t knet_h,
+	int all)
+{
+	int savederrno = 0;
+	int idx = 0;
+
+	savederrno = pthread_rwlock_wrlock(&shlib_rwlock);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_COMPRESS, "Unable to get write lock: %s",
+			strerror(savederrno));
+		return;
+	}
+
+	while (compress_modules_cmds[idx].model_name != NULL) {
+		if ((compress_modules_cmds[idx].built_in == 1) &&
+		    (compress_modules_cmds[idx].loaded == 1) &&
+		    (compress_modules_cmds[idx].model_id > 0) &&
+		    (knet_h->compress_int_data[idx] != NULL) &&
+		    (idx < KNET_MAX_COMPRESS_METHODS)) {
+			if ((all) ||
+			    ((compress_modules_cmds[idx].model_id == knet_h->compress_model) &&
+			     (!compress_channel_uses_model(knet_h, idx)))) {
+				__atomic_store_n(&knet_h->decompress_ops[idx], NULL, __ATOMIC_RELEASE);
+				if (compress_modules_cmds[idx].ops->fini != NULL) {
+					compress_modules_cmds[idx].ops->fini(knet_h, idx);
+				} else {
+					knet_h->compress_int_data[idx] = NULL;
+				}
+			}
+		}
+		idx++;
+	}
+
+	if (all) {
+		for (idx = 0; idx < KNET_COMPRESS_DICT_MAX; idx++) {
+			free(knet_h->compress_dict[idx].dict);
+			knet_h->compress_dict[idx].dict = NULL;
+			knet_h->compress_dict[idx].dict_len = 0;
+		}
+	}
+
+	pthread_rwlock_unlock(&shlib_rwlock);
+	return;
+}
+
+/*
+ * load the library of a model that supports dictionaries
+ * returns with shlib_rwlock held in write mode on success
+ */
+static int compress_dict_get_model(knet_handle_t knet_h, const char *model)
+{
+	int savederrno = 0;
+	int cmp_model;
+
+	cmp_model = compress_get_model(model);
+	if ((cmp_model <= 0) || (compress_modules_cmds[cmp_model].built_in == 0)) {
+		log_err(knet_h, KNET_SUB_COMPRESS, "compress model %s not supported", model);
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = pthread_rwlock_wrlock(&shlib_rwlock);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_COMPRESS, "Unable to get write lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	if (compress_load_lib(knet_h, cmp_model, 0) < 0) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_COMPRESS, "Unable to load library: %s",
+			strerror(savederrno));
+		goto out_unlock;
+	}
+
+	if ((compress_modules_cmds[cmp_model].ops->train_dict == NULL) ||
+	    (compress_modules_cmds[cmp_model].ops->load_dict == NULL)) {
+		log_err(knet_h, KNET_SUB_COMPRESS, "compress model %s does not support dictionaries", model);
+		savederrno = EINVAL;
+		goto out_unlock;
+	}
+
+	return cmp_model;
+
+out_unlock:
+	pthread_rwlock_unlock(&shlib_rwlock);
+	errno = savederrno;
+	return -1;
+}
+
+int compress_dict_train(
+	knet_handle_t knet_h,
+	const char *model,
+	const unsigned char *samples,
+	const size_t *samples_sizes,
+	unsigned int samples_num,
+	unsigned char *dict,
+	size_t *dict_len)
+{
+	int savederrno = 0, err = 0;
+	int cmp_model;
+
+	cmp_model = compress_dict_get_model(knet_h, model);
+	if (cmp_model < 0) {
+		return -1;
+	}
+
+	/*
+	 * training can take a long time, don't block other handles.
+	 * libraries are never unloaded, ops cannot change under our feet.
+	 */
+	pthread_rwlock_unlock(&shlib_rwlock);
+	savederrno = pthread_rwlock_rdlock(&shlib_rwlock);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_COMPRESS, "Unable to get read lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	err = compress_modules_cmds[cmp_model].ops->train_dict(knet_h, samples, samples_sizes, samples_num, dict, dict_len);
+	if (err < 0) {
+		savederrno = errno;
+	}
+
+	pthread_rwlock_unlock(&shlib_rwlock);
+
+	errno = savederrno;
+	return err;
+}
+
+/*
+ * compress_dict_set must be invoked in global write lock context
+ */
+int compress_dict_set(
+	knet_handle_t knet_h,
+	const char *model,
+	const unsigned char *dict,
+	size_t dict_len)
+{
+	int savederrno = 0, err = 0;
+	int cmp_model, idx;
+	struct knet_compress_dict old_dict[KNET_COMPRESS_DICT_MAX];
+	unsigned char *new_dict = NULL;
+
+	cmp_model = compress_dict_get_model(knet_h, model);
+	if (cmp_model < 0) {
+		return -1;
+	}
+
+	memmove(old_dict, knet_h->compress_dict, sizeof(old_dict));
+
+	if (dict) {
+		new_dict = malloc(dict_len);
+		if (!new_dict) {
+			savederrno = ENOMEM;
+			err = -1;
+			goto out_unlock;
+		}
+		memmove(new_dict, dict, dict_len);
+
+		memmove(&knet_h->compress_dict[1], &knet_h->compress_dict[0],
+			sizeof(struct knet_compress_dict) * (KNET_COMPRESS_DICT_MAX - 1));
+		knet_h->compress_dict[0].dict = new_dict;
+		knet_h->compress_dict[0].dict_len = dict_len;
+	} else {
+		memset(knet_h->compress_dict, 0, sizeof(knet_h->compress_dict));
+	}
+
+	/*
+	 * every module that is in use needs to see the new dictionaries
+	 */
+	for (idx = 1; idx <= max_model; idx++) {
+		if (!compress_check_lib_is_init(knet_h, idx)) {
+			continue;
+		}
+		if (compress_load_dict(knet_h, idx) < 0) {
+			savederrno = errno;
+			err = -1;
+			break;
+		}
+	}
+
+	if (err) {
+		log_err(knet_h, KNET_SUB_COMPRESS, "Unable to load compress dictionary: %s", strerror(savederrno));
+		free(new_dict);
+		memmove(knet_h->compress_dict, old_dict, sizeof(old_dict));
+		for (idx = 1; idx <= max_model; idx++) {
+			if (compress_check_lib_is_init(knet_h, idx)) {
+				compress_load_dict(knet_h, idx);
+			}
+		}
+		goto out_unlock;
+	}
+
+	if (dict) {
+		free(old_dict[KNET_COMPRESS_DICT_MAX - 1].dict);
+	} else {
+		for (idx = 0; idx < KNET_COMPRESS_DICT_MAX; idx++) {
+			free(old_dict[idx].dict);
+		}
+	}
+
+out_unlock:
+	pthread_rwlock_unlock(&shlib_rwlock);
+	errno = savederrno;
+	return err;
+}
+
+/*
+ * adaptive compression.
+ *
+ * Data that does not compress (already compressed or encrypted by
+ * the application) is detected by the result of the compression itself.
+ * Every time a packet does not shrink by at least
+ * KNET_COMPRESS_ADAPTIVE_MIN_SAVING percent, the following packets of
+ * the same channel are sent uncompressed. The number of packets to skip
+ * doubles at each failed probe, up to KNET_COMPRESS_ADAPTIVE_MAX_SKIP,
+ * and goes back to 0 as soon as a probe compresses well.
+ *
+ * adaptive state is owned by the TX worker that handles the channel.
+ */
+
+#define KNET_COMPRESS_ADAPTIVE_MIN_SAVING 5
+#define KNET_COMPRESS_ADAPTIVE_MIN_SKIP   16
+#define KNET_COMPRESS_ADAPTIVE_MAX_SKIP   1024
+
+int compress_adaptive_skip(
+	knet_handle_t knet_h,
+	struct knet_compress_adaptive *adaptive)
+{
+	if ((!knet_h->compress_adaptive) || (!adaptive)) {
+		return 0;
+	}
+
+	if (adaptive->skip) {
+		adaptive->skip--;
+		return 1;
+	}
+
+	return 0;
+}
+
+void compress_adaptive_update(
+	knet_handle_t knet_h,
+	struct knet_compress_adaptive *adaptive,
+	size_t inlen,
+	size_t outlen)
+{
+	if ((!knet_h->compress_adaptive) || (!adaptive)) {
+		return;
+	}
+
+	if (outlen * 100 < inlen * (100 - KNET_COMPRESS_ADAPTIVE_MIN_SAVING)) {
+		adaptive->backoff = 0;
+		adaptive->skip = 0;
+		return;
+	}
+
+	if (!adaptive->backoff) {
+		adaptive->backoff = KNET_COMPRESS_ADAPTIVE_MIN_SKIP;
+	} else if (adaptive->backoff < KNET_COMPRESS_ADAPTIVE_MAX_SKIP) {
+		adaptive->backoff = adaptive->backoff * 2;
+	}
+
+	adaptive->skip = adaptive->backoff;
+}
+
+/*
+ * compress does not require compress_check_lib_is_init
+ * because it's protected by compress_cfg
+ */
+int compress(
+	knet_handle_t knet_h,
+	int compress_model,
+	int compress_level,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len)
+{
+	switch (compress_model) {
+	COMPRESS_STATIC_CASES(compress, (knet_h, buf_in, buf_in_len, buf_out, buf_out_len, compress_level))
+	default:
+		break;
+	}
+	return compress_modules_cmds[compress_model].ops->compress(knet_h, buf_in, buf_in_len, buf_out, buf_out_len, compress_level);
+}
+
+/*
+ * decompress runs in global read lock context.
+ *
+ * Models are published in knet_h->decompress_ops once they are
+ * initialized for the handle and are removed only in global write lock
+ * context (compress_fini), so the RX path can use them without
+ * taking shlib_rwlock. The lock is only needed the first time
+ * a model is seen, to load and initialize it.
+ */
+static const struct compress_ops *decompress_get_ops(
+	knet_handle_t knet_h,
+	int compress_model)
+{
+	int savederrno = 0;
+	const struct compress_ops *ops;
+
+	if ((compress_model <= 0) || (compress_model > max_model)) {
+		log_err(knet_h,  KNET_SUB_COMPRESS, "Received packet with unknown compress model %d", compress_model);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	ops = __atomic_load_n(&knet_h->decompress_ops[compress_model], __ATOMIC_ACQUIRE);
+	if (ops) {
+		return ops;
+	}
+
+	if (compress_is_valid_model(compress_model) < 0) {
+		log_err(knet_h,  KNET_SUB_COMPRESS, "Received packet compressed with %s but support is not built in this version of libknet. Please contact your distribution vendor or fix the build.", compress_modules_cmds[compress_model].model_name);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	savederrno = pthread_rwlock_rdlock(&shlib_rwlock);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_COMPRESS, "Unable to get read lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return NULL;
+	}
+
+	if (!compress_check_lib_is_init(knet_h, compress_model)) {
+		/*
+		 * need to switch to write lock, load the lib, and return with a write lock
+		 * this is not racy because compress_load_lib is written idempotent.
+		 */
+		pthread_rwlock_unlock(&shlib_rwlock);
+		savederrno = pthread_rwlock_wrlock(&shlib_rwlock);
+		if (savederrno) {
+			log_err(knet_h, KNET_SUB_COMPRESS, "Unable to get write lock: %s",
+				strerror(savederrno));
+			errno = savederrno;
+			return NULL;
+		}
+
+		if (compress_load_lib(knet_h, compress_model, 1) < 0) {
+			savederrno = errno;
+			log_err(knet_h, KNET_SUB_COMPRESS, "Unable to load library: %s",
+				strerror(savederrno));
+			pthread_rwlock_unlock(&shlib_rwlock);
+			errno = savederrno;
+			return NULL;
+		}
+	}
+
+	/*
+	 * the model is initialized and published, from here on
+	 * it is covered by the global read lock as above
+	 */
+	ops = compress_modules_cmds[compress_model].ops;
+
+	pthread_rwlock_unlock(&shlib_rwlock);
+
+	return ops;
+}
+
+int decompress(
+	knet_handle_t knet_h,
+	int compress_model,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len)
+{
+	const struct compress_ops *ops;
+
+	ops = decompress_get_ops(knet_h, compress_model);
+	if (!ops) {
+		return -1;
+	}
+
+	switch (compress_model) {
+	COMPRESS_STATIC_CASES(decompress, (knet_h, buf_in, buf_in_len, buf_out, buf_out_len))
+	default:
+		break;
+	}
+	return ops->decompress(knet_h, buf_in, buf_in_len, buf_out, buf_out_len);
+}
+
+/*
+ * stream compression
+ *
+ * Unicast data for a single destination can be compressed as a stream,
+ * keeping the history between packets for each destination host and
+ * channel (see knet_handle_set_compress_stream).
+ *
+ * Each stream packet carries an 8 bit stream seq number and the epoch
+ * of the stream, bumped every time the sender drops its history.
+ * The first packet after a reset is flagged with KNET_COMPRESS_STREAM_RESET
+ * and can always be decompressed. The receiver drops stream packets
+ * until it sees a reset when it misses a packet, and asks the sender
+ * to reset the stream with a KNET_HEADER_TYPE_COMPRESS_RESYNC packet.
+ * The sender also resets the stream when a packet of the stream has
+ * not been sent.
+ */
+
+/*
+ * minimum interval between resync requests for the same stream
+ */
+#define KNET_COMPRESS_STREAM_RESYNC_INTERVAL 100000000llu /* nanoseconds */
+
+int compress_stream_supported(
+	knet_handle_t knet_h,
+	int compress_model)
+{
+	if ((compress_model <= 0) || (compress_model > max_model) ||
+	    (!compress_modules_cmds[compress_model].loaded) ||
+	    (!compress_modules_cmds[compress_model].ops->stream_compress)) {
+		return 0;
+	}
+
+	return 1;
+}
+
+static void compress_stream_drop_held(
+	struct knet_compress_stream *stream)
+{
+	int i;
+
+	for (i = 0; i < KNET_COMPRESS_STREAM_REORDER; i++) {
+		free(stream->held[i].buf);
+		stream->held[i].buf = NULL;
+	}
+}
+
+static void compress_stream_free(
+	knet_handle_t knet_h,
+	struct knet_compress_stream *stream)
+{
+	compress_stream_drop_held(stream);
+
+	if ((stream->ctx) && (stream->compress_model > 0)) {
+		compress_modules_cmds[stream->compress_model].ops->stream_free(knet_h, stream->ctx);
+	}
+
+	memset(stream, 0, sizeof(struct knet_compress_stream));
+}
+
+/*
+ * must be invoked in global write lock context
+ */
+void compress_stream_fini(
+	knet_handle_t knet_h,
+	struct knet_compress_stream *streams,
+	int8_t channel)
+{
+	int8_t i;
+
+	for (i = 0; i < KNET_DATAFD_MAX; i++) {
+		if ((channel < 0) || (channel == i)) {
+			compress_stream_free(knet_h, &streams[i]);
+		}
+	}
+}
+
+/*
+ * compress_stream_compress runs in the TX worker that owns the channel.
+ * compress_flags is the value to send in khp_data_compress
+ */
+int compress_stream_compress(
+	knet_handle_t knet_h,
+	struct knet_compress_stream *stream,
+	int compress_model,
+	int compress_level,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len,
+	uint8_t *compress_flags,
+	uint8_t *stream_seq)
+{
+	int reset = 0;
+
+	if (stream->compress_model != compress_model) {
+		compress_stream_free(knet_h, stream);
+		stream->compress_model = compress_model;
+	}
+
+	if (__atomic_exchange_n(&stream->reset_req, 0, __ATOMIC_ACQ_REL)) {
+		reset = 1;
+	}
+
+	if ((!stream->synced) || (stream->compress_level != compress_level)) {
+		reset = 1;
+	}
+
+	if (compress_modules_cmds[compress_model].ops->stream_compress(knet_h, &stream->ctx, reset,
+								      buf_in, buf_in_len,
+								      buf_out, buf_out_len,
+								      compress_level) < 0) {
+		stream->synced = 0;
+		return -1;
+	}
+
+	if (reset) {
+		stream->compress_level = compress_level;
+		stream->epoch = (stream->epoch + 1) & (KNET_COMPRESS_STREAM_EPOCH_MASK >> KNET_COMPRESS_STREAM_EPOCH_SHIFT);
+		stream->seq = 0;
+	} else {
+		stream->seq++;
+	}
+	stream->synced = 1;
+
+	*compress_flags = compress_model | KNET_COMPRESS_STREAM |
+			  (stream->epoch << KNET_COMPRESS_STREAM_EPOCH_SHIFT);
+	if (reset) {
+		*compress_flags |= KNET_COMPRESS_STREAM_RESET;
+	}
+	*stream_seq = stream->seq;
+
+	return 0;
+}
+
+/*
+ * the last packet compressed will not reach the receiver,
+ * start a new history with the next one
+ */
+void compress_stream_invalidate(
+	struct knet_compress_stream *stream)
+{
+	stream->synced = 0;
+}
+
+/*
+ * invoked by the RX threads when the receiver asks for a reset
+ */
+void compress_stream_request_reset(
+	struct knet_compress_stream *stream)
+{
+	__atomic_store_n(&stream->reset_req, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * keep a copy of a packet received ahead of the next expected one
+ */
+static int compress_stream_hold(
+	struct knet_compress_stream *stream,
+	uint8_t compress_flags,
+	uint8_t stream_seq,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len)
+{
+	struct knet_compress_stream_held *held = &stream->held[stream_seq % KNET_COMPRESS_STREAM_REORDER];
+
+	if ((held->buf) && (held->seq == stream_seq)) {
+		errno = EALREADY;
+		return -1;
+	}
+
+	free(held->buf);
+	held->buf = malloc(buf_in_len);
+	if (!held->buf) {
+		return -1;
+	}
+
+	memmove(held->buf, buf_in, buf_in_len);
+	held->len = buf_in_len;
+	held->compress_flags = compress_flags;
+	held->seq = stream_seq;
+
+	errno = EINPROGRESS;
+	return -1;
+}
+
+/*
+ * compress_stream_decompress runs in global read lock context
+ * with the source host rx_mutex held.
+ *
+ * errno is set to EALREADY for stale or duplicated packets that
+ * can be silently dropped, and to EINPROGRESS for packets received
+ * ahead of a missing one. Those are held and returned by
+ * compress_stream_decompress_held once the missing one arrives.
+ * *resync is set when the sender should be asked to reset the stream.
+ */
+int compress_stream_decompress(
+	knet_handle_t knet_h,
+	struct knet_compress_stream *stream,
+	uint8_t compress_flags,
+	uint8_t stream_seq,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len,
+	int *resync)
+{
+	int savederrno = 0;
+	int compress_model = compress_flags & KNET_COMPRESS_MODEL_MASK;
+	uint8_t epoch = (compress_flags & KNET_COMPRESS_STREAM_EPOCH_MASK) >> KNET_COMPRESS_STREAM_EPOCH_SHIFT;
+	uint8_t next_epoch = (stream->epoch + 1) & (KNET_COMPRESS_STREAM_EPOCH_MASK >> KNET_COMPRESS_STREAM_EPOCH_SHIFT);
+	int reset = compress_flags & KNET_COMPRESS_STREAM_RESET;
+	int8_t seq_diff;
+	const struct compress_ops *ops;
+	struct timespec clock_now;
+	unsigned long long timediff;
+
+	*resync = 0;
+
+	ops = decompress_get_ops(knet_h, compress_model);
+	if (!ops) {
+		return -1;
+	}
+
+	if (!ops->stream_decompress) {
+		log_err(knet_h, KNET_SUB_COMPRESS, "Received stream packet compressed with %s that does not support streams",
+			compress_modules_cmds[compress_model].model_name);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (reset) {
+		/*
+		 * a reset we have already seen, the next one
+		 * would come with a new epoch
+		 */
+		if ((stream->synced) && (stream->compress_model == compress_model) && (stream->epoch == epoch)) {
+			errno = EALREADY;
+			return -1;
+		}
+		if (stream->compress_model != compress_model) {
+			compress_stream_free(knet_h, stream);
+			stream->compress_model = compress_model;
+		}
+		compress_stream_drop_held(stream);
+	} else {
+		if ((!stream->synced) || (stream->compress_model != compress_model)) {
+			savederrno = ENOTCONN;
+			goto out_resync;
+		}
+		if (stream->epoch != epoch) {
+			if (epoch == next_epoch) {
+				log_debug(knet_h, KNET_SUB_COMPRESS, "Compress stream reset has been lost");
+				stream->synced = 0;
+				savederrno = ENOTCONN;
+				goto out_resync;
+			}
+			errno = EALREADY;
+			return -1;
+		}
+		seq_diff = (int8_t)(stream_seq - (uint8_t)(stream->seq + 1));
+		if (seq_diff < 0) {
+			errno = EALREADY;
+			return -1;
+		}
+		if ((seq_diff > 0) && (seq_diff <= KNET_COMPRESS_STREAM_REORDER)) {
+			if (compress_stream_hold(stream, compress_flags, stream_seq, buf_in, buf_in_len) < 0) {
+				if ((errno == EINPROGRESS) || (errno == EALREADY)) {
+					return -1;
+				}
+				savederrno = errno;
+				log_debug(knet_h, KNET_SUB_COMPRESS, "Unable to hold out of order stream packet: %s",
+					  strerror(savederrno));
+				stream->synced = 0;
+				goto out_resync;
+			}
+		}
+		if (seq_diff > 0) {
+			log_debug(knet_h, KNET_SUB_COMPRESS, "Compress stream lost %d packet(s)", seq_diff);
+			stream->synced = 0;
+			savederrno = ENOTCONN;
+			goto out_resync;
+		}
+	}
+
+	if (ops->stream_decompress(knet_h, &stream->ctx, reset,
+				   buf_in, buf_in_len,
+				   buf_out, buf_out_len) < 0) {
+		savederrno = errno;
+		stream->synced = 0;
+		goto out_resync;
+	}
+
+	stream->synced = 1;
+	stream->seq = stream_seq;
+	stream->epoch = epoch;
+
+	return 0;
+
+out_resync:
+	compress_stream_drop_held(stream);
+
+	clock_gettime(CLOCK_MONOTONIC, &clock_now);
+	timespec_diff(stream->last_resync, clock_now, &timediff);
+	if (((stream->last_resync.tv_sec == 0) && (stream->last_resync.tv_nsec == 0)) ||
+	    (timediff >= KNET_COMPRESS_STREAM_RESYNC_INTERVAL)) {
+		stream->last_resync = clock_now;
+		*resync = 1;
+	}
+
+	errno = savederrno;
+	return -1;
+}
+
+/*
+ * returns the next packet of the stream if it has been received
+ * out of order and held by compress_stream_decompress.
+ * Same context and return values as compress_stream_decompress,
+ * errno is set to ENOENT if there is nothing to deliver.
+ */
+int compress_stream_decompress_held(
+	knet_handle_t knet_h,
+	struct knet_compress_stream *stream,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len,
+	int *resync)
+{
+	int err, savederrno;
+	uint8_t next_seq = stream->seq + 1;
+	struct knet_compress_stream_held *held = &stream->held[next_seq % KNET_COMPRESS_STREAM_REORDER];
+	unsigned char *buf;
+
+	*resync = 0;
+
+	if ((!stream->synced) || (!held->buf) || (held->seq != next_seq)) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	/*
+	 * detach the buffer first, decompress can drop all held packets
+	 */
+	buf = held->buf;
+	held->buf = NULL;
+
+	err = compress_stream_decompress(knet_h, stream, held->compress_flags, next_seq,
+					 buf, held->len, buf_out, buf_out_len, resync);
+	savederrno = errno;
+	free(buf);
 	errno = savederrno;
 	return err;
 }
@@ -22,8 +22,48 @@ void compress_fini(
 	knet_handle_t knet_h,
 	int all);
 
+int compress_dict_train(
+	knet_handle_t knet_h,
+	const char *model,
+	const unsigned char *samples,
+	const size_t *samples_sizes,
+	unsigned int samples_num,
+	unsigned char *dict,
+	size_t *dict_len);
+
+int compress_dict_set(
+	knet_handle_t knet_h,
+	const char *model,
+	const unsigned char *dict,
+	size_t dict_len);
+
+int compress_adaptive_skip(
+	knet_handle_t knet_h,
+	struct knet_compress_adaptive *adaptive);
+
+void compress_adaptive_update(
+	knet_handle_t knet_h,
+	struct knet_compress_adaptive *adaptive,
+	size_t inlen,
+	size_t outlen);
+
+void compress_auto_check(
+	knet_handle_t knet_h);
+
+int compress_channel_cfg(
+	knet_handle_t knet_h,
+	int8_t channel,
+	struct knet_handle_compress_cfg *knet_handle_compress_cfg);
+
+void compress_channel_get_cfg(
+	knet_handle_t knet_h,
+	int8_t channel,
+	struct knet_handle_compress_cfg *knet_handle_compress_cfg);
+
 int compress(
 	knet_handle_t knet_h,
+	int compress_model,
+	int compress_level,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
@@ -37,4 +77,49 @@ int decompress(
 	unsigned char *buf_out,
 	ssize_t *buf_out_len);
 
+int compress_stream_supported(
+	knet_handle_t knet_h,
+	int compress_model);
+
+void compress_stream_fini(
+	knet_handle_t knet_h,
+	struct knet_compress_stream *streams,
+	int8_t channel);
+
+int compress_stream_compress(
+	knet_handle_t knet_h,
+	struct knet_compress_stream *stream,
+	int compress_model,
+	int compress_level,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len,
+	uint8_t *compress_flags,
+	uint8_t *stream_seq);
+
+void compress_stream_invalidate(
+	struct knet_compress_stream *stream);
+
+void compress_stream_request_reset(
+	struct knet_compress_stream *stream);
+
+int compress_stream_decompress(
+	knet_handle_t knet_h,
+	struct knet_compress_stream *stream,
+	uint8_t compress_flags,
+	uint8_t stream_seq,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len,
+	int *resync);
+
+int compress_stream_decompress_held(
+	knet_handle_t knet_h,
+	struct knet_compress_stream *stream,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len,
+	int *resync);
+
 #endif
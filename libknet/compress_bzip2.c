@@ -9,31 +9,233 @@
 
 #include "config.h"
 
+#include <string.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <bzlib.h>
 
 #include "logging.h"
 #include "compress_model.h"
+#include "threads_local.h"
+
+/*
+ * bzip2 has no API to reset a stream and allocates several hundred KB
+ * (depending on compress_level) every time a stream is initialized.
+ * Each thread keeps a small cache of the buffers released by
+ * BZ2_bzCompressEnd/BZ2_bzDecompressEnd and hands them back on the next
+ * BZ2_bzCompressInit/BZ2_bzDecompressInit of the same size.
+ */
+
+#define BZIP2_MEM_SLOTS 8
+
+/*
+ * the model index is fixed in compress.c, it is the same for all handles
+ */
+static int bzip2_method_idx;
+
+struct bzip2_mem_slot {
+	void *ptr;
+	size_t size;
+	int in_use;
+};
+
+struct bzip2_thread {
+	struct bzip2_mem_slot slots[BZIP2_MEM_SLOTS];
+};
+
+static void *bzip2_mem_alloc(void *opaque, int items, int size)
+{
+	struct bzip2_thread *bt = opaque;
+	struct bzip2_mem_slot *slot = NULL;
+	size_t len = (size_t)items * size;
+	int i;
+
+	for (i = 0; i < BZIP2_MEM_SLOTS; i++) {
+		if ((bt->slots[i].ptr) && (!bt->slots[i].in_use) && (bt->slots[i].size == len)) {
+			bt->slots[i].in_use = 1;
+			return bt->slots[i].ptr;
+		}
+	}
+
+	/*
+	 * use an empty slot or recycle one that holds a buffer
+	 * of a different size (compress_level changed)
+	 */
+	for (i = 0; i < BZIP2_MEM_SLOTS; i++) {
+		if (!bt->slots[i].ptr) {
+			slot = &bt->slots[i];
+			break;
+		}
+		if ((!slot) && (!bt->slots[i].in_use)) {
+			slot = &bt->slots[i];
+		}
+	}
+
+	if (!slot) {
+		return malloc(len);
+	}
+
+	free(slot->ptr);
+	slot->ptr = malloc(len);
+	if (!slot->ptr) {
+		slot->size = 0;
+		return NULL;
+	}
+	slot->size = len;
+	slot->in_use = 1;
+
+	return slot->ptr;
+}
+
+static void bzip2_mem_free(void *opaque, void *ptr)
+{
+	struct bzip2_thread *bt = opaque;
+	int i;
+
+	for (i = 0; i < BZIP2_MEM_SLOTS; i++) {
+		if (bt->slots[i].ptr == ptr) {
+			bt->slots[i].in_use = 0;
+			return;
+		}
+	}
+
+	free(ptr);
+}
+
+static void *bzip2_thread_alloc(void *private_data)
+{
+	struct bzip2_thread *bt;
+
+	bt = malloc(sizeof(struct bzip2_thread));
+	if (!bt) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(bt, 0, sizeof(struct bzip2_thread));
+
+	return bt;
+}
+
+static void bzip2_thread_free(void *data)
+{
+	struct bzip2_thread *bt = data;
+	int i;
+
+	for (i = 0; i < BZIP2_MEM_SLOTS; i++) {
+		free(bt->slots[i].ptr);
+	}
+	free(bt);
+}
+
+static int bzip2_is_init(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	if (knet_h->compress_int_data[method_idx]) {
+		return 1;
+	}
+	return 0;
+}
+
+static int bzip2_init(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	struct threads_local *bt;
+
+	bzip2_method_idx = method_idx;
+
+	if (!knet_h->compress_int_data[method_idx]) {
+		bt = malloc(sizeof(struct threads_local));
+		if (!bt) {
+			log_err(knet_h, KNET_SUB_BZIP2COMP, "bzip2 unable to allocate memory cache tracker");
+			errno = ENOMEM;
+			return -1;
+		}
+		if (threads_local_init(bt, bzip2_thread_alloc, bzip2_thread_free, NULL) < 0) {
+			log_err(knet_h, KNET_SUB_BZIP2COMP, "bzip2 unable to initialize memory cache tracker");
+			free(bt);
+			return -1;
+		}
+		knet_h->compress_int_data[method_idx] = bt;
+	}
+
+	return 0;
+}
+
+static void bzip2_fini(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	if (knet_h->compress_int_data[method_idx]) {
+		threads_local_fini(knet_h->compress_int_data[method_idx]);
+		free(knet_h->compress_int_data[method_idx]);
+		knet_h->compress_int_data[method_idx] = NULL;
+	}
+	return;
+}
+
+static int bzip2_stream_setup(knet_handle_t knet_h, bz_stream *strm)
+{
+	struct bzip2_thread *bt;
+
+	bt = threads_local_get(knet_h->compress_int_data[bzip2_method_idx]);
+	if (!bt) {
+		log_err(knet_h, KNET_SUB_BZIP2COMP, "bzip2 unable to allocate memory cache");
+		errno = ENOMEM;
+		return -1;
+	}
+
+	memset(strm, 0, sizeof(bz_stream));
+	strm->bzalloc = bzip2_mem_alloc;
+	strm->bzfree = bzip2_mem_free;
+	strm->opaque = bt;
+
+	return 0;
+}
 
 static int bzip2_compress(
 	knet_handle_t knet_h,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
-	ssize_t *buf_out_len)
+	ssize_t *buf_out_len,
+	int compress_level)
 {
 	int err = 0;
 	int savederrno = 0;
-	unsigned int destLen = KNET_DATABUFSIZE_COMPRESS;
+	bz_stream strm;
+
+	if (bzip2_stream_setup(knet_h, &strm) < 0) {
+		return -1;
+	}
+
+	/*
+	 * same as BZ2_bzBuffToBuffCompress
+	 */
+	err = BZ2_bzCompressInit(&strm, compress_level, 0, 0);
+	if (err == BZ_OK) {
+		strm.next_in = (char *)buf_in;
+		strm.avail_in = buf_in_len;
+		strm.next_out = (char *)buf_out;
+		strm.avail_out = KNET_DATABUFSIZE_COMPRESS;
 
-	err = BZ2_bzBuffToBuffCompress((char *)buf_out, &destLen,
-				       (char *)buf_in, buf_in_len,
-				       knet_h->compress_level,
-				       0, 0);
+		err = BZ2_bzCompress(&strm, BZ_FINISH);
+		switch(err) {
+			case BZ_STREAM_END:
+				err = BZ_OK;
+				break;
+			case BZ_FINISH_OK:
+				err = BZ_OUTBUFF_FULL;
+				break;
+		}
+
+		*buf_out_len = KNET_DATABUFSIZE_COMPRESS - strm.avail_out;
+		BZ2_bzCompressEnd(&strm);
+	}
 
 	switch(err) {
 		case BZ_OK:
-			*buf_out_len = destLen;
 			break;
 		case BZ_MEM_ERROR:
 			log_err(knet_h, KNET_SUB_BZIP2COMP, "bzip2 compress has not enough memory");
@@ -65,15 +267,42 @@ static int bzip2_decompress(
 {
 	int err = 0;
 	int savederrno = 0;
-	unsigned int destLen = KNET_DATABUFSIZE_COMPRESS;
+	bz_stream strm;
+
+	if (bzip2_stream_setup(knet_h, &strm) < 0) {
+		return -1;
+	}
+
+	/*
+	 * same as BZ2_bzBuffToBuffDecompress
+	 */
+	err = BZ2_bzDecompressInit(&strm, 0, 0);
+	if (err == BZ_OK) {
+		strm.next_in = (char *)buf_in;
+		strm.avail_in = buf_in_len;
+		strm.next_out = (char *)buf_out;
+		strm.avail_out = KNET_DATABUFSIZE_COMPRESS;
 
-	err = BZ2_bzBuffToBuffDecompress((char *)buf_out, &destLen,
-					 (char *)buf_in, buf_in_len,
-					 0, 0);
+		err = BZ2_bzDecompress(&strm);
+		switch(err) {
+			case BZ_STREAM_END:
+				err = BZ_OK;
+				break;
+			case BZ_OK:
+				if (strm.avail_out > 0) {
+					err = BZ_UNEXPECTED_EOF;
+				} else {
+					err = BZ_OUTBUFF_FULL;
+				}
+				break;
+		}
+
+		*buf_out_len = KNET_DATABUFSIZE_COMPRESS - strm.avail_out;
+		BZ2_bzDecompressEnd(&strm);
+	}
 
 	switch(err) {
 		case BZ_OK:
-			*buf_out_len = destLen;
 			break;
 		case BZ_MEM_ERROR:
 			log_err(knet_h, KNET_SUB_BZIP2COMP, "bzip2 decompress has not enough memory");
@@ -103,12 +332,17 @@ static int bzip2_decompress(
 	return err;
 }
 
-compress_ops_t compress_model = {
+const compress_ops_t KNET_COMPRESS_MODEL(bzip2) = {
 	KNET_COMPRESS_MODEL_ABI,
+	bzip2_is_init,
+	bzip2_init,
+	bzip2_fini,
 	NULL,
+	bzip2_compress,
+	bzip2_decompress,
 	NULL,
 	NULL,
 	NULL,
-	bzip2_compress,
-	bzip2_decompress
+	NULL,
+	NULL
 };
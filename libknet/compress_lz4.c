@@ -9,23 +9,112 @@
 
 #include "config.h"
 
+#include <string.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <lz4.h>
 
 #include "logging.h"
 #include "compress_model.h"
+#include "threads_local.h"
+
+/*
+ * each thread keeps its own compression state, instead of having
+ * lz4 setup a new one for every packet.
+ */
+
+/*
+ * the model index is fixed in compress.c, it is the same for all handles
+ */
+static int lz4_method_idx;
+
+static void *lz4_state_alloc(void *private_data)
+{
+	void *state;
+
+	state = malloc(LZ4_sizeofState());
+	if (!state) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(state, 0, LZ4_sizeofState());
+
+	return state;
+}
+
+static void lz4_state_free(void *state)
+{
+	free(state);
+}
+
+static int lz4_is_init(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	if (knet_h->compress_int_data[method_idx]) {
+		return 1;
+	}
+	return 0;
+}
+
+static int lz4_init(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	struct threads_local *state;
+
+	lz4_method_idx = method_idx;
+
+	if (!knet_h->compress_int_data[method_idx]) {
+		state = malloc(sizeof(struct threads_local));
+		if (!state) {
+			log_err(knet_h, KNET_SUB_LZ4COMP, "lz4 unable to allocate compression state tracker");
+			errno = ENOMEM;
+			return -1;
+		}
+		if (threads_local_init(state, lz4_state_alloc, lz4_state_free, NULL) < 0) {
+			log_err(knet_h, KNET_SUB_LZ4COMP, "lz4 unable to initialize compression state tracker");
+			free(state);
+			return -1;
+		}
+		knet_h->compress_int_data[method_idx] = state;
+	}
+
+	return 0;
+}
+
+static void lz4_fini(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	if (knet_h->compress_int_data[method_idx]) {
+		threads_local_fini(knet_h->compress_int_data[method_idx]);
+		free(knet_h->compress_int_data[method_idx]);
+		knet_h->compress_int_data[method_idx] = NULL;
+	}
+	return;
+}
 
 static int lz4_compress(
 	knet_handle_t knet_h,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
-	ssize_t *buf_out_len)
+	ssize_t *buf_out_len,
+	int compress_level)
 {
 	int lzerr = 0, err = 0;
 	int savederrno = 0;
+	void *state;
 
-	lzerr = LZ4_compress_fast((const char *)buf_in, (char *)buf_out, buf_in_len, KNET_DATABUFSIZE_COMPRESS, knet_h->compress_level);
+	state = threads_local_get(knet_h->compress_int_data[lz4_method_idx]);
+	if (!state) {
+		log_err(knet_h, KNET_SUB_LZ4COMP, "lz4 unable to allocate compression state");
+		errno = ENOMEM;
+		return -1;
+	}
+
+	lzerr = LZ4_compress_fast_extState(state, (const char *)buf_in, (char *)buf_out, buf_in_len, KNET_DATABUFSIZE_COMPRESS, compress_level);
 
 	/*
 	 * data compressed
@@ -80,12 +169,17 @@ static int lz4_decompress(
 	return err;
 }
 
-compress_ops_t compress_model = {
+const compress_ops_t KNET_COMPRESS_MODEL(lz4) = {
 	KNET_COMPRESS_MODEL_ABI,
+	lz4_is_init,
+	lz4_init,
+	lz4_fini,
+	NULL,
+	lz4_compress,
+	lz4_decompress,
 	NULL,
 	NULL,
 	NULL,
 	NULL,
-	lz4_compress,
-	lz4_decompress
+	NULL
 };
@@ -9,12 +9,15 @@
 
 #include "config.h"
 
+#include <string.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <lz4.h>
 #include <lz4hc.h>
 
 #include "logging.h"
 #include "compress_model.h"
+#include "threads_local.h"
 
 #ifdef LZ4HC_CLEVEL_MAX
 #define KNET_LZ4HC_MAX LZ4HC_CLEVEL_MAX
@@ -32,17 +35,103 @@
 #define KNET_LZ4HC_MAX 16
 #endif
 
+/*
+ * lz4hc allocates (and frees) its compression state for every packet,
+ * each thread keeps its own instead.
+ */
+
+/*
+ * the model index is fixed in compress.c, it is the same for all handles
+ */
+static int lz4hc_method_idx;
+
+static void *lz4hc_state_alloc(void *private_data)
+{
+	void *state;
+
+	state = malloc(LZ4_sizeofStateHC());
+	if (!state) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(state, 0, LZ4_sizeofStateHC());
+
+	return state;
+}
+
+static void lz4hc_state_free(void *state)
+{
+	free(state);
+}
+
+static int lz4hc_is_init(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	if (knet_h->compress_int_data[method_idx]) {
+		return 1;
+	}
+	return 0;
+}
+
+static int lz4hc_init(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	struct threads_local *state;
+
+	lz4hc_method_idx = method_idx;
+
+	if (!knet_h->compress_int_data[method_idx]) {
+		state = malloc(sizeof(struct threads_local));
+		if (!state) {
+			log_err(knet_h, KNET_SUB_LZ4HCCOMP, "lz4hc unable to allocate compression state tracker");
+			errno = ENOMEM;
+			return -1;
+		}
+		if (threads_local_init(state, lz4hc_state_alloc, lz4hc_state_free, NULL) < 0) {
+			log_err(knet_h, KNET_SUB_LZ4HCCOMP, "lz4hc unable to initialize compression state tracker");
+			free(state);
+			return -1;
+		}
+		knet_h->compress_int_data[method_idx] = state;
+	}
+
+	return 0;
+}
+
+static void lz4hc_fini(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	if (knet_h->compress_int_data[method_idx]) {
+		threads_local_fini(knet_h->compress_int_data[method_idx]);
+		free(knet_h->compress_int_data[method_idx]);
+		knet_h->compress_int_data[method_idx] = NULL;
+	}
+	return;
+}
+
 static int lz4hc_compress(
 	knet_handle_t knet_h,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
-	ssize_t *buf_out_len)
+	ssize_t *buf_out_len,
+	int compress_level)
 {
 	int lzerr = 0, err = 0;
 	int savederrno = 0;
+	void *state;
 
-	lzerr = LZ4_compress_HC((const char *)buf_in, (char *)buf_out, buf_in_len, KNET_DATABUFSIZE_COMPRESS, knet_h->compress_level);
+	state = threads_local_get(knet_h->compress_int_data[lz4hc_method_idx]);
+	if (!state) {
+		log_err(knet_h, KNET_SUB_LZ4HCCOMP, "lz4hc unable to allocate compression state");
+		errno = ENOMEM;
+		return -1;
+	}
+
+	lzerr = LZ4_compress_HC_extStateHC(state, (const char *)buf_in, (char *)buf_out, buf_in_len, KNET_DATABUFSIZE_COMPRESS, compress_level);
 
 	/*
 	 * data compressed
@@ -91,12 +180,17 @@ static int lz4_decompress(
 	return err;
 }
 
-compress_ops_t compress_model = {
+const compress_ops_t KNET_COMPRESS_MODEL(lz4hc) = {
 	KNET_COMPRESS_MODEL_ABI,
+	lz4hc_is_init,
+	lz4hc_init,
+	lz4hc_fini,
+	NULL,
+	lz4hc_compress,
+	lz4_decompress,
 	NULL,
 	NULL,
 	NULL,
 	NULL,
-	lz4hc_compress,
-	lz4_decompress
+	NULL
 };
@@ -9,31 +9,159 @@
 
 #include "config.h"
 
+#include <string.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <lzma.h>
 
 #include "logging.h"
 #include "compress_model.h"
+#include "threads_local.h"
+
+/*
+ * lzma encoder/decoder state is several MB. Each thread keeps its own
+ * streams, and initializing an already used lzma_stream reuses the
+ * memory allocated for the previous packet.
+ */
+
+/*
+ * the model index is fixed in compress.c, it is the same for all handles
+ */
+static int lzma_method_idx;
+
+struct lzma_thread {
+	lzma_stream comp;
+	lzma_stream decomp;
+};
+
+static void *lzma_thread_alloc(void *private_data)
+{
+	struct lzma_thread *lt;
+	lzma_stream strm_init = LZMA_STREAM_INIT;
+
+	lt = malloc(sizeof(struct lzma_thread));
+	if (!lt) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	lt->comp = strm_init;
+	lt->decomp = strm_init;
+
+	return lt;
+}
+
+static void lzma_thread_free(void *data)
+{
+	struct lzma_thread *lt = data;
+
+	lzma_end(&lt->comp);
+	lzma_end(&lt->decomp);
+	free(lt);
+}
+
+static int lzma_is_init(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	if (knet_h->compress_int_data[method_idx]) {
+		return 1;
+	}
+	return 0;
+}
+
+static int lzma_init(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	struct threads_local *lt;
+
+	lzma_method_idx = method_idx;
+
+	if (!knet_h->compress_int_data[method_idx]) {
+		lt = malloc(sizeof(struct threads_local));
+		if (!lt) {
+			log_err(knet_h, KNET_SUB_LZMACOMP, "lzma unable to allocate stream tracker");
+			errno = ENOMEM;
+			return -1;
+		}
+		if (threads_local_init(lt, lzma_thread_alloc, lzma_thread_free, NULL) < 0) {
+			log_err(knet_h, KNET_SUB_LZMACOMP, "lzma unable to initialize stream tracker");
+			free(lt);
+			return -1;
+		}
+		knet_h->compress_int_data[method_idx] = lt;
+	}
+
+	return 0;
+}
+
+static void lzma_fini(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	if (knet_h->compress_int_data[method_idx]) {
+		threads_local_fini(knet_h->compress_int_data[method_idx]);
+		free(knet_h->compress_int_data[method_idx]);
+		knet_h->compress_int_data[method_idx] = NULL;
+	}
+	return;
+}
+
+static struct lzma_thread *lzma_get_thread(knet_handle_t knet_h)
+{
+	struct lzma_thread *lt;
+
+	lt = threads_local_get(knet_h->compress_int_data[lzma_method_idx]);
+	if (!lt) {
+		log_err(knet_h, KNET_SUB_LZMACOMP, "lzma unable to allocate stream");
+		errno = ENOMEM;
+	}
+
+	return lt;
+}
 
 static int lzma_compress(
 	knet_handle_t knet_h,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
-	ssize_t *buf_out_len)
+	ssize_t *buf_out_len,
+	int compress_level)
 {
 	int err = 0;
 	int savederrno = 0;
-	size_t out_pos = 0;
 	lzma_ret ret = 0;
+	struct lzma_thread *lt;
+
+	lt = lzma_get_thread(knet_h);
+	if (!lt) {
+		return -1;
+	}
 
-	ret = lzma_easy_buffer_encode(knet_h->compress_level, LZMA_CHECK_NONE, NULL,
-				      (const uint8_t *)buf_in, buf_in_len,
-				      (uint8_t *)buf_out, &out_pos, KNET_DATABUFSIZE_COMPRESS);
+	ret = lzma_easy_encoder(&lt->comp, compress_level, LZMA_CHECK_NONE);
+	if (ret == LZMA_OK) {
+		lt->comp.next_in = (const uint8_t *)buf_in;
+		lt->comp.avail_in = buf_in_len;
+		lt->comp.next_out = (uint8_t *)buf_out;
+		lt->comp.avail_out = KNET_DATABUFSIZE_COMPRESS;
+
+		ret = lzma_code(&lt->comp, LZMA_FINISH);
+		if (ret == LZMA_OK) {
+			/*
+			 * not enough room in buf_out
+			 */
+			ret = LZMA_BUF_ERROR;
+		}
+	}
 
 	switch(ret) {
-		case LZMA_OK:
-			*buf_out_len = out_pos;
+		case LZMA_STREAM_END:
+			*buf_out_len = lt->comp.total_out;
+			break;
+		case LZMA_BUF_ERROR:
+			log_err(knet_h, KNET_SUB_LZMACOMP, "lzma unable to compress source in destination buffer");
+			savederrno = E2BIG;
+			err = -1;
 			break;
 		case LZMA_MEM_ERROR:
 			log_err(knet_h, KNET_SUB_LZMACOMP, "lzma compress memory allocation failed");
@@ -70,17 +198,36 @@ static int lzma_decompress(
 {
 	int err = 0;
 	int savederrno = 0;
-	uint64_t memlimit = UINT64_MAX; /* disable lzma internal memlimit check */
-	size_t out_pos = 0, in_pos = 0;
 	lzma_ret ret = 0;
+	struct lzma_thread *lt;
 
-	ret = lzma_stream_buffer_decode(&memlimit, 0, NULL,
-					(const uint8_t *)buf_in, &in_pos, buf_in_len,
-					(uint8_t *)buf_out, &out_pos, KNET_DATABUFSIZE_COMPRESS);
+	lt = lzma_get_thread(knet_h);
+	if (!lt) {
+		return -1;
+	}
+
+	/*
+	 * UINT64_MAX disables lzma internal memlimit check
+	 */
+	ret = lzma_stream_decoder(&lt->decomp, UINT64_MAX, 0);
+	if (ret == LZMA_OK) {
+		lt->decomp.next_in = (const uint8_t *)buf_in;
+		lt->decomp.avail_in = buf_in_len;
+		lt->decomp.next_out = (uint8_t *)buf_out;
+		lt->decomp.avail_out = KNET_DATABUFSIZE_COMPRESS;
+
+		ret = lzma_code(&lt->decomp, LZMA_FINISH);
+		if ((ret == LZMA_OK) || (ret == LZMA_BUF_ERROR)) {
+			/*
+			 * truncated input or output bigger than buf_out
+			 */
+			ret = LZMA_DATA_ERROR;
+		}
+	}
 
 	switch(ret) {
-		case LZMA_OK:
-			*buf_out_len = out_pos;
+		case LZMA_STREAM_END:
+			*buf_out_len = lt->decomp.total_out;
 			break;
 		case LZMA_MEM_ERROR:
 			log_err(knet_h, KNET_SUB_LZMACOMP, "lzma decompress memory allocation failed");
@@ -114,12 +261,17 @@ static int lzma_decompress(
 	return err;
 }
 
-compress_ops_t compress_model = {
+const compress_ops_t KNET_COMPRESS_MODEL(lzma) = {
 	KNET_COMPRESS_MODEL_ABI,
+	lzma_is_init,
+	lzma_init,
+	lzma_fini,
 	NULL,
+	lzma_compress,
+	lzma_decompress,
 	NULL,
 	NULL,
 	NULL,
-	lzma_compress,
-	lzma_decompress
+	NULL,
+	NULL
 };
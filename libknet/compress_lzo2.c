@@ -16,6 +16,34 @@
 
 #include "logging.h"
 #include "compress_model.h"
+#include "threads_local.h"
+
+/*
+ * lzo2 compress work memory cannot be shared between TX threads,
+ * each thread gets its own copy.
+ */
+
+static void *lzo2_wrkmem_alloc(void *private_data)
+{
+	void *wrkmem;
+
+	/*
+	 * LZO1X_999_MEM_COMPRESS is the highest amount of memory lzo2 can use
+	 */
+	wrkmem = malloc(LZO1X_999_MEM_COMPRESS);
+	if (!wrkmem) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(wrkmem, 0, LZO1X_999_MEM_COMPRESS);
+
+	return wrkmem;
+}
+
+static void lzo2_wrkmem_free(void *wrkmem)
+{
+	free(wrkmem);
+}
 
 static int lzo2_is_init(
 	knet_handle_t knet_h,
@@ -31,17 +59,21 @@ static int lzo2_init(
 	knet_handle_t knet_h,
 	int method_idx)
 {
-	/*
-	 * LZO1X_999_MEM_COMPRESS is the highest amount of memory lzo2 can use
-	 */
+	struct threads_local *wrkmem;
+
 	if (!knet_h->compress_int_data[method_idx]) {
-		knet_h->compress_int_data[method_idx] = malloc(LZO1X_999_MEM_COMPRESS);
-		if (!knet_h->compress_int_data[method_idx]) {
-			log_err(knet_h, KNET_SUB_LZO2COMP, "lzo2 unable to allocate work memory");
+		wrkmem = malloc(sizeof(struct threads_local));
+		if (!wrkmem) {
+			log_err(knet_h, KNET_SUB_LZO2COMP, "lzo2 unable to allocate work memory tracker");
 			errno = ENOMEM;
 			return -1;
 		}
-		memset(knet_h->compress_int_data[method_idx], 0, LZO1X_999_MEM_COMPRESS);
+		if (threads_local_init(wrkmem, lzo2_wrkmem_alloc, lzo2_wrkmem_free, NULL) < 0) {
+			log_err(knet_h, KNET_SUB_LZO2COMP, "lzo2 unable to initialize work memory tracker");
+			free(wrkmem);
+			return -1;
+		}
+		knet_h->compress_int_data[method_idx] = wrkmem;
 	}
 
 	return 0;
@@ -52,6 +84,7 @@ static void lzo2_fini(
 	int method_idx)
 {
 	if (knet_h->compress_int_data[method_idx]) {
+		threads_local_fini(knet_h->compress_int_data[method_idx]);
 		free(knet_h->compress_int_data[method_idx]);
 		knet_h->compress_int_data[method_idx] = NULL;
 	}
@@ -91,29 +124,38 @@ static int lzo2_compress(
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
-	ssize_t *buf_out_len)
+	ssize_t *buf_out_len,
+	int compress_level)
 {
 	int savederrno = 0, lzerr = 0, err = 0;
 	lzo_uint cmp_len;
+	void *wrkmem;
 
-	switch(knet_h->compress_level) {
+	wrkmem = threads_local_get(knet_h->compress_int_data[knet_h->compress_model]);
+	if (!wrkmem) {
+		log_err(knet_h, KNET_SUB_LZO2COMP, "lzo2 unable to allocate work memory");
+		errno = ENOMEM;
+		return -1;
+	}
+
+	switch(compress_level) {
 		case 1:
-			lzerr = lzo1x_1_compress(buf_in, buf_in_len, buf_out, &cmp_len, knet_h->compress_int_data[knet_h->compress_model]);
+			lzerr = lzo1x_1_compress(buf_in, buf_in_len, buf_out, &cmp_len, wrkmem);
 			break;
 		case 11:
-			lzerr = lzo1x_1_11_compress(buf_in, buf_in_len, buf_out, &cmp_len, knet_h->compress_int_data[knet_h->compress_model]);
+			lzerr = lzo1x_1_11_compress(buf_in, buf_in_len, buf_out, &cmp_len, wrkmem);
 			break;
 		case 12:
-			lzerr = lzo1x_1_12_compress(buf_in, buf_in_len, buf_out, &cmp_len, knet_h->compress_int_data[knet_h->compress_model]);
+			lzerr = lzo1x_1_12_compress(buf_in, buf_in_len, buf_out, &cmp_len, wrkmem);
 			break;
 		case 15:
-			lzerr = lzo1x_1_15_compress(buf_in, buf_in_len, buf_out, &cmp_len, knet_h->compress_int_data[knet_h->compress_model]);
+			lzerr = lzo1x_1_15_compress(buf_in, buf_in_len, buf_out, &cmp_len, wrkmem);
 			break;
 		case 999:
-			lzerr = lzo1x_999_compress(buf_in, buf_in_len, buf_out, &cmp_len, knet_h->compress_int_data[knet_h->compress_model]);
+			lzerr = lzo1x_999_compress(buf_in, buf_in_len, buf_out, &cmp_len, wrkmem);
 			break;
 		default:
-			lzerr = lzo1x_1_compress(buf_in, buf_in_len, buf_out, &cmp_len, knet_h->compress_int_data[knet_h->compress_model]);
+			lzerr = lzo1x_1_compress(buf_in, buf_in_len, buf_out, &cmp_len, wrkmem);
 			break;
 	}
 
@@ -154,12 +196,17 @@ static int lzo2_decompress(
 	return err;
 }
 
-compress_ops_t compress_model = {
+const compress_ops_t KNET_COMPRESS_MODEL(lzo2) = {
 	KNET_COMPRESS_MODEL_ABI,
 	lzo2_is_init,
 	lzo2_init,
 	lzo2_fini,
 	lzo2_val_level,
 	lzo2_compress,
-	lzo2_decompress
+	lzo2_decompress,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL
 };
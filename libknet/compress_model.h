@@ -11,9 +11,9 @@
 
 #include "internals.h"
 
-#define KNET_COMPRESS_MODEL_ABI 1
+#define KNET_COMPRESS_MODEL_ABI 4
 
-typedef struct {
+typedef struct compress_ops {
 	uint8_t abi_ver;
 
 	/*
@@ -59,17 +59,76 @@ typedef struct {
 	 * required functions
 	 *
 	 * hopefully those 2 don't require any explanation....
+	 *
+	 * compress_level is passed down by the caller because it
+	 * can be overridden per channel, do not use knet_h->compress_level.
 	 */
 	int (*compress)	(knet_handle_t knet_h,
 			 const unsigned char *buf_in,
 			 const ssize_t buf_in_len,
 			 unsigned char *buf_out,
-			 ssize_t *buf_out_len);
+			 ssize_t *buf_out_len,
+			 int compress_level);
 	int (*decompress)(knet_handle_t knet_h,
 			 const unsigned char *buf_in,
 			 const ssize_t buf_in_len,
 			 unsigned char *buf_out,
 			 ssize_t *buf_out_len);
+
+	/*
+	 * optional dictionary support
+	 *
+	 * train_dict builds a dictionary from samples_num samples
+	 * stored back to back in samples. dict_len is the size of
+	 * dict on input and the size of the dictionary on output.
+	 *
+	 * load_dict (re)builds the module dictionary state from
+	 * knet_h->compress_dict. It is invoked in shlib_rwlock write
+	 * context after init, every time the dictionaries change and
+	 * when compress_level changes.
+	 * Entry 0 of knet_h->compress_dict is used to compress,
+	 * all of them are used to decompress.
+	 */
+	int (*train_dict)(knet_handle_t knet_h,
+			 const unsigned char *samples,
+			 const size_t *samples_sizes,
+			 unsigned int samples_num,
+			 unsigned char *dict,
+			 size_t *dict_len);
+	int (*load_dict)(knet_handle_t knet_h,
+			 int method_idx);
+
+	/*
+	 * optional stream support
+	 *
+	 * stream_compress and stream_decompress keep the history between
+	 * packets in *stream. The module allocates it on first use
+	 * (*stream is NULL) and stream_free releases it. A stream is used
+	 * either to compress or to decompress, never both, and never by
+	 * two threads at the same time.
+	 * When reset is set, the history is dropped before processing
+	 * buf_in and compress_level is applied. Each call must produce
+	 * output that can be decompressed as soon as it is received.
+	 * On error the stream is left in an unknown state and the
+	 * caller resets it before using it again.
+	 */
+	int (*stream_compress)(knet_handle_t knet_h,
+			 void **stream,
+			 int reset,
+			 const unsigned char *buf_in,
+			 const ssize_t buf_in_len,
+			 unsigned char *buf_out,
+			 ssize_t *buf_out_len,
+			 int compress_level);
+	int (*stream_decompress)(knet_handle_t knet_h,
+			 void **stream,
+			 int reset,
+			 const unsigned char *buf_in,
+			 const ssize_t buf_in_len,
+			 unsigned char *buf_out,
+			 ssize_t *buf_out_len);
+	void (*stream_free)(knet_handle_t knet_h,
+			 void *stream);
 } compress_ops_t;
 
 typedef struct {
@@ -85,7 +144,19 @@ typedef struct {
 	/*
 	 * runtime bits
 	 */
-	compress_ops_t	*ops;
+	const compress_ops_t	*ops;
 } compress_model_t;
 
+/*
+ * modules listed in --enable-static-modules are linked into libknet
+ * and built with KNET_STATIC_MODULE. Each of them needs its own ops
+ * symbol (compress_<name>_model) instead of the compress_model symbol
+ * looked up by load_module. Ops are always declared const.
+ */
+#ifdef KNET_STATIC_MODULE
+#define KNET_COMPRESS_MODEL(name) compress_##name##_model
+#else
+#define KNET_COMPRESS_MODEL(name) compress_model
+#endif
+
 #endif
@@ -9,28 +9,177 @@
 
 #include "config.h"
 
+#include <string.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <zlib.h>
 
 #include "logging.h"
 #include "compress_model.h"
+#include "threads_local.h"
+
+/*
+ * deflate/inflate state is big and expensive to setup, each
+ * thread keeps its own streams and resets them for every packet.
+ */
+
+/*
+ * the model index is fixed in compress.c, it is the same for all handles
+ */
+static int zlib_method_idx;
+
+struct zlib_thread {
+	z_stream comp;
+	int comp_init;
+	int comp_level;
+	z_stream decomp;
+	int decomp_init;
+};
+
+static void *zlib_thread_alloc(void *private_data)
+{
+	struct zlib_thread *zt;
+
+	zt = malloc(sizeof(struct zlib_thread));
+	if (!zt) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(zt, 0, sizeof(struct zlib_thread));
+
+	return zt;
+}
+
+static void zlib_thread_free(void *data)
+{
+	struct zlib_thread *zt = data;
+
+	if (zt->comp_init) {
+		deflateEnd(&zt->comp);
+	}
+	if (zt->decomp_init) {
+		inflateEnd(&zt->decomp);
+	}
+	free(zt);
+}
+
+static int zlib_is_init(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	if (knet_h->compress_int_data[method_idx]) {
+		return 1;
+	}
+	return 0;
+}
+
+static int zlib_init(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	struct threads_local *zt;
+
+	zlib_method_idx = method_idx;
+
+	if (!knet_h->compress_int_data[method_idx]) {
+		zt = malloc(sizeof(struct threads_local));
+		if (!zt) {
+			log_err(knet_h, KNET_SUB_ZLIBCOMP, "zlib unable to allocate stream tracker");
+			errno = ENOMEM;
+			return -1;
+		}
+		if (threads_local_init(zt, zlib_thread_alloc, zlib_thread_free, NULL) < 0) {
+			log_err(knet_h, KNET_SUB_ZLIBCOMP, "zlib unable to initialize stream tracker");
+			free(zt);
+			return -1;
+		}
+		knet_h->compress_int_data[method_idx] = zt;
+	}
+
+	return 0;
+}
+
+static void zlib_fini(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	if (knet_h->compress_int_data[method_idx]) {
+		threads_local_fini(knet_h->compress_int_data[method_idx]);
+		free(knet_h->compress_int_data[method_idx]);
+		knet_h->compress_int_data[method_idx] = NULL;
+	}
+	return;
+}
+
+static struct zlib_thread *zlib_get_thread(knet_handle_t knet_h)
+{
+	struct zlib_thread *zt;
+
+	zt = threads_local_get(knet_h->compress_int_data[zlib_method_idx]);
+	if (!zt) {
+		log_err(knet_h, KNET_SUB_ZLIBCOMP, "zlib unable to allocate stream");
+		errno = ENOMEM;
+	}
+
+	return zt;
+}
 
 static int zlib_compress(
 	knet_handle_t knet_h,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
-	ssize_t *buf_out_len)
+	ssize_t *buf_out_len,
+	int compress_level)
 {
 	int zerr = 0, err = 0;
 	int savederrno = 0;
-	uLongf destLen = *buf_out_len;
+	struct zlib_thread *zt;
 
-	zerr = compress2(buf_out, &destLen,
-			 buf_in, buf_in_len,
-			 knet_h->compress_level);
+	zt = zlib_get_thread(knet_h);
+	if (!zt) {
+		return -1;
+	}
+
+	if (!zt->comp_init) {
+		memset(&zt->comp, 0, sizeof(z_stream));
+		zerr = deflateInit(&zt->comp, compress_level);
+		if (zerr == Z_OK) {
+			zt->comp_init = 1;
+			zt->comp_level = compress_level;
+		}
+	} else {
+		zerr = deflateReset(&zt->comp);
+		/*
+		 * compress_level can change at runtime and between channels,
+		 * a stream that has just been reset can switch level in place
+		 */
+		if ((zerr == Z_OK) && (zt->comp_level != compress_level)) {
+			zerr = deflateParams(&zt->comp, compress_level, Z_DEFAULT_STRATEGY);
+			if (zerr == Z_OK) {
+				zt->comp_level = compress_level;
+			}
+		}
+	}
+
+	if (zerr == Z_OK) {
+		zt->comp.next_in = (Bytef *)buf_in;
+		zt->comp.avail_in = buf_in_len;
+		zt->comp.next_out = buf_out;
+		zt->comp.avail_out = *buf_out_len;
 
-	*buf_out_len = destLen;
+		zerr = deflate(&zt->comp, Z_FINISH);
+		if (zerr == Z_STREAM_END) {
+			zerr = Z_OK;
+		} else if (zerr == Z_OK) {
+			/*
+			 * not enough room in buf_out
+			 */
+			zerr = Z_BUF_ERROR;
+		}
+
+		*buf_out_len = zt->comp.total_out;
+	}
 
 	switch(zerr) {
 		case Z_OK:
@@ -70,12 +219,47 @@ static int zlib_decompress(
 {
 	int zerr = 0, err = 0;
 	int savederrno = 0;
-	uLongf destLen = *buf_out_len;
+	struct zlib_thread *zt;
 
-	zerr = uncompress(buf_out, &destLen,
-			  buf_in, buf_in_len);
+	zt = zlib_get_thread(knet_h);
+	if (!zt) {
+		return -1;
+	}
 
-	*buf_out_len = destLen;
+	if (!zt->decomp_init) {
+		memset(&zt->decomp, 0, sizeof(z_stream));
+		zerr = inflateInit(&zt->decomp);
+		if (zerr == Z_OK) {
+			zt->decomp_init = 1;
+		}
+	} else {
+		zerr = inflateReset(&zt->decomp);
+	}
+
+	if (zerr == Z_OK) {
+		zt->decomp.next_in = (Bytef *)buf_in;
+		zt->decomp.avail_in = buf_in_len;
+		zt->decomp.next_out = buf_out;
+		zt->decomp.avail_out = *buf_out_len;
+
+		zerr = inflate(&zt->decomp, Z_FINISH);
+		switch(zerr) {
+			case Z_STREAM_END:
+				zerr = Z_OK;
+				break;
+			case Z_OK:
+				/*
+				 * truncated input or not enough room in buf_out
+				 */
+				zerr = Z_BUF_ERROR;
+				break;
+			case Z_NEED_DICT:
+				zerr = Z_DATA_ERROR;
+				break;
+		}
+
+		*buf_out_len = zt->decomp.total_out;
+	}
 
 	switch(zerr) {
 		case Z_OK:
@@ -106,12 +290,202 @@ static int zlib_decompress(
 	return err;
 }
 
-compress_ops_t compress_model = {
+/*
+ * streams keep the deflate/inflate history between packets and
+ * terminate every packet with a sync flush. The empty stored block
+ * appended by the flush (00 00 ff ff) is always the same, it is
+ * stripped by the sender and added back by the receiver.
+ */
+static const unsigned char zlib_stream_tail[] = { 0x00, 0x00, 0xff, 0xff };
+
+struct zlib_stream {
+	z_stream strm;
+	int deflate;
+	int level;
+};
+
+static void zlib_stream_free(
+	knet_handle_t knet_h,
+	void *stream)
+{
+	struct zlib_stream *zs = stream;
+
+	if (!zs) {
+		return;
+	}
+
+	if (zs->deflate) {
+		deflateEnd(&zs->strm);
+	} else {
+		inflateEnd(&zs->strm);
+	}
+	free(zs);
+}
+
+static struct zlib_stream *zlib_stream_alloc(
+	knet_handle_t knet_h,
+	int deflate,
+	int compress_level)
+{
+	struct zlib_stream *zs;
+	int zerr;
+
+	zs = malloc(sizeof(struct zlib_stream));
+	if (!zs) {
+		log_err(knet_h, KNET_SUB_ZLIBCOMP, "zlib unable to allocate stream");
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(zs, 0, sizeof(struct zlib_stream));
+
+	if (deflate) {
+		zerr = deflateInit(&zs->strm, compress_level);
+	} else {
+		zerr = inflateInit(&zs->strm);
+	}
+	if (zerr != Z_OK) {
+		log_err(knet_h, KNET_SUB_ZLIBCOMP, "zlib unable to initialize stream: %d", zerr);
+		free(zs);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	zs->deflate = deflate;
+	zs->level = compress_level;
+
+	return zs;
+}
+
+static int zlib_stream_compress(
+	knet_handle_t knet_h,
+	void **stream,
+	int reset,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len,
+	int compress_level)
+{
+	struct zlib_stream *zs = *stream;
+	int zerr = Z_OK;
+	ssize_t out_len;
+
+	if (!zs) {
+		zs = zlib_stream_alloc(knet_h, 1, compress_level);
+		if (!zs) {
+			return -1;
+		}
+		*stream = zs;
+	} else if (reset) {
+		zerr = deflateReset(&zs->strm);
+		if ((zerr == Z_OK) && (zs->level != compress_level)) {
+			zerr = deflateParams(&zs->strm, compress_level, Z_DEFAULT_STRATEGY);
+			if (zerr == Z_OK) {
+				zs->level = compress_level;
+			}
+		}
+		if (zerr != Z_OK) {
+			log_err(knet_h, KNET_SUB_ZLIBCOMP, "zlib unable to reset stream: %d", zerr);
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	zs->strm.next_in = (Bytef *)buf_in;
+	zs->strm.avail_in = buf_in_len;
+	zs->strm.next_out = buf_out;
+	zs->strm.avail_out = *buf_out_len;
+
+	zerr = deflate(&zs->strm, Z_SYNC_FLUSH);
+	/*
+	 * a flush is complete only if there is room left in buf_out
+	 */
+	if ((zerr != Z_OK) || (zs->strm.avail_in) || (!zs->strm.avail_out)) {
+		log_err(knet_h, KNET_SUB_ZLIBCOMP, "zlib stream compress error: %d", zerr);
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	out_len = *buf_out_len - zs->strm.avail_out;
+	if ((out_len < (ssize_t)sizeof(zlib_stream_tail)) ||
+	    (memcmp(buf_out + out_len - sizeof(zlib_stream_tail), zlib_stream_tail, sizeof(zlib_stream_tail)))) {
+		log_err(knet_h, KNET_SUB_ZLIBCOMP, "zlib stream compress produced an unexpected flush marker");
+		errno = EINVAL;
+		return -1;
+	}
+
+	*buf_out_len = out_len - sizeof(zlib_stream_tail);
+
+	return 0;
+}
+
+static int zlib_stream_decompress(
+	knet_handle_t knet_h,
+	void **stream,
+	int reset,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len)
+{
+	struct zlib_stream *zs = *stream;
+	int zerr = Z_OK;
+
+	if (!zs) {
+		zs = zlib_stream_alloc(knet_h, 0, 0);
+		if (!zs) {
+			return -1;
+		}
+		*stream = zs;
+	} else if (reset) {
+		zerr = inflateReset(&zs->strm);
+		if (zerr != Z_OK) {
+			log_err(knet_h, KNET_SUB_ZLIBCOMP, "zlib unable to reset stream: %d", zerr);
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	zs->strm.next_out = buf_out;
+	zs->strm.avail_out = *buf_out_len;
+
+	zs->strm.next_in = (Bytef *)buf_in;
+	zs->strm.avail_in = buf_in_len;
+
+	zerr = inflate(&zs->strm, Z_SYNC_FLUSH);
+	if (((zerr == Z_OK) || (zerr == Z_BUF_ERROR)) && (!zs->strm.avail_in)) {
+		zs->strm.next_in = (Bytef *)zlib_stream_tail;
+		zs->strm.avail_in = sizeof(zlib_stream_tail);
+
+		zerr = inflate(&zs->strm, Z_SYNC_FLUSH);
+	}
+
+	/*
+	 * the sender never terminates the stream, Z_STREAM_END
+	 * means that the data are not what we expect
+	 */
+	if ((zerr != Z_OK) || (zs->strm.avail_in) || (!zs->strm.avail_out)) {
+		log_debug(knet_h, KNET_SUB_ZLIBCOMP, "zlib stream decompress error: %d", zerr);
+		errno = EINVAL;
+		return -1;
+	}
+
+	*buf_out_len = *buf_out_len - zs->strm.avail_out;
+
+	return 0;
+}
+
+const compress_ops_t KNET_COMPRESS_MODEL(zlib) = {
 	KNET_COMPRESS_MODEL_ABI,
+	zlib_is_init,
+	zlib_init,
+	zlib_fini,
 	NULL,
+	zlib_compress,
+	zlib_decompress,
 	NULL,
 	NULL,
-	NULL,
-	zlib_compress,
-	zlib_decompress
+	zlib_stream_compress,
+	zlib_stream_decompress,
+	zlib_stream_free
 };
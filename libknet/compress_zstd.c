@@ -0,0 +1,516 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.  All rights reserved.
+ *
+ * This software licensed under GPL-2.0+, LGPL-2.0+
+ */
+#define KNET_MODULE
+
+#include "config.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <zstd.h>
+#include <zdict.h>
+
+#include "logging.h"
+#include "compress_model.h"
+#include "threads_local.h"
+
+/*
+ * compression/decompression contexts cannot be shared between
+ * threads, digested dictionaries are read only and are shared
+ * by all threads of a handle.
+ *
+ * each compressed frame carries the ID of the dictionary used to
+ * compress it (0 if none), that is used to pick the right dictionary
+ * on decompress.
+ */
+
+/*
+ * the model index is fixed in compress.c, it is the same for all handles
+ */
+static int zstd_method_idx;
+
+struct zstd_thread {
+	ZSTD_CCtx *cctx;
+	ZSTD_DCtx *dctx;
+};
+
+struct zstd_handle {
+	struct threads_local contexts;
+	ZSTD_CDict *cdict;
+	ZSTD_DDict *ddict[KNET_COMPRESS_DICT_MAX];
+	unsigned int ddict_id[KNET_COMPRESS_DICT_MAX];
+};
+
+static void zstd_thread_free(void *data)
+{
+	struct zstd_thread *zt = data;
+
+	ZSTD_freeCCtx(zt->cctx);
+	ZSTD_freeDCtx(zt->dctx);
+	free(zt);
+}
+
+static void *zstd_thread_alloc(void *private_data)
+{
+	struct zstd_thread *zt;
+
+	zt = malloc(sizeof(struct zstd_thread));
+	if (!zt) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(zt, 0, sizeof(struct zstd_thread));
+
+	zt->cctx = ZSTD_createCCtx();
+	zt->dctx = ZSTD_createDCtx();
+	if ((!zt->cctx) || (!zt->dctx)) {
+		zstd_thread_free(zt);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return zt;
+}
+
+static void zstd_free_dicts(struct zstd_handle *zh)
+{
+	int i;
+
+	ZSTD_freeCDict(zh->cdict);
+	zh->cdict = NULL;
+
+	for (i = 0; i < KNET_COMPRESS_DICT_MAX; i++) {
+		ZSTD_freeDDict(zh->ddict[i]);
+		zh->ddict[i] = NULL;
+		zh->ddict_id[i] = 0;
+	}
+}
+
+static int zstd_is_init(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	if (knet_h->compress_int_data[method_idx]) {
+		return 1;
+	}
+	return 0;
+}
+
+static int zstd_init(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	struct zstd_handle *zh;
+
+	zstd_method_idx = method_idx;
+
+	if (!knet_h->compress_int_data[method_idx]) {
+		zh = malloc(sizeof(struct zstd_handle));
+		if (!zh) {
+			log_err(knet_h, KNET_SUB_ZSTDCOMP, "zstd unable to allocate handle data");
+			errno = ENOMEM;
+			return -1;
+		}
+		memset(zh, 0, sizeof(struct zstd_handle));
+		if (threads_local_init(&zh->contexts, zstd_thread_alloc, zstd_thread_free, NULL) < 0) {
+			log_err(knet_h, KNET_SUB_ZSTDCOMP, "zstd unable to initialize contexts tracker");
+			free(zh);
+			return -1;
+		}
+		knet_h->compress_int_data[method_idx] = zh;
+	}
+
+	return 0;
+}
+
+static void zstd_fini(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	struct zstd_handle *zh = knet_h->compress_int_data[method_idx];
+
+	if (zh) {
+		threads_local_fini(&zh->contexts);
+		zstd_free_dicts(zh);
+		free(zh);
+		knet_h->compress_int_data[method_idx] = NULL;
+	}
+	return;
+}
+
+static int zstd_val_level(
+	knet_handle_t knet_h,
+	int compress_level)
+{
+	if ((compress_level < ZSTD_minCLevel()) || (compress_level > ZSTD_maxCLevel())) {
+		log_err(knet_h, KNET_SUB_ZSTDCOMP, "zstd unsupported compression level %d (accepted values from %d to %d)",
+			compress_level, ZSTD_minCLevel(), ZSTD_maxCLevel());
+		return -1;
+	}
+	return 0;
+}
+
+static int zstd_compress(
+	knet_handle_t knet_h,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len,
+	int compress_level)
+{
+	struct zstd_handle *zh = knet_h->compress_int_data[zstd_method_idx];
+	struct zstd_thread *zt;
+	size_t ret;
+
+	zt = threads_local_get(&zh->contexts);
+	if (!zt) {
+		log_err(knet_h, KNET_SUB_ZSTDCOMP, "zstd unable to allocate compression context");
+		errno = ENOMEM;
+		return -1;
+	}
+
+	/*
+	 * the dictionary is digested with the handle compress_level,
+	 * channel overrides of the level do not apply to it
+	 */
+	if (zh->cdict) {
+		ret = ZSTD_compress_usingCDict(zt->cctx,
+					       buf_out, KNET_DATABUFSIZE_COMPRESS,
+					       buf_in, buf_in_len,
+					       zh->cdict);
+	} else {
+		ret = ZSTD_compressCCtx(zt->cctx,
+					buf_out, KNET_DATABUFSIZE_COMPRESS,
+					buf_in, buf_in_len,
+					compress_level);
+	}
+
+	if (ZSTD_isError(ret)) {
+		log_err(knet_h, KNET_SUB_ZSTDCOMP, "zstd compression error: %s", ZSTD_getErrorName(ret));
+		errno = EINVAL;
+		return -1;
+	}
+
+	*buf_out_len = ret;
+
+	return 0;
+}
+
+static int zstd_decompress(
+	knet_handle_t knet_h,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len)
+{
+	struct zstd_handle *zh = knet_h->compress_int_data[zstd_method_idx];
+	struct zstd_thread *zt;
+	ZSTD_DDict *ddict = NULL;
+	unsigned int dict_id;
+	size_t ret;
+	int i;
+
+	zt = threads_local_get(&zh->contexts);
+	if (!zt) {
+		log_err(knet_h, KNET_SUB_ZSTDCOMP, "zstd unable to allocate decompression context");
+		errno = ENOMEM;
+		return -1;
+	}
+
+	dict_id = ZSTD_getDictID_fromFrame(buf_in, buf_in_len);
+	if (dict_id) {
+		for (i = 0; i < KNET_COMPRESS_DICT_MAX; i++) {
+			if ((zh->ddict[i]) && (zh->ddict_id[i] == dict_id)) {
+				ddict = zh->ddict[i];
+				break;
+			}
+		}
+		if (!ddict) {
+			log_err(knet_h, KNET_SUB_ZSTDCOMP, "zstd received data compressed with unknown dictionary %u", dict_id);
+			errno = EINVAL;
+			return -1;
+		}
+		ret = ZSTD_decompress_usingDDict(zt->dctx,
+						 buf_out, KNET_DATABUFSIZE,
+						 buf_in, buf_in_len,
+						 ddict);
+	} else {
+		ret = ZSTD_decompressDCtx(zt->dctx,
+					  buf_out, KNET_DATABUFSIZE,
+					  buf_in, buf_in_len);
+	}
+
+	if (ZSTD_isError(ret)) {
+		log_err(knet_h, KNET_SUB_ZSTDCOMP, "zstd decompression error: %s", ZSTD_getErrorName(ret));
+		errno = EINVAL;
+		return -1;
+	}
+
+	*buf_out_len = ret;
+
+	return 0;
+}
+
+static int zstd_train_dict(
+	knet_handle_t knet_h,
+	const unsigned char *samples,
+	const size_t *samples_sizes,
+	unsigned int samples_num,
+	unsigned char *dict,
+	size_t *dict_len)
+{
+	size_t ret;
+
+	ret = ZDICT_trainFromBuffer(dict, *dict_len, samples, samples_sizes, samples_num);
+	if (ZDICT_isError(ret)) {
+		log_err(knet_h, KNET_SUB_ZSTDCOMP, "zstd unable to train dictionary: %s", ZDICT_getErrorName(ret));
+		errno = EINVAL;
+		return -1;
+	}
+
+	log_debug(knet_h, KNET_SUB_ZSTDCOMP, "zstd trained dictionary %u (%zu bytes) from %u samples",
+		  ZDICT_getDictID(dict, ret), ret, samples_num);
+
+	*dict_len = ret;
+
+	return 0;
+}
+
+static int zstd_load_dict(
+	knet_handle_t knet_h,
+	int method_idx)
+{
+	struct zstd_handle *zh = knet_h->compress_int_data[method_idx];
+	struct knet_compress_dict *dict;
+	int i;
+
+	zstd_free_dicts(zh);
+
+	for (i = 0; i < KNET_COMPRESS_DICT_MAX; i++) {
+		dict = &knet_h->compress_dict[i];
+		if (!dict->dict) {
+			continue;
+		}
+
+		/*
+		 * raw content dictionaries have no ID and cannot
+		 * be identified on the receiving side
+		 */
+		zh->ddict_id[i] = ZDICT_getDictID(dict->dict, dict->dict_len);
+		if (!zh->ddict_id[i]) {
+			log_err(knet_h, KNET_SUB_ZSTDCOMP, "zstd dictionary is not in zstd format or has no ID");
+			errno = EINVAL;
+			goto out_fail;
+		}
+
+		zh->ddict[i] = ZSTD_createDDict(dict->dict, dict->dict_len);
+		if (!zh->ddict[i]) {
+			log_err(knet_h, KNET_SUB_ZSTDCOMP, "zstd unable to load decompression dictionary");
+			errno = ENOMEM;
+			goto out_fail;
+		}
+
+		if (i == 0) {
+			zh->cdict = ZSTD_createCDict(dict->dict, dict->dict_len, knet_h->compress_level);
+			if (!zh->cdict) {
+				log_err(knet_h, KNET_SUB_ZSTDCOMP, "zstd unable to load compression dictionary");
+				errno = ENOMEM;
+				goto out_fail;
+			}
+			log_debug(knet_h, KNET_SUB_ZSTDCOMP, "zstd compressing with dictionary %u", zh->ddict_id[i]);
+		}
+	}
+
+	return 0;
+
+out_fail:
+	zstd_free_dicts(zh);
+	return -1;
+}
+
+/*
+ * streams are a single zstd frame that is never ended, every packet
+ * is flushed so that the receiver can decode it on arrival.
+ * The window is kept small, there is one stream per host and channel
+ * and the receiver refuses frames that require more memory.
+ * Dictionaries are not used in stream mode.
+ */
+#define KNET_ZSTD_STREAM_WINDOW_LOG 17
+
+struct zstd_stream {
+	ZSTD_CCtx *cctx;
+	ZSTD_DCtx *dctx;
+};
+
+static void zstd_stream_free(
+	knet_handle_t knet_h,
+	void *stream)
+{
+	struct zstd_stream *zs = stream;
+
+	if (!zs) {
+		return;
+	}
+
+	ZSTD_freeCCtx(zs->cctx);
+	ZSTD_freeDCtx(zs->dctx);
+	free(zs);
+}
+
+static int zstd_stream_compress(
+	knet_handle_t knet_h,
+	void **stream,
+	int reset,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len,
+	int compress_level)
+{
+	struct zstd_stream *zs = *stream;
+	ZSTD_inBuffer in = { buf_in, buf_in_len, 0 };
+	ZSTD_outBuffer out = { buf_out, *buf_out_len, 0 };
+	size_t ret;
+
+	if (!zs) {
+		zs = malloc(sizeof(struct zstd_stream));
+		if (!zs) {
+			log_err(knet_h, KNET_SUB_ZSTDCOMP, "zstd unable to allocate stream");
+			errno = ENOMEM;
+			return -1;
+		}
+		memset(zs, 0, sizeof(struct zstd_stream));
+
+		zs->cctx = ZSTD_createCCtx();
+		if (!zs->cctx) {
+			log_err(knet_h, KNET_SUB_ZSTDCOMP, "zstd unable to allocate stream context");
+			free(zs);
+			errno = ENOMEM;
+			return -1;
+		}
+		ret = ZSTD_CCtx_setParameter(zs->cctx, ZSTD_c_windowLog, KNET_ZSTD_STREAM_WINDOW_LOG);
+		if (ZSTD_isError(ret)) {
+			log_err(knet_h, KNET_SUB_ZSTDCOMP, "zstd unable to set stream window: %s", ZSTD_getErrorName(ret));
+			zstd_stream_free(knet_h, zs);
+			errno = EINVAL;
+			return -1;
+		}
+		*stream = zs;
+		reset = 1;
+	}
+
+	if (reset) {
+		ret = ZSTD_CCtx_reset(zs->cctx, ZSTD_reset_session_only);
+		if (!ZSTD_isError(ret)) {
+			ret = ZSTD_CCtx_setParameter(zs->cctx, ZSTD_c_compressionLevel, compress_level);
+		}
+		if (ZSTD_isError(ret)) {
+			log_err(knet_h, KNET_SUB_ZSTDCOMP, "zstd unable to reset stream: %s", ZSTD_getErrorName(ret));
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	do {
+		ret = ZSTD_compressStream2(zs->cctx, &out, &in, ZSTD_e_flush);
+		if (ZSTD_isError(ret)) {
+			log_err(knet_h, KNET_SUB_ZSTDCOMP, "zstd stream compress error: %s", ZSTD_getErrorName(ret));
+			errno = EINVAL;
+			return -1;
+		}
+	} while ((ret) && (out.pos < out.size));
+
+	if (ret) {
+		log_err(knet_h, KNET_SUB_ZSTDCOMP, "zstd stream compress error: output buffer too small");
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	*buf_out_len = out.pos;
+
+	return 0;
+}
+
+static int zstd_stream_decompress(
+	knet_handle_t knet_h,
+	void **stream,
+	int reset,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len)
+{
+	struct zstd_stream *zs = *stream;
+	ZSTD_inBuffer in = { buf_in, buf_in_len, 0 };
+	ZSTD_outBuffer out = { buf_out, *buf_out_len, 0 };
+	size_t ret;
+
+	if (!zs) {
+		zs = malloc(sizeof(struct zstd_stream));
+		if (!zs) {
+			log_err(knet_h, KNET_SUB_ZSTDCOMP, "zstd unable to allocate stream");
+			errno = ENOMEM;
+			return -1;
+		}
+		memset(zs, 0, sizeof(struct zstd_stream));
+
+		zs->dctx = ZSTD_createDCtx();
+		if (!zs->dctx) {
+			log_err(knet_h, KNET_SUB_ZSTDCOMP, "zstd unable to allocate stream context");
+			free(zs);
+			errno = ENOMEM;
+			return -1;
+		}
+		ret = ZSTD_DCtx_setParameter(zs->dctx, ZSTD_d_windowLogMax, KNET_ZSTD_STREAM_WINDOW_LOG);
+		if (ZSTD_isError(ret)) {
+			log_err(knet_h, KNET_SUB_ZSTDCOMP, "zstd unable to set stream window: %s", ZSTD_getErrorName(ret));
+			zstd_stream_free(knet_h, zs);
+			errno = EINVAL;
+			return -1;
+		}
+		*stream = zs;
+	} else if (reset) {
+		ret = ZSTD_DCtx_reset(zs->dctx, ZSTD_reset_session_only);
+		if (ZSTD_isError(ret)) {
+			log_err(knet_h, KNET_SUB_ZSTDCOMP, "zstd unable to reset stream: %s", ZSTD_getErrorName(ret));
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	while (in.pos < in.size) {
+		ret = ZSTD_decompressStream(zs->dctx, &out, &in);
+		if (ZSTD_isError(ret)) {
+			log_debug(knet_h, KNET_SUB_ZSTDCOMP, "zstd stream decompress error: %s", ZSTD_getErrorName(ret));
+			errno = EINVAL;
+			return -1;
+		}
+		if (out.pos == out.size) {
+			log_debug(knet_h, KNET_SUB_ZSTDCOMP, "zstd stream decompress error: output buffer too small");
+			errno = ENOBUFS;
+			return -1;
+		}
+	}
+
+	*buf_out_len = out.pos;
+
+	return 0;
+}
+
+const compress_ops_t KNET_COMPRESS_MODEL(zstd) = {
+	KNET_COMPRESS_MODEL_ABI,
+	zstd_is_init,
+	zstd_init,
+	zstd_fini,
+	zstd_val_level,
+	zstd_compress,
+	zstd_decompress,
+	zstd_train_dict,
+	zstd_load_dict,
+	zstd_stream_compress,
+	zstd_stream_decompress,
+	zstd_stream_free
+};
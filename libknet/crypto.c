@@ -20,13 +20,40 @@
 #include "logging.h"
 #include "common.h"
 
+/*
+ * modules linked into libknet at build time (--enable-static-modules),
+ * see compress.c
+ */
+
+#if STATIC_CRYPTO_NSS
+extern const crypto_ops_t crypto_nss_model;
+#define CRYPTO_NSS_OPS &crypto_nss_model
+#define CRYPTO_NSS_CASE(op, args) case 0: return crypto_nss_model.op args;
+#else
+#define CRYPTO_NSS_OPS NULL
+#define CRYPTO_NSS_CASE(op, args)
+#endif
+
+#if STATIC_CRYPTO_OPENSSL
+extern const crypto_ops_t crypto_openssl_model;
+#define CRYPTO_OPENSSL_OPS &crypto_openssl_model
+#define CRYPTO_OPENSSL_CASE(op, args) case 1: return crypto_openssl_model.op args;
+#else
+#define CRYPTO_OPENSSL_OPS NULL
+#define CRYPTO_OPENSSL_CASE(op, args)
+#endif
+
+#define CRYPTO_STATIC_CASES(op, args) \
+	CRYPTO_NSS_CASE(op, args) \
+	CRYPTO_OPENSSL_CASE(op, args)
+
 /*
  * internal module switch data
  */
 
 crypto_model_t crypto_modules_cmds[] = {
-	{ "nss", WITH_CRYPTO_NSS, 0, NULL },
-	{ "openssl", WITH_CRYPTO_OPENSSL, 0, NULL },
+	{ "nss", WITH_CRYPTO_NSS, STATIC_CRYPTO_NSS, CRYPTO_NSS_OPS },
+	{ "openssl", WITH_CRYPTO_OPENSSL, STATIC_CRYPTO_OPENSSL, CRYPTO_OPENSSL_OPS },
 	{ NULL, 0, 0, NULL }
 };
 
@@ -53,6 +80,11 @@ int crypto_encrypt_and_sign (
 	unsigned char *buf_out,
 	ssize_t *buf_out_len)
 {
+	switch (knet_h->crypto_instance->model) {
+	CRYPTO_STATIC_CASES(crypt, (knet_h, buf_in, buf_in_len, buf_out, buf_out_len))
+	default:
+		break;
+	}
 	return crypto_modules_cmds[knet_h->crypto_instance->model].ops->crypt(knet_h, buf_in, buf_in_len, buf_out, buf_out_len);
 }
 
@@ -63,6 +95,11 @@ int crypto_encrypt_and_signv (
 	unsigned char *buf_out,
 	ssize_t *buf_out_len)
 {
+	switch (knet_h->crypto_instance->model) {
+	CRYPTO_STATIC_CASES(cryptv, (knet_h, iov_in, iovcnt_in, buf_out, buf_out_len))
+	default:
+		break;
+	}
 	return crypto_modules_cmds[knet_h->crypto_instance->model].ops->cryptv(knet_h, iov_in, iovcnt_in, buf_out, buf_out_len);
 }
 
@@ -73,9 +110,53 @@ int crypto_authenticate_and_decrypt (
 	unsigned char *buf_out,
 	ssize_t *buf_out_len)
 {
+	switch (knet_h->crypto_instance->model) {
+	CRYPTO_STATIC_CASES(decrypt, (knet_h, buf_in, buf_in_len, buf_out, buf_out_len))
+	default:
+		break;
+	}
 	return crypto_modules_cmds[knet_h->crypto_instance->model].ops->decrypt(knet_h, buf_in, buf_in_len, buf_out, buf_out_len);
 }
 
+/*
+ * hash only mode, data is hashed and verified in place
+ * (see crypto_model.h)
+ */
+
+int crypto_is_hash_only(
+	knet_handle_t knet_h)
+{
+	return knet_h->crypto_instance->hash_only;
+}
+
+int crypto_signv (
+	knet_handle_t knet_h,
+	const struct iovec *iov_in,
+	int iovcnt_in,
+	unsigned char *hash)
+{
+	switch (knet_h->crypto_instance->model) {
+	CRYPTO_STATIC_CASES(signv, (knet_h, iov_in, iovcnt_in, hash))
+	default:
+		break;
+	}
+	return crypto_modules_cmds[knet_h->crypto_instance->model].ops->signv(knet_h, iov_in, iovcnt_in, hash);
+}
+
+int crypto_authenticate (
+	knet_handle_t knet_h,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	ssize_t *buf_out_len)
+{
+	switch (knet_h->crypto_instance->model) {
+	CRYPTO_STATIC_CASES(authenticate, (knet_h, buf_in, buf_in_len, buf_out_len))
+	default:
+		break;
+	}
+	return crypto_modules_cmds[knet_h->crypto_instance->model].ops->authenticate(knet_h, buf_in, buf_in_len, buf_out_len);
+}
+
 int crypto_init(
 	knet_handle_t knet_h,
 	struct knet_handle_crypto_cfg *knet_handle_crypto_cfg)
@@ -140,11 +221,17 @@ int crypto_init(
 	 * crypto_modules_cmds.ops->fini is not invoked on error.
 	 */
 	knet_h->crypto_instance->model = model;
+	knet_h->crypto_instance->hash_only = 0;
 	if (crypto_modules_cmds[knet_h->crypto_instance->model].ops->init(knet_h, knet_handle_crypto_cfg)) {
 		savederrno = errno;
 		goto out_err;
 	}
 
+	if ((crypto_modules_cmds[model].ops->signv == NULL) ||
+	    (crypto_modules_cmds[model].ops->authenticate == NULL)) {
+		knet_h->crypto_instance->hash_only = 0;
+	}
+
 	log_debug(knet_h, KNET_SUB_CRYPTO, "security network overhead: %zu", knet_h->sec_header_size);
 	pthread_rwlock_unlock(&shlib_rwlock);
 	return 0;
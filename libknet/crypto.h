@@ -32,6 +32,21 @@ int crypto_encrypt_and_signv (
 	unsigned char *buf_out,
 	ssize_t *buf_out_len);
 
+int crypto_is_hash_only(
+	knet_handle_t knet_h);
+
+int crypto_signv (
+	knet_handle_t knet_h,
+	const struct iovec *iov_in,
+	int iovcnt_in,
+	unsigned char *hash);
+
+int crypto_authenticate (
+	knet_handle_t knet_h,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	ssize_t *buf_out_len);
+
 int crypto_init(
 	knet_handle_t knet_h,
 	struct knet_handle_crypto_cfg *knet_handle_crypto_cfg);
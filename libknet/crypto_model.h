@@ -9,14 +9,56 @@
 #ifndef __KNET_CRYPTO_MODEL_H__
 #define __KNET_CRYPTO_MODEL_H__
 
+#include <string.h>
+#include <arpa/inet.h>
+
 #include "internals.h"
 
 struct crypto_instance {
 	int	model;
 	void	*model_instance;
+	uint8_t	hash_only;	/* set by the module init when only a hash is configured */
 };
 
-#define KNET_CRYPTO_MODEL_ABI 1
+#define KNET_CRYPTO_MODEL_ABI 2
+
+/*
+ * AEAD ciphers (GCM, ChaCha20-Poly1305) encrypt and authenticate in
+ * one pass. onwire format is: nonce | ciphertext | tag
+ *
+ * a nonce must never be reused with the same key, and all nodes share
+ * the same key. Each thread builds nonces from a random 64 bit prefix
+ * and a 32 bit packet counter. The module has to regenerate the prefix
+ * (crypto_aead_nonce_needs_prefix) before first use and every time the
+ * counter wraps.
+ */
+#define KNET_AEAD_NONCE_SIZE 12
+#define KNET_AEAD_NONCE_PREFIX_SIZE 8
+#define KNET_AEAD_TAG_SIZE 16
+
+struct crypto_aead_nonce {
+	unsigned char prefix[KNET_AEAD_NONCE_PREFIX_SIZE];
+	uint32_t counter;
+	uint8_t prefix_valid;
+};
+
+static inline int crypto_aead_nonce_needs_prefix(struct crypto_aead_nonce *state)
+{
+	return !state->prefix_valid;
+}
+
+static inline void crypto_aead_nonce_next(struct crypto_aead_nonce *state, unsigned char *nonce)
+{
+	uint32_t counter = htonl(state->counter);
+
+	memmove(nonce, state->prefix, KNET_AEAD_NONCE_PREFIX_SIZE);
+	memmove(nonce + KNET_AEAD_NONCE_PREFIX_SIZE, &counter, sizeof(uint32_t));
+
+	state->counter++;
+	if (!state->counter) {
+		state->prefix_valid = 0;
+	}
+}
 
 /*
  * see compress_model.h for explanation of the various lib related functions
@@ -41,13 +83,41 @@ typedef struct {
 			 const ssize_t buf_in_len,
 			 unsigned char *buf_out,
 			 ssize_t *buf_out_len);
+
+	/*
+	 * hash only mode (crypto_instance->hash_only), optional.
+	 *
+	 * the onwire format is the same as crypt/decrypt: data | hash
+	 *
+	 * signv computes the hash of iov_in into hash (sec_hash_size bytes)
+	 * without copying the data, the caller sends the hash as the last iovec.
+	 * authenticate verifies the hash at the end of buf_in, in place,
+	 * and returns the length of the data in buf_out_len.
+	 */
+	int (*signv)	(knet_handle_t knet_h,
+			 const struct iovec *iov_in,
+			 int iovcnt_in,
+			 unsigned char *hash);
+	int (*authenticate) (knet_handle_t knet_h,
+			 const unsigned char *buf_in,
+			 const ssize_t buf_in_len,
+			 ssize_t *buf_out_len);
 } crypto_ops_t;
 
 typedef struct {
 	const char	*model_name;
 	uint8_t		built_in;
 	uint8_t		loaded;
-	crypto_ops_t	*ops;
+	const crypto_ops_t	*ops;
 } crypto_model_t;
 
+/*
+ * see KNET_COMPRESS_MODEL in compress_model.h
+ */
+#ifdef KNET_STATIC_MODULE
+#define KNET_CRYPTO_MODEL(name) crypto_##name##_model
+#else
+#define KNET_CRYPTO_MODEL(name) crypto_model
+#endif
+
 #endif
@@ -24,6 +24,7 @@
 
 #include "crypto_model.h"
 #include "logging.h"
+#include "threads_local.h"
 
 static int nss_db_is_init = 0;
 
@@ -60,12 +61,26 @@ static void nss_atexit_handler(void)
 #define AES_128_KEY_LENGTH 16
 #endif
 
+#ifndef CHACHA20_POLY1305_KEY_LENGTH
+#define CHACHA20_POLY1305_KEY_LENGTH 32
+#endif
+
+/*
+ * CK_GCM_PARAMS gained ulIvBits in NSS 3.52
+ */
+#if (NSS_VMAJOR > 3) || ((NSS_VMAJOR == 3) && (NSS_VMINOR >= 52))
+#define NSS_GCM_PARAMS_HAS_IVBITS
+#endif
+
 enum nsscrypto_crypt_t {
 	CRYPTO_CIPHER_TYPE_NONE = 0,
 	CRYPTO_CIPHER_TYPE_AES256 = 1,
 	CRYPTO_CIPHER_TYPE_AES192 = 2,
 	CRYPTO_CIPHER_TYPE_AES128 = 3,
-	CRYPTO_CIPHER_TYPE_3DES = 4
+	CRYPTO_CIPHER_TYPE_3DES = 4,
+	CRYPTO_CIPHER_TYPE_AES256_GCM = 5,
+	CRYPTO_CIPHER_TYPE_AES128_GCM = 6,
+	CRYPTO_CIPHER_TYPE_CHACHA20_POLY1305 = 7
 };
 
 CK_MECHANISM_TYPE cipher_to_nss[] = {
@@ -73,7 +88,14 @@ CK_MECHANISM_TYPE cipher_to_nss[] = {
 	CKM_AES_CBC_PAD,		/* CRYPTO_CIPHER_TYPE_AES256 */
 	CKM_AES_CBC_PAD,		/* CRYPTO_CIPHER_TYPE_AES192 */
 	CKM_AES_CBC_PAD,		/* CRYPTO_CIPHER_TYPE_AES128 */
-	CKM_DES3_CBC_PAD 		/* CRYPTO_CIPHER_TYPE_3DES */
+	CKM_DES3_CBC_PAD, 		/* CRYPTO_CIPHER_TYPE_3DES */
+	CKM_AES_GCM,			/* CRYPTO_CIPHER_TYPE_AES256_GCM */
+	CKM_AES_GCM,			/* CRYPTO_CIPHER_TYPE_AES128_GCM */
+#ifdef CKM_NSS_CHACHA20_POLY1305
+	CKM_NSS_CHACHA20_POLY1305	/* CRYPTO_CIPHER_TYPE_CHACHA20_POLY1305 */
+#else
+	CKM_INVALID_MECHANISM		/* CRYPTO_CIPHER_TYPE_CHACHA20_POLY1305 */
+#endif
 };
 
 size_t nsscipher_key_len[] = {
@@ -81,7 +103,10 @@ size_t nsscipher_key_len[] = {
 	AES_256_KEY_LENGTH,		/* CRYPTO_CIPHER_TYPE_AES256 */
 	AES_192_KEY_LENGTH,		/* CRYPTO_CIPHER_TYPE_AES192 */
 	AES_128_KEY_LENGTH,		/* CRYPTO_CIPHER_TYPE_AES128 */
-	24				/* CRYPTO_CIPHER_TYPE_3DES */
+	24,				/* CRYPTO_CIPHER_TYPE_3DES */
+	AES_256_KEY_LENGTH,		/* CRYPTO_CIPHER_TYPE_AES256_GCM */
+	AES_128_KEY_LENGTH,		/* CRYPTO_CIPHER_TYPE_AES128_GCM */
+	CHACHA20_POLY1305_KEY_LENGTH	/* CRYPTO_CIPHER_TYPE_CHACHA20_POLY1305 */
 };
 
 size_t nsscypher_block_len[] = {
@@ -89,7 +114,21 @@ size_t nsscypher_block_len[] = {
 	AES_BLOCK_SIZE,			/* CRYPTO_CIPHER_TYPE_AES256 */
 	AES_BLOCK_SIZE,			/* CRYPTO_CIPHER_TYPE_AES192 */
 	AES_BLOCK_SIZE,			/* CRYPTO_CIPHER_TYPE_AES128 */
-	0				/* CRYPTO_CIPHER_TYPE_3DES */
+	0,				/* CRYPTO_CIPHER_TYPE_3DES */
+	0,				/* CRYPTO_CIPHER_TYPE_AES256_GCM */
+	0,				/* CRYPTO_CIPHER_TYPE_AES128_GCM */
+	0				/* CRYPTO_CIPHER_TYPE_CHACHA20_POLY1305 */
+};
+
+uint8_t nsscipher_is_aead[] = {
+	0,				/* CRYPTO_CIPHER_TYPE_NONE */
+	0,				/* CRYPTO_CIPHER_TYPE_AES256 */
+	0,				/* CRYPTO_CIPHER_TYPE_AES192 */
+	0,				/* CRYPTO_CIPHER_TYPE_AES128 */
+	0,				/* CRYPTO_CIPHER_TYPE_3DES */
+	1,				/* CRYPTO_CIPHER_TYPE_AES256_GCM */
+	1,				/* CRYPTO_CIPHER_TYPE_AES128_GCM */
+	1				/* CRYPTO_CIPHER_TYPE_CHACHA20_POLY1305 */
 };
 
 /*
@@ -139,8 +178,119 @@ struct nsscrypto_instance {
 	int crypto_cipher_type;
 
 	int crypto_hash_type;
+
+	int crypto_cipher_reuse;	/* IV == SALT_SIZE, contexts can be cached */
+
+	struct threads_local thread_data;
+
+	int thread_data_init;
+};
+
+/*
+ * per thread data
+ */
+
+struct nsscrypto_thread {
+	struct crypto_aead_nonce nonce;
+	unsigned char *aead_buf;	/* PK11_Encrypt needs linear input */
+	PK11Context *encrypt_ctx;
+	PK11Context *decrypt_ctx;
+	PK11Context *hash_ctx;
 };
 
+static void nsscrypto_thread_free(void *data)
+{
+	struct nsscrypto_thread *thread = data;
+
+	if (thread->encrypt_ctx) {
+		PK11_DestroyContext(thread->encrypt_ctx, PR_TRUE);
+	}
+	if (thread->decrypt_ctx) {
+		PK11_DestroyContext(thread->decrypt_ctx, PR_TRUE);
+	}
+	if (thread->hash_ctx) {
+		PK11_DestroyContext(thread->hash_ctx, PR_TRUE);
+	}
+	free(thread->aead_buf);
+	free(thread);
+}
+
+static void *nsscrypto_thread_alloc(void *private_data)
+{
+	struct nsscrypto_thread *thread;
+
+	thread = malloc(sizeof(struct nsscrypto_thread));
+	if (!thread) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(thread, 0, sizeof(struct nsscrypto_thread));
+
+	thread->aead_buf = malloc(KNET_DATABUFSIZE);
+	if (!thread->aead_buf) {
+		free(thread);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return thread;
+}
+
+static struct nsscrypto_thread *nsscrypto_get_thread(knet_handle_t knet_h)
+{
+	struct nsscrypto_instance *instance = knet_h->crypto_instance->model_instance;
+	struct nsscrypto_thread *thread;
+
+	thread = threads_local_get(&instance->thread_data);
+	if (!thread) {
+		log_err(knet_h, KNET_SUB_NSSCRYPTO, "Unable to setup per thread crypto data: %s", strerror(errno));
+	}
+
+	return thread;
+}
+
+/*
+ * contexts are created on first use by each thread and reset with
+ * PK11_DigestBegin for every packet. A context that failed an operation
+ * is in an unknown state and it is dropped, to be recreated by the
+ * next packet.
+ */
+
+static PK11Context *nsscrypto_thread_ctx(
+	knet_handle_t knet_h,
+	PK11Context **ctx,
+	CK_MECHANISM_TYPE type,
+	CK_ATTRIBUTE_TYPE operation,
+	PK11SymKey *key,
+	SECItem *param)
+{
+	if (!*ctx) {
+		*ctx = PK11_CreateContextBySymKey(type, operation, key, param);
+		if (!*ctx) {
+			log_err(knet_h, KNET_SUB_NSSCRYPTO, "PK11_CreateContext failed type=%d (err %d): %s",
+				(int)type, PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
+			return NULL;
+		}
+	}
+
+	if (PK11_DigestBegin(*ctx) != SECSuccess) {
+		log_err(knet_h, KNET_SUB_NSSCRYPTO, "PK11_DigestBegin failed type=%d (err %d): %s",
+			(int)type, PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
+		PK11_DestroyContext(*ctx, PR_TRUE);
+		*ctx = NULL;
+	}
+
+	return *ctx;
+}
+
+static void nsscrypto_thread_ctx_drop(PK11Context **ctx)
+{
+	if (*ctx) {
+		PK11_DestroyContext(*ctx, PR_TRUE);
+		*ctx = NULL;
+	}
+}
+
 /*
  * crypt/decrypt functions
  */
@@ -157,6 +307,14 @@ static int nssstring_to_crypto_cipher_type(const char* crypto_cipher_type)
 		return CRYPTO_CIPHER_TYPE_AES128;
 	} else if (strcmp(crypto_cipher_type, "3des") == 0) {
 		return CRYPTO_CIPHER_TYPE_3DES;
+	} else if (strcmp(crypto_cipher_type, "aes256-gcm") == 0) {
+		return CRYPTO_CIPHER_TYPE_AES256_GCM;
+	} else if (strcmp(crypto_cipher_type, "aes128-gcm") == 0) {
+		return CRYPTO_CIPHER_TYPE_AES128_GCM;
+#ifdef CKM_NSS_CHACHA20_POLY1305
+	} else if (strcmp(crypto_cipher_type, "chacha20-p1305") == 0) {
+		return CRYPTO_CIPHER_TYPE_CHACHA20_POLY1305;
+#endif
 	}
 	return -1;
 }
@@ -495,6 +653,282 @@ out:
 	return err;
 }
 
+/*
+ * CBC contexts cannot be re-IV'd via the public NSS API, so cached
+ * contexts are created with an all zero IV and the per packet IV
+ * is chained in by the cipher itself:
+ *
+ * encrypt: CBC(0, R | data) = E(R) | CBC(E(R), data)
+ *          E(R) is used as salt/IV, R being random
+ * decrypt: CBC^-1(0, salt | data) = junk | data
+ *
+ * The result on the wire is identical to a context created with
+ * IV = salt, hence interoperable with encrypt_nss/decrypt_nss.
+ */
+
+static unsigned char nss_zero_iv[SALT_SIZE];
+
+static int encrypt_nss_cached(
+	knet_handle_t knet_h,
+	struct nsscrypto_thread *thread,
+	const struct iovec *iov,
+	int iovcnt,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len)
+{
+	struct nsscrypto_instance *instance = knet_h->crypto_instance->model_instance;
+	PK11Context	*crypt_context;
+	SECItem		crypt_param;
+	unsigned char	rand_block[SALT_SIZE];
+	int		tmp_outlen = 0, tmp1_outlen = 0;
+	unsigned int	tmp2_outlen = 0;
+	int		i;
+
+	if (PK11_GenerateRandom(rand_block, SALT_SIZE) != SECSuccess) {
+		log_err(knet_h, KNET_SUB_NSSCRYPTO, "Failure to generate a random number (err %d): %s",
+			PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
+		return -1;
+	}
+
+	crypt_param.type = siBuffer;
+	crypt_param.data = nss_zero_iv;
+	crypt_param.len = SALT_SIZE;
+
+	crypt_context = nsscrypto_thread_ctx(knet_h, &thread->encrypt_ctx,
+					     cipher_to_nss[instance->crypto_cipher_type],
+					     CKA_ENCRYPT, instance->nss_sym_key, &crypt_param);
+	if (!crypt_context) {
+		return -1;
+	}
+
+	if (PK11_CipherOp(crypt_context, buf_out, &tmp_outlen, KNET_DATABUFSIZE_CRYPT,
+			  rand_block, SALT_SIZE) != SECSuccess) {
+		goto out_fail;
+	}
+	tmp1_outlen = tmp_outlen;
+
+	for (i=0; i<iovcnt; i++) {
+		if (PK11_CipherOp(crypt_context, buf_out + tmp1_outlen,
+				  &tmp_outlen,
+				  KNET_DATABUFSIZE_CRYPT - tmp1_outlen,
+				  (unsigned char *)iov[i].iov_base,
+				  iov[i].iov_len) != SECSuccess) {
+			goto out_fail;
+		}
+		tmp1_outlen = tmp1_outlen + tmp_outlen;
+	}
+
+	if (PK11_DigestFinal(crypt_context, buf_out + tmp1_outlen,
+			     &tmp2_outlen, KNET_DATABUFSIZE_CRYPT - tmp1_outlen) != SECSuccess) {
+		goto out_fail;
+	}
+
+	*buf_out_len = tmp1_outlen + tmp2_outlen;
+
+	return 0;
+
+out_fail:
+	log_err(knet_h, KNET_SUB_NSSCRYPTO, "Encryption failed crypt_type=%d (err %d): %s",
+		(int)cipher_to_nss[instance->crypto_cipher_type],
+		PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
+	nsscrypto_thread_ctx_drop(&thread->encrypt_ctx);
+	return -1;
+}
+
+static int decrypt_nss_cached(
+	knet_handle_t knet_h,
+	struct nsscrypto_thread *thread,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len)
+{
+	struct nsscrypto_instance *instance = knet_h->crypto_instance->model_instance;
+	PK11Context	*decrypt_context;
+	SECItem		decrypt_param;
+	int		tmp1_outlen = 0;
+	unsigned int	tmp2_outlen = 0;
+
+	if (buf_in_len <= SALT_SIZE) {
+		log_err(knet_h, KNET_SUB_NSSCRYPTO, "Packet is too short");
+		return -1;
+	}
+
+	decrypt_param.type = siBuffer;
+	decrypt_param.data = nss_zero_iv;
+	decrypt_param.len = SALT_SIZE;
+
+	decrypt_context = nsscrypto_thread_ctx(knet_h, &thread->decrypt_ctx,
+					       cipher_to_nss[instance->crypto_cipher_type],
+					       CKA_DECRYPT, instance->nss_sym_key, &decrypt_param);
+	if (!decrypt_context) {
+		return -1;
+	}
+
+	if (PK11_CipherOp(decrypt_context, buf_out, &tmp1_outlen,
+			  KNET_DATABUFSIZE_CRYPT, buf_in, buf_in_len) != SECSuccess) {
+		goto out_fail;
+	}
+
+	if (PK11_DigestFinal(decrypt_context, buf_out + tmp1_outlen, &tmp2_outlen,
+			     KNET_DATABUFSIZE_CRYPT - tmp1_outlen) != SECSuccess) {
+		goto out_fail;
+	}
+
+	if (tmp1_outlen + tmp2_outlen < SALT_SIZE) {
+		log_err(knet_h, KNET_SUB_NSSCRYPTO, "Packet is too short");
+		return -1;
+	}
+
+	/*
+	 * drop the first (junk) block
+	 */
+	*buf_out_len = tmp1_outlen + tmp2_outlen - SALT_SIZE;
+	memmove(buf_out, buf_out + SALT_SIZE, *buf_out_len);
+
+	return 0;
+
+out_fail:
+	log_err(knet_h, KNET_SUB_NSSCRYPTO, "Decryption failed (err %d): %s",
+		PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
+	nsscrypto_thread_ctx_drop(&thread->decrypt_ctx);
+	return -1;
+}
+
+/*
+ * AEAD crypt/decrypt functions
+ */
+
+union nss_aead_params {
+	CK_GCM_PARAMS gcm;
+#ifdef CKM_NSS_CHACHA20_POLY1305
+	CK_NSS_AEAD_PARAMS chacha;
+#endif
+};
+
+static void nss_aead_param(
+	struct nsscrypto_instance *instance,
+	unsigned char *nonce,
+	SECItem *param,
+	union nss_aead_params *params)
+{
+	memset(params, 0, sizeof(union nss_aead_params));
+	param->type = siBuffer;
+
+	if (cipher_to_nss[instance->crypto_cipher_type] == CKM_AES_GCM) {
+		params->gcm.pIv = nonce;
+		params->gcm.ulIvLen = KNET_AEAD_NONCE_SIZE;
+#ifdef NSS_GCM_PARAMS_HAS_IVBITS
+		params->gcm.ulIvBits = KNET_AEAD_NONCE_SIZE * 8;
+#endif
+		params->gcm.ulTagBits = KNET_AEAD_TAG_SIZE * 8;
+		param->data = (unsigned char *)&params->gcm;
+		param->len = sizeof(CK_GCM_PARAMS);
+		return;
+	}
+
+#ifdef CKM_NSS_CHACHA20_POLY1305
+	params->chacha.pNonce = nonce;
+	params->chacha.ulNonceLen = KNET_AEAD_NONCE_SIZE;
+	params->chacha.ulTagLen = KNET_AEAD_TAG_SIZE;
+	param->data = (unsigned char *)&params->chacha;
+	param->len = sizeof(CK_NSS_AEAD_PARAMS);
+#endif
+}
+
+static int encrypt_nss_aead(
+	knet_handle_t knet_h,
+	struct nsscrypto_thread *thread,
+	const struct iovec *iov,
+	int iovcnt,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len)
+{
+	struct nsscrypto_instance *instance = knet_h->crypto_instance->model_instance;
+	SECItem		param;
+	union nss_aead_params params;
+	unsigned char	*nonce = buf_out;
+	const unsigned char *data_in;
+	size_t		data_len = 0;
+	unsigned int	outlen = 0;
+	int		i;
+
+	if (crypto_aead_nonce_needs_prefix(&thread->nonce)) {
+		if (PK11_GenerateRandom(thread->nonce.prefix, KNET_AEAD_NONCE_PREFIX_SIZE) != SECSuccess) {
+			log_err(knet_h, KNET_SUB_NSSCRYPTO, "Failure to generate a random number (err %d): %s",
+				PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
+			return -1;
+		}
+		thread->nonce.prefix_valid = 1;
+	}
+
+	crypto_aead_nonce_next(&thread->nonce, nonce);
+
+	if (iovcnt == 1) {
+		data_in = iov[0].iov_base;
+		data_len = iov[0].iov_len;
+	} else {
+		for (i=0; i<iovcnt; i++) {
+			if (data_len + iov[i].iov_len > KNET_DATABUFSIZE) {
+				log_err(knet_h, KNET_SUB_NSSCRYPTO, "Packet is too long");
+				return -1;
+			}
+			memmove(thread->aead_buf + data_len, iov[i].iov_base, iov[i].iov_len);
+			data_len = data_len + iov[i].iov_len;
+		}
+		data_in = thread->aead_buf;
+	}
+
+	nss_aead_param(instance, nonce, &param, &params);
+
+	if (PK11_Encrypt(instance->nss_sym_key, cipher_to_nss[instance->crypto_cipher_type], &param,
+			 buf_out + KNET_AEAD_NONCE_SIZE, &outlen, KNET_DATABUFSIZE_CRYPT - KNET_AEAD_NONCE_SIZE,
+			 data_in, data_len) != SECSuccess) {
+		log_err(knet_h, KNET_SUB_NSSCRYPTO, "PK11_Encrypt failed crypt_type=%d (err %d): %s",
+			(int)cipher_to_nss[instance->crypto_cipher_type],
+			PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
+		return -1;
+	}
+
+	*buf_out_len = KNET_AEAD_NONCE_SIZE + outlen;
+
+	return 0;
+}
+
+static int decrypt_nss_aead(
+	knet_handle_t knet_h,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	unsigned char *buf_out,
+	ssize_t *buf_out_len)
+{
+	struct nsscrypto_instance *instance = knet_h->crypto_instance->model_instance;
+	SECItem		param;
+	union nss_aead_params params;
+	unsigned char	*nonce = (unsigned char *)buf_in;
+	ssize_t		datalen = buf_in_len - KNET_AEAD_NONCE_SIZE;
+	unsigned int	outlen = 0;
+
+	if ((datalen <= KNET_AEAD_TAG_SIZE) || (datalen > (ssize_t)(KNET_DATABUFSIZE_CRYPT))) {
+		log_err(knet_h, KNET_SUB_NSSCRYPTO, "Incorrect packet size.");
+		return -1;
+	}
+
+	nss_aead_param(instance, nonce, &param, &params);
+
+	if (PK11_Decrypt(instance->nss_sym_key, cipher_to_nss[instance->crypto_cipher_type], &param,
+			 buf_out, &outlen, KNET_DATABUFSIZE_CRYPT,
+			 buf_in + KNET_AEAD_NONCE_SIZE, datalen) != SECSuccess) {
+		log_err(knet_h, KNET_SUB_NSSCRYPTO, "PK11_Decrypt failed, authentication tag does not match (err %d): %s",
+			PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
+		return -1;
+	}
+
+	*buf_out_len = outlen;
+
+	return 0;
+}
+
 /*
  * hash/hmac/digest functions
  */
@@ -535,47 +969,43 @@ static int init_nss_hash(knet_handle_t knet_h)
 	return 0;
 }
 
-static int calculate_nss_hash(
+static int calculate_nss_hashv(
 	knet_handle_t knet_h,
-	const unsigned char *buf,
-	const size_t buf_len,
+	const struct iovec *iov,
+	int iovcnt,
 	unsigned char *hash)
 {
 	struct nsscrypto_instance *instance = knet_h->crypto_instance->model_instance;
+	struct nsscrypto_thread *thread;
 	PK11Context*	hash_context = NULL;
 	SECItem		hash_param;
 	unsigned int	hash_tmp_outlen = 0;
-	int		err = -1;
+	int		i;
+
+	thread = nsscrypto_get_thread(knet_h);
+	if (!thread) {
+		return -1;
+	}
 
 	/* Now do the digest */
 	hash_param.type = siBuffer;
 	hash_param.data = 0;
 	hash_param.len = 0;
 
-	hash_context = PK11_CreateContextBySymKey(hash_to_nss[instance->crypto_hash_type],
-						  CKA_SIGN,
-						  instance->nss_sym_key_sign,
-						  &hash_param);
-
+	hash_context = nsscrypto_thread_ctx(knet_h, &thread->hash_ctx,
+					    hash_to_nss[instance->crypto_hash_type],
+					    CKA_SIGN, instance->nss_sym_key_sign, &hash_param);
 	if (!hash_context) {
-		log_err(knet_h, KNET_SUB_NSSCRYPTO, "PK11_CreateContext failed (hash) hash_type=%d (err %d): %s",
-			(int)hash_to_nss[instance->crypto_hash_type],
-			PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
-		goto out;
-	}
-
-	if (PK11_DigestBegin(hash_context) != SECSuccess) {
-		log_err(knet_h, KNET_SUB_NSSCRYPTO, "PK11_DigestBegin failed (hash) hash_type=%d (err %d): %s",
-			(int)hash_to_nss[instance->crypto_hash_type],
-			PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
-		goto out;
+		return -1;
 	}
 
-	if (PK11_DigestOp(hash_context, buf, buf_len) != SECSuccess) {
-		log_err(knet_h, KNET_SUB_NSSCRYPTO, "PK11_DigestOp failed (hash) hash_type=%d (err %d): %s",
-			(int)hash_to_nss[instance->crypto_hash_type],
-			PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
-		goto out;
+	for (i = 0; i < iovcnt; i++) {
+		if (PK11_DigestOp(hash_context, iov[i].iov_base, iov[i].iov_len) != SECSuccess) {
+			log_err(knet_h, KNET_SUB_NSSCRYPTO, "PK11_DigestOp failed (hash) hash_type=%d (err %d): %s",
+				(int)hash_to_nss[instance->crypto_hash_type],
+				PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
+			goto out_fail;
+		}
 	}
 
 	if (PK11_DigestFinal(hash_context, hash,
@@ -583,17 +1013,28 @@ static int calculate_nss_hash(
 		log_err(knet_h, KNET_SUB_NSSCRYPTO, "PK11_DigestFinale failed (hash) hash_type=%d (err %d): %s",
 			(int)hash_to_nss[instance->crypto_hash_type],
 			PR_GetError(), PR_ErrorToString(PR_GetError(), PR_LANGUAGE_I_DEFAULT));
-		goto out;
+		goto out_fail;
 	}
 
-	err = 0;
+	return 0;
 
-out:
-	if (hash_context) {
-		PK11_DestroyContext(hash_context, PR_TRUE);
-	}
+out_fail:
+	nsscrypto_thread_ctx_drop(&thread->hash_ctx);
+	return -1;
+}
 
-	return err;
+static int calculate_nss_hash(
+	knet_handle_t knet_h,
+	const unsigned char *buf,
+	const size_t buf_len,
+	unsigned char *hash)
+{
+	struct iovec iov;
+
+	iov.iov_base = (unsigned char *)buf;
+	iov.iov_len = buf_len;
+
+	return calculate_nss_hashv(knet_h, &iov, 1, hash);
 }
 
 /*
@@ -646,9 +1087,26 @@ static int nsscrypto_encrypt_and_signv (
 	ssize_t *buf_out_len)
 {
 	struct nsscrypto_instance *instance = knet_h->crypto_instance->model_instance;
+	struct nsscrypto_thread *thread;
 	int i;
 
-	if (cipher_to_nss[instance->crypto_cipher_type]) {
+	if (nsscipher_is_aead[instance->crypto_cipher_type]) {
+		thread = nsscrypto_get_thread(knet_h);
+		if (!thread) {
+			return -1;
+		}
+		return encrypt_nss_aead(knet_h, thread, iov_in, iovcnt_in, buf_out, buf_out_len);
+	}
+
+	if (instance->crypto_cipher_reuse) {
+		thread = nsscrypto_get_thread(knet_h);
+		if (!thread) {
+			return -1;
+		}
+		if (encrypt_nss_cached(knet_h, thread, iov_in, iovcnt_in, buf_out, buf_out_len) < 0) {
+			return -1;
+		}
+	} else if (cipher_to_nss[instance->crypto_cipher_type]) {
 		if (encrypt_nss(knet_h, iov_in, iovcnt_in, buf_out, buf_out_len) < 0) {
 			return -1;
 		}
@@ -686,6 +1144,44 @@ static int nsscrypto_encrypt_and_sign (
 	return nsscrypto_encrypt_and_signv(knet_h, &iov_in, 1, buf_out, buf_out_len);
 }
 
+static int nsscrypto_signv (
+	knet_handle_t knet_h,
+	const struct iovec *iov_in,
+	int iovcnt_in,
+	unsigned char *hash)
+{
+	return calculate_nss_hashv(knet_h, iov_in, iovcnt_in, hash);
+}
+
+static int nsscrypto_authenticate (
+	knet_handle_t knet_h,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	ssize_t *buf_out_len)
+{
+	struct nsscrypto_instance *instance = knet_h->crypto_instance->model_instance;
+	unsigned char tmp_hash[nsshash_len[instance->crypto_hash_type]];
+	ssize_t temp_buf_len = buf_in_len - nsshash_len[instance->crypto_hash_type];
+
+	if ((temp_buf_len <= 0) || (temp_buf_len > (ssize_t)(KNET_DATABUFSIZE_CRYPT))) {
+		log_err(knet_h, KNET_SUB_NSSCRYPTO, "Incorrect packet size.");
+		return -1;
+	}
+
+	if (calculate_nss_hash(knet_h, buf_in, temp_buf_len, tmp_hash) < 0) {
+		return -1;
+	}
+
+	if (memcmp(tmp_hash, buf_in + temp_buf_len, nsshash_len[instance->crypto_hash_type]) != 0) {
+		log_err(knet_h, KNET_SUB_NSSCRYPTO, "Digest does not match");
+		return -1;
+	}
+
+	*buf_out_len = temp_buf_len;
+
+	return 0;
+}
+
 static int nsscrypto_authenticate_and_decrypt (
 	knet_handle_t knet_h,
 	const unsigned char *buf_in,
@@ -694,31 +1190,29 @@ static int nsscrypto_authenticate_and_decrypt (
 	ssize_t *buf_out_len)
 {
 	struct nsscrypto_instance *instance = knet_h->crypto_instance->model_instance;
+	struct nsscrypto_thread *thread;
 	ssize_t temp_len = buf_in_len;
 
-	if (hash_to_nss[instance->crypto_hash_type]) {
-		unsigned char tmp_hash[nsshash_len[instance->crypto_hash_type]];
-		ssize_t temp_buf_len = buf_in_len - nsshash_len[instance->crypto_hash_type];
+	if (nsscipher_is_aead[instance->crypto_cipher_type]) {
+		return decrypt_nss_aead(knet_h, buf_in, buf_in_len, buf_out, buf_out_len);
+	}
 
-		if ((temp_buf_len <= 0) || (temp_buf_len > KNET_MAX_PACKET_SIZE)) {
-			log_err(knet_h, KNET_SUB_NSSCRYPTO, "Incorrect packet size.");
+	if (hash_to_nss[instance->crypto_hash_type]) {
+		if (nsscrypto_authenticate(knet_h, buf_in, buf_in_len, &temp_len) < 0) {
 			return -1;
 		}
+		*buf_out_len = temp_len;
+	}
 
-		if (calculate_nss_hash(knet_h, buf_in, temp_buf_len, tmp_hash) < 0) {
+	if (instance->crypto_cipher_reuse) {
+		thread = nsscrypto_get_thread(knet_h);
+		if (!thread) {
 			return -1;
 		}
-
-		if (memcmp(tmp_hash, buf_in + temp_buf_len, nsshash_len[instance->crypto_hash_type]) != 0) {
-			log_err(knet_h, KNET_SUB_NSSCRYPTO, "Digest does not match");
+		if (decrypt_nss_cached(knet_h, thread, buf_in, temp_len, buf_out, buf_out_len) < 0) {
 			return -1;
 		}
-
-		temp_len = temp_len - nsshash_len[instance->crypto_hash_type];
-		*buf_out_len = temp_len;
-	}
-
-	if (cipher_to_nss[instance->crypto_cipher_type]) {
+	} else if (cipher_to_nss[instance->crypto_cipher_type]) {
 		if (decrypt_nss(knet_h, buf_in, temp_len, buf_out, buf_out_len) < 0) {
 			return -1;
 		}
@@ -736,6 +1230,9 @@ static void nsscrypto_fini(
 	struct nsscrypto_instance *nsscrypto_instance = knet_h->crypto_instance->model_instance;
 
 	if (nsscrypto_instance) {
+		if (nsscrypto_instance->thread_data_init) {
+			threads_local_fini(&nsscrypto_instance->thread_data);
+		}
 		if (nsscrypto_instance->nss_sym_key) {
 			PK11_FreeSymKey(nsscrypto_instance->nss_sym_key);
 			nsscrypto_instance->nss_sym_key = NULL;
@@ -790,12 +1287,30 @@ static int nsscrypto_init(
 	}
 
 	if ((nsscrypto_instance->crypto_cipher_type > 0) &&
+	    (!nsscipher_is_aead[nsscrypto_instance->crypto_cipher_type]) &&
 	    (nsscrypto_instance->crypto_hash_type == 0)) {
 		log_err(knet_h, KNET_SUB_NSSCRYPTO, "crypto communication requires hash specified");
 		savederrno = EINVAL;
 		goto out_err;
 	}
 
+	if ((nsscipher_is_aead[nsscrypto_instance->crypto_cipher_type]) &&
+	    (nsscrypto_instance->crypto_hash_type > 0)) {
+		log_err(knet_h, KNET_SUB_NSSCRYPTO, "AEAD ciphers provide authentication, hash must be none");
+		savederrno = EINVAL;
+		goto out_err;
+	}
+
+	if (threads_local_init(&nsscrypto_instance->thread_data,
+			       nsscrypto_thread_alloc, nsscrypto_thread_free,
+			       nsscrypto_instance) < 0) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_NSSCRYPTO, "Unable to init per thread crypto data: %s",
+			strerror(savederrno));
+		goto out_err;
+	}
+	nsscrypto_instance->thread_data_init = 1;
+
 	nsscrypto_instance->private_key = knet_handle_crypto_cfg->private_key;
 	nsscrypto_instance->private_key_len = knet_handle_crypto_cfg->private_key_len;
 
@@ -805,10 +1320,28 @@ static int nsscrypto_init(
 	}
 
 	knet_h->sec_header_size = 0;
+	knet_h->sec_block_size = 0;
+	knet_h->sec_hash_size = 0;
+	knet_h->sec_salt_size = 0;
+
+	if (nsscipher_is_aead[nsscrypto_instance->crypto_cipher_type]) {
+		/*
+		 * no padding, the tag plays the role of the hash
+		 * and the nonce the role of the salt
+		 */
+		knet_h->sec_hash_size = KNET_AEAD_TAG_SIZE;
+		knet_h->sec_salt_size = KNET_AEAD_NONCE_SIZE;
+		knet_h->sec_header_size = KNET_AEAD_NONCE_SIZE + KNET_AEAD_TAG_SIZE;
+
+		return 0;
+	}
 
 	if (nsscrypto_instance->crypto_hash_type > 0) {
 		knet_h->sec_header_size += nsshash_len[nsscrypto_instance->crypto_hash_type];
 		knet_h->sec_hash_size = nsshash_len[nsscrypto_instance->crypto_hash_type];
+		if (nsscrypto_instance->crypto_cipher_type == 0) {
+			knet_h->crypto_instance->hash_only = 1;
+		}
 	}
 
 	if (nsscrypto_instance->crypto_cipher_type > 0) {
@@ -828,6 +1361,13 @@ static int nsscrypto_init(
 		knet_h->sec_header_size += SALT_SIZE;
 		knet_h->sec_salt_size = SALT_SIZE;
 		knet_h->sec_block_size = block_size;
+
+		/*
+		 * see encrypt_nss_cached, the salt must be exactly one IV
+		 */
+		if (PK11_GetIVLength(cipher_to_nss[nsscrypto_instance->crypto_cipher_type]) == SALT_SIZE) {
+			nsscrypto_instance->crypto_cipher_reuse = 1;
+		}
 	}
 
 	return 0;
@@ -838,11 +1378,13 @@ out_err:
 	return -1;
 }
 
-crypto_ops_t crypto_model = {
+const crypto_ops_t KNET_CRYPTO_MODEL(nss) = {
 	KNET_CRYPTO_MODEL_ABI,
 	nsscrypto_init,
 	nsscrypto_fini,
 	nsscrypto_encrypt_and_sign,
 	nsscrypto_encrypt_and_signv,
-	nsscrypto_authenticate_and_decrypt
+	nsscrypto_authenticate_and_decrypt,
+	nsscrypto_signv,
+	nsscrypto_authenticate
 };
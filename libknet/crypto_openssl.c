@@ -14,12 +14,12 @@
 #include <dlfcn.h>
 #include <openssl/conf.h>
 #include <openssl/evp.h>
-#include <openssl/hmac.h>
 #include <openssl/rand.h>
 #include <openssl/err.h>
 
 #include "logging.h"
 #include "crypto_model.h"
+#include "threads_local.h"
 
 /*
  * 1.0.2 requires at least 120 bytes
@@ -41,168 +41,272 @@ struct opensslcrypto_instance {
 	const EVP_CIPHER *crypto_cipher_type;
 
 	const EVP_MD *crypto_hash_type;
+
+	int crypto_cipher_is_aead;
+
+	EVP_PKEY *hmac_key;
+
+	struct threads_local thread_data;
+
+	int thread_data_init;
 };
 
+#ifdef BUILDCRYPTOOPENSSL10
+#define EVP_MD_CTX_new EVP_MD_CTX_create
+#define EVP_MD_CTX_free EVP_MD_CTX_destroy
+#endif
+
+#ifndef EVP_CTRL_AEAD_GET_TAG
+#define EVP_CTRL_AEAD_GET_TAG EVP_CTRL_GCM_GET_TAG
+#define EVP_CTRL_AEAD_SET_TAG EVP_CTRL_GCM_SET_TAG
+#endif
+
 /*
- * crypt/decrypt functions openssl1.0
+ * names shared with the nss model, anything else
+ * is passed to EVP_get_cipherbyname as-is
+ */
+static const struct {
+	const char *knet_name;
+	const char *openssl_name;
+} openssl_cipher_aliases[] = {
+	{ "aes128-gcm", "aes-128-gcm" },
+	{ "aes192-gcm", "aes-192-gcm" },
+	{ "aes256-gcm", "aes-256-gcm" },
+	{ "chacha20-p1305", "chacha20-poly1305" },
+	{ NULL, NULL }
+};
+
+/*
+ * cipher and HMAC contexts are keyed once per thread and
+ * only re-IV'd (cipher) or copied from the keyed template (HMAC)
+ * for each packet.
+ */
+
+struct opensslcrypto_thread {
+	EVP_CIPHER_CTX *encrypt_ctx;
+	EVP_CIPHER_CTX *decrypt_ctx;
+	EVP_MD_CTX *hmac_template;
+	EVP_MD_CTX *hmac_ctx;
+	struct crypto_aead_nonce nonce;
+};
+
+static void opensslcrypto_thread_free(void *data)
+{
+	struct opensslcrypto_thread *thread = data;
+
+	if (thread->encrypt_ctx) {
+		EVP_CIPHER_CTX_free(thread->encrypt_ctx);
+	}
+	if (thread->decrypt_ctx) {
+		EVP_CIPHER_CTX_free(thread->decrypt_ctx);
+	}
+	if (thread->hmac_template) {
+		EVP_MD_CTX_free(thread->hmac_template);
+	}
+	if (thread->hmac_ctx) {
+		EVP_MD_CTX_free(thread->hmac_ctx);
+	}
+	free(thread);
+}
+
+static void *opensslcrypto_thread_alloc(void *private_data)
+{
+	struct opensslcrypto_instance *instance = private_data;
+	struct opensslcrypto_thread *thread;
+
+	thread = malloc(sizeof(struct opensslcrypto_thread));
+	if (!thread) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(thread, 0, sizeof(struct opensslcrypto_thread));
+
+	if (instance->crypto_cipher_type) {
+		thread->encrypt_ctx = EVP_CIPHER_CTX_new();
+		thread->decrypt_ctx = EVP_CIPHER_CTX_new();
+		if ((!thread->encrypt_ctx) || (!thread->decrypt_ctx)) {
+			goto out_err;
+		}
+		/*
+		 * add warning re keylength
+		 */
+		if ((!EVP_EncryptInit_ex(thread->encrypt_ctx, instance->crypto_cipher_type, NULL, instance->private_key, NULL)) ||
+		    (!EVP_DecryptInit_ex(thread->decrypt_ctx, instance->crypto_cipher_type, NULL, instance->private_key, NULL))) {
+			goto out_err;
+		}
+	}
+
+	if (instance->crypto_hash_type) {
+		thread->hmac_template = EVP_MD_CTX_new();
+		thread->hmac_ctx = EVP_MD_CTX_new();
+		if ((!thread->hmac_template) || (!thread->hmac_ctx)) {
+			goto out_err;
+		}
+		if (!EVP_DigestSignInit(thread->hmac_template, NULL, instance->crypto_hash_type, NULL, instance->hmac_key)) {
+			goto out_err;
+		}
+	}
+
+	return thread;
+
+out_err:
+	opensslcrypto_thread_free(thread);
+	errno = ENOMEM;
+	return NULL;
+}
+
+static struct opensslcrypto_thread *opensslcrypto_get_thread(knet_handle_t knet_h)
+{
+	struct opensslcrypto_instance *instance = knet_h->crypto_instance->model_instance;
+	struct opensslcrypto_thread *thread;
+
+	thread = threads_local_get(&instance->thread_data);
+	if (!thread) {
+		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to setup per thread crypto contexts: %s", strerror(errno));
+	}
+
+	return thread;
+}
+
+/*
+ * crypt/decrypt functions
  */
 
-#ifdef BUILDCRYPTOOPENSSL10
 static int encrypt_openssl(
 	knet_handle_t knet_h,
+	struct opensslcrypto_thread *thread,
 	const struct iovec *iov,
 	int iovcnt,
 	unsigned char *buf_out,
 	ssize_t *buf_out_len)
 {
-	struct opensslcrypto_instance *instance = knet_h->crypto_instance->model_instance;
-	EVP_CIPHER_CTX	ctx;
+	EVP_CIPHER_CTX	*ctx = thread->encrypt_ctx;
 	int		tmplen = 0, offset = 0;
 	unsigned char	*salt = buf_out;
 	unsigned char	*data = buf_out + SALT_SIZE;
-	int		err = 0;
 	int		i;
 	char		sslerr[SSLERR_BUF_SIZE];
 
-	EVP_CIPHER_CTX_init(&ctx);
-
-	/*
-	 * contribute to PRNG for each packet we send/receive
-	 */
-	RAND_seed((unsigned char *)iov[iovcnt - 1].iov_base, iov[iovcnt - 1].iov_len);
-
 	if (!RAND_bytes(salt, SALT_SIZE)) {
 		ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
 		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to get random salt data: %s", sslerr);
-		err = -1;
-		goto out;
+		return -1;
 	}
 
-	/*
-	 * add warning re keylength
-	 */
-	EVP_EncryptInit_ex(&ctx, instance->crypto_cipher_type, NULL, instance->private_key, salt);
+	if (!EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, salt)) {
+		ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
+		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to set encrypt IV: %s", sslerr);
+		return -1;
+	}
 
 	for (i=0; i<iovcnt; i++) {
-		if (!EVP_EncryptUpdate(&ctx,
+		if (!EVP_EncryptUpdate(ctx,
 				       data + offset, &tmplen,
 				       (unsigned char *)iov[i].iov_base, iov[i].iov_len)) {
 			ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
 			log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to encrypt: %s", sslerr);
-			err = -1;
-			goto out;
+			return -1;
 		}
 		offset = offset + tmplen;
 	}
 
-	if (!EVP_EncryptFinal_ex(&ctx, data + offset, &tmplen)) {
+	if (!EVP_EncryptFinal_ex(ctx, data + offset, &tmplen)) {
 		ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
 		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to finalize encrypt: %s", sslerr);
-		err = -1;
-		goto out;
+		return -1;
 	}
 
 	*buf_out_len = offset + tmplen + SALT_SIZE;
 
-out:
-	EVP_CIPHER_CTX_cleanup(&ctx);
-	return err;
+	return 0;
 }
 
 static int decrypt_openssl (
 	knet_handle_t knet_h,
+	struct opensslcrypto_thread *thread,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
 	ssize_t *buf_out_len)
 {
-	struct opensslcrypto_instance *instance = knet_h->crypto_instance->model_instance;
-	EVP_CIPHER_CTX	ctx;
+	EVP_CIPHER_CTX	*ctx = thread->decrypt_ctx;
 	int		tmplen1 = 0, tmplen2 = 0;
 	unsigned char	*salt = (unsigned char *)buf_in;
 	unsigned char	*data = salt + SALT_SIZE;
 	int		datalen = buf_in_len - SALT_SIZE;
-	int		err = 0;
 	char		sslerr[SSLERR_BUF_SIZE];
 
-	EVP_CIPHER_CTX_init(&ctx);
-
-	/*
-	 * contribute to PRNG for each packet we send/receive
-	 */
-	RAND_seed(buf_in, buf_in_len);
+	if (datalen <= 0) {
+		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Packet is too short");
+		return -1;
+	}
 
-	/*
-	 * add warning re keylength
-	 */
-	EVP_DecryptInit_ex(&ctx, instance->crypto_cipher_type, NULL, instance->private_key, salt);
+	if (!EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, salt)) {
+		ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
+		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to set decrypt IV: %s", sslerr);
+		return -1;
+	}
 
-	if (!EVP_DecryptUpdate(&ctx, buf_out, &tmplen1, data, datalen)) {
+	if (!EVP_DecryptUpdate(ctx, buf_out, &tmplen1, data, datalen)) {
 		ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
 		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to decrypt: %s", sslerr);
-		err = -1;
-		goto out;
+		return -1;
 	}
 
-	if (!EVP_DecryptFinal_ex(&ctx, buf_out + tmplen1, &tmplen2)) {
+	if (!EVP_DecryptFinal_ex(ctx, buf_out + tmplen1, &tmplen2)) {
 		ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
 		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to finalize decrypt: %s", sslerr);
-		err = -1;
-		goto out;
+		return -1;
 	}
 
 	*buf_out_len = tmplen1 + tmplen2;
 
-out:
-	EVP_CIPHER_CTX_cleanup(&ctx);
-	return err;
+	return 0;
 }
-#endif
 
-#ifdef BUILDCRYPTOOPENSSL11
-static int encrypt_openssl(
+/*
+ * AEAD crypt/decrypt functions
+ */
+
+static int encrypt_openssl_aead(
 	knet_handle_t knet_h,
+	struct opensslcrypto_thread *thread,
 	const struct iovec *iov,
 	int iovcnt,
 	unsigned char *buf_out,
 	ssize_t *buf_out_len)
 {
-	struct opensslcrypto_instance *instance = knet_h->crypto_instance->model_instance;
-	EVP_CIPHER_CTX	*ctx;
+	EVP_CIPHER_CTX	*ctx = thread->encrypt_ctx;
 	int		tmplen = 0, offset = 0;
-	unsigned char	*salt = buf_out;
-	unsigned char	*data = buf_out + SALT_SIZE;
-	int		err = 0;
+	unsigned char	*nonce = buf_out;
+	unsigned char	*data = buf_out + KNET_AEAD_NONCE_SIZE;
 	int		i;
 	char		sslerr[SSLERR_BUF_SIZE];
 
-	ctx = EVP_CIPHER_CTX_new();
+	if (crypto_aead_nonce_needs_prefix(&thread->nonce)) {
+		if (!RAND_bytes(thread->nonce.prefix, KNET_AEAD_NONCE_PREFIX_SIZE)) {
+			ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
+			log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to get random nonce data: %s", sslerr);
+			return -1;
+		}
+		thread->nonce.prefix_valid = 1;
+	}
 
-	/*
-	 * contribute to PRNG for each packet we send/receive
-	 */
-	RAND_seed((unsigned char *)iov[iovcnt - 1].iov_base, iov[iovcnt - 1].iov_len);
+	crypto_aead_nonce_next(&thread->nonce, nonce);
 
-	if (!RAND_bytes(salt, SALT_SIZE)) {
+	if (!EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, nonce)) {
 		ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
-		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to get random salt data: %s", sslerr);
-		err = -1;
-		goto out;
+		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to set encrypt nonce: %s", sslerr);
+		return -1;
 	}
 
-	/*
-	 * add warning re keylength
-	 */
-	EVP_EncryptInit_ex(ctx, instance->crypto_cipher_type, NULL, instance->private_key, salt);
-
 	for (i=0; i<iovcnt; i++) {
 		if (!EVP_EncryptUpdate(ctx,
 				       data + offset, &tmplen,
 				       (unsigned char *)iov[i].iov_base, iov[i].iov_len)) {
 			ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
 			log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to encrypt: %s", sslerr);
-			err = -1;
-			goto out;
+			return -1;
 		}
 		offset = offset + tmplen;
 	}
@@ -210,101 +314,148 @@ static int encrypt_openssl(
 	if (!EVP_EncryptFinal_ex(ctx, data + offset, &tmplen)) {
 		ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
 		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to finalize encrypt: %s", sslerr);
-		err = -1;
-		goto out;
+		return -1;
 	}
+	offset = offset + tmplen;
 
-	*buf_out_len = offset + tmplen + SALT_SIZE;
+	if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, KNET_AEAD_TAG_SIZE, data + offset)) {
+		ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
+		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to get authentication tag: %s", sslerr);
+		return -1;
+	}
 
-out:
-	EVP_CIPHER_CTX_free(ctx);
-	return err;
+	*buf_out_len = KNET_AEAD_NONCE_SIZE + offset + KNET_AEAD_TAG_SIZE;
+
+	return 0;
 }
 
-static int decrypt_openssl (
+static int decrypt_openssl_aead(
 	knet_handle_t knet_h,
+	struct opensslcrypto_thread *thread,
 	const unsigned char *buf_in,
 	const ssize_t buf_in_len,
 	unsigned char *buf_out,
 	ssize_t *buf_out_len)
 {
-	struct opensslcrypto_instance *instance = knet_h->crypto_instance->model_instance;
-	EVP_CIPHER_CTX	*ctx = NULL;
+	EVP_CIPHER_CTX	*ctx = thread->decrypt_ctx;
 	int		tmplen1 = 0, tmplen2 = 0;
-	unsigned char	*salt = (unsigned char *)buf_in;
-	unsigned char	*data = salt + SALT_SIZE;
-	int		datalen = buf_in_len - SALT_SIZE;
-	int		err = 0;
+	unsigned char	*nonce = (unsigned char *)buf_in;
+	unsigned char	*data = nonce + KNET_AEAD_NONCE_SIZE;
+	int		datalen = buf_in_len - KNET_AEAD_NONCE_SIZE - KNET_AEAD_TAG_SIZE;
 	char		sslerr[SSLERR_BUF_SIZE];
 
-	if (datalen <= 0) {
-		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Packet is too short");
-		err = -1;
-		goto out;
+	if ((datalen <= 0) || (datalen > (int)(KNET_DATABUFSIZE_CRYPT))) {
+		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Incorrect packet size.");
+		return -1;
 	}
 
-	ctx = EVP_CIPHER_CTX_new();
-
-	/*
-	 * contribute to PRNG for each packet we send/receive
-	 */
-	RAND_seed(buf_in, buf_in_len);
-
-	/*
-	 * add warning re keylength
-	 */
-	EVP_DecryptInit_ex(ctx, instance->crypto_cipher_type, NULL, instance->private_key, salt);
+	if (!EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, nonce)) {
+		ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
+		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to set decrypt nonce: %s", sslerr);
+		return -1;
+	}
 
 	if (!EVP_DecryptUpdate(ctx, buf_out, &tmplen1, data, datalen)) {
 		ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
 		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to decrypt: %s", sslerr);
-		err = -1;
-		goto out;
+		return -1;
 	}
 
-	if (!EVP_DecryptFinal_ex(ctx, buf_out + tmplen1, &tmplen2)) {
+	if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, KNET_AEAD_TAG_SIZE, data + datalen)) {
 		ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
-		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to finalize decrypt: %s", sslerr);
-		err = -1;
-		goto out;
+		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to set authentication tag: %s", sslerr);
+		return -1;
+	}
+
+	if (!EVP_DecryptFinal_ex(ctx, buf_out + tmplen1, &tmplen2)) {
+		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Authentication tag does not match");
+		return -1;
 	}
 
 	*buf_out_len = tmplen1 + tmplen2;
 
-out:
-	if (ctx) {
-		EVP_CIPHER_CTX_free(ctx);
-	}
-	return err;
+	return 0;
 }
-#endif
 
 /*
  * hash/hmac/digest functions
  */
 
+static int calculate_openssl_hashv(
+	knet_handle_t knet_h,
+	struct opensslcrypto_thread *thread,
+	const struct iovec *iov,
+	int iovcnt,
+	unsigned char *hash)
+{
+	size_t hash_len = knet_h->sec_hash_size;
+	char sslerr[SSLERR_BUF_SIZE];
+	int i;
+
+	if (!EVP_MD_CTX_copy_ex(thread->hmac_ctx, thread->hmac_template)) {
+		goto out_err;
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		if (!EVP_DigestSignUpdate(thread->hmac_ctx, iov[i].iov_base, iov[i].iov_len)) {
+			goto out_err;
+		}
+	}
+
+	if ((!EVP_DigestSignFinal(thread->hmac_ctx, hash, &hash_len)) ||
+	    (hash_len != knet_h->sec_hash_size)) {
+		goto out_err;
+	}
+
+	return 0;
+
+out_err:
+	ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
+	log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to calculate hash: %s", sslerr);
+	return -1;
+}
+
 static int calculate_openssl_hash(
 	knet_handle_t knet_h,
+	struct opensslcrypto_thread *thread,
 	const unsigned char *buf,
 	const size_t buf_len,
 	unsigned char *hash)
 {
-	struct opensslcrypto_instance *instance = knet_h->crypto_instance->model_instance;
-	unsigned int hash_len = 0;
-	unsigned char *hash_out = NULL;
-	char sslerr[SSLERR_BUF_SIZE];
+	struct iovec iov;
 
-	hash_out = HMAC(instance->crypto_hash_type,
-			instance->private_key, instance->private_key_len,
-			buf, buf_len,
-			hash, &hash_len);
+	iov.iov_base = (unsigned char *)buf;
+	iov.iov_len = buf_len;
 
-	if ((!hash_out) || (hash_len != knet_h->sec_hash_size)) {
-		ERR_error_string_n(ERR_get_error(), sslerr, sizeof(sslerr));
-		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to calculate hash: %s", sslerr);
+	return calculate_openssl_hashv(knet_h, thread, &iov, 1, hash);
+}
+
+static int verify_openssl_hash(
+	knet_handle_t knet_h,
+	struct opensslcrypto_thread *thread,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	ssize_t *buf_out_len)
+{
+	unsigned char tmp_hash[knet_h->sec_hash_size];
+	ssize_t temp_buf_len = buf_in_len - knet_h->sec_hash_size;
+
+	if ((temp_buf_len <= 0) || (temp_buf_len > (ssize_t)(KNET_DATABUFSIZE_CRYPT))) {
+		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Incorrect packet size.");
+		return -1;
+	}
+
+	if (calculate_openssl_hash(knet_h, thread, buf_in, temp_buf_len, tmp_hash) < 0) {
 		return -1;
 	}
 
+	if (memcmp(tmp_hash, buf_in + temp_buf_len, knet_h->sec_hash_size) != 0) {
+		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Digest does not match");
+		return -1;
+	}
+
+	*buf_out_len = temp_buf_len;
+
 	return 0;
 }
 
@@ -320,10 +471,20 @@ static int opensslcrypto_encrypt_and_signv (
 	ssize_t *buf_out_len)
 {
 	struct opensslcrypto_instance *instance = knet_h->crypto_instance->model_instance;
+	struct opensslcrypto_thread *thread;
 	int i;
 
+	thread = opensslcrypto_get_thread(knet_h);
+	if (!thread) {
+		return -1;
+	}
+
+	if (instance->crypto_cipher_is_aead) {
+		return encrypt_openssl_aead(knet_h, thread, iov_in, iovcnt_in, buf_out, buf_out_len);
+	}
+
 	if (instance->crypto_cipher_type) {
-		if (encrypt_openssl(knet_h, iov_in, iovcnt_in, buf_out, buf_out_len) < 0) {
+		if (encrypt_openssl(knet_h, thread, iov_in, iovcnt_in, buf_out, buf_out_len) < 0) {
 			return -1;
 		}
 	} else {
@@ -335,7 +496,7 @@ static int opensslcrypto_encrypt_and_signv (
 	}
 
 	if (instance->crypto_hash_type) {
-		if (calculate_openssl_hash(knet_h, buf_out, *buf_out_len, buf_out + *buf_out_len) < 0) {
+		if (calculate_openssl_hash(knet_h, thread, buf_out, *buf_out_len, buf_out + *buf_out_len) < 0) {
 			return -1;
 		}
 		*buf_out_len = *buf_out_len + knet_h->sec_hash_size;
@@ -368,31 +529,26 @@ static int opensslcrypto_authenticate_and_decrypt (
 	ssize_t *buf_out_len)
 {
 	struct opensslcrypto_instance *instance = knet_h->crypto_instance->model_instance;
+	struct opensslcrypto_thread *thread;
 	ssize_t temp_len = buf_in_len;
 
-	if (instance->crypto_hash_type) {
-		unsigned char tmp_hash[knet_h->sec_hash_size];
-		ssize_t temp_buf_len = buf_in_len - knet_h->sec_hash_size;
-
-		if ((temp_buf_len <= 0) || (temp_buf_len > KNET_MAX_PACKET_SIZE)) {
-			log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Incorrect packet size.");
-			return -1;
-		}
+	thread = opensslcrypto_get_thread(knet_h);
+	if (!thread) {
+		return -1;
+	}
 
-		if (calculate_openssl_hash(knet_h, buf_in, temp_buf_len, tmp_hash) < 0) {
-			return -1;
-		}
+	if (instance->crypto_cipher_is_aead) {
+		return decrypt_openssl_aead(knet_h, thread, buf_in, buf_in_len, buf_out, buf_out_len);
+	}
 
-		if (memcmp(tmp_hash, buf_in + temp_buf_len, knet_h->sec_hash_size) != 0) {
-			log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Digest does not match");
+	if (instance->crypto_hash_type) {
+		if (verify_openssl_hash(knet_h, thread, buf_in, buf_in_len, &temp_len) < 0) {
 			return -1;
 		}
-
-		temp_len = temp_len - knet_h->sec_hash_size;
 		*buf_out_len = temp_len;
 	}
 	if (instance->crypto_cipher_type) {
-		if (decrypt_openssl(knet_h, buf_in, temp_len, buf_out, buf_out_len) < 0) {
+		if (decrypt_openssl(knet_h, thread, buf_in, temp_len, buf_out, buf_out_len) < 0) {
 			return -1;
 		}
 	} else {
@@ -403,6 +559,38 @@ static int opensslcrypto_authenticate_and_decrypt (
 	return 0;
 }
 
+static int opensslcrypto_signv (
+	knet_handle_t knet_h,
+	const struct iovec *iov_in,
+	int iovcnt_in,
+	unsigned char *hash)
+{
+	struct opensslcrypto_thread *thread;
+
+	thread = opensslcrypto_get_thread(knet_h);
+	if (!thread) {
+		return -1;
+	}
+
+	return calculate_openssl_hashv(knet_h, thread, iov_in, iovcnt_in, hash);
+}
+
+static int opensslcrypto_authenticate (
+	knet_handle_t knet_h,
+	const unsigned char *buf_in,
+	const ssize_t buf_in_len,
+	ssize_t *buf_out_len)
+{
+	struct opensslcrypto_thread *thread;
+
+	thread = opensslcrypto_get_thread(knet_h);
+	if (!thread) {
+		return -1;
+	}
+
+	return verify_openssl_hash(knet_h, thread, buf_in, buf_in_len, buf_out_len);
+}
+
 #ifdef BUILDCRYPTOOPENSSL10
 static pthread_mutex_t *openssl_internal_lock;
 
@@ -479,6 +667,12 @@ static void opensslcrypto_fini(
 #ifdef BUILDCRYPTOOPENSSL10
 		openssl_internal_lock_cleanup();
 #endif
+		if (opensslcrypto_instance->thread_data_init) {
+			threads_local_fini(&opensslcrypto_instance->thread_data);
+		}
+		if (opensslcrypto_instance->hmac_key) {
+			EVP_PKEY_free(opensslcrypto_instance->hmac_key);
+		}
 		if (opensslcrypto_instance->private_key) {
 			free(opensslcrypto_instance->private_key);
 			opensslcrypto_instance->private_key = NULL;
@@ -497,7 +691,9 @@ static int opensslcrypto_init(
 {
 	static int openssl_is_init = 0;
 	struct opensslcrypto_instance *opensslcrypto_instance = NULL;
+	const char *cipher_name;
 	int savederrno;
+	int i;
 
 	log_debug(knet_h, KNET_SUB_OPENSSLCRYPTO,
 		  "Initizializing openssl crypto module [%s/%s]",
@@ -542,12 +738,31 @@ static int opensslcrypto_init(
 	if (strcmp(knet_handle_crypto_cfg->crypto_cipher_type, "none") == 0) {
 		opensslcrypto_instance->crypto_cipher_type = NULL;
 	} else {
-		opensslcrypto_instance->crypto_cipher_type = EVP_get_cipherbyname(knet_handle_crypto_cfg->crypto_cipher_type);
+		cipher_name = knet_handle_crypto_cfg->crypto_cipher_type;
+		for (i = 0; openssl_cipher_aliases[i].knet_name != NULL; i++) {
+			if (!strcmp(cipher_name, openssl_cipher_aliases[i].knet_name)) {
+				cipher_name = openssl_cipher_aliases[i].openssl_name;
+				break;
+			}
+		}
+		opensslcrypto_instance->crypto_cipher_type = EVP_get_cipherbyname(cipher_name);
 		if (!opensslcrypto_instance->crypto_cipher_type) {
 			log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "unknown crypto cipher type requested");
 			savederrno = ENXIO;
 			goto out_err;
 		}
+		if (EVP_CIPHER_flags(opensslcrypto_instance->crypto_cipher_type) & EVP_CIPH_FLAG_AEAD_CIPHER) {
+			/*
+			 * CCM needs the total length upfront and cannot work with iovecs
+			 */
+			if ((EVP_CIPHER_mode(opensslcrypto_instance->crypto_cipher_type) == EVP_CIPH_CCM_MODE) ||
+			    (EVP_CIPHER_iv_length(opensslcrypto_instance->crypto_cipher_type) != KNET_AEAD_NONCE_SIZE)) {
+				log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "AEAD cipher type not supported");
+				savederrno = ENXIO;
+				goto out_err;
+			}
+			opensslcrypto_instance->crypto_cipher_is_aead = 1;
+		}
 	}
 
 	if (strcmp(knet_handle_crypto_cfg->crypto_hash_type, "none") == 0) {
@@ -562,12 +777,20 @@ static int opensslcrypto_init(
 	}
 
 	if ((opensslcrypto_instance->crypto_cipher_type) &&
+	    (!opensslcrypto_instance->crypto_cipher_is_aead) &&
 	    (!opensslcrypto_instance->crypto_hash_type)) {
 		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "crypto communication requires hash specified");
 		savederrno = EINVAL;
 		goto out_err;
 	}
 
+	if ((opensslcrypto_instance->crypto_cipher_is_aead) &&
+	    (opensslcrypto_instance->crypto_hash_type)) {
+		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "AEAD ciphers provide authentication, hash must be none");
+		savederrno = EINVAL;
+		goto out_err;
+	}
+
 	opensslcrypto_instance->private_key = malloc(knet_handle_crypto_cfg->private_key_len);
 	if (!opensslcrypto_instance->private_key) {
 		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to allocate memory for openssl private key");
@@ -577,11 +800,50 @@ static int opensslcrypto_init(
 	memmove(opensslcrypto_instance->private_key, knet_handle_crypto_cfg->private_key, knet_handle_crypto_cfg->private_key_len);
 	opensslcrypto_instance->private_key_len = knet_handle_crypto_cfg->private_key_len;
 
+	if (opensslcrypto_instance->crypto_hash_type) {
+		opensslcrypto_instance->hmac_key = EVP_PKEY_new_mac_key(EVP_PKEY_HMAC, NULL,
+									opensslcrypto_instance->private_key,
+									opensslcrypto_instance->private_key_len);
+		if (!opensslcrypto_instance->hmac_key) {
+			log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to setup openssl hmac key");
+			savederrno = ENOMEM;
+			goto out_err;
+		}
+	}
+
+	if (threads_local_init(&opensslcrypto_instance->thread_data,
+			       opensslcrypto_thread_alloc, opensslcrypto_thread_free,
+			       opensslcrypto_instance) < 0) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_OPENSSLCRYPTO, "Unable to init per thread crypto data: %s",
+			strerror(savederrno));
+		goto out_err;
+	}
+	opensslcrypto_instance->thread_data_init = 1;
+
 	knet_h->sec_header_size = 0;
+	knet_h->sec_block_size = 0;
+	knet_h->sec_hash_size = 0;
+	knet_h->sec_salt_size = 0;
+
+	if (opensslcrypto_instance->crypto_cipher_is_aead) {
+		/*
+		 * no padding, the tag plays the role of the hash
+		 * and the nonce the role of the salt
+		 */
+		knet_h->sec_hash_size = KNET_AEAD_TAG_SIZE;
+		knet_h->sec_salt_size = KNET_AEAD_NONCE_SIZE;
+		knet_h->sec_header_size = KNET_AEAD_NONCE_SIZE + KNET_AEAD_TAG_SIZE;
+
+		return 0;
+	}
 
 	if (opensslcrypto_instance->crypto_hash_type) {
 		knet_h->sec_hash_size = EVP_MD_size(opensslcrypto_instance->crypto_hash_type);
 		knet_h->sec_header_size += knet_h->sec_hash_size;
+		if (!opensslcrypto_instance->crypto_cipher_type) {
+			knet_h->crypto_instance->hash_only = 1;
+		}
 	}
 
 	if (opensslcrypto_instance->crypto_cipher_type) {
@@ -604,11 +866,13 @@ out_err:
 	return -1;
 }
 
-crypto_ops_t crypto_model = {
+const crypto_ops_t KNET_CRYPTO_MODEL(openssl) = {
 	KNET_CRYPTO_MODEL_ABI,
 	opensslcrypto_init,
 	opensslcrypto_fini,
 	opensslcrypto_encrypt_and_sign,
 	opensslcrypto_encrypt_and_signv,
-	opensslcrypto_authenticate_and_decrypt
+	opensslcrypto_authenticate_and_decrypt,
+	opensslcrypto_signv,
+	opensslcrypto_authenticate
 };
@@ -21,6 +21,7 @@
 
 #include "internals.h"
 #include "crypto.h"
+#include "host.h"
 #include "links.h"
 #include "compress.h"
 #include "compat.h"
@@ -72,6 +73,7 @@ static void _fini_shlib_tracker(void)
 static int _init_locks(knet_handle_t knet_h)
 {
 	int savederrno = 0;
+	pthread_rwlockattr_t tx_rwlock_attr;
 
 	savederrno = pthread_rwlock_init(&knet_h->global_rwlock, NULL);
 	if (savederrno) {
@@ -115,9 +117,67 @@ static int _init_locks(knet_handle_t knet_h)
 		goto exit_fail;
 	}
 
-	savederrno = pthread_mutex_init(&knet_h->tx_mutex, NULL);
+	savederrno = pthread_rwlockattr_init(&tx_rwlock_attr);
 	if (savederrno) {
-		log_err(knet_h, KNET_SUB_HANDLE, "Unable to initialize tx_thread mutex: %s",
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to initialize tx_thread rwlock attributes: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+
+#ifdef KNET_LINUX
+	/*
+	 * TX workers hold the read lock for every packet, make sure
+	 * PMTUd is not starved when more than one worker is busy.
+	 */
+	pthread_rwlockattr_setkind_np(&tx_rwlock_attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+
+	savederrno = pthread_rwlock_init(&knet_h->tx_rwlock, &tx_rwlock_attr);
+	pthread_rwlockattr_destroy(&tx_rwlock_attr);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to initialize tx_thread rwlock: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+
+	savederrno = pthread_mutex_init(&knet_h->tx_workers_mutex, NULL);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to initialize tx_workers mutex: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+
+	savederrno = pthread_mutex_init(&knet_h->rx_workers_mutex, NULL);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to initialize rx_workers mutex: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+
+	savederrno = pthread_mutex_init(&knet_h->crypto_workers_mutex, NULL);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to initialize crypto_workers mutex: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+
+	savederrno = pthread_mutex_init(&knet_h->crypto_jobs_mutex, NULL);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to initialize crypto_jobs mutex: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+
+	savederrno = pthread_cond_init(&knet_h->crypto_jobs_cond, NULL);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to initialize crypto_jobs conditional: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+
+	savederrno = pthread_mutex_init(&knet_h->handle_stats_mutex, NULL);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to initialize handle stats mutex: %s",
 			strerror(savederrno));
 		goto exit_fail;
 	}
@@ -136,6 +196,13 @@ static int _init_locks(knet_handle_t knet_h)
 		goto exit_fail;
 	}
 
+	savederrno = pthread_mutex_init(&knet_h->defrag_pool_mutex, NULL);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to initialize defrag pool mutex: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+
 	return 0;
 
 exit_fail:
@@ -150,12 +217,30 @@ static void _destroy_locks(knet_handle_t knet_h)
 	pthread_mutex_destroy(&knet_h->kmtu_mutex);
 	pthread_cond_destroy(&knet_h->pmtud_cond);
 	pthread_mutex_destroy(&knet_h->hb_mutex);
-	pthread_mutex_destroy(&knet_h->tx_mutex);
+	pthread_rwlock_destroy(&knet_h->tx_rwlock);
+	pthread_mutex_destroy(&knet_h->tx_workers_mutex);
+	pthread_mutex_destroy(&knet_h->rx_workers_mutex);
+	pthread_mutex_destroy(&knet_h->crypto_workers_mutex);
+	pthread_mutex_destroy(&knet_h->crypto_jobs_mutex);
+	pthread_cond_destroy(&knet_h->crypto_jobs_cond);
+	pthread_mutex_destroy(&knet_h->handle_stats_mutex);
 	pthread_mutex_destroy(&knet_h->backoff_mutex);
 	pthread_mutex_destroy(&knet_h->tx_seq_num_mutex);
+	pthread_mutex_destroy(&knet_h->defrag_pool_mutex);
 	pthread_mutex_destroy(&knet_h->threads_status_mutex);
 }
 
+/*
+ * 'min' stats start from the maximum value so the
+ * first value we get is always less
+ */
+static void _channel_stats_reset(knet_handle_t knet_h, int8_t channel)
+{
+	memset(&knet_h->channel_stats[channel], 0, sizeof(struct knet_channel_stats));
+	knet_h->channel_stats[channel].tx_compress_time_min = UINT64_MAX;
+	knet_h->channel_stats[channel].rx_compress_time_min = UINT64_MAX;
+}
+
 static int _init_socks(knet_handle_t knet_h)
 {
 	int savederrno = 0;
@@ -190,40 +275,6 @@ static void _close_socks(knet_handle_t knet_h)
 static int _init_buffers(knet_handle_t knet_h)
 {
 	int savederrno = 0;
-	int i;
-	size_t bufsize;
-
-	for (i = 0; i < PCKT_FRAG_MAX; i++) {
-		bufsize = ceil((float)KNET_MAX_PACKET_SIZE / (i + 1)) + KNET_HEADER_ALL_SIZE;
-		knet_h->send_to_links_buf[i] = malloc(bufsize);
-		if (!knet_h->send_to_links_buf[i]) {
-			savederrno = errno;
-			log_err(knet_h, KNET_SUB_HANDLE, "Unable to allocate memory datafd to link buffer: %s",
-				strerror(savederrno));
-			goto exit_fail;
-		}
-		memset(knet_h->send_to_links_buf[i], 0, bufsize);
-	}
-
-	for (i = 0; i < PCKT_RX_BUFS; i++) {
-		knet_h->recv_from_links_buf[i] = malloc(KNET_DATABUFSIZE);
-		if (!knet_h->recv_from_links_buf[i]) {
-			savederrno = errno;
-			log_err(knet_h, KNET_SUB_HANDLE, "Unable to allocate memory for link to datafd buffer: %s",
-				strerror(savederrno));
-			goto exit_fail;
-		}
-		memset(knet_h->recv_from_links_buf[i], 0, KNET_DATABUFSIZE);
-	}
-
-	knet_h->recv_from_sock_buf = malloc(KNET_DATABUFSIZE);
-	if (!knet_h->recv_from_sock_buf) {
-		savederrno = errno;
-		log_err(knet_h, KNET_SUB_HANDLE, "Unable to allocate memory for app to datafd buffer: %s",
-				strerror(savederrno));
-		goto exit_fail;
-	}
-	memset(knet_h->recv_from_sock_buf, 0, KNET_DATABUFSIZE);
 
 	knet_h->pingbuf = malloc(KNET_HEADER_PING_SIZE);
 	if (!knet_h->pingbuf) {
@@ -243,36 +294,6 @@ static int _init_buffers(knet_handle_t knet_h)
 	}
 	memset(knet_h->pmtudbuf, 0, KNET_PMTUD_SIZE_V6);
 
-	for (i = 0; i < PCKT_FRAG_MAX; i++) {
-		bufsize = ceil((float)KNET_MAX_PACKET_SIZE / (i + 1)) + KNET_HEADER_ALL_SIZE + KNET_DATABUFSIZE_CRYPT_PAD;
-		knet_h->send_to_links_buf_crypt[i] = malloc(bufsize);
-		if (!knet_h->send_to_links_buf_crypt[i]) {
-			savederrno = errno;
-			log_err(knet_h, KNET_SUB_HANDLE, "Unable to allocate memory for crypto datafd to link buffer: %s",
-				strerror(savederrno));
-			goto exit_fail;
-		}
-		memset(knet_h->send_to_links_buf_crypt[i], 0, bufsize);
-	}
-
-	knet_h->recv_from_links_buf_decrypt = malloc(KNET_DATABUFSIZE_CRYPT);
-	if (!knet_h->recv_from_links_buf_decrypt) {
-		savederrno = errno;
-		log_err(knet_h, KNET_SUB_CRYPTO, "Unable to allocate memory for crypto link to datafd buffer: %s",
-			strerror(savederrno));
-		goto exit_fail;
-	}
-	memset(knet_h->recv_from_links_buf_decrypt, 0, KNET_DATABUFSIZE_CRYPT);
-
-	knet_h->recv_from_links_buf_crypt = malloc(KNET_DATABUFSIZE_CRYPT);
-	if (!knet_h->recv_from_links_buf_crypt) {
-		savederrno = errno;
-		log_err(knet_h, KNET_SUB_CRYPTO, "Unable to allocate memory for crypto link to datafd buffer: %s",
-			strerror(savederrno));
-		goto exit_fail;
-	}
-	memset(knet_h->recv_from_links_buf_crypt, 0, KNET_DATABUFSIZE_CRYPT);
-
 	knet_h->pingbuf_crypt = malloc(KNET_DATABUFSIZE_CRYPT);
 	if (!knet_h->pingbuf_crypt) {
 		savederrno = errno; 
@@ -291,24 +312,6 @@ static int _init_buffers(knet_handle_t knet_h)
 	}
 	memset(knet_h->pmtudbuf_crypt, 0, KNET_DATABUFSIZE_CRYPT);
 
-	knet_h->recv_from_links_buf_decompress = malloc(KNET_DATABUFSIZE_COMPRESS);
-	if (!knet_h->recv_from_links_buf_decompress) {
-		savederrno = errno;
-		log_err(knet_h, KNET_SUB_HANDLE, "Unable to allocate memory for decompress buffer: %s",
-			strerror(savederrno));
-		goto exit_fail;
-	}
-	memset(knet_h->recv_from_links_buf_decompress, 0, KNET_DATABUFSIZE_COMPRESS);
-
-	knet_h->send_to_links_buf_compress = malloc(KNET_DATABUFSIZE_COMPRESS);
-	if (!knet_h->send_to_links_buf_compress) {
-		savederrno = errno;
-		log_err(knet_h, KNET_SUB_HANDLE, "Unable to allocate memory for compress buffer: %s",
-			strerror(savederrno));
-		goto exit_fail;
-	}
-	memset(knet_h->send_to_links_buf_compress, 0, KNET_DATABUFSIZE_COMPRESS);
-
 	memset(knet_h->knet_transport_fd_tracker, KNET_MAX_TRANSPORTS, sizeof(knet_h->knet_transport_fd_tracker));
 
 	return 0;
@@ -320,26 +323,22 @@ exit_fail:
 
 static void _destroy_buffers(knet_handle_t knet_h)
 {
-	int i;
-
-	for (i = 0; i < PCKT_FRAG_MAX; i++) {
-		free(knet_h->send_to_links_buf[i]);
-		free(knet_h->send_to_links_buf_crypt[i]);
-	}
+	struct knet_defrag_chunk *chunk;
 
-	for (i = 0; i < PCKT_RX_BUFS; i++) {
-		free(knet_h->recv_from_links_buf[i]);
-	}
-
-	free(knet_h->recv_from_links_buf_decompress);
-	free(knet_h->send_to_links_buf_compress);
-	free(knet_h->recv_from_sock_buf);
-	free(knet_h->recv_from_links_buf_decrypt);
-	free(knet_h->recv_from_links_buf_crypt);
 	free(knet_h->pingbuf);
 	free(knet_h->pingbuf_crypt);
 	free(knet_h->pmtudbuf);
 	free(knet_h->pmtudbuf_crypt);
+
+	/*
+	 * all hosts are gone, every defrag buffer is back in the pool
+	 */
+	while (knet_h->defrag_pool) {
+		chunk = knet_h->defrag_pool;
+		knet_h->defrag_pool = chunk->next;
+		free(chunk);
+	}
+	knet_h->defrag_pool_allocated = 0;
 }
 
 static int _init_epolls(knet_handle_t knet_h)
@@ -347,18 +346,6 @@ static int _init_epolls(knet_handle_t knet_h)
 	struct epoll_event ev;
 	int savederrno = 0;
 
-	/*
-	 * even if the kernel does dynamic allocation with epoll_ctl
-	 * we need to reserve one extra for host to host communication
-	 */
-	knet_h->send_to_links_epollfd = epoll_create(KNET_EPOLL_MAX_EVENTS + 1);
-	if (knet_h->send_to_links_epollfd < 0) {
-		savederrno = errno;
-		log_err(knet_h, KNET_SUB_HANDLE, "Unable to create epoll datafd to link fd: %s",
-			strerror(savederrno));
-		goto exit_fail;
-	}
-
 	knet_h->recv_from_links_epollfd = epoll_create(KNET_EPOLL_MAX_EVENTS);
 	if (knet_h->recv_from_links_epollfd < 0) {
 		savederrno = errno;
@@ -375,13 +362,6 @@ static int _init_epolls(knet_handle_t knet_h)
 		goto exit_fail;
 	}
 
-	if (_fdset_cloexec(knet_h->send_to_links_epollfd)) {
-		savederrno = errno;
-		log_err(knet_h, KNET_SUB_HANDLE, "Unable to set CLOEXEC on datafd to link epoll fd: %s",
-			strerror(savederrno)); 
-		goto exit_fail;
-	}
-
 	if (_fdset_cloexec(knet_h->recv_from_links_epollfd)) {
 		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HANDLE, "Unable to set CLOEXEC on link to datafd epoll fd: %s",
@@ -396,18 +376,6 @@ static int _init_epolls(knet_handle_t knet_h)
 		goto exit_fail;
 	}
 
-	memset(&ev, 0, sizeof(struct epoll_event));
-	ev.events = EPOLLIN;
-	ev.data.fd = knet_h->hostsockfd[0];
-
-	if (epoll_ctl(knet_h->send_to_links_epollfd,
-		      EPOLL_CTL_ADD, knet_h->hostsockfd[0], &ev)) {
-		savederrno = errno;
-		log_err(knet_h, KNET_SUB_HANDLE, "Unable to add hostsockfd[0] to epoll pool: %s",
-			strerror(savederrno));
-		goto exit_fail;
-	}
-
 	memset(&ev, 0, sizeof(struct epoll_event));
 	ev.events = EPOLLIN;
 	ev.data.fd = knet_h->dstsockfd[0];
@@ -434,18 +402,18 @@ static void _close_epolls(knet_handle_t knet_h)
 
 	memset(&ev, 0, sizeof(struct epoll_event));
 
+	/*
+	 * TX workers epoll fds are closed by _stop_threads
+	 */
 	for (i = 0; i < KNET_DATAFD_MAX; i++) {
 		if (knet_h->sockfd[i].in_use) {
-			epoll_ctl(knet_h->send_to_links_epollfd, EPOLL_CTL_DEL, knet_h->sockfd[i].sockfd[knet_h->sockfd[i].is_created], &ev);
 			if  (knet_h->sockfd[i].sockfd[knet_h->sockfd[i].is_created]) {
 				 _close_socketpair(knet_h, knet_h->sockfd[i].sockfd);
 			}
 		}
 	}
 
-	epoll_ctl(knet_h->send_to_links_epollfd, EPOLL_CTL_DEL, knet_h->hostsockfd[0], &ev);
 	epoll_ctl(knet_h->dst_link_handler_epollfd, EPOLL_CTL_DEL, knet_h->dstsockfd[0], &ev);
-	close(knet_h->send_to_links_epollfd);
 	close(knet_h->recv_from_links_epollfd);
 	close(knet_h->dst_link_handler_epollfd);
 }
@@ -470,21 +438,21 @@ static int _start_threads(knet_handle_t knet_h)
 		goto exit_fail;
 	}
 
-	savederrno = pthread_create(&knet_h->send_to_links_thread, 0,
-				    _handle_send_to_links_thread, (void *) knet_h);
-	if (savederrno) {
+	if (_tx_worker_start(knet_h, 0) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HANDLE, "Unable to start datafd to link thread: %s",
 			strerror(savederrno));
 		goto exit_fail;
 	}
+	knet_h->tx_workers_num = 1;
 
-	savederrno = pthread_create(&knet_h->recv_from_links_thread, 0,
-				    _handle_recv_from_links_thread, (void *) knet_h);
-	if (savederrno) {
+	if (_rx_worker_start(knet_h, 0) < 0) {
+		savederrno = errno;
 		log_err(knet_h, KNET_SUB_HANDLE, "Unable to start link to datafd thread: %s",
 			strerror(savederrno));
 		goto exit_fail;
 	}
+	knet_h->rx_workers_num = 1;
 
 	savederrno = pthread_create(&knet_h->heartbt_thread, 0,
 				    _handle_heartbt_thread, (void *) knet_h);
@@ -504,6 +472,7 @@ exit_fail:
 static void _stop_threads(knet_handle_t knet_h)
 {
 	void *retval;
+	uint8_t i;
 
 	wait_all_threads_status(knet_h, KNET_THREAD_STOPPED);
 
@@ -512,14 +481,25 @@ static void _stop_threads(knet_handle_t knet_h)
 		pthread_join(knet_h->heartbt_thread, &retval);
 	}
 
-	if (knet_h->send_to_links_thread) {
-		pthread_cancel(knet_h->send_to_links_thread);
-		pthread_join(knet_h->send_to_links_thread, &retval);
+	/*
+	 * TX workers exit on their own on shutdown
+	 */
+	for (i = 0; i < KNET_MAX_TX_THREADS; i++) {
+		_tx_worker_stop(knet_h, i);
+	}
+
+	/*
+	 * crypto workers can go only after all TX workers
+	 */
+	for (i = 0; i < KNET_MAX_CRYPTO_THREADS; i++) {
+		_crypto_worker_stop(knet_h, i);
 	}
 
-	if (knet_h->recv_from_links_thread) {
-		pthread_cancel(knet_h->recv_from_links_thread);
-		pthread_join(knet_h->recv_from_links_thread, &retval);
+	/*
+	 * RX workers exit on their own on shutdown
+	 */
+	for (i = 0; i < KNET_MAX_RX_THREADS; i++) {
+		_rx_worker_stop(knet_h, i);
 	}
 
 	if (knet_h->dst_link_handler_thread) {
@@ -540,6 +520,7 @@ knet_handle_t knet_handle_new_ex(knet_node_id_t host_id,
 {
 	knet_handle_t knet_h;
 	int savederrno = 0;
+	int i;
 	struct rlimit cur;
 
 	if (getrlimit(RLIMIT_NOFILE, &cur) < 0) {
@@ -598,12 +579,27 @@ knet_handle_t knet_handle_new_ex(knet_node_id_t host_id,
 	 * set pmtud default timers
 	 */
 	knet_h->pmtud_interval = KNET_PMTUD_DEFAULT_INTERVAL;
+	knet_h->rx_bufsize = KNET_RX_BUFSIZE_DEFAULT;
 
 	/*
 	 * set transports reconnect default timers
 	 */
 	knet_h->reconnect_int = KNET_TRANSPORT_DEFAULT_RECONNECT_INTERVAL;
 
+	/*
+	 * set defrag pool defaults
+	 */
+	knet_h->defrag_pool_max = KNET_DEFRAG_BUFS_DEFAULT;
+	knet_h->defrag_expire = KNET_DEFRAG_EXPIRE_DEFAULT;
+
+	/*
+	 * set dedup window default and start with the onwire
+	 * version every host understands, until they ping us
+	 */
+	knet_h->dedup_window = KNET_DEDUP_WINDOW_DEFAULT;
+	knet_h->onwire_ver = KNET_HEADER_VERSION;
+	knet_h->onwire_ver_max = KNET_HEADER_VERSION_MAX;
+
 	/*
 	 * Set 'min' stats to the maximum value so the
 	 * first value we get is always less
@@ -612,6 +608,9 @@ knet_handle_t knet_handle_new_ex(knet_node_id_t host_id,
 	knet_h->stats.rx_compress_time_min = UINT64_MAX;
 	knet_h->stats.tx_crypt_time_min = UINT64_MAX;
 	knet_h->stats.rx_crypt_time_min = UINT64_MAX;
+	for (i = 0; i < KNET_DATAFD_MAX; i++) {
+		_channel_stats_reset(knet_h, i);
+	}
 
 	/*
 	 * init global shlib tracker
@@ -921,11 +920,13 @@ int knet_handle_add_datafd(knet_handle_t knet_h, int *datafd, int8_t *channel)
 		*datafd = knet_h->sockfd[*channel].sockfd[0];
 	}
 
+	knet_h->sockfd[*channel].tx_worker = _tx_worker_by_channel(knet_h, *channel);
+
 	memset(&ev, 0, sizeof(struct epoll_event));
 	ev.events = EPOLLIN;
 	ev.data.fd = knet_h->sockfd[*channel].sockfd[knet_h->sockfd[*channel].is_created];
 
-	if (epoll_ctl(knet_h->send_to_links_epollfd,
+	if (epoll_ctl(knet_h->tx_workers[knet_h->sockfd[*channel].tx_worker]->epollfd,
 		      EPOLL_CTL_ADD, knet_h->sockfd[*channel].sockfd[knet_h->sockfd[*channel].is_created], &ev)) {
 		savederrno = errno;
 		err = -1;
@@ -951,6 +952,7 @@ int knet_handle_remove_datafd(knet_handle_t knet_h, int datafd)
 	int8_t channel = -1;
 	int i;
 	struct epoll_event ev;
+	struct knet_host *host;
 
 	if (!knet_h) {
 		errno = EINVAL;
@@ -987,7 +989,7 @@ int knet_handle_remove_datafd(knet_handle_t knet_h, int datafd)
 	if (!knet_h->sockfd[channel].has_error) {
 		memset(&ev, 0, sizeof(struct epoll_event));
 
-		if (epoll_ctl(knet_h->send_to_links_epollfd,
+		if (epoll_ctl(knet_h->tx_workers[knet_h->sockfd[channel].tx_worker]->epollfd,
 			      EPOLL_CTL_DEL, knet_h->sockfd[channel].sockfd[knet_h->sockfd[channel].is_created], &ev)) {
 			savederrno = errno;
 			err = -1;
@@ -1002,6 +1004,15 @@ int knet_handle_remove_datafd(knet_handle_t knet_h, int datafd)
 	}
 
 	memset(&knet_h->sockfd[channel], 0, sizeof(struct knet_sock));
+	compress_channel_cfg(knet_h, channel, NULL);
+	for (host = knet_h->host_head; host != NULL; host = host->next) {
+		compress_stream_fini(knet_h, host->tx_compress_stream, channel);
+		compress_stream_fini(knet_h, host->rx_compress_stream, channel);
+	}
+	if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+		_channel_stats_reset(knet_h, channel);
+		pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+	}
 
 out_unlock:
 	pthread_rwlock_unlock(&knet_h->global_rwlock);
@@ -1100,83 +1111,93 @@ out_unlock:
 	return err;
 }
 
-int knet_handle_enable_filter(knet_handle_t knet_h,
-			      void *dst_host_filter_fn_private_data,
-			      int (*dst_host_filter_fn) (
-					void *private_data,
-					const unsigned char *outdata,
-					ssize_t outdata_len,
-					uint8_t tx_rx,
-					knet_node_id_t this_host_id,
-					knet_node_id_t src_node_id,
-					int8_t *channel,
-					knet_node_id_t *dst_host_ids,
-					size_t *dst_host_ids_entries))
+int knet_handle_set_tx_threads(knet_handle_t knet_h, uint8_t tx_threads)
 {
-	int savederrno = 0;
+	int savederrno = 0, err = 0;
+	uint8_t i, old_tx_threads;
 
 	if (!knet_h) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	savederrno = get_global_wrlock(knet_h);
+	if ((!tx_threads) || (tx_threads > KNET_MAX_TX_THREADS)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = pthread_mutex_lock(&knet_h->tx_workers_mutex);
 	if (savederrno) {
-		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get tx_workers mutex lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
 		return -1;
 	}
 
-	knet_h->dst_host_filter_fn_private_data = dst_host_filter_fn_private_data;
-	knet_h->dst_host_filter_fn = dst_host_filter_fn;
-	if (knet_h->dst_host_filter_fn) {
-		log_debug(knet_h, KNET_SUB_HANDLE, "dst_host_filter_fn enabled");
-	} else {
-		log_debug(knet_h, KNET_SUB_HANDLE, "dst_host_filter_fn disabled");
-	}
-
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
-
-	return 0;
-}
-
-int knet_handle_setfwd(knet_handle_t knet_h, unsigned int enabled)
-{
-	int savederrno = 0;
-
-	if (!knet_h) {
-		errno = EINVAL;
-		return -1;
-	}
+	old_tx_threads = knet_h->tx_workers_num;
 
-	if (enabled > 1) {
-		errno = EINVAL;
-		return -1;
+	/*
+	 * new workers are started before they are visible
+	 * to the rest of the code
+	 */
+	for (i = old_tx_threads; i < tx_threads; i++) {
+		if (_tx_worker_start(knet_h, i) < 0) {
+			savederrno = errno;
+			err = -1;
+			goto out_stop_new;
+		}
 	}
 
 	savederrno = get_global_wrlock(knet_h);
 	if (savederrno) {
 		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
 			strerror(savederrno));
-		errno = savederrno;
-		return -1;
+		err = -1;
+		goto out_stop_new;
 	}
 
-	knet_h->enabled = enabled;
+	knet_h->tx_workers_num = tx_threads;
 
-	if (enabled) {
-		log_debug(knet_h, KNET_SUB_HANDLE, "Data forwarding is enabled");
-	} else {
-		log_debug(knet_h, KNET_SUB_HANDLE, "Data forwarding is disabled");
+	if (_tx_workers_reshard(knet_h) < 0) {
+		savederrno = errno;
+		err = -1;
+	}
+
+	for (i = tx_threads; i < old_tx_threads; i++) {
+		knet_h->tx_workers[i]->stop = 1;
 	}
 
 	pthread_rwlock_unlock(&knet_h->global_rwlock);
 
-	return 0;
+	for (i = tx_threads; i < old_tx_threads; i++) {
+		_tx_worker_stop(knet_h, i);
+	}
+
+	log_debug(knet_h, KNET_SUB_HANDLE, "TX threads set to: %u", tx_threads);
+
+	goto out_unlock;
+
+out_stop_new:
+	if (!get_global_wrlock(knet_h)) {
+		for (i = old_tx_threads; i < tx_threads; i++) {
+			if (knet_h->tx_workers[i]) {
+				knet_h->tx_workers[i]->stop = 1;
+			}
+		}
+		pthread_rwlock_unlock(&knet_h->global_rwlock);
+
+		for (i = old_tx_threads; i < tx_threads; i++) {
+			_tx_worker_stop(knet_h, i);
+		}
+	}
+
+out_unlock:
+	pthread_mutex_unlock(&knet_h->tx_workers_mutex);
+	errno = savederrno;
+	return err;
 }
 
-int knet_handle_pmtud_getfreq(knet_handle_t knet_h, unsigned int *interval)
+int knet_handle_get_tx_threads(knet_handle_t knet_h, uint8_t *tx_threads)
 {
 	int savederrno = 0;
 
@@ -1185,7 +1206,7 @@ int knet_handle_pmtud_getfreq(knet_handle_t knet_h, unsigned int *interval)
 		return -1;
 	}
 
-	if (!interval) {
+	if (!tx_threads) {
 		errno = EINVAL;
 		return -1;
 	}
@@ -1198,70 +1219,863 @@ int knet_handle_pmtud_getfreq(knet_handle_t knet_h, unsigned int *interval)
 		return -1;
 	}
 
-	*interval = knet_h->pmtud_interval;
+	*tx_threads = knet_h->tx_workers_num;
 
 	pthread_rwlock_unlock(&knet_h->global_rwlock);
 
 	return 0;
 }
 
-int knet_handle_pmtud_setfreq(knet_handle_t knet_h, unsigned int interval)
+int knet_handle_set_rx_threads(knet_handle_t knet_h, uint8_t rx_threads)
 {
-	int savederrno = 0;
+	int savederrno = 0, err = 0;
+	uint8_t i, old_rx_threads;
 
 	if (!knet_h) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	if ((!interval) || (interval > 86400)) {
+	if ((!rx_threads) || (rx_threads > KNET_MAX_RX_THREADS)) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	savederrno = get_global_wrlock(knet_h);
+	savederrno = pthread_mutex_lock(&knet_h->rx_workers_mutex);
 	if (savederrno) {
-		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get rx_workers mutex lock: %s",
 			strerror(savederrno));
 		errno = savederrno;
 		return -1;
 	}
 
-	knet_h->pmtud_interval = interval;
-	log_debug(knet_h, KNET_SUB_HANDLE, "PMTUd interval set to: %u seconds", interval);
-
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
-
-	return 0;
-}
-
-int knet_handle_enable_pmtud_notify(knet_handle_t knet_h,
-				    void *pmtud_notify_fn_private_data,
-				    void (*pmtud_notify_fn) (
-						void *private_data,
-						unsigned int data_mtu))
-{
-	int savederrno = 0;
+	old_rx_threads = knet_h->rx_workers_num;
 
-	if (!knet_h) {
-		errno = EINVAL;
-		return -1;
+	/*
+	 * all RX workers poll the same epoll fd, new workers
+	 * start processing data as soon as they are created
+	 */
+	for (i = old_rx_threads; i < rx_threads; i++) {
+		if (_rx_worker_start(knet_h, i) < 0) {
+			savederrno = errno;
+			err = -1;
+			goto out_stop_new;
+		}
 	}
 
 	savederrno = get_global_wrlock(knet_h);
 	if (savederrno) {
 		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
 			strerror(savederrno));
-		errno = savederrno;
-		return -1;
+		err = -1;
+		goto out_stop_new;
 	}
 
-	knet_h->pmtud_notify_fn_private_data = pmtud_notify_fn_private_data;
+	knet_h->rx_workers_num = rx_threads;
+
+	for (i = rx_threads; i < old_rx_threads; i++) {
+		knet_h->rx_workers[i]->stop = 1;
+	}
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+
+	for (i = rx_threads; i < old_rx_threads; i++) {
+		_rx_worker_stop(knet_h, i);
+	}
+
+	log_debug(knet_h, KNET_SUB_HANDLE, "RX threads set to: %u", rx_threads);
+
+	goto out_unlock;
+
+out_stop_new:
+	if (!get_global_wrlock(knet_h)) {
+		for (i = old_rx_threads; i < rx_threads; i++) {
+			if (knet_h->rx_workers[i]) {
+				knet_h->rx_workers[i]->stop = 1;
+			}
+		}
+		pthread_rwlock_unlock(&knet_h->global_rwlock);
+
+		for (i = old_rx_threads; i < rx_threads; i++) {
+			_rx_worker_stop(knet_h, i);
+		}
+	}
+
+out_unlock:
+	pthread_mutex_unlock(&knet_h->rx_workers_mutex);
+	errno = savederrno;
+	return err;
+}
+
+int knet_handle_get_rx_threads(knet_handle_t knet_h, uint8_t *rx_threads)
+{
+	int savederrno = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!rx_threads) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get read lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	*rx_threads = knet_h->rx_workers_num;
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+
+	return 0;
+}
+
+int knet_handle_set_crypto_threads(knet_handle_t knet_h, uint8_t crypto_threads)
+{
+	int savederrno = 0, err = 0;
+	uint8_t i, old_crypto_threads;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (crypto_threads > KNET_MAX_CRYPTO_THREADS) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = pthread_mutex_lock(&knet_h->crypto_workers_mutex);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get crypto_workers mutex lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	old_crypto_threads = knet_h->crypto_workers_num;
+
+	/*
+	 * TX workers never depend on crypto workers to complete a job,
+	 * workers can be added and removed without global write lock
+	 */
+	for (i = old_crypto_threads; i < crypto_threads; i++) {
+		if (_crypto_worker_start(knet_h, i) < 0) {
+			savederrno = errno;
+			err = -1;
+			for (; i > old_crypto_threads; i--) {
+				_crypto_worker_stop(knet_h, i - 1);
+			}
+			goto out_unlock;
+		}
+	}
+
+	knet_h->crypto_workers_num = crypto_threads;
+
+	for (i = crypto_threads; i < old_crypto_threads; i++) {
+		_crypto_worker_stop(knet_h, i);
+	}
+
+	log_debug(knet_h, KNET_SUB_HANDLE, "Crypto threads set to: %u", crypto_threads);
+
+out_unlock:
+	pthread_mutex_unlock(&knet_h->crypto_workers_mutex);
+	errno = savederrno;
+	return err;
+}
+
+int knet_handle_get_crypto_threads(knet_handle_t knet_h, uint8_t *crypto_threads)
+{
+	int savederrno = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!crypto_threads) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = pthread_mutex_lock(&knet_h->crypto_workers_mutex);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get crypto_workers mutex lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	*crypto_threads = knet_h->crypto_workers_num;
+
+	pthread_mutex_unlock(&knet_h->crypto_workers_mutex);
+
+	return 0;
+}
+
+int knet_handle_enable_filter(knet_handle_t knet_h,
+			      void *dst_host_filter_fn_private_data,
+			      int (*dst_host_filter_fn) (
+					void *private_data,
+					const unsigned char *outdata,
+					ssize_t outdata_len,
+					uint8_t tx_rx,
+					knet_node_id_t this_host_id,
+					knet_node_id_t src_node_id,
+					int8_t *channel,
+					knet_node_id_t *dst_host_ids,
+					size_t *dst_host_ids_entries))
+{
+	int savederrno = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = get_global_wrlock(knet_h);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	knet_h->dst_host_filter_fn_private_data = dst_host_filter_fn_private_data;
+	knet_h->dst_host_filter_fn = dst_host_filter_fn;
+	if (knet_h->dst_host_filter_fn) {
+		log_debug(knet_h, KNET_SUB_HANDLE, "dst_host_filter_fn enabled");
+	} else {
+		log_debug(knet_h, KNET_SUB_HANDLE, "dst_host_filter_fn disabled");
+	}
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+
+	return 0;
+}
+
+int knet_handle_setfwd(knet_handle_t knet_h, unsigned int enabled)
+{
+	int savederrno = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (enabled > 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = get_global_wrlock(knet_h);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	knet_h->enabled = enabled;
+
+	if (enabled) {
+		log_debug(knet_h, KNET_SUB_HANDLE, "Data forwarding is enabled");
+	} else {
+		log_debug(knet_h, KNET_SUB_HANDLE, "Data forwarding is disabled");
+	}
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+
+	return 0;
+}
+
+int knet_handle_set_encrypt_then_fragment(knet_handle_t knet_h, unsigned int enabled)
+{
+	int savederrno = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (enabled > 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = get_global_wrlock(knet_h);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	knet_h->encrypt_then_fragment = enabled;
+
+	if (enabled) {
+		log_debug(knet_h, KNET_SUB_HANDLE, "Encrypt then fragment is enabled");
+	} else {
+		log_debug(knet_h, KNET_SUB_HANDLE, "Encrypt then fragment is disabled");
+	}
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+
+	return 0;
+}
+
+int knet_handle_get_encrypt_then_fragment(knet_handle_t knet_h, unsigned int *enabled)
+{
+	int savederrno = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!enabled) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get read lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	*enabled = knet_h->encrypt_then_fragment;
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+
+	return 0;
+}
+
+int knet_handle_set_defrag_bufs(knet_handle_t knet_h, uint32_t max_bufs, uint32_t expire_msecs)
+{
+	int savederrno = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((!max_bufs) || (!expire_msecs)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = get_global_wrlock(knet_h);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	/*
+	 * RX workers hold the global read lock when using the pool,
+	 * buffers currently in use are released when given back
+	 */
+	knet_h->defrag_pool_max = max_bufs;
+	knet_h->defrag_expire = expire_msecs;
+	_defrag_pool_trim(knet_h);
+
+	log_debug(knet_h, KNET_SUB_HANDLE, "Defrag pool set to %u buffers, expire after %u msecs",
+		  max_bufs, expire_msecs);
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+
+	return 0;
+}
+
+int knet_handle_get_defrag_bufs(knet_handle_t knet_h, uint32_t *max_bufs, uint32_t *expire_msecs)
+{
+	int savederrno = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((!max_bufs) || (!expire_msecs)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get read lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	*max_bufs = knet_h->defrag_pool_max;
+	*expire_msecs = knet_h->defrag_expire;
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+
+	return 0;
+}
+
+int knet_handle_set_dedup_window(knet_handle_t knet_h, uint32_t window)
+{
+	int savederrno = 0, err = 0;
+	struct knet_host *host;
+	uint64_t **cbufs = NULL;
+	size_t host_idx, hosts = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((window < KNET_DEDUP_WINDOW_MIN) || (window > KNET_DEDUP_WINDOW_MAX) ||
+	    (window & (window - 1))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = get_global_wrlock(knet_h);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	if (window == knet_h->dedup_window) {
+		goto exit_unlock;
+	}
+
+	/*
+	 * allocate all the new buffers first, so that on failure
+	 * the hosts are left untouched
+	 */
+	for (host = knet_h->host_head; host != NULL; host = host->next) {
+		hosts++;
+	}
+
+	if (hosts) {
+		cbufs = calloc(hosts, sizeof(uint64_t *));
+		if (!cbufs) {
+			savederrno = errno;
+			err = -1;
+			log_err(knet_h, KNET_SUB_HANDLE, "Unable to allocate memory for dedup buffers: %s",
+				strerror(savederrno));
+			goto exit_unlock;
+		}
+		for (host_idx = 0; host_idx < hosts; host_idx++) {
+			cbufs[host_idx] = _cbuffers_alloc(window);
+			if (!cbufs[host_idx]) {
+				savederrno = errno;
+				err = -1;
+				log_err(knet_h, KNET_SUB_HANDLE, "Unable to allocate memory for dedup buffers: %s",
+					strerror(savederrno));
+				goto exit_free;
+			}
+		}
+	}
+
+	/*
+	 * RX workers hold the global read lock when using the buffers
+	 */
+	host_idx = 0;
+	for (host = knet_h->host_head; host != NULL; host = host->next) {
+		_cbuffers_install(host, cbufs[host_idx], window);
+		cbufs[host_idx] = NULL;
+		host_idx++;
+	}
+
+	knet_h->dedup_window = window;
+
+	log_debug(knet_h, KNET_SUB_HANDLE, "Dedup window set to %u packets", window);
+
+exit_free:
+	if (cbufs) {
+		for (host_idx = 0; host_idx < hosts; host_idx++) {
+			free(cbufs[host_idx]);
+		}
+		free(cbufs);
+	}
+
+exit_unlock:
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	errno = savederrno;
+	return err;
+}
+
+int knet_handle_get_dedup_window(knet_handle_t knet_h, uint32_t *window)
+{
+	int savederrno = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!window) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get read lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	*window = knet_h->dedup_window;
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+
+	return 0;
+}
+
+int knet_handle_pmtud_getfreq(knet_handle_t knet_h, unsigned int *interval)
+{
+	int savederrno = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!interval) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get read lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	*interval = knet_h->pmtud_interval;
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+
+	return 0;
+}
+
+int knet_handle_pmtud_setfreq(knet_handle_t knet_h, unsigned int interval)
+{
+	int savederrno = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((!interval) || (interval > 86400)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = get_global_wrlock(knet_h);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	knet_h->pmtud_interval = interval;
+	log_debug(knet_h, KNET_SUB_HANDLE, "PMTUd interval set to: %u seconds", interval);
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+
+	return 0;
+}
+
+int knet_handle_enable_pmtud_notify(knet_handle_t knet_h,
+				    void *pmtud_notify_fn_private_data,
+				    void (*pmtud_notify_fn) (
+						void *private_data,
+						unsigned int data_mtu))
+{
+	int savederrno = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = get_global_wrlock(knet_h);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	knet_h->pmtud_notify_fn_private_data = pmtud_notify_fn_private_data;
 	knet_h->pmtud_notify_fn = pmtud_notify_fn;
 	if (knet_h->pmtud_notify_fn) {
 		log_debug(knet_h, KNET_SUB_HANDLE, "pmtud_notify_fn enabled");
 	} else {
-		log_debug(knet_h, KNET_SUB_HANDLE, "pmtud_notify_fn disabled");
+		log_debug(knet_h, KNET_SUB_HANDLE, "pmtud_notify_fn disabled");
+	}
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+
+	return 0;
+}
+
+int knet_handle_pmtud_get(knet_handle_t knet_h,
+			  unsigned int *data_mtu)
+{
+	int savederrno = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!data_mtu) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get read lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	*data_mtu = knet_h->data_mtu;
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+
+	return 0;
+}
+
+int knet_handle_crypto(knet_handle_t knet_h, struct knet_handle_crypto_cfg *knet_handle_crypto_cfg)
+{
+	int savederrno = 0;
+	int err = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!knet_handle_crypto_cfg) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = get_global_wrlock(knet_h);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	crypto_fini(knet_h);
+
+	if ((!strncmp("none", knet_handle_crypto_cfg->crypto_model, 4)) || 
+	    ((!strncmp("none", knet_handle_crypto_cfg->crypto_cipher_type, 4)) &&
+	     (!strncmp("none", knet_handle_crypto_cfg->crypto_hash_type, 4)))) {
+		log_debug(knet_h, KNET_SUB_CRYPTO, "crypto is not enabled");
+		err = 0;
+		goto exit_unlock;
+	}
+
+	if (knet_handle_crypto_cfg->private_key_len < KNET_MIN_KEY_LEN) {
+		log_debug(knet_h, KNET_SUB_CRYPTO, "private key len too short (min %d): %u",
+			  KNET_MIN_KEY_LEN, knet_handle_crypto_cfg->private_key_len);
+		savederrno = EINVAL;
+		err = -1;
+		goto exit_unlock;
+	}
+
+	if (knet_handle_crypto_cfg->private_key_len > KNET_MAX_KEY_LEN) {
+		log_debug(knet_h, KNET_SUB_CRYPTO, "private key len too long (max %d): %u",
+			  KNET_MAX_KEY_LEN, knet_handle_crypto_cfg->private_key_len);
+		savederrno = EINVAL;
+		err = -1;
+		goto exit_unlock;
+	}
+
+	err = crypto_init(knet_h, knet_handle_crypto_cfg);
+
+	if (err) {
+		err = -2;
+		savederrno = errno;
+	}
+
+exit_unlock:
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	errno = savederrno;
+	return err;
+}
+
+int knet_handle_compress(knet_handle_t knet_h, struct knet_handle_compress_cfg *knet_handle_compress_cfg)
+{
+	int savederrno = 0;
+	int err = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!knet_handle_compress_cfg) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = get_global_wrlock(knet_h);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	compress_fini(knet_h, 0);
+	err = compress_cfg(knet_h, knet_handle_compress_cfg);
+	savederrno = errno;
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	errno = savederrno;
+	return err;
+}
+
+int knet_handle_compress_dict_train(knet_handle_t knet_h, const char *compress_model,
+				    const char *samples, const size_t *samples_sizes,
+				    unsigned int samples_num,
+				    char *dict, size_t *dict_len)
+{
+	int savederrno = 0;
+	int err = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((!compress_model) || (!samples) || (!samples_sizes) || (!samples_num)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((!dict) || (!dict_len) || (!*dict_len)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get read lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	err = compress_dict_train(knet_h, compress_model,
+				  (const unsigned char *)samples, samples_sizes, samples_num,
+				  (unsigned char *)dict, dict_len);
+	savederrno = errno;
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	errno = savederrno;
+	return err;
+}
+
+int knet_handle_compress_dict(knet_handle_t knet_h, const char *compress_model,
+			      const char *dict, size_t dict_len)
+{
+	int savederrno = 0;
+	int err = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!compress_model) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((dict) && (!dict_len)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = get_global_wrlock(knet_h);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	err = compress_dict_set(knet_h, compress_model, (const unsigned char *)dict, dict_len);
+	savederrno = errno;
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	errno = savederrno;
+	return err;
+}
+
+int knet_handle_set_compress_adaptive(knet_handle_t knet_h, unsigned int enabled)
+{
+	int savederrno = 0;
+	int i;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (enabled > 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = get_global_wrlock(knet_h);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	knet_h->compress_adaptive = enabled;
+
+	/*
+	 * start again from a clean state
+	 */
+	for (i = 0; i < KNET_MAX_TX_THREADS; i++) {
+		if (knet_h->tx_workers[i]) {
+			memset(knet_h->tx_workers[i]->compress_adaptive, 0, sizeof(knet_h->tx_workers[i]->compress_adaptive));
+		}
+	}
+
+	if (enabled) {
+		log_debug(knet_h, KNET_SUB_HANDLE, "Adaptive compression is enabled");
+	} else {
+		log_debug(knet_h, KNET_SUB_HANDLE, "Adaptive compression is disabled");
 	}
 
 	pthread_rwlock_unlock(&knet_h->global_rwlock);
@@ -1269,8 +2083,7 @@ int knet_handle_enable_pmtud_notify(knet_handle_t knet_h,
 	return 0;
 }
 
-int knet_handle_pmtud_get(knet_handle_t knet_h,
-			  unsigned int *data_mtu)
+int knet_handle_get_compress_adaptive(knet_handle_t knet_h, unsigned int *enabled)
 {
 	int savederrno = 0;
 
@@ -1279,7 +2092,7 @@ int knet_handle_pmtud_get(knet_handle_t knet_h,
 		return -1;
 	}
 
-	if (!data_mtu) {
+	if (!enabled) {
 		errno = EINVAL;
 		return -1;
 	}
@@ -1292,14 +2105,15 @@ int knet_handle_pmtud_get(knet_handle_t knet_h,
 		return -1;
 	}
 
-	*data_mtu = knet_h->data_mtu;
+	*enabled = knet_h->compress_adaptive;
 
 	pthread_rwlock_unlock(&knet_h->global_rwlock);
 
 	return 0;
 }
 
-int knet_handle_crypto(knet_handle_t knet_h, struct knet_handle_crypto_cfg *knet_handle_crypto_cfg)
+int knet_handle_set_channel_compress(knet_handle_t knet_h, int8_t channel,
+				     struct knet_handle_compress_cfg *knet_handle_compress_cfg)
 {
 	int savederrno = 0;
 	int err = 0;
@@ -1309,7 +2123,13 @@ int knet_handle_crypto(knet_handle_t knet_h, struct knet_handle_crypto_cfg *knet
 		return -1;
 	}
 
-	if (!knet_handle_crypto_cfg) {
+	if ((channel < 0) || (channel >= KNET_DATAFD_MAX)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((knet_handle_compress_cfg) &&
+	    (!strcmp(knet_handle_compress_cfg->compress_model, "auto"))) {
 		errno = EINVAL;
 		return -1;
 	}
@@ -1322,56 +2142,75 @@ int knet_handle_crypto(knet_handle_t knet_h, struct knet_handle_crypto_cfg *knet
 		return -1;
 	}
 
-	crypto_fini(knet_h);
+	if (!knet_h->sockfd[channel].in_use) {
+		savederrno = EINVAL;
+		err = -1;
+		goto out_unlock;
+	}
 
-	if ((!strncmp("none", knet_handle_crypto_cfg->crypto_model, 4)) || 
-	    ((!strncmp("none", knet_handle_crypto_cfg->crypto_cipher_type, 4)) &&
-	     (!strncmp("none", knet_handle_crypto_cfg->crypto_hash_type, 4)))) {
-		log_debug(knet_h, KNET_SUB_CRYPTO, "crypto is not enabled");
-		err = 0;
-		goto exit_unlock;
+	err = compress_channel_cfg(knet_h, channel, knet_handle_compress_cfg);
+	savederrno = errno;
+
+out_unlock:
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	errno = savederrno;
+	return err;
+}
+
+int knet_handle_get_channel_compress(knet_handle_t knet_h, int8_t channel,
+				     struct knet_handle_compress_cfg *knet_handle_compress_cfg)
+{
+	int savederrno = 0;
+	int err = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
 	}
 
-	if (knet_handle_crypto_cfg->private_key_len < KNET_MIN_KEY_LEN) {
-		log_debug(knet_h, KNET_SUB_CRYPTO, "private key len too short (min %d): %u",
-			  KNET_MIN_KEY_LEN, knet_handle_crypto_cfg->private_key_len);
-		savederrno = EINVAL;
-		err = -1;
-		goto exit_unlock;
+	if ((channel < 0) || (channel >= KNET_DATAFD_MAX)) {
+		errno = EINVAL;
+		return -1;
 	}
 
-	if (knet_handle_crypto_cfg->private_key_len > KNET_MAX_KEY_LEN) {
-		log_debug(knet_h, KNET_SUB_CRYPTO, "private key len too long (max %d): %u",
-			  KNET_MAX_KEY_LEN, knet_handle_crypto_cfg->private_key_len);
-		savederrno = EINVAL;
-		err = -1;
-		goto exit_unlock;
+	if (!knet_handle_compress_cfg) {
+		errno = EINVAL;
+		return -1;
 	}
 
-	err = crypto_init(knet_h, knet_handle_crypto_cfg);
+	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get read lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
 
-	if (err) {
-		err = -2;
-		savederrno = errno;
+	if (!knet_h->sockfd[channel].in_use) {
+		savederrno = EINVAL;
+		err = -1;
+		goto out_unlock;
 	}
 
-exit_unlock:
+	compress_channel_get_cfg(knet_h, channel, knet_handle_compress_cfg);
+
+out_unlock:
 	pthread_rwlock_unlock(&knet_h->global_rwlock);
 	errno = savederrno;
 	return err;
 }
 
-int knet_handle_compress(knet_handle_t knet_h, struct knet_handle_compress_cfg *knet_handle_compress_cfg)
+int knet_handle_set_compress_stream(knet_handle_t knet_h, unsigned int enabled)
 {
 	int savederrno = 0;
-	int err = 0;
+	struct knet_host *host;
 
 	if (!knet_h) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	if (!knet_handle_compress_cfg) {
+	if (enabled > 1) {
 		errno = EINVAL;
 		return -1;
 	}
@@ -1384,13 +2223,56 @@ int knet_handle_compress(knet_handle_t knet_h, struct knet_handle_compress_cfg *
 		return -1;
 	}
 
-	compress_fini(knet_h, 0);
-	err = compress_cfg(knet_h, knet_handle_compress_cfg);
-	savederrno = errno;
+	knet_h->compress_stream = enabled;
+
+	/*
+	 * release the TX history, a new stream starts
+	 * from scratch if it is enabled again
+	 */
+	if (!enabled) {
+		for (host = knet_h->host_head; host != NULL; host = host->next) {
+			compress_stream_fini(knet_h, host->tx_compress_stream, -1);
+		}
+	}
+
+	if (enabled) {
+		log_debug(knet_h, KNET_SUB_HANDLE, "Stream compression is enabled");
+	} else {
+		log_debug(knet_h, KNET_SUB_HANDLE, "Stream compression is disabled");
+	}
 
 	pthread_rwlock_unlock(&knet_h->global_rwlock);
-	errno = savederrno;
-	return err;
+
+	return 0;
+}
+
+int knet_handle_get_compress_stream(knet_handle_t knet_h, unsigned int *enabled)
+{
+	int savederrno = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!enabled) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = pthread_rwlock_rdlock(&knet_h->global_rwlock);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get read lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	*enabled = knet_h->compress_stream;
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+
+	return 0;
 }
 
 ssize_t knet_recv(knet_handle_t knet_h, char *buff, const size_t buff_len, const int8_t channel)
@@ -1567,10 +2449,54 @@ int knet_handle_get_stats(knet_handle_t knet_h, struct knet_handle_stats *stats,
 	return err;
 }
 
+int knet_handle_get_channel_stats(knet_handle_t knet_h, int8_t channel,
+				  struct knet_channel_stats *stats, size_t struct_size)
+{
+	int savederrno = 0;
+	int err = 0;
+
+	if (!knet_h) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((channel < 0) || (channel >= KNET_DATAFD_MAX)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!stats) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	savederrno = get_global_wrlock(knet_h);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_HANDLE, "Unable to get write lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	if (struct_size > sizeof(struct knet_channel_stats)) {
+		struct_size = sizeof(struct knet_channel_stats);
+	}
+
+	memmove(stats, &knet_h->channel_stats[channel], struct_size);
+
+	/* Tell the caller our full size in case they have an old version */
+	stats->size = sizeof(struct knet_channel_stats);
+
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+	errno = savederrno;
+	return err;
+}
+
 int knet_handle_clear_stats(knet_handle_t knet_h, int clear_option)
 {
 	int savederrno = 0;
 	int err = 0;
+	int i;
 
 	if (!knet_h) {
 		errno = EINVAL;
@@ -1593,6 +2519,9 @@ int knet_handle_clear_stats(knet_handle_t knet_h, int clear_option)
 
 	memset(&knet_h->stats, 0, sizeof(struct knet_handle_stats));
 	memset(&knet_h->stats_extra, 0, sizeof(struct knet_handle_stats_extra));
+	for (i = 0; i < KNET_DATAFD_MAX; i++) {
+		_channel_stats_reset(knet_h, i);
+	}
 	if (clear_option == KNET_CLEARSTATS_HANDLE_AND_LINK) {
 		_link_clear_stats(knet_h);
 	}
@@ -15,6 +15,7 @@
 #include <pthread.h>
 #include <stdio.h>
 
+#include "compress.h"
 #include "host.h"
 #include "internals.h"
 #include "logging.h"
@@ -35,6 +36,7 @@ int knet_host_add(knet_handle_t knet_h, knet_node_id_t host_id)
 {
 	int savederrno = 0, err = 0;
 	struct knet_host *host = NULL;
+	uint64_t *cbuf;
 	uint8_t link_idx;
 
 	if (!knet_h) {
@@ -69,6 +71,24 @@ int knet_host_add(knet_handle_t knet_h, knet_node_id_t host_id)
 
 	memset(host, 0, sizeof(struct knet_host));
 
+	cbuf = _cbuffers_alloc(knet_h->dedup_window);
+	if (!cbuf) {
+		err = -1;
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_HOST, "Unable to allocate dedup buffers for host %u: %s",
+			host_id, strerror(savederrno));
+		goto exit_unlock;
+	}
+	_cbuffers_install(host, cbuf, knet_h->dedup_window);
+
+	savederrno = pthread_mutex_init(&host->rx_mutex, NULL);
+	if (savederrno) {
+		err = -1;
+		log_err(knet_h, KNET_SUB_HOST, "Unable to initialize RX mutex for host %u: %s",
+			host_id, strerror(savederrno));
+		goto exit_unlock;
+	}
+
 	/*
 	 * set host_id
 	 */
@@ -104,7 +124,8 @@ int knet_host_add(knet_handle_t knet_h, knet_node_id_t host_id)
 
 exit_unlock:
 	pthread_rwlock_unlock(&knet_h->global_rwlock);
-	if (err < 0) {
+	if ((err < 0) && (host)) {
+		free(host->circular_buffer);
 		free(host);
 	}
 	errno = savederrno;
@@ -173,10 +194,23 @@ int knet_host_remove(knet_handle_t knet_h, knet_node_id_t host_id)
 	}
 
 	knet_h->host_index[host_id] = NULL;
+	_defrag_bufs_release(knet_h, removed, 0);
+	compress_stream_fini(knet_h, removed->tx_compress_stream, -1);
+	compress_stream_fini(knet_h, removed->rx_compress_stream, -1);
+	pthread_mutex_destroy(&removed->rx_mutex);
+	free(removed->circular_buffer);
 	free(removed);
 
 	_host_list_update(knet_h);
 
+	/*
+	 * removing an older host might allow a newer onwire version
+	 */
+	if (!pthread_mutex_lock(&knet_h->tx_seq_num_mutex)) {
+		_handle_update_onwire_ver(knet_h);
+		pthread_mutex_unlock(&knet_h->tx_seq_num_mutex);
+	}
+
 exit_unlock:
 	pthread_rwlock_unlock(&knet_h->global_rwlock);
 	errno = savederrno;
@@ -548,18 +582,192 @@ int _send_host_info(knet_handle_t knet_h, const void *data, const size_t datalen
 	return 0;
 }
 
-static void _clear_cbuffers(struct knet_host *host, seq_num_t rx_seq_num)
+/*
+ * defrag pool. Buffers are allocated on demand up to knet_h->defrag_pool_max
+ * and kept on the free list for reuse until the handle is freed.
+ */
+
+struct knet_defrag_chunk *_defrag_pool_get(knet_handle_t knet_h)
+{
+	struct knet_defrag_chunk *chunk = NULL;
+
+	if (pthread_mutex_lock(&knet_h->defrag_pool_mutex) != 0) {
+		log_debug(knet_h, KNET_SUB_RX, "Unable to get defrag pool mutex lock");
+		errno = EAGAIN;
+		return NULL;
+	}
+
+	if (knet_h->defrag_pool) {
+		chunk = knet_h->defrag_pool;
+		knet_h->defrag_pool = chunk->next;
+		pthread_mutex_unlock(&knet_h->defrag_pool_mutex);
+		return chunk;
+	}
+
+	if (knet_h->defrag_pool_allocated >= knet_h->defrag_pool_max) {
+		pthread_mutex_unlock(&knet_h->defrag_pool_mutex);
+		errno = ENOBUFS;
+		return NULL;
+	}
+
+	knet_h->defrag_pool_allocated++;
+	pthread_mutex_unlock(&knet_h->defrag_pool_mutex);
+
+	chunk = malloc(sizeof(struct knet_defrag_chunk));
+	if (!chunk) {
+		(void)pthread_mutex_lock(&knet_h->defrag_pool_mutex);
+		knet_h->defrag_pool_allocated--;
+		pthread_mutex_unlock(&knet_h->defrag_pool_mutex);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return chunk;
+}
+
+void _defrag_pool_put(knet_handle_t knet_h, struct knet_defrag_chunk *chunk)
+{
+	(void)pthread_mutex_lock(&knet_h->defrag_pool_mutex);
+
+	/*
+	 * the pool might have been shrunk while the buffer was in use
+	 */
+	if (knet_h->defrag_pool_allocated > knet_h->defrag_pool_max) {
+		knet_h->defrag_pool_allocated--;
+		free(chunk);
+	} else {
+		chunk->next = knet_h->defrag_pool;
+		knet_h->defrag_pool = chunk;
+	}
+
+	pthread_mutex_unlock(&knet_h->defrag_pool_mutex);
+}
+
+/*
+ * free the buffers that are not in use, down to the current max
+ */
+void _defrag_pool_trim(knet_handle_t knet_h)
+{
+	struct knet_defrag_chunk *chunk;
+
+	(void)pthread_mutex_lock(&knet_h->defrag_pool_mutex);
+
+	while ((knet_h->defrag_pool) &&
+	       (knet_h->defrag_pool_allocated > knet_h->defrag_pool_max)) {
+		chunk = knet_h->defrag_pool;
+		knet_h->defrag_pool = chunk->next;
+		knet_h->defrag_pool_allocated--;
+		free(chunk);
+	}
+
+	pthread_mutex_unlock(&knet_h->defrag_pool_mutex);
+}
+
+/*
+ * return the host reassembly buffers (both the authenticated and the
+ * encrypt-then-fragment ones) to the pool, all of them or only those that did not receive a fragment in the last
+ * knet_h->defrag_expire msecs. Needs the host rx_mutex.
+ */
+void _defrag_bufs_release(knet_handle_t knet_h, struct knet_host *host, int expired_only)
+{
+	struct knet_host_defrag_buf *defrag_bufs[2] = { host->defrag_buf, host->crypt_defrag_buf };
+	struct knet_host_defrag_buf *defrag_buf;
+	struct timespec now;
+	unsigned long long diff;
+	int i, j;
+
+	if (expired_only) {
+		if (clock_gettime(CLOCK_MONOTONIC, &now) < 0) {
+			return;
+		}
+	}
+
+	for (j = 0; j < 2; j++) {
+		for (i = 0; i < KNET_MAX_LINK; i++) {
+			defrag_buf = &defrag_bufs[j][i];
+			if (!defrag_buf->chunk) {
+				continue;
+			}
+			if (expired_only) {
+				timespec_diff(defrag_buf->last_update, now, &diff);
+				if (diff < (knet_h->defrag_expire * 1000000llu)) {
+					continue;
+				}
+				log_debug(knet_h, KNET_SUB_RX, "Defrag buffer for host %u seq %u expired",
+					  host->host_id, defrag_buf->pckt_seq);
+			}
+			_defrag_pool_put(knet_h, defrag_buf->chunk);
+			memset(defrag_buf, 0, sizeof(struct knet_host_defrag_buf));
+		}
+	}
+}
+
+/*
+ * the circular buffers are bitsets, one bit per seq_num in the window.
+ * Both buffers of a host are allocated in one block of size bits each,
+ * size is a power of 2 and a multiple of 64.
+ */
+
+uint64_t *_cbuffers_alloc(uint32_t size)
+{
+	return calloc(2, size / 8);
+}
+
+/*
+ * replace the host circular buffers with cbuf (from _cbuffers_alloc),
+ * the old ones are freed. The dedup history is lost.
+ */
+void _cbuffers_install(struct knet_host *host, uint64_t *cbuf, uint32_t size)
 {
-	int i;
+	free(host->circular_buffer);
+	host->circular_buffer = cbuf;
+	host->circular_buffer_defrag = cbuf + (size / 64);
+	host->cbuffer_size = size;
+}
 
-	memset(host->circular_buffer, 0, KNET_CBUFFER_SIZE);
+static void _clear_cbuffers(knet_handle_t knet_h, struct knet_host *host, seq_num_t rx_seq_num)
+{
+	memset(host->circular_buffer, 0, host->cbuffer_size / 8);
 	host->rx_seq_num = rx_seq_num;
 
-	memset(host->circular_buffer_defrag, 0, KNET_CBUFFER_SIZE);
+	memset(host->circular_buffer_defrag, 0, host->cbuffer_size / 8);
+
+	_defrag_bufs_release(knet_h, host, 0);
+}
+
+static inline int _cbuf_test(const uint64_t *cbuf, size_t idx)
+{
+	return (cbuf[idx >> 6] >> (idx & 63)) & 1;
+}
+
+/*
+ * clear the [from, to] range (from <= to) in both circular buffers,
+ * the inner loop works on whole words and gets vectorized by the compiler
+ */
+static void _cbuf_clear_range(struct knet_host *host, size_t from, size_t to)
+{
+	size_t first = from >> 6, last = to >> 6, w;
+	uint64_t first_mask = ~0ULL << (from & 63);
+	uint64_t last_mask = ~0ULL >> (63 - (to & 63));
+	uint64_t *cbuf = host->circular_buffer;
+	uint64_t *cbuf_defrag = host->circular_buffer_defrag;
+
+	if (first == last) {
+		cbuf[first] &= ~(first_mask & last_mask);
+		cbuf_defrag[first] &= ~(first_mask & last_mask);
+		return;
+	}
+
+	cbuf[first] &= ~first_mask;
+	cbuf_defrag[first] &= ~first_mask;
 
-	for (i = 0; i < KNET_MAX_LINK; i++) {
-		memset(&host->defrag_buf[i], 0, sizeof(struct knet_host_defrag_buf));
+	for (w = first + 1; w < last; w++) {
+		cbuf[w] = 0;
+		cbuf_defrag[w] = 0;
 	}
+
+	cbuf[last] &= ~last_mask;
+	cbuf_defrag[last] &= ~last_mask;
 }
 
 /*
@@ -567,16 +775,14 @@ static void _clear_cbuffers(struct knet_host *host, seq_num_t rx_seq_num)
  * defrag_buf = 0 -> use normal cbuf 1 -> use the defrag buffer lookup
  */
 
-int _seq_num_lookup(struct knet_host *host, seq_num_t seq_num, int defrag_buf, int clear_buf)
+int _seq_num_lookup(knet_handle_t knet_h, struct knet_host *host, seq_num_t seq_num, int defrag_buf, int clear_buf)
 {
 	size_t i, j; /* circular buffer indexes */
 	seq_num_t seq_dist;
-	char *dst_cbuf = host->circular_buffer;
-	char *dst_cbuf_defrag = host->circular_buffer_defrag;
 	seq_num_t *dst_seq_num = &host->rx_seq_num;
 
 	if (clear_buf) {
-		_clear_cbuffers(host, seq_num);
+		_clear_cbuffers(knet_h, host, seq_num);
 	}
 
 	if (seq_num < *dst_seq_num) {
@@ -585,31 +791,32 @@ int _seq_num_lookup(struct knet_host *host, seq_num_t seq_num, int defrag_buf, i
 		seq_dist = *dst_seq_num - seq_num;
 	}
 
-	j = seq_num % KNET_CBUFFER_SIZE;
+	j = seq_num & (host->cbuffer_size - 1);
 
-	if (seq_dist < KNET_CBUFFER_SIZE) { /* seq num is in ring buffer */
+	if (seq_dist < host->cbuffer_size) { /* seq num is in ring buffer */
 		if (!defrag_buf) {
-			return (dst_cbuf[j] == 0) ? 1 : 0;
+			return (_cbuf_test(host->circular_buffer, j) == 0) ? 1 : 0;
 		} else {
-			return (dst_cbuf_defrag[j] == 0) ? 1 : 0;
+			return (_cbuf_test(host->circular_buffer_defrag, j) == 0) ? 1 : 0;
 		}
-	} else if (seq_dist <= SEQ_MAX - KNET_CBUFFER_SIZE) {
-		memset(dst_cbuf, 0, KNET_CBUFFER_SIZE);
-		memset(dst_cbuf_defrag, 0, KNET_CBUFFER_SIZE);
+	} else if (seq_dist <= SEQ_MAX - host->cbuffer_size) {
+		/*
+		 * jumped out of the window, nothing in there is valid anymore
+		 */
+		memset(host->circular_buffer, 0, host->cbuffer_size / 8);
+		memset(host->circular_buffer_defrag, 0, host->cbuffer_size / 8);
 		*dst_seq_num = seq_num;
+		return 1;
 	}
 
 	/* cleaning up circular buffer */
-	i = (*dst_seq_num + 1) % KNET_CBUFFER_SIZE;
+	i = (*dst_seq_num + 1) & (host->cbuffer_size - 1);
 
 	if (i > j) {
-		memset(dst_cbuf + i, 0, KNET_CBUFFER_SIZE - i);
-		memset(dst_cbuf, 0, j + 1);
-		memset(dst_cbuf_defrag + i, 0, KNET_CBUFFER_SIZE - i);
-		memset(dst_cbuf_defrag, 0, j + 1);
+		_cbuf_clear_range(host, i, host->cbuffer_size - 1);
+		_cbuf_clear_range(host, 0, j);
 	} else {
-		memset(dst_cbuf + i, 0, j - i + 1);
-		memset(dst_cbuf_defrag + i, 0, j - i + 1);
+		_cbuf_clear_range(host, i, j);
 	}
 
 	*dst_seq_num = seq_num;
@@ -617,17 +824,114 @@ int _seq_num_lookup(struct knet_host *host, seq_num_t seq_num, int defrag_buf, i
 	return 1;
 }
 
+/*
+ * same as _seq_num_lookup, without touching the circular buffers.
+ * Returns 1 if seq_num is in the window and has been delivered already.
+ */
+int _seq_num_seen(struct knet_host *host, seq_num_t seq_num)
+{
+	seq_num_t seq_dist;
+
+	if (seq_num < host->rx_seq_num) {
+		seq_dist =  (SEQ_MAX - seq_num) + host->rx_seq_num;
+	} else {
+		seq_dist = host->rx_seq_num - seq_num;
+	}
+
+	if (seq_dist >= host->cbuffer_size) {
+		return 0;
+	}
+
+	return _cbuf_test(host->circular_buffer, seq_num & (host->cbuffer_size - 1));
+}
+
 void _seq_num_set(struct knet_host *host, seq_num_t seq_num, int defrag_buf)
 {
-	if (!defrag_buf) { 
-		host->circular_buffer[seq_num % KNET_CBUFFER_SIZE] = 1;
+	size_t idx = seq_num & (host->cbuffer_size - 1);
+	uint64_t bit = 1ULL << (idx & 63);
+
+	if (!defrag_buf) {
+		host->circular_buffer[idx >> 6] |= bit;
 	} else {
-		host->circular_buffer_defrag[seq_num % KNET_CBUFFER_SIZE] = 1;
+		host->circular_buffer_defrag[idx >> 6] |= bit;
 	}
 
 	return;
 }
 
+/*
+ * onwire v1 packets only carry the lower 16 bits of the seq_num.
+ * Pick the seq_num closest to the last one received from the host.
+ */
+seq_num_t _seq_num_extend(struct knet_host *host, uint16_t seq_num_lo)
+{
+	seq_num_t seq_num = (host->rx_seq_num & ~(seq_num_t)SEQ_ONWIRE_V1_MAX) | seq_num_lo;
+	int32_t diff = (int32_t)(seq_num - host->rx_seq_num);
+
+	if (diff > (SEQ_ONWIRE_V1_MAX / 2)) {
+		seq_num -= SEQ_ONWIRE_V1_MAX + 1;
+	} else if (diff < -(SEQ_ONWIRE_V1_MAX / 2) - 1) {
+		seq_num += SEQ_ONWIRE_V1_MAX + 1;
+	}
+
+	return seq_num;
+}
+
+/*
+ * data packets are sent with the highest onwire version supported
+ * by all the reachable hosts. Hosts that did not ping us yet
+ * might be running an older version of knet.
+ * Needs tx_seq_num_mutex.
+ */
+void _handle_update_onwire_ver(knet_handle_t knet_h)
+{
+	struct knet_host *host;
+	uint8_t onwire_ver = knet_h->onwire_ver_max;
+	uint8_t host_ver;
+
+	for (host = knet_h->host_head; host != NULL; host = host->next) {
+		if ((host->host_id == knet_h->host_id) || (!host->status.reachable)) {
+			continue;
+		}
+		host_ver = host->onwire_ver_max;
+		if (host_ver < KNET_HEADER_VERSION) {
+			host_ver = KNET_HEADER_VERSION;
+		}
+		if (host_ver < onwire_ver) {
+			onwire_ver = host_ver;
+		}
+	}
+
+	if (knet_h->onwire_ver != onwire_ver) {
+		log_info(knet_h, KNET_SUB_HOST, "Sending data packets with onwire version %u (was %u)",
+			 onwire_ver, knet_h->onwire_ver);
+		knet_h->onwire_ver = onwire_ver;
+	}
+}
+
+/*
+ * record the onwire version advertised by the host pings.
+ * Needs the host rx_mutex.
+ */
+void _host_set_onwire_ver(knet_handle_t knet_h, struct knet_host *host, uint8_t onwire_ver_max)
+{
+	if (host->onwire_ver_max == onwire_ver_max) {
+		return;
+	}
+
+	if (pthread_mutex_lock(&knet_h->tx_seq_num_mutex)) {
+		log_debug(knet_h, KNET_SUB_HOST, "Unable to get seq mutex lock");
+		return;
+	}
+
+	log_debug(knet_h, KNET_SUB_HOST, "host: %u supports onwire version up to %u",
+		  host->host_id, onwire_ver_max);
+	host->onwire_ver_max = onwire_ver_max;
+	_handle_update_onwire_ver(knet_h);
+
+	pthread_mutex_unlock(&knet_h->tx_seq_num_mutex);
+}
+
 int _host_dstcache_update_async(knet_handle_t knet_h, struct knet_host *host)
 {
 	int savederrno = 0;
@@ -690,13 +994,20 @@ int _host_dstcache_update_sync(knet_handle_t knet_h, struct knet_host *host)
 	/* no active links, we can clean the circular buffers and indexes */
 	if (!host->active_link_entries) {
 		log_warn(knet_h, KNET_SUB_HOST, "host: %u has no active links", host->host_id);
-		_clear_cbuffers(host, 0);
+		if (!pthread_mutex_lock(&host->rx_mutex)) {
+			_clear_cbuffers(knet_h, host, 0);
+			pthread_mutex_unlock(&host->rx_mutex);
+		}
 	} else {
 		reachable = 1;
 	}
 
 	if (host->status.reachable != reachable) {
 		host->status.reachable = reachable;
+		if (!pthread_mutex_lock(&knet_h->tx_seq_num_mutex)) {
+			_handle_update_onwire_ver(knet_h);
+			pthread_mutex_unlock(&knet_h->tx_seq_num_mutex);
+		}
 		if (knet_h->host_status_change_notify_fn) {
 			knet_h->host_status_change_notify_fn(
 						     knet_h->host_status_change_notify_fn_private_data,
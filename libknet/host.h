@@ -12,8 +12,21 @@
 
 #include "internals.h"
 
-int _seq_num_lookup(struct knet_host *host, seq_num_t seq_num, int defrag_buf, int clear_buf);
+int _seq_num_lookup(knet_handle_t knet_h, struct knet_host *host, seq_num_t seq_num, int defrag_buf, int clear_buf);
+int _seq_num_seen(struct knet_host *host, seq_num_t seq_num);
 void _seq_num_set(struct knet_host *host, seq_num_t seq_num, int defrag_buf);
+seq_num_t _seq_num_extend(struct knet_host *host, uint16_t seq_num_lo);
+
+uint64_t *_cbuffers_alloc(uint32_t size);
+void _cbuffers_install(struct knet_host *host, uint64_t *cbuf, uint32_t size);
+
+void _handle_update_onwire_ver(knet_handle_t knet_h);
+void _host_set_onwire_ver(knet_handle_t knet_h, struct knet_host *host, uint8_t onwire_ver_max);
+
+struct knet_defrag_chunk *_defrag_pool_get(knet_handle_t knet_h);
+void _defrag_pool_put(knet_handle_t knet_h, struct knet_defrag_chunk *chunk);
+void _defrag_pool_trim(knet_handle_t knet_h);
+void _defrag_bufs_release(knet_handle_t knet_h, struct knet_host *host, int expired_only);
 
 int _send_host_info(knet_handle_t knet_h, const void *data, const size_t datalen);
 int _host_dstcache_update_async(knet_handle_t knet_h, struct knet_host *host);
@@ -33,6 +33,17 @@
 #define PCKT_FRAG_MAX UINT8_MAX
 #define PCKT_RX_BUFS  512
 
+/*
+ * RX ring slots are sized after the biggest link MTU (see _rx_ring_resize),
+ * datagrams that don't fit spill over into one of the KNET_RX_OVERSIZE_BUFS
+ * per worker oversize buffers. Those are also the UDP GRO receive buffers:
+ * a coalesced read can be up to KNET_DATABUFSIZE, and a handful of them
+ * carry as much data as a full batch of MTU sized datagrams.
+ */
+#define KNET_RX_BUFSIZE_DEFAULT 1500
+#define KNET_RX_SLOT_ALIGN 64
+#define KNET_RX_OVERSIZE_BUFS 16
+
 #define KNET_EPOLL_MAX_EVENTS KNET_DATAFD_MAX
 
 typedef void *knet_transport_link_t; /* per link transport handle */
@@ -79,12 +90,21 @@ struct knet_link {
 	uint32_t last_sent_mtu;
 	uint32_t last_recv_mtu;
 	uint8_t has_valid_mtu;
+	uint8_t tx_gso_disabled;		/* set to 1 if the kernel refused UDP GSO sends on outsock */
 };
 
-#define KNET_CBUFFER_SIZE 4096
+/*
+ * reassembly buffers are borrowed from a pool shared by all hosts
+ * (see knet_handle_set_defrag_bufs) on the first fragment of a packet
+ * and given back on completion or expiry.
+ */
+struct knet_defrag_chunk {
+	struct knet_defrag_chunk *next;		/* free list */
+	char buf[KNET_DATABUFSIZE_CRYPT];	/* big enough for encrypt-then-fragment packets */
+};
 
 struct knet_host_defrag_buf {
-	char buf[KNET_DATABUFSIZE];
+	struct knet_defrag_chunk *chunk;	/* borrowed from the pool while in use */
 	uint8_t in_use;			/* 0 buffer is free, 1 is in use */
 	seq_num_t pckt_seq;		/* identify the pckt we are receiving */
 	uint8_t frag_recv;		/* how many frags did we receive */
@@ -95,6 +115,37 @@ struct knet_host_defrag_buf {
 	struct timespec last_update;	/* keep time of the last pckt */
 };
 
+/*
+ * stream packets can be received out of order (RR link policy).
+ * Up to KNET_COMPRESS_STREAM_REORDER packets ahead of the next
+ * expected one are held until the missing one arrives.
+ */
+#define KNET_COMPRESS_STREAM_REORDER 4
+
+struct knet_compress_stream_held {
+	unsigned char *buf;		/* compressed payload, NULL if the slot is empty */
+	ssize_t len;
+	uint8_t compress_flags;
+	uint8_t seq;
+};
+
+/*
+ * per host and channel compression stream (see compress_stream_compress).
+ * TX streams are owned by the TX worker of the channel,
+ * RX streams are protected by the host rx_mutex.
+ */
+struct knet_compress_stream {
+	int compress_model;		/* model that owns ctx, 0 if none */
+	int compress_level;		/* TX: level the history has been built with */
+	void *ctx;			/* module private stream state */
+	uint8_t synced;			/* history is in sync with the other end */
+	uint8_t seq;			/* last stream seq sent/received */
+	uint8_t epoch;			/* increased at every reset */
+	uint8_t reset_req;		/* TX: reset requested by the receiver (atomic) */
+	struct timespec last_resync;	/* RX: last time we asked the sender to reset */
+	struct knet_compress_stream_held held[KNET_COMPRESS_STREAM_REORDER]; /* RX: indexed by seq */
+};
+
 struct knet_host {
 	/* required */
 	knet_node_id_t host_id;
@@ -104,14 +155,24 @@ struct knet_host {
 	/* status */
 	struct knet_host_status status;
 	/* internals */
-	char circular_buffer[KNET_CBUFFER_SIZE];
+	uint64_t *circular_buffer;	/* dedup window, one bit per seq_num (see _seq_num_lookup) */
+	uint32_t cbuffer_size;		/* window size in packets, see knet_handle_set_dedup_window */
 	seq_num_t rx_seq_num;
 	seq_num_t untimed_rx_seq_num;
 	seq_num_t timed_rx_seq_num;
 	uint8_t got_data;
+	pthread_mutex_t rx_mutex;	/* serialize RX workers on the per host state (seq_num, circular
+					 * and defrag buffers, links status) */
 	/* defrag/reassembly buffers */
 	struct knet_host_defrag_buf defrag_buf[KNET_MAX_LINK];
-	char circular_buffer_defrag[KNET_CBUFFER_SIZE];
+	struct knet_host_defrag_buf crypt_defrag_buf[KNET_MAX_LINK];	/* encrypt-then-fragment, fragments
+									 * are not authenticated yet */
+	uint64_t *circular_buffer_defrag;	/* same size as circular_buffer */
+	uint8_t onwire_ver_max;		/* highest onwire version advertised by the host pings,
+					 * 0 until the first ping. Protected by tx_seq_num_mutex */
+	/* compression streams, see knet_handle_set_compress_stream */
+	struct knet_compress_stream tx_compress_stream[KNET_DATAFD_MAX];
+	struct knet_compress_stream rx_compress_stream[KNET_DATAFD_MAX];
 	/* link stuff */
 	struct knet_link link[KNET_MAX_LINK];
 	uint8_t active_link_entries;
@@ -127,6 +188,7 @@ struct knet_sock {
 	int in_use;      /* set to 1 if it's use, 0 if free */
 	int has_error;   /* set to 1 if there were errors reading from the sock
 			  * and socket has been removed from epoll */
+	uint8_t tx_worker; /* index of the TX worker polling this socket */
 };
 
 struct knet_fd_trackers {
@@ -140,6 +202,18 @@ struct knet_fd_trackers {
 
 #define KNET_MAX_COMPRESS_METHODS UINT8_MAX
 
+struct compress_ops;
+
+/*
+ * compression dictionaries, see knet_handle_compress_dict
+ */
+#define KNET_COMPRESS_DICT_MAX 4
+
+struct knet_compress_dict {
+	unsigned char *dict;
+	size_t dict_len;
+};
+
 struct knet_handle_stats_extra {
 	uint64_t tx_crypt_pmtu_packets;
 	uint64_t tx_crypt_pmtu_reply_packets;
@@ -147,6 +221,139 @@ struct knet_handle_stats_extra {
 	uint64_t tx_crypt_pong_packets;
 };
 
+/*
+ * per outsock queue of messages for the TX fan-out (see threads_tx.c)
+ */
+#define KNET_TX_FANOUT_SOCKS KNET_MAX_LINK
+#define KNET_TX_FANOUT_MSGS 256
+
+struct knet_tx_fanout {
+	int outsock;
+	uint8_t transport_type;
+	int msgs;
+	struct knet_mmsghdr msg[KNET_TX_FANOUT_MSGS];
+	struct knet_link *link[KNET_TX_FANOUT_MSGS];
+};
+
+/*
+ * adaptive compression state (see compress_adaptive_skip)
+ */
+struct knet_compress_adaptive {
+	uint32_t backoff;			/* packets to skip after the next probe that does not compress */
+	uint32_t skip;				/* packets left to skip before probing again */
+};
+
+/*
+ * per channel compression override (see knet_handle_set_channel_compress)
+ */
+struct knet_channel_compress {
+	uint8_t enabled;			/* override the handle configuration */
+	int compress_model;
+	int compress_level;
+	size_t compress_threshold;
+};
+
+/*
+ * automatic compression model/level selection (see compress_auto_check)
+ */
+#define KNET_COMPRESS_AUTO_STEPS 8
+
+struct knet_compress_auto_step {
+	int model;
+	int level;
+};
+
+struct knet_compress_auto {
+	struct knet_compress_auto_step steps[KNET_COMPRESS_AUTO_STEPS]; /* ordered from cheapest to most expensive */
+	uint8_t steps_num;
+	uint8_t step;				/* current step, applied in global write lock context */
+	uint64_t compress_time;			/* total time spent compressing, protected by handle_stats_mutex */
+	uint64_t last_compress_time;		/* values at the last check, heartbeat thread only */
+	uint64_t last_tx_retries;
+	struct timespec last_check;
+};
+
+/*
+ * TX workers. Each datafd/channel is polled by exactly one worker
+ * (see _tx_workers_reshard), so that packets for a given channel are
+ * never reordered, while different channels are processed in parallel.
+ * worker 0 always exists and also handles the internal hostsockfd.
+ */
+struct knet_tx_worker {
+	knet_handle_t knet_h;
+	uint8_t worker_id;
+	uint8_t stop;				/* set in global write lock context to stop the worker */
+	pthread_t thread;
+	int epollfd;
+	pthread_mutex_t buf_mutex;		/* protects the buffers below between the worker and knet_send_sync */
+	struct knet_header *recv_from_sock_buf;
+	struct knet_header *send_to_links_buf[PCKT_FRAG_MAX];
+	unsigned char *send_to_links_buf_crypt[PCKT_FRAG_MAX];
+	unsigned char *send_to_links_buf_compress;
+	struct knet_compress_adaptive compress_adaptive[KNET_DATAFD_MAX]; /* per channel, protected by buf_mutex */
+	struct knet_tx_fanout *fanout;		/* KNET_TX_FANOUT_SOCKS queues */
+};
+
+/*
+ * RX workers. All workers poll recv_from_links_epollfd. Sockets are
+ * registered with KNET_RX_EPOLL_EVENTS (oneshot) so that each socket
+ * is read by only one worker at a time, and the worker re-arms it
+ * once the batch has been delivered, so packets received on one socket
+ * are delivered in order. Different sockets are handled in parallel,
+ * per host state is updated under host->rx_mutex.
+ */
+struct knet_rx_worker {
+	knet_handle_t knet_h;
+	uint8_t worker_id;
+	uint8_t stop;				/* set in global write lock context to stop the worker */
+	pthread_t thread;
+	unsigned char *recv_from_links_ring;	/* PCKT_RX_BUFS slots of recv_ring_slot bytes */
+	uint32_t recv_ring_slot;
+	unsigned char *recv_from_links_buf_oversize; /* KNET_RX_OVERSIZE_BUFS * KNET_DATABUFSIZE */
+	struct iovec recv_iov[PCKT_RX_BUFS][2];	/* ring slot + oversize spill */
+	unsigned char *recv_from_links_buf_crypt;
+	unsigned char *recv_from_links_buf_decrypt;
+	unsigned char *recv_from_links_buf_decompress;
+	unsigned char *recv_from_links_buf_segment;	/* UDP GRO segments are parsed from here */
+};
+
+#define KNET_RX_EPOLL_EVENTS (EPOLLIN | EPOLLONESHOT)
+
+/*
+ * fragments of one message to be encrypted in parallel (see threads_tx.c).
+ * The job lives on the stack of the TX worker that submits it, that
+ * also encrypts fragments and waits for the job to be completed.
+ * The TX worker holds global_rwlock read lock for the whole life of
+ * the job, so that crypto workers don't need to take it.
+ */
+/*
+ * max iovecs of an outgoing packet: header, user data and,
+ * in hash only crypto mode, the hash
+ */
+#define KNET_TX_IOVCNT_MAX 3
+
+struct knet_crypto_job {
+	struct iovec (*iov_out)[KNET_TX_IOVCNT_MAX];	/* in: cleartext iovecs, out: see _encrypt_frag */
+	int iovcnt;
+	unsigned char **buf_crypt;		/* one output buffer per fragment */
+	uint8_t frag_num;
+	uint8_t next_frag;			/* next fragment to be picked up */
+	uint8_t done_frags;			/* fragments completed (successfully or not) */
+	int err;
+	pthread_cond_t done_cond;		/* signaled when done_frags == frag_num */
+	struct knet_crypto_job *next;
+};
+
+/*
+ * crypto workers pick up fragments from knet_h->crypto_jobs
+ */
+struct knet_crypto_worker {
+	knet_handle_t knet_h;
+	uint8_t worker_id;
+	uint8_t stop;				/* set under crypto_jobs_mutex to stop the worker */
+	pthread_t thread;
+};
+
 struct knet_handle {
 	knet_node_id_t host_id;
 	unsigned int enabled:1;
@@ -155,12 +362,12 @@ struct knet_handle {
 	uint8_t log_levels[KNET_MAX_SUBSYSTEMS];
 	int hostsockfd[2];
 	int dstsockfd[2];
-	int send_to_links_epollfd;
 	int recv_from_links_epollfd;
 	int dst_link_handler_epollfd;
 	unsigned int pmtud_interval;
 	unsigned int data_mtu;	/* contains the max data size that we can send onwire
 				 * without frags */
+	uint32_t rx_bufsize;	/* biggest datagram we expect from the links, set by PMTUd */
 	struct knet_host *host_head;
 	struct knet_host *host_index[KNET_MAX_HOST];
 	knet_transport_t transports[KNET_MAX_TRANSPORTS+1];
@@ -170,22 +377,32 @@ struct knet_handle {
 	uint32_t reconnect_int;
 	knet_node_id_t host_ids[KNET_MAX_HOST];
 	size_t host_ids_entries;
-	struct knet_header *recv_from_sock_buf;
-	struct knet_header *send_to_links_buf[PCKT_FRAG_MAX];
-	struct knet_header *recv_from_links_buf[PCKT_RX_BUFS];
+	struct knet_tx_worker *tx_workers[KNET_MAX_TX_THREADS];
+	uint8_t tx_workers_num;
+	pthread_mutex_t tx_workers_mutex;	/* serialize changes to the TX workers pool */
+	struct knet_rx_worker *rx_workers[KNET_MAX_RX_THREADS];
+	uint8_t rx_workers_num;
+	pthread_mutex_t rx_workers_mutex;	/* serialize changes to the RX workers pool */
+	struct knet_crypto_worker *crypto_workers[KNET_MAX_CRYPTO_THREADS];
+	uint8_t crypto_workers_num;
+	pthread_mutex_t crypto_workers_mutex;	/* serialize changes to the crypto workers pool */
+	pthread_mutex_t crypto_jobs_mutex;	/* protects crypto_jobs and the jobs in it */
+	pthread_cond_t crypto_jobs_cond;	/* signaled when a job is queued or a worker has to stop */
+	struct knet_crypto_job *crypto_jobs;
 	struct knet_header *pingbuf;
 	struct knet_header *pmtudbuf;
 	uint8_t threads_status[KNET_THREAD_MAX];
 	pthread_mutex_t threads_status_mutex;
-	pthread_t send_to_links_thread;
-	pthread_t recv_from_links_thread;
 	pthread_t heartbt_thread;
 	pthread_t dst_link_handler_thread;
 	pthread_t pmtud_link_handler_thread;
 	pthread_rwlock_t global_rwlock;		/* global config lock */
 	pthread_mutex_t pmtud_mutex;		/* pmtud mutex to handle conditional send/recv + timeout */
 	pthread_cond_t pmtud_cond;		/* conditional for above */
-	pthread_mutex_t tx_mutex;		/* used to protect knet_send_sync and TX thread */
+	pthread_rwlock_t tx_rwlock;		/* read locked by the TX workers and knet_send_sync,
+						 * write locked by PMTUd to send probes in isolation */
+	pthread_mutex_t handle_stats_mutex;	/* used to protect handle stats between TX and RX workers,
+						 * link data TX stats and RR link rotation between TX workers */
 	pthread_mutex_t hb_mutex;		/* used to protect heartbeat thread and seq_num broadcasting */
 	pthread_mutex_t backoff_mutex;		/* used to protect dst_link->pong_timeout_adj */
 	pthread_mutex_t kmtu_mutex;		/* used to protect kernel_mtu */
@@ -199,19 +416,32 @@ struct knet_handle {
 	size_t sec_block_size;
 	size_t sec_hash_size;
 	size_t sec_salt_size;
-	unsigned char *send_to_links_buf_crypt[PCKT_FRAG_MAX];
-	unsigned char *recv_from_links_buf_crypt;
-	unsigned char *recv_from_links_buf_decrypt;
 	unsigned char *pingbuf_crypt;
 	unsigned char *pmtudbuf_crypt;
+	unsigned int encrypt_then_fragment;	/* see knet_handle_set_encrypt_then_fragment */
+	pthread_mutex_t defrag_pool_mutex;	/* protects the defrag pool below, taken with the host rx_mutex held */
+	struct knet_defrag_chunk *defrag_pool;	/* free reassembly buffers */
+	uint32_t defrag_pool_allocated;		/* free + borrowed buffers */
+	uint32_t defrag_pool_max;		/* see knet_handle_set_defrag_bufs */
+	uint32_t defrag_expire;			/* msecs */
 	int compress_model;
 	int compress_level;
 	size_t compress_threshold;
+	unsigned int compress_adaptive;	/* see knet_handle_set_compress_adaptive */
+	unsigned int compress_auto;	/* compress_model "auto", see knet_handle_compress */
+	unsigned int compress_stream;	/* see knet_handle_set_compress_stream */
+	struct knet_compress_auto compress_auto_state;
+	struct knet_channel_compress channel_compress[KNET_DATAFD_MAX];
+	struct knet_channel_stats channel_stats[KNET_DATAFD_MAX]; /* protected by handle_stats_mutex */
 	void *compress_int_data[KNET_MAX_COMPRESS_METHODS]; /* for compress method private data */
-	unsigned char *recv_from_links_buf_decompress;
-	unsigned char *send_to_links_buf_compress;
+	const struct compress_ops *decompress_ops[KNET_MAX_COMPRESS_METHODS]; /* models ready to decompress, see decompress() */
+	struct knet_compress_dict compress_dict[KNET_COMPRESS_DICT_MAX]; /* 0 is the most recent one */
 	seq_num_t tx_seq_num;
-	pthread_mutex_t tx_seq_num_mutex;
+	uint8_t onwire_ver;		/* version of the data packets we send (see _handle_update_onwire_ver) */
+	uint8_t onwire_ver_max;		/* highest version we advertise, lowered only by the test suite
+					 * to behave like older versions of knet */
+	pthread_mutex_t tx_seq_num_mutex;	/* protects tx_seq_num, onwire_ver and onwire_ver_max */
+	uint32_t dedup_window;		/* see knet_handle_set_dedup_window */
 	uint8_t has_loop_link;
 	uint8_t loop_link;
 	void *dst_host_filter_fn_private_data;
@@ -329,6 +329,140 @@ int knet_handle_get_channel(knet_handle_t knet_h, const int datafd, int8_t *chan
 
 int knet_handle_get_datafd(knet_handle_t knet_h, const int8_t channel, int *datafd);
 
+#define KNET_MAX_TX_THREADS 16
+
+/**
+ * knet_handle_set_tx_threads
+ *
+ * @brief Set the number of threads used to process outgoing data
+ *
+ * knet_h     - pointer to knet_handle_t
+ *
+ * tx_threads - number of TX threads, from 1 to KNET_MAX_TX_THREADS.
+ *              Compression, fragmentation, encryption and transmission
+ *              of the data read from the datafds are spread across
+ *              the TX threads by channel. All the packets of a given
+ *              channel are always processed by the same thread and
+ *              are never reordered.
+ *              The value can be changed at any time, channels are
+ *              redistributed between the remaining threads.
+ *
+ * @return
+ * knet_handle_set_tx_threads returns
+ * 0 on success
+ * -1 on error and errno is set.
+ *
+ * default is 1 TX thread.
+ */
+
+int knet_handle_set_tx_threads(knet_handle_t knet_h, uint8_t tx_threads);
+
+/**
+ * knet_handle_get_tx_threads
+ *
+ * @brief Get the number of threads used to process outgoing data
+ *
+ * knet_h     - pointer to knet_handle_t
+ *
+ * tx_threads - pointer where to store the current number of TX threads
+ *
+ * @return
+ * knet_handle_get_tx_threads returns
+ * 0 on success
+ * -1 on error and errno is set.
+ */
+
+int knet_handle_get_tx_threads(knet_handle_t knet_h, uint8_t *tx_threads);
+
+#define KNET_MAX_RX_THREADS 16
+
+/**
+ * knet_handle_set_rx_threads
+ *
+ * @brief Set the number of threads used to process incoming data
+ *
+ * knet_h     - pointer to knet_handle_t
+ *
+ * rx_threads - number of RX threads, from 1 to KNET_MAX_RX_THREADS.
+ *              Each link socket is read and processed by one RX thread
+ *              at a time, so packets received on the same link are
+ *              delivered in the order they were received.
+ *              Different sockets are processed in parallel.
+ *              The value can be changed at any time.
+ *
+ * @return
+ * knet_handle_set_rx_threads returns
+ * 0 on success
+ * -1 on error and errno is set.
+ *
+ * default is 1 RX thread.
+ */
+
+int knet_handle_set_rx_threads(knet_handle_t knet_h, uint8_t rx_threads);
+
+/**
+ * knet_handle_get_rx_threads
+ *
+ * @brief Get the number of threads used to process incoming data
+ *
+ * knet_h     - pointer to knet_handle_t
+ *
+ * rx_threads - pointer where to store the current number of RX threads
+ *
+ * @return
+ * knet_handle_get_rx_threads returns
+ * 0 on success
+ * -1 on error and errno is set.
+ */
+
+int knet_handle_get_rx_threads(knet_handle_t knet_h, uint8_t *rx_threads);
+
+#define KNET_MAX_CRYPTO_THREADS 16
+
+/**
+ * knet_handle_set_crypto_threads
+ *
+ * @brief Set the number of threads used to encrypt fragments in parallel
+ *
+ * knet_h     - pointer to knet_handle_t
+ *
+ * crypto_threads - number of crypto threads, from 0 to KNET_MAX_CRYPTO_THREADS.
+ *              When crypto is enabled and a message has to be split
+ *              in more than one fragment, the fragments are encrypted
+ *              concurrently by the TX thread processing the message
+ *              and by the crypto threads. Fragments are always sent
+ *              in order.
+ *              0 disables the pool, all fragments are encrypted by
+ *              the TX thread.
+ *              The value can be changed at any time.
+ *
+ * @return
+ * knet_handle_set_crypto_threads returns
+ * 0 on success
+ * -1 on error and errno is set.
+ *
+ * default is 0 crypto threads.
+ */
+
+int knet_handle_set_crypto_threads(knet_handle_t knet_h, uint8_t crypto_threads);
+
+/**
+ * knet_handle_get_crypto_threads
+ *
+ * @brief Get the number of threads used to encrypt fragments in parallel
+ *
+ * knet_h     - pointer to knet_handle_t
+ *
+ * crypto_threads - pointer where to store the current number of crypto threads
+ *
+ * @return
+ * knet_handle_get_crypto_threads returns
+ * 0 on success
+ * -1 on error and errno is set.
+ */
+
+int knet_handle_get_crypto_threads(knet_handle_t knet_h, uint8_t *crypto_threads);
+
 /**
  * knet_recv
  * @brief Receive data from knet nodes
@@ -617,6 +751,11 @@ struct knet_handle_crypto_cfg {
  *                         encryption.
  *                         Currently supported by "nss" model:
  *                         "3des", "aes128", "aes192" and "aes256".
+ *                         Both models support the AEAD ciphers
+ *                         "aes128-gcm", "aes256-gcm" and "chacha20-p1305"
+ *                         (ChaCha20-Poly1305, "openssl" also "aes192-gcm").
+ *                         AEAD ciphers authenticate the packet by themselves
+ *                         and require crypto_hash_type to be "none".
  *                         "openssl" model supports more modes and it strictly
  *                         depends on the openssl build. See: EVP_get_cipherbyname
  *                         openssl API call for details.
@@ -667,6 +806,158 @@ struct knet_handle_crypto_cfg {
 int knet_handle_crypto(knet_handle_t knet_h,
 		       struct knet_handle_crypto_cfg *knet_handle_crypto_cfg);
 
+/**
+ * knet_handle_set_encrypt_then_fragment
+ *
+ * @brief Encrypt large packets once and fragment the result
+ *
+ * knet_h   - pointer to knet_handle_t
+ *
+ * enabled  - set to 1 to enable, 0 to disable.
+ *            By default, when a packet is bigger than the data MTU,
+ *            each fragment is encrypted and signed separately and carries
+ *            its own crypto overhead (salt, padding and hash).
+ *            When enabled, the packet is encrypted and signed once, and the
+ *            result is split into fragments that are reassembled by the
+ *            receiving node before a single authenticate and decrypt.
+ *            Nothing is delivered to the application before the whole
+ *            packet has been authenticated.
+ *            Must be enabled on all nodes: nodes that have it disabled
+ *            drop encrypt-then-fragment packets, while packets with
+ *            per fragment encryption are always accepted.
+ *            Has no effect when crypto is not configured.
+ *
+ * @return
+ * knet_handle_set_encrypt_then_fragment returns
+ * 0 on success
+ * -1 on error and errno is set.
+ *
+ * default is disabled.
+ */
+
+int knet_handle_set_encrypt_then_fragment(knet_handle_t knet_h, unsigned int enabled);
+
+/**
+ * knet_handle_get_encrypt_then_fragment
+ *
+ * @brief Get the encrypt then fragment configuration
+ *
+ * knet_h   - pointer to knet_handle_t
+ *
+ * enabled  - pointer where to store the current configuration
+ *
+ * @return
+ * knet_handle_get_encrypt_then_fragment returns
+ * 0 on success
+ * -1 on error and errno is set.
+ */
+
+int knet_handle_get_encrypt_then_fragment(knet_handle_t knet_h, unsigned int *enabled);
+
+#define KNET_DEFRAG_BUFS_DEFAULT 128
+#define KNET_DEFRAG_EXPIRE_DEFAULT 1000
+
+/**
+ * knet_handle_set_defrag_bufs
+ *
+ * @brief Configure the pool of buffers used to reassemble fragmented packets
+ *
+ * knet_h       - pointer to knet_handle_t
+ *
+ * max_bufs     - maximum number of reassembly buffers (each one
+ *                is big enough for KNET_MAX_PACKET_SIZE plus crypto overhead).
+ *                The buffers are shared by all hosts, allocated on demand
+ *                when the first fragment of a packet is received and
+ *                returned to the pool once the packet is complete.
+ *                When all buffers are in use, fragments of new packets are
+ *                dropped until a buffer is returned.
+ *                Lowering the value frees the unused buffers immediately,
+ *                and the others as they are returned. Must be > 0.
+ *
+ * expire_msecs - a packet that did not receive any fragment in expire_msecs
+ *                milliseconds is dropped and its buffer returned to the pool.
+ *                Must be > 0.
+ *
+ * @return
+ * knet_handle_set_defrag_bufs returns
+ * 0 on success
+ * -1 on error and errno is set.
+ *
+ * default is KNET_DEFRAG_BUFS_DEFAULT buffers and KNET_DEFRAG_EXPIRE_DEFAULT msecs.
+ */
+
+int knet_handle_set_defrag_bufs(knet_handle_t knet_h, uint32_t max_bufs, uint32_t expire_msecs);
+
+/**
+ * knet_handle_get_defrag_bufs
+ *
+ * @brief Get the reassembly buffers pool configuration
+ *
+ * knet_h       - pointer to knet_handle_t
+ *
+ * max_bufs     - pointer where to store the maximum number of buffers
+ *
+ * expire_msecs - pointer where to store the expire timeout in milliseconds
+ *
+ * @return
+ * knet_handle_get_defrag_bufs returns
+ * 0 on success
+ * -1 on error and errno is set.
+ */
+
+int knet_handle_get_defrag_bufs(knet_handle_t knet_h, uint32_t *max_bufs, uint32_t *expire_msecs);
+
+#define KNET_DEDUP_WINDOW_DEFAULT 4096
+#define KNET_DEDUP_WINDOW_MIN     64
+#define KNET_DEDUP_WINDOW_MAX     1048576
+
+/**
+ * knet_handle_set_dedup_window
+ *
+ * @brief Configure the size of the packet deduplication window
+ *
+ * knet_h       - pointer to knet_handle_t
+ *
+ * window       - number of packets, per host, that knet remembers to
+ *                drop duplicates (active/rr link policies send the same
+ *                packet over several links). Packets older than the window
+ *                are dropped as well.
+ *                Links with very different latencies, or high packet rates,
+ *                need a bigger window. Each host uses window / 4 bytes.
+ *                Must be a power of 2 between KNET_DEDUP_WINDOW_MIN and
+ *                KNET_DEDUP_WINDOW_MAX.
+ *                Windows bigger than 32768 packets are fully effective only
+ *                with hosts that speak onwire v2 (32 bit seq numbers),
+ *                older versions of knet only send 16 bit seq numbers.
+ *                Changing the window drops the current deduplication history.
+ *
+ * @return
+ * knet_handle_set_dedup_window returns
+ * 0 on success
+ * -1 on error and errno is set.
+ *
+ * default is KNET_DEDUP_WINDOW_DEFAULT packets.
+ */
+
+int knet_handle_set_dedup_window(knet_handle_t knet_h, uint32_t window);
+
+/**
+ * knet_handle_get_dedup_window
+ *
+ * @brief Get the size of the packet deduplication window
+ *
+ * knet_h       - pointer to knet_handle_t
+ *
+ * window       - pointer where to store the window size in packets
+ *
+ * @return
+ * knet_handle_get_dedup_window returns
+ * 0 on success
+ * -1 on error and errno is set.
+ */
+
+int knet_handle_get_dedup_window(knet_handle_t knet_h, uint32_t *window);
+
 
 
 #define KNET_COMPRESS_THRESHOLD 100
@@ -690,6 +981,8 @@ struct knet_handle_compress_cfg {
  *            compress_model contains the model name.
  *                           See "compress_level" for the list of accepted values.
  *                           Setting the value to "none" disables compression.
+ *                           Setting the value to "auto" lets knet pick the model
+ *                           and level at runtime (see below).
  *
  *            compress_threshold
  *                           tells the transmission thread to NOT compress
@@ -706,6 +999,8 @@ struct knet_handle_compress_cfg {
  *                                  depending on the version of lz4hc libknet was built with.
  *                           lzma: 0 (minimal) .. 9 (max compression)
  *                           bzip2: 1 (minimal) .. 9 (max compression)
+ *                           zstd: ZSTD_minCLevel() (fastest) .. ZSTD_maxCLevel() (max compression),
+ *                                 0 selects the zstd default.
  *                           For lzo2 it selects the algorithm to use:
  *                                 1  : lzo1x_1_compress (default)
  *                                 11 : lzo1x_1_11_compress
@@ -716,10 +1011,17 @@ struct knet_handle_compress_cfg {
  *                           Please refer to the documentation of the respective
  *                           compression library for guidance about setting this
  *                           value.
+ *                           compress_level is ignored in "auto" mode.
  *
  * Implementation notes:
  * - it is possible to enable/disable compression at any time.
  * - nodes can be using a different compression algorithm at any time.
+ * - in "auto" mode knet moves between lz4, lz4hc and zlib (the ones that
+ *   are available) and their levels, about once a second: it uses more CPU
+ *   when the links push back (the sockets are full) and less when the
+ *   TX threads are busy compressing. Changes are logged at info level.
+ *   At least one of those models must be available, otherwise
+ *   EINVAL is returned.
  * - knet does NOT implement the compression algorithm directly. it relies
  *   on external libraries for this functionality. Please read
  *   the libraries man pages to figure out which algorithm/compression
@@ -735,6 +1037,263 @@ struct knet_handle_compress_cfg {
 int knet_handle_compress(knet_handle_t knet_h,
 			 struct knet_handle_compress_cfg *knet_handle_compress_cfg);
 
+/**
+ * knet_handle_compress_dict_train
+ *
+ * @brief Build a compression dictionary from sample payloads
+ *
+ * knet_h   - pointer to knet_handle_t
+ *
+ * compress_model -
+ *            compress model name. Only models that support
+ *            dictionaries are accepted (zstd).
+ *
+ * samples  - samples_num sample payloads stored back to back.
+ *            Samples should be representative of the data
+ *            that will be sent by the application.
+ *
+ * samples_sizes -
+ *            array of samples_num entries with the size of each sample
+ *
+ * samples_num -
+ *            number of samples. The compression library might
+ *            require a minimum amount of samples/data to build
+ *            a dictionary (zstd recommends about 100 times the
+ *            dictionary size).
+ *
+ * dict     - buffer where to store the dictionary
+ *
+ * dict_len - size of dict on input, size of the dictionary on output.
+ *            Dictionaries of a few KB up to around 100KB give
+ *            the best results.
+ *
+ * The dictionary must be loaded with knet_handle_compress_dict
+ * on all the nodes. knet does not distribute it.
+ *
+ * @return
+ * knet_handle_compress_dict_train returns
+ * 0 on success
+ * -1 on error and errno is set. EINVAL means that the model does not
+ *    support dictionaries or that the samples are not suitable
+ *    to build a dictionary.
+ */
+
+int knet_handle_compress_dict_train(knet_handle_t knet_h, const char *compress_model,
+				    const char *samples, const size_t *samples_sizes,
+				    unsigned int samples_num,
+				    char *dict, size_t *dict_len);
+
+/**
+ * knet_handle_compress_dict
+ *
+ * @brief Load a compression dictionary
+ *
+ * knet_h   - pointer to knet_handle_t
+ *
+ * compress_model -
+ *            compress model name. Only models that support
+ *            dictionaries are accepted (zstd).
+ *
+ * dict     - dictionary, as created by knet_handle_compress_dict_train
+ *            or by the compression library tools (zstd --train).
+ *            NULL removes all the dictionaries.
+ *
+ * dict_len - size of the dictionary
+ *
+ * Small packets with repetitive content compress a lot better
+ * when a dictionary is shared by all the nodes.
+ *
+ * The last loaded dictionary is used to compress data. Each compressed
+ * packet carries the ID of the dictionary used to compress it, and
+ * knet keeps the last 4 loaded dictionaries to decompress data.
+ * Dictionaries can be replaced at runtime by loading the new one
+ * on all nodes first, and then starting to send data with it.
+ *
+ * Dictionaries are not tied to the compress configuration and are retained
+ * across calls to knet_handle_compress.
+ *
+ * @return
+ * knet_handle_compress_dict returns
+ * 0 on success
+ * -1 on error and errno is set. EINVAL means that the model does not
+ *    support dictionaries or that dict is not a valid dictionary.
+ */
+
+int knet_handle_compress_dict(knet_handle_t knet_h, const char *compress_model,
+			      const char *dict, size_t dict_len);
+
+/**
+ * knet_handle_set_compress_adaptive
+ *
+ * @brief Skip compression for data that does not compress
+ *
+ * knet_h   - pointer to knet_handle_t
+ *
+ * enabled  - set to 1 to enable, 0 to disable.
+ *            When enabled, knet tracks how well the packets of each
+ *            channel compress. When a packet does not shrink by at least
+ *            5%, the next packets of the same channel are sent without
+ *            compression, and compression is probed again later.
+ *            The interval between probes grows (16 to 1024 packets)
+ *            while the data keeps being incompressible and resets as soon
+ *            as a probe compresses well.
+ *            This saves CPU time when the application sends data that
+ *            is already compressed or encrypted.
+ *            Skipped packets are reported in
+ *            knet_handle_stats.tx_compress_skipped_packets.
+ *            It has no effect when compression is disabled.
+ *
+ * @return
+ * knet_handle_set_compress_adaptive returns
+ * 0 on success
+ * -1 on error and errno is set.
+ *
+ * default is disabled.
+ */
+
+int knet_handle_set_compress_adaptive(knet_handle_t knet_h, unsigned int enabled);
+
+/**
+ * knet_handle_get_compress_adaptive
+ *
+ * @brief Get the adaptive compression configuration
+ *
+ * knet_h   - pointer to knet_handle_t
+ *
+ * enabled  - pointer where to store the current configuration
+ *
+ * @return
+ * knet_handle_get_compress_adaptive returns
+ * 0 on success
+ * -1 on error and errno is set.
+ */
+
+int knet_handle_get_compress_adaptive(knet_handle_t knet_h, unsigned int *enabled);
+
+/**
+ * knet_handle_set_compress_stream
+ *
+ * @brief Compress unicast data as a stream
+ *
+ * knet_h   - pointer to knet_handle_t
+ *
+ * enabled  - set to 1 to enable, 0 to disable.
+ *            When enabled, data packets sent to a single destination
+ *            (see knet_handle_enable_filter) are compressed as a
+ *            stream, keeping the compression history between packets
+ *            for each destination host and channel. Small packets
+ *            that look alike compress much better this way.
+ *            Only compress models that support streams (zlib and zstd)
+ *            use it, other packets are compressed as usual.
+ *            Stream packets received out of order (for example with
+ *            the round-robin link policy) are held by the receiver,
+ *            up to 4 packets ahead of a missing one, and delivered in
+ *            order once the missing one arrives. When a stream packet
+ *            is lost, or arrives more than 4 packets late, the receiver
+ *            drops the held packets and the following packets of the
+ *            same stream, until the sender starts a new history after
+ *            the receiver asks for it (one round trip). The packets sent
+ *            right after a new history starts cannot be reordered with
+ *            the first one. The sender also starts a new history when a
+ *            stream packet cannot be sent.
+ *            With more than one RX thread (knet_handle_set_rx_threads),
+ *            no packet is lost to reordering, but packets received on
+ *            different links can still be written to the application
+ *            socket out of order.
+ *            Each stream uses memory on both nodes (up to a few hundred
+ *            KB for zlib on the sender side).
+ *            All nodes must run a version of knet that can decompress
+ *            streams. Older versions drop those packets.
+ *            Packets lost because the stream was out of sync are reported
+ *            in knet_channel_stats.rx_compress_stream_lost.
+ *
+ * @return
+ * knet_handle_set_compress_stream returns
+ * 0 on success
+ * -1 on error and errno is set.
+ *
+ * default is disabled.
+ */
+
+int knet_handle_set_compress_stream(knet_handle_t knet_h, unsigned int enabled);
+
+/**
+ * knet_handle_get_compress_stream
+ *
+ * @brief Get the stream compression configuration
+ *
+ * knet_h   - pointer to knet_handle_t
+ *
+ * enabled  - pointer where to store the current configuration
+ *
+ * @return
+ * knet_handle_get_compress_stream returns
+ * 0 on success
+ * -1 on error and errno is set.
+ */
+
+int knet_handle_get_compress_stream(knet_handle_t knet_h, unsigned int *enabled);
+
+/**
+ * knet_handle_set_channel_compress
+ *
+ * @brief Override the compression configuration for one channel
+ *
+ * knet_h   - pointer to knet_handle_t
+ *
+ * channel  - channel (as returned by knet_handle_add_datafd)
+ *            the override applies to.
+ *
+ * knet_handle_compress_cfg -
+ *            compression configuration for the packets sent on this
+ *            channel, same format as for knet_handle_compress.
+ *            "none" disables compression for the channel.
+ *            "auto" is not supported per channel.
+ *            Set to NULL to remove the override and go back
+ *            to the handle configuration.
+ *
+ * Implementation notes:
+ * - the override only applies to the packets sent by this node,
+ *   receivers decompress whatever model is used.
+ * - the override is removed when the datafd is removed from the handle.
+ * - the channel settings are used also when the handle compression
+ *   is disabled or in "auto" mode.
+ * - crypto is configured per handle only. Received packets have to be
+ *   decrypted before the channel they belong to is known.
+ *
+ * @return
+ * knet_handle_set_channel_compress returns
+ * 0 on success
+ * -1 on error and errno is set. EINVAL means that either the channel,
+ *    the model or the level are not valid.
+ */
+
+int knet_handle_set_channel_compress(knet_handle_t knet_h, int8_t channel,
+				     struct knet_handle_compress_cfg *knet_handle_compress_cfg);
+
+/**
+ * knet_handle_get_channel_compress
+ *
+ * @brief Get the compression override of a channel
+ *
+ * knet_h   - pointer to knet_handle_t
+ *
+ * channel  - channel to query
+ *
+ * knet_handle_compress_cfg -
+ *            filled with the channel configuration.
+ *            compress_model is an empty string if the channel
+ *            uses the handle configuration.
+ *
+ * @return
+ * knet_handle_get_channel_compress returns
+ * 0 on success
+ * -1 on error and errno is set.
+ */
+
+int knet_handle_get_channel_compress(knet_handle_t knet_h, int8_t channel,
+				     struct knet_handle_compress_cfg *knet_handle_compress_cfg);
+
 
 
 struct knet_handle_stats {
@@ -766,6 +1325,9 @@ struct knet_handle_stats {
 	uint64_t rx_crypt_time_ave;
 	uint64_t rx_crypt_time_min;
 	uint64_t rx_crypt_time_max;
+
+	/* packets sent uncompressed by adaptive compression */
+	uint64_t tx_compress_skipped_packets;
 };
 
 /**
@@ -793,6 +1355,60 @@ struct knet_handle_stats {
 
 int knet_handle_get_stats(knet_handle_t knet_h, struct knet_handle_stats *stats, size_t struct_size);
 
+struct knet_channel_stats {
+	size_t   size;
+
+	uint64_t tx_uncompressed_packets;
+	uint64_t tx_compressed_packets;
+	uint64_t tx_compressed_original_bytes;
+	uint64_t tx_compressed_size_bytes;
+	uint64_t tx_compress_time_ave;
+	uint64_t tx_compress_time_min;
+	uint64_t tx_compress_time_max;
+	uint64_t tx_compress_skipped_packets;
+
+	uint64_t rx_compressed_packets;
+	uint64_t rx_compressed_original_bytes;
+	uint64_t rx_compressed_size_bytes;
+	uint64_t rx_compress_time_ave;
+	uint64_t rx_compress_time_min;
+	uint64_t rx_compress_time_max;
+
+	/* see knet_handle_set_compress_stream */
+	uint64_t tx_compress_stream_packets;
+	uint64_t tx_compress_stream_resets;
+	uint64_t rx_compress_stream_packets;
+	uint64_t rx_compress_stream_lost;
+	uint64_t rx_compress_stream_reordered;	/* received out of order and held */
+};
+
+/**
+ * knet_handle_get_channel_stats
+ *
+ * @brief Get compression statistics for one channel
+ *
+ * knet_h   - pointer to knet_handle_t
+ *
+ * channel  - channel to query
+ *
+ * knet_channel_stats
+ *            pointer to a knet_channel_stats structure
+ *
+ * struct_size
+ *            size of knet_channel_stats structure to allow
+ *            for backwards compatibility (see knet_handle_get_stats).
+ *
+ * Channel stats are cleared by knet_handle_clear_stats and
+ * when the datafd is removed from the handle.
+ *
+ * @return
+ * 0 on success
+ * -1 on error and errno is set.
+ */
+
+int knet_handle_get_channel_stats(knet_handle_t knet_h, int8_t channel,
+				  struct knet_channel_stats *stats, size_t struct_size);
+
 /*
  * Tell knet_handle_clear_stats whether to clear just the handle stats
  * or all of them.
@@ -1847,6 +2463,7 @@ int knet_link_get_status(knet_handle_t knet_h, knet_node_id_t host_id, uint8_t l
 #define KNET_SUB_LZO2COMP      73 /* compress_lzo.c */
 #define KNET_SUB_LZMACOMP      74 /* compress_lzma.c */
 #define KNET_SUB_BZIP2COMP     75 /* compress_bzip2.c */
+#define KNET_SUB_ZSTDCOMP      76 /* compress_zstd.c */
 
 #define KNET_SUB_UNKNOWN       UINT8_MAX - 1
 #define KNET_MAX_SUBSYSTEMS    UINT8_MAX
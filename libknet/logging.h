@@ -15,7 +15,7 @@
 typedef void log_msg_t(knet_handle_t knet_h, uint8_t subsystem, uint8_t msglevel,
 		       const char *fmt, ...) __attribute__((format(printf, 4, 5)));
 
-#ifdef KNET_MODULE
+#if defined(KNET_MODULE) && !defined(KNET_STATIC_MODULE)
 #define LOG_MSG (*log_msg)
 #else
 #define LOG_MSG log_msg
@@ -92,16 +92,19 @@ struct knet_hostinfo {
 #define khip_link_status_link_id khi_payload.knet_hostinfo_payload_link_status.khip_link_status_link_id
 
 /*
- * typedef uint64_t seq_num_t;
- * #define SEQ_MAX UINT64_MAX
+ * seq_num_t is the sequence number as seen by the TX/RX threads.
+ * Only the lower 16 bits travel in the payloads below, the upper
+ * 16 bits are sent in kh_seq_num_hi (onwire v2) or rebuilt by the
+ * receiver from the last seq_num seen (onwire v1, see _seq_num_rx).
  */
-typedef uint16_t seq_num_t;
-#define SEQ_MAX UINT16_MAX
+typedef uint32_t seq_num_t;
+#define SEQ_MAX UINT32_MAX
+#define SEQ_ONWIRE_V1_MAX UINT16_MAX
 
 struct knet_header_payload_data {
-	seq_num_t	khp_data_seq_num;	/* pckt seq number used to deduplicate pkcts */
+	uint16_t	khp_data_seq_num;	/* pckt seq number used to deduplicate pkcts (lower 16 bits) */
 	uint8_t		khp_data_compress;	/* identify if user data are compressed */
-	uint8_t		khp_data_pad1;		/* make sure to have space in the header to grow features */
+	uint8_t		khp_data_stream_seq;	/* compress stream sequence number, 0 if not a stream */
 	uint8_t		khp_data_bcast;		/* data destination bcast/ucast */
 	uint8_t		khp_data_frag_num;	/* number of fragments of this pckt. 1 is not fragmented */
 	uint8_t		khp_data_frag_seq;	/* as above, indicates the frag sequence number */
@@ -109,11 +112,29 @@ struct knet_header_payload_data {
 	uint8_t		khp_data_userdata[0];	/* pointer to the real user data */
 } __attribute__((packed));
 
+/*
+ * khp_data_compress carries the compress model id in the lower bits.
+ * Packets compressed in stream mode (see compress_stream_compress)
+ * also carry the stream flags and epoch in the upper bits.
+ * Older versions of knet reject those as unknown compress models.
+ */
+#define KNET_COMPRESS_MODEL_MASK        0x0f
+#define KNET_COMPRESS_STREAM_EPOCH_MASK 0x30 /* increased at every stream reset */
+#define KNET_COMPRESS_STREAM_EPOCH_SHIFT 4
+#define KNET_COMPRESS_STREAM_RESET      0x40 /* first packet of a new stream history */
+#define KNET_COMPRESS_STREAM            0x80 /* data depends on the previous packets of the stream */
+
 struct knet_header_payload_ping {
 	uint8_t		khp_ping_link;		/* source link id */
 	uint32_t	khp_ping_time[4];	/* ping timestamp */
-	seq_num_t	khp_ping_seq_num;	/* transport host seq_num */
+	uint16_t	khp_ping_seq_num;	/* transport host seq_num (lower 16 bits) */
 	uint8_t		khp_ping_timed;		/* timed pinged (1) or forced by seq_num (0) */
+	/*
+	 * older versions of knet do not send the fields below
+	 * and ignore them. Check the pckt len before use.
+	 */
+	uint16_t	khp_ping_seq_num_hi;	/* transport host seq_num (upper 16 bits) */
+	uint8_t		khp_ping_onwire_ver;	/* highest onwire version supported by the sender */
 }  __attribute__((packed));
 
 /* taken from tracepath6 */
@@ -147,10 +168,25 @@ union knet_header_payload {
  * starting point
  */
 
-#define KNET_HEADER_VERSION          0x01 /* we currently support only one version */
+/*
+ * pings, pongs and PMTUd packets are always sent as v1, so that links
+ * come up with any version of knet. Data packets are sent with the
+ * highest version supported by all the reachable hosts
+ * (see _handle_update_onwire_ver).
+ *
+ * v2 has the same layout as v1 and carries the upper 16 bits of the
+ * seq_num in kh_seq_num_hi, that is always 0 in v1.
+ */
+#define KNET_HEADER_VERSION          0x01 /* version 1, 16 bit seq_num */
+#define KNET_HEADER_VERSION_V2       0x02 /* version 2, 32 bit seq_num */
+#define KNET_HEADER_VERSION_MAX      KNET_HEADER_VERSION_V2 /* highest version we support */
 
 #define KNET_HEADER_TYPE_DATA        0x00 /* pure data packet */
 #define KNET_HEADER_TYPE_HOST_INFO   0x01 /* host status information pckt */
+#define KNET_HEADER_TYPE_CRYPT_FRAG  0x02 /* cleartext header + fragment of an encrypted
+					    * DATA/HOST_INFO pckt (encrypt-then-fragment) */
+#define KNET_HEADER_TYPE_COMPRESS_RESYNC 0x03 /* ask the sender to reset a compress stream,
+						* khp_data_channel identifies the stream */
 
 #define KNET_HEADER_TYPE_PMSK        0x80 /* packet mask */
 #define KNET_HEADER_TYPE_PING        0x81 /* heartbeat */
@@ -162,8 +198,7 @@ struct knet_header {
 	uint8_t				kh_version; /* pckt format/version */
 	uint8_t				kh_type;    /* from above defines. Tells what kind of pckt it is */
 	knet_node_id_t			kh_node;    /* host id of the source host for this pckt */
-	uint8_t				kh_pad1;    /* make sure to have space in the header to grow features */
-	uint8_t				kh_pad2;
+	uint16_t			kh_seq_num_hi; /* v2: upper 16 bits of khp_data_seq_num, 0 in v1 */
 	union knet_header_payload	kh_payload; /* union of potential data struct based on kh_type */
 } __attribute__((packed));
 
@@ -179,11 +214,14 @@ struct knet_header {
 #define khp_data_bcast    kh_payload.khp_data.khp_data_bcast
 #define khp_data_channel  kh_payload.khp_data.khp_data_channel
 #define khp_data_compress kh_payload.khp_data.khp_data_compress
+#define khp_data_stream_seq kh_payload.khp_data.khp_data_stream_seq
 
 #define khp_ping_link     kh_payload.khp_ping.khp_ping_link
 #define khp_ping_time     kh_payload.khp_ping.khp_ping_time
 #define khp_ping_seq_num  kh_payload.khp_ping.khp_ping_seq_num
 #define khp_ping_timed    kh_payload.khp_ping.khp_ping_timed
+#define khp_ping_seq_num_hi kh_payload.khp_ping.khp_ping_seq_num_hi
+#define khp_ping_onwire_ver kh_payload.khp_ping.khp_ping_onwire_ver
 
 #define khp_pmtud_link    kh_payload.khp_pmtud.khp_pmtud_link
 #define khp_pmtud_size    kh_payload.khp_pmtud.khp_pmtud_size
@@ -196,6 +234,7 @@ struct knet_header {
 #define KNET_HEADER_ALL_SIZE sizeof(struct knet_header)
 #define KNET_HEADER_SIZE (KNET_HEADER_ALL_SIZE - sizeof(union knet_header_payload))
 #define KNET_HEADER_PING_SIZE (KNET_HEADER_SIZE + sizeof(struct knet_header_payload_ping))
+#define KNET_HEADER_PING_V1_SIZE (KNET_HEADER_PING_SIZE - sizeof(uint16_t) - sizeof(uint8_t)) /* without seq_num_hi and onwire_ver */
 #define KNET_HEADER_PMTUD_SIZE (KNET_HEADER_SIZE + sizeof(struct knet_header_payload_pmtud))
 #define KNET_HEADER_DATA_SIZE (KNET_HEADER_SIZE + sizeof(struct knet_header_payload_data))
 
@@ -18,6 +18,27 @@ api_checks		= \
 			  api_knet_handle_remove_datafd_test \
 			  api_knet_handle_get_channel_test \
 			  api_knet_handle_get_datafd_test \
+			  api_knet_handle_set_tx_threads_test \
+			  api_knet_handle_get_tx_threads_test \
+			  api_knet_handle_set_rx_threads_test \
+			  api_knet_handle_get_rx_threads_test \
+			  api_knet_handle_set_crypto_threads_test \
+			  api_knet_handle_get_crypto_threads_test \
+			  api_knet_handle_set_encrypt_then_fragment_test \
+			  api_knet_handle_get_encrypt_then_fragment_test \
+			  api_knet_handle_set_defrag_bufs_test \
+			  api_knet_handle_get_defrag_bufs_test \
+			  api_knet_handle_set_dedup_window_test \
+			  api_knet_handle_get_dedup_window_test \
+			  api_knet_handle_set_compress_adaptive_test \
+			  api_knet_handle_get_compress_adaptive_test \
+			  api_knet_handle_compress_dict_train_test \
+			  api_knet_handle_compress_dict_test \
+			  api_knet_handle_set_channel_compress_test \
+			  api_knet_handle_get_channel_compress_test \
+			  api_knet_handle_get_channel_stats_test \
+			  api_knet_handle_set_compress_stream_test \
+			  api_knet_handle_get_compress_stream_test \
 			  api_knet_handle_get_stats_test \
 			  api_knet_get_crypto_list_test \
 			  api_knet_get_compress_list_test \
@@ -105,6 +126,69 @@ api_knet_handle_get_channel_test_SOURCES = api_knet_handle_get_channel.c \
 api_knet_handle_get_datafd_test_SOURCES = api_knet_handle_get_datafd.c \
 					  test-common.c
 
+api_knet_handle_set_tx_threads_test_SOURCES = api_knet_handle_set_tx_threads.c \
+					      test-common.c
+
+api_knet_handle_get_tx_threads_test_SOURCES = api_knet_handle_get_tx_threads.c \
+					      test-common.c
+
+api_knet_handle_set_rx_threads_test_SOURCES = api_knet_handle_set_rx_threads.c \
+					      test-common.c
+
+api_knet_handle_get_rx_threads_test_SOURCES = api_knet_handle_get_rx_threads.c \
+					      test-common.c
+
+api_knet_handle_set_crypto_threads_test_SOURCES = api_knet_handle_set_crypto_threads.c \
+						  test-common.c
+
+api_knet_handle_get_crypto_threads_test_SOURCES = api_knet_handle_get_crypto_threads.c \
+						  test-common.c
+
+api_knet_handle_set_encrypt_then_fragment_test_SOURCES = api_knet_handle_set_encrypt_then_fragment.c \
+							 test-common.c
+
+api_knet_handle_get_encrypt_then_fragment_test_SOURCES = api_knet_handle_get_encrypt_then_fragment.c \
+							 test-common.c
+
+api_knet_handle_set_defrag_bufs_test_SOURCES = api_knet_handle_set_defrag_bufs.c \
+					       test-common.c
+
+api_knet_handle_get_defrag_bufs_test_SOURCES = api_knet_handle_get_defrag_bufs.c \
+					       test-common.c
+
+api_knet_handle_set_dedup_window_test_SOURCES = api_knet_handle_set_dedup_window.c \
+						test-common.c
+
+api_knet_handle_get_dedup_window_test_SOURCES = api_knet_handle_get_dedup_window.c \
+						test-common.c
+
+api_knet_handle_set_compress_adaptive_test_SOURCES = api_knet_handle_set_compress_adaptive.c \
+						     test-common.c
+
+api_knet_handle_get_compress_adaptive_test_SOURCES = api_knet_handle_get_compress_adaptive.c \
+						     test-common.c
+
+api_knet_handle_compress_dict_train_test_SOURCES = api_knet_handle_compress_dict_train.c \
+						   test-common.c
+
+api_knet_handle_compress_dict_test_SOURCES = api_knet_handle_compress_dict.c \
+					     test-common.c
+
+api_knet_handle_set_channel_compress_test_SOURCES = api_knet_handle_set_channel_compress.c \
+						    test-common.c
+
+api_knet_handle_get_channel_compress_test_SOURCES = api_knet_handle_get_channel_compress.c \
+						    test-common.c
+
+api_knet_handle_get_channel_stats_test_SOURCES = api_knet_handle_get_channel_stats.c \
+						 test-common.c
+
+api_knet_handle_set_compress_stream_test_SOURCES = api_knet_handle_set_compress_stream.c \
+						   test-common.c
+
+api_knet_handle_get_compress_stream_test_SOURCES = api_knet_handle_get_compress_stream.c \
+						   test-common.c
+
 api_knet_handle_get_stats_test_SOURCES = api_knet_handle_get_stats.c \
 					 test-common.c
 
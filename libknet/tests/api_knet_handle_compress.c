@@ -146,6 +146,63 @@ static void test(void)
 	}
 	flush_logs(logfds[0], stdout);
 
+	printf("Test knet_handle_compress with auto compress model and excessive compress threshold\n");
+
+	memset(&knet_handle_compress_cfg, 0, sizeof(struct knet_handle_compress_cfg));
+	strncpy(knet_handle_compress_cfg.compress_model, "auto", sizeof(knet_handle_compress_cfg.compress_model) - 1);
+	knet_handle_compress_cfg.compress_threshold = KNET_MAX_PACKET_SIZE +1;
+
+	if ((!knet_handle_compress(knet_h, &knet_handle_compress_cfg)) || (errno != EINVAL)) {
+		printf("knet_handle_compress accepted invalid compress threshold for auto\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress with auto compress model\n");
+
+	memset(&knet_handle_compress_cfg, 0, sizeof(struct knet_handle_compress_cfg));
+	strncpy(knet_handle_compress_cfg.compress_model, "auto", sizeof(knet_handle_compress_cfg.compress_model) - 1);
+	knet_handle_compress_cfg.compress_level = 1000;
+	knet_handle_compress_cfg.compress_threshold = 64;
+
+	if (knet_handle_compress(knet_h, &knet_handle_compress_cfg) != 0) {
+		printf("knet_handle_compress did not accept auto compress mode: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((!knet_h->compress_auto) || (knet_h->compress_model == 0)) {
+		printf("knet_handle_compress auto mode did not select a compress model\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress switching back from auto to zlib\n");
+
+	memset(&knet_handle_compress_cfg, 0, sizeof(struct knet_handle_compress_cfg));
+	strncpy(knet_handle_compress_cfg.compress_model, "zlib", sizeof(knet_handle_compress_cfg.compress_model) - 1);
+	knet_handle_compress_cfg.compress_level = 1;
+	knet_handle_compress_cfg.compress_threshold = 64;
+
+	if ((knet_handle_compress(knet_h, &knet_handle_compress_cfg) != 0) || (knet_h->compress_auto)) {
+		printf("knet_handle_compress did not disable auto compress mode\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+	flush_logs(logfds[0], stdout);
+
 	knet_handle_free(knet_h);
 	flush_logs(logfds[0], stdout);
 	close_logpipes(logfds);
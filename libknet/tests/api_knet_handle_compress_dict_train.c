@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.  All rights reserved.
+ *
+ * This software licensed under GPL-2.0+, LGPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "test-common.h"
+
+#define SAMPLES_NUM 1000
+#define SAMPLE_SIZE 128
+
+static char samples[SAMPLES_NUM * SAMPLE_SIZE];
+static size_t samples_sizes[SAMPLES_NUM];
+
+static int has_compress_model(const char *model)
+{
+	struct knet_compress_info compress_list[16];
+	size_t compress_list_entries;
+	size_t i;
+
+	memset(compress_list, 0, sizeof(compress_list));
+
+	if (knet_get_compress_list(compress_list, &compress_list_entries) < 0) {
+		return 0;
+	}
+
+	for (i = 0; i < compress_list_entries; i++) {
+		if (!strcmp(compress_list[i].name, model)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void test(void)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+	char dict[1024];
+	size_t dict_len = sizeof(dict);
+	unsigned int i;
+
+	for (i = 0; i < SAMPLES_NUM; i++) {
+		snprintf(samples + (i * SAMPLE_SIZE), SAMPLE_SIZE,
+			 "{ \"node\": %u, \"seq\": %u, \"state\": \"%s\", \"payload\": \"cluster membership update\" }",
+			 i % 32, i, (i % 3) ? "joined" : "left");
+		samples_sizes[i] = SAMPLE_SIZE;
+	}
+
+	printf("Test knet_handle_compress_dict_train incorrect knet_h\n");
+
+	if ((!knet_handle_compress_dict_train(NULL, "zstd", samples, samples_sizes, SAMPLES_NUM, dict, &dict_len)) || (errno != EINVAL)) {
+		printf("knet_handle_compress_dict_train accepted invalid knet_h or returned incorrect error: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_DEBUG);
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress_dict_train with no compress_model\n");
+	if ((!knet_handle_compress_dict_train(knet_h, NULL, samples, samples_sizes, SAMPLES_NUM, dict, &dict_len)) || (errno != EINVAL)) {
+		printf("knet_handle_compress_dict_train accepted invalid compress_model or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress_dict_train with no samples\n");
+	if ((!knet_handle_compress_dict_train(knet_h, "zstd", NULL, samples_sizes, SAMPLES_NUM, dict, &dict_len)) || (errno != EINVAL)) {
+		printf("knet_handle_compress_dict_train accepted invalid samples or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress_dict_train with no samples_sizes\n");
+	if ((!knet_handle_compress_dict_train(knet_h, "zstd", samples, NULL, SAMPLES_NUM, dict, &dict_len)) || (errno != EINVAL)) {
+		printf("knet_handle_compress_dict_train accepted invalid samples_sizes or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress_dict_train with 0 samples_num\n");
+	if ((!knet_handle_compress_dict_train(knet_h, "zstd", samples, samples_sizes, 0, dict, &dict_len)) || (errno != EINVAL)) {
+		printf("knet_handle_compress_dict_train accepted invalid samples_num or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress_dict_train with no dict\n");
+	if ((!knet_handle_compress_dict_train(knet_h, "zstd", samples, samples_sizes, SAMPLES_NUM, NULL, &dict_len)) || (errno != EINVAL)) {
+		printf("knet_handle_compress_dict_train accepted invalid dict or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress_dict_train with no dict_len\n");
+	if ((!knet_handle_compress_dict_train(knet_h, "zstd", samples, samples_sizes, SAMPLES_NUM, dict, NULL)) || (errno != EINVAL)) {
+		printf("knet_handle_compress_dict_train accepted invalid dict_len or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress_dict_train with 0 dict_len\n");
+	dict_len = 0;
+	if ((!knet_handle_compress_dict_train(knet_h, "zstd", samples, samples_sizes, SAMPLES_NUM, dict, &dict_len)) || (errno != EINVAL)) {
+		printf("knet_handle_compress_dict_train accepted invalid dict_len or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress_dict_train with invalid compress_model\n");
+	dict_len = sizeof(dict);
+	if ((!knet_handle_compress_dict_train(knet_h, "none", samples, samples_sizes, SAMPLES_NUM, dict, &dict_len)) || (errno != EINVAL)) {
+		printf("knet_handle_compress_dict_train accepted invalid compress_model or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	if (has_compress_model("zlib")) {
+		printf("Test knet_handle_compress_dict_train with compress_model without dictionary support\n");
+		if ((!knet_handle_compress_dict_train(knet_h, "zlib", samples, samples_sizes, SAMPLES_NUM, dict, &dict_len)) || (errno != EINVAL)) {
+			printf("knet_handle_compress_dict_train accepted zlib or returned incorrect error: %s\n", strerror(errno));
+			knet_handle_free(knet_h);
+			flush_logs(logfds[0], stdout);
+			close_logpipes(logfds);
+			exit(FAIL);
+		}
+
+		flush_logs(logfds[0], stdout);
+	}
+
+	if (!has_compress_model("zstd")) {
+		printf("zstd support not built in. Skipping training tests\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		return;
+	}
+
+	printf("Test knet_handle_compress_dict_train with zstd\n");
+	if (knet_handle_compress_dict_train(knet_h, "zstd", samples, samples_sizes, SAMPLES_NUM, dict, &dict_len) < 0) {
+		printf("knet_handle_compress_dict_train failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((dict_len == 0) || (dict_len > sizeof(dict))) {
+		printf("knet_handle_compress_dict_train returned incorrect dict_len: %zu\n", dict_len);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_compress_dict with trained dictionary\n");
+	if (knet_handle_compress_dict(knet_h, "zstd", dict, dict_len) < 0) {
+		printf("knet_handle_compress_dict failed to load trained dictionary: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	knet_handle_free(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	test();
+
+	return PASS;
+}
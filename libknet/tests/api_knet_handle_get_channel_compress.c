@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.  All rights reserved.
+ *
+ * This software licensed under GPL-2.0+, LGPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "test-common.h"
+
+static int private_data;
+
+static void sock_notify(void *pvt_data,
+			int datafd,
+			int8_t channel,
+			uint8_t tx_rx,
+			int error,
+			int errorno)
+{
+	return;
+}
+
+static void test(void)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+	int datafd = 0;
+	int8_t channel = 0;
+	struct knet_handle_compress_cfg knet_handle_compress_cfg;
+
+	printf("Test knet_handle_get_channel_compress incorrect knet_h\n");
+
+	if ((!knet_handle_get_channel_compress(NULL, 0, &knet_handle_compress_cfg)) || (errno != EINVAL)) {
+		printf("knet_handle_get_channel_compress accepted invalid knet_h or returned incorrect error: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_DEBUG);
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_channel_compress with invalid channel\n");
+
+	if ((!knet_handle_get_channel_compress(knet_h, -1, &knet_handle_compress_cfg)) || (errno != EINVAL)) {
+		printf("knet_handle_get_channel_compress accepted invalid channel or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_channel_compress with unused channel\n");
+
+	if ((!knet_handle_get_channel_compress(knet_h, 0, &knet_handle_compress_cfg)) || (errno != EINVAL)) {
+		printf("knet_handle_get_channel_compress accepted unused channel or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	if (knet_handle_enable_sock_notify(knet_h, &private_data, sock_notify) < 0) {
+		printf("knet_handle_enable_sock_notify failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	datafd = 0;
+	channel = -1;
+
+	if (knet_handle_add_datafd(knet_h, &datafd, &channel) < 0) {
+		printf("knet_handle_add_datafd failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	printf("Test knet_handle_get_channel_compress with no cfg\n");
+
+	if ((!knet_handle_get_channel_compress(knet_h, channel, NULL)) || (errno != EINVAL)) {
+		printf("knet_handle_get_channel_compress accepted invalid cfg or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_channel_compress default value\n");
+
+	memset(&knet_handle_compress_cfg, 0xff, sizeof(struct knet_handle_compress_cfg));
+
+	if ((knet_handle_get_channel_compress(knet_h, channel, &knet_handle_compress_cfg) < 0) ||
+	    (knet_handle_compress_cfg.compress_model[0] != 0)) {
+		printf("knet_handle_get_channel_compress returned incorrect default value: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_channel_compress after knet_handle_set_channel_compress\n");
+
+	memset(&knet_handle_compress_cfg, 0, sizeof(struct knet_handle_compress_cfg));
+	strncpy(knet_handle_compress_cfg.compress_model, "zlib", sizeof(knet_handle_compress_cfg.compress_model) - 1);
+	knet_handle_compress_cfg.compress_level = 3;
+	knet_handle_compress_cfg.compress_threshold = 200;
+
+	if (knet_handle_set_channel_compress(knet_h, channel, &knet_handle_compress_cfg) < 0) {
+		printf("knet_handle_set_channel_compress failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	memset(&knet_handle_compress_cfg, 0, sizeof(struct knet_handle_compress_cfg));
+
+	if ((knet_handle_get_channel_compress(knet_h, channel, &knet_handle_compress_cfg) < 0) ||
+	    (strcmp(knet_handle_compress_cfg.compress_model, "zlib")) ||
+	    (knet_handle_compress_cfg.compress_level != 3) ||
+	    (knet_handle_compress_cfg.compress_threshold != 200)) {
+		printf("knet_handle_get_channel_compress returned incorrect values: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	knet_handle_free(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	struct knet_compress_info compress_list[16];
+	size_t compress_list_entries;
+	size_t i;
+
+	memset(compress_list, 0, sizeof(compress_list));
+
+	if (knet_get_compress_list(compress_list, &compress_list_entries) < 0) {
+		printf("knet_get_compress_list failed: %s\n", strerror(errno));
+		return FAIL;
+	}
+
+	for (i=0; i < compress_list_entries; i++) {
+		if (!strcmp(compress_list[i].name, "zlib")) {
+			test();
+			return PASS;
+		}
+	}
+
+	printf("WARNING: zlib support not builtin the library. Unable to test/verify channel compress API calls\n");
+	return SKIP;
+}
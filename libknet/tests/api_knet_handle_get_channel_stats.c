@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.  All rights reserved.
+ *
+ * This software licensed under GPL-2.0+, LGPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "netutils.h"
+#include "test-common.h"
+
+static int private_data;
+
+static void sock_notify(void *pvt_data,
+			int datafd,
+			int8_t channel,
+			uint8_t tx_rx,
+			int error,
+			int errorno)
+{
+	return;
+}
+
+static void test(void)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+	int datafd = 0;
+	int8_t channel = 0;
+	struct knet_channel_stats stats;
+	char send_buff[KNET_MAX_PACKET_SIZE];
+	char recv_buff[KNET_MAX_PACKET_SIZE];
+	ssize_t send_len = 0;
+	int recv_len = 0;
+	int savederrno;
+	struct sockaddr_storage lo;
+	struct knet_handle_compress_cfg knet_handle_compress_cfg;
+
+	if (make_local_sockaddr(&lo, 0) < 0) {
+		printf("Unable to convert loopback to sockaddr: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	memset(send_buff, 0, sizeof(send_buff));
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_DEBUG);
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_channel_stats incorrect knet_h\n");
+
+	if ((!knet_handle_get_channel_stats(NULL, 0, &stats, sizeof(stats))) || (errno != EINVAL)) {
+		printf("knet_handle_get_channel_stats accepted invalid knet_h or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_channel_stats with invalid channel\n");
+
+	if ((!knet_handle_get_channel_stats(knet_h, KNET_DATAFD_MAX, &stats, sizeof(stats))) || (errno != EINVAL)) {
+		printf("knet_handle_get_channel_stats accepted invalid channel or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_channel_stats with no stats\n");
+
+	if ((!knet_handle_get_channel_stats(knet_h, 0, NULL, sizeof(stats))) || (errno != EINVAL)) {
+		printf("knet_handle_get_channel_stats accepted invalid stats or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	if (knet_handle_enable_sock_notify(knet_h, &private_data, sock_notify) < 0) {
+		printf("knet_handle_enable_sock_notify failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+        }
+
+	datafd = 0;
+	channel = -1;
+
+	if (knet_handle_add_datafd(knet_h, &datafd, &channel) < 0) {
+		printf("knet_handle_add_datafd failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	printf("Test knet_handle_get_channel_stats with zlib on the channel only\n");
+
+	memset(&knet_handle_compress_cfg, 0, sizeof(struct knet_handle_compress_cfg));
+	strncpy(knet_handle_compress_cfg.compress_model, "zlib", sizeof(knet_handle_compress_cfg.compress_model) - 1);
+	knet_handle_compress_cfg.compress_level = 1;
+	knet_handle_compress_cfg.compress_threshold = 0;
+
+	if (knet_handle_set_channel_compress(knet_h, channel, &knet_handle_compress_cfg) < 0) {
+		printf("knet_handle_set_channel_compress failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_host_add(knet_h, 1) < 0) {
+		printf("knet_host_add failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_link_set_config(knet_h, 1, 0, KNET_TRANSPORT_UDP, &lo, &lo, 0) < 0) {
+		printf("Unable to configure link: %s\n", strerror(errno));
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_link_set_enable(knet_h, 1, 0, 1) < 0) {
+		printf("knet_link_set_enable failed: %s\n", strerror(errno));
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_handle_setfwd(knet_h, 1) < 0) {
+		printf("knet_handle_setfwd failed: %s\n", strerror(errno));
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (wait_for_host(knet_h, 1, 10, logfds[0], stdout) < 0) {
+		printf("timeout waiting for host to be reachable");
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	send_len = knet_send(knet_h, send_buff, KNET_MAX_PACKET_SIZE, channel);
+	if (send_len <= 0) {
+		printf("knet_send failed: %s\n", strerror(errno));
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (send_len != sizeof(send_buff)) {
+		printf("knet_send sent only %zd bytes: %s\n", send_len, strerror(errno));
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	if (wait_for_packet(knet_h, 10, datafd)) {
+		printf("Error waiting for packet: %s\n", strerror(errno));
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	recv_len = knet_recv(knet_h, recv_buff, KNET_MAX_PACKET_SIZE, channel);
+	savederrno = errno;
+	if (recv_len != send_len) {
+		printf("knet_recv received only %d bytes: %s (errno: %d)\n", recv_len, strerror(errno), errno);
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		if ((is_helgrind()) && (recv_len == -1) && (savederrno == EAGAIN)) {
+			printf("helgrind exception. this is normal due to possible timeouts\n");
+			exit(PASS);
+		}
+		exit(FAIL);
+	}
+
+	if (memcmp(recv_buff, send_buff, KNET_MAX_PACKET_SIZE)) {
+		printf("recv and send buffers are different!\n");
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_handle_get_channel_stats(knet_h, channel, &stats, sizeof(stats)) < 0) {
+		printf("knet_handle_get_channel_stats failed: %s\n", strerror(errno));
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((stats.size != sizeof(struct knet_channel_stats)) ||
+	    (stats.tx_compressed_packets != 1) ||
+	    (stats.rx_compressed_packets != 1) ||
+	    (stats.tx_compressed_original_bytes != KNET_MAX_PACKET_SIZE) ||
+	    (stats.tx_compressed_size_bytes >= stats.tx_compressed_original_bytes)) {
+		printf("channel stats look wrong: tx_packets: %" PRIu64 " (%" PRIu64 "/%" PRIu64 " comp/uncomp), rx_packets: %" PRIu64 "\n",
+		       stats.tx_compressed_packets,
+		       stats.tx_compressed_size_bytes,
+		       stats.tx_compressed_original_bytes,
+		       stats.rx_compressed_packets);
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_channel_stats after knet_handle_clear_stats\n");
+
+	if ((knet_handle_clear_stats(knet_h, KNET_CLEARSTATS_HANDLE_ONLY) < 0) ||
+	    (knet_handle_get_channel_stats(knet_h, channel, &stats, sizeof(stats)) < 0) ||
+	    (stats.tx_compressed_packets != 0) ||
+	    (stats.rx_compressed_packets != 0)) {
+		printf("knet_handle_clear_stats did not clear channel stats: %s\n", strerror(errno));
+		knet_link_set_enable(knet_h, 1, 0, 0);
+		knet_link_clear_config(knet_h, 1, 0);
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	knet_link_set_enable(knet_h, 1, 0, 0);
+	knet_link_clear_config(knet_h, 1, 0);
+	knet_host_remove(knet_h, 1);
+	knet_handle_free(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	struct knet_compress_info compress_list[16];
+	size_t compress_list_entries;
+	size_t i;
+
+	memset(compress_list, 0, sizeof(compress_list));
+
+	if (knet_get_compress_list(compress_list, &compress_list_entries) < 0) {
+		printf("knet_get_compress_list failed: %s\n", strerror(errno));
+		return FAIL;
+	}
+
+	for (i=0; i < compress_list_entries; i++) {
+		if (!strcmp(compress_list[i].name, "zlib")) {
+			test();
+			return PASS;
+		}
+	}
+
+	printf("WARNING: zlib support not builtin the library. Unable to test/verify channel stats\n");
+	return SKIP;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.  All rights reserved.
+ *
+ * This software licensed under GPL-2.0+, LGPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "test-common.h"
+
+static void test(void)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+	unsigned int enabled;
+
+	printf("Test knet_handle_get_compress_adaptive incorrect knet_h\n");
+
+	if ((!knet_handle_get_compress_adaptive(NULL, &enabled)) || (errno != EINVAL)) {
+		printf("knet_handle_get_compress_adaptive accepted invalid knet_h or returned incorrect error: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_DEBUG);
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_compress_adaptive with no enabled\n");
+	if ((!knet_handle_get_compress_adaptive(knet_h, NULL)) || (errno != EINVAL)) {
+		printf("knet_handle_get_compress_adaptive accepted invalid enabled or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_compress_adaptive default value\n");
+	if (knet_handle_get_compress_adaptive(knet_h, &enabled) < 0) {
+		printf("knet_handle_get_compress_adaptive failed error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (enabled != 0) {
+		printf("knet_handle_get_compress_adaptive returned incorrect default value: %u\n", enabled);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_compress_adaptive after knet_handle_set_compress_adaptive\n");
+	if (knet_handle_set_compress_adaptive(knet_h, 1) < 0) {
+		printf("knet_handle_set_compress_adaptive failed error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((knet_handle_get_compress_adaptive(knet_h, &enabled) < 0) || (enabled != 1)) {
+		printf("knet_handle_get_compress_adaptive failed to return the value: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	knet_handle_free(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	test();
+
+	return PASS;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.  All rights reserved.
+ *
+ * This software licensed under GPL-2.0+, LGPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "test-common.h"
+
+static void test(void)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+	unsigned int enabled;
+
+	printf("Test knet_handle_get_compress_stream incorrect knet_h\n");
+
+	if ((!knet_handle_get_compress_stream(NULL, &enabled)) || (errno != EINVAL)) {
+		printf("knet_handle_get_compress_stream accepted invalid knet_h or returned incorrect error: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_DEBUG);
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_compress_stream with no enabled\n");
+	if ((!knet_handle_get_compress_stream(knet_h, NULL)) || (errno != EINVAL)) {
+		printf("knet_handle_get_compress_stream accepted invalid enabled or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_compress_stream default value\n");
+	if (knet_handle_get_compress_stream(knet_h, &enabled) < 0) {
+		printf("knet_handle_get_compress_stream failed error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (enabled != 0) {
+		printf("knet_handle_get_compress_stream returned incorrect default value: %u\n", enabled);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_compress_stream after knet_handle_set_compress_stream\n");
+	if (knet_handle_set_compress_stream(knet_h, 1) < 0) {
+		printf("knet_handle_set_compress_stream failed error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((knet_handle_get_compress_stream(knet_h, &enabled) < 0) || (enabled != 1)) {
+		printf("knet_handle_get_compress_stream failed to return the value: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	knet_handle_free(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	test();
+
+	return PASS;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.  All rights reserved.
+ *
+ * This software licensed under GPL-2.0+, LGPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "test-common.h"
+
+static void test(void)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+	uint32_t window;
+
+	printf("Test knet_handle_get_dedup_window incorrect knet_h\n");
+
+	if ((!knet_handle_get_dedup_window(NULL, &window)) || (errno != EINVAL)) {
+		printf("knet_handle_get_dedup_window accepted invalid knet_h or returned incorrect error: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_DEBUG);
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_dedup_window with no window\n");
+	if ((!knet_handle_get_dedup_window(knet_h, NULL)) || (errno != EINVAL)) {
+		printf("knet_handle_get_dedup_window accepted invalid window or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_dedup_window default value\n");
+	if (knet_handle_get_dedup_window(knet_h, &window) < 0) {
+		printf("knet_handle_get_dedup_window failed error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (window != KNET_DEDUP_WINDOW_DEFAULT) {
+		printf("knet_handle_get_dedup_window returned incorrect default value: %u\n", window);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_dedup_window after knet_handle_set_dedup_window\n");
+	if (knet_handle_set_dedup_window(knet_h, 65536) < 0) {
+		printf("knet_handle_set_dedup_window failed error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((knet_handle_get_dedup_window(knet_h, &window) < 0) ||
+	    (window != 65536)) {
+		printf("knet_handle_get_dedup_window failed to return the value: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	knet_handle_free(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	test();
+
+	return PASS;
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.  All rights reserved.
+ *
+ * This software licensed under GPL-2.0+, LGPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "test-common.h"
+
+static void test(void)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+	uint32_t max_bufs, expire_msecs;
+
+	printf("Test knet_handle_get_defrag_bufs incorrect knet_h\n");
+
+	if ((!knet_handle_get_defrag_bufs(NULL, &max_bufs, &expire_msecs)) || (errno != EINVAL)) {
+		printf("knet_handle_get_defrag_bufs accepted invalid knet_h or returned incorrect error: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_DEBUG);
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_defrag_bufs with no max_bufs\n");
+	if ((!knet_handle_get_defrag_bufs(knet_h, NULL, &expire_msecs)) || (errno != EINVAL)) {
+		printf("knet_handle_get_defrag_bufs accepted invalid max_bufs or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_defrag_bufs with no expire_msecs\n");
+	if ((!knet_handle_get_defrag_bufs(knet_h, &max_bufs, NULL)) || (errno != EINVAL)) {
+		printf("knet_handle_get_defrag_bufs accepted invalid expire_msecs or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_defrag_bufs default values\n");
+	if (knet_handle_get_defrag_bufs(knet_h, &max_bufs, &expire_msecs) < 0) {
+		printf("knet_handle_get_defrag_bufs failed error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((max_bufs != KNET_DEFRAG_BUFS_DEFAULT) || (expire_msecs != KNET_DEFRAG_EXPIRE_DEFAULT)) {
+		printf("knet_handle_get_defrag_bufs returned incorrect default values: %u %u\n", max_bufs, expire_msecs);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_defrag_bufs after knet_handle_set_defrag_bufs\n");
+	if (knet_handle_set_defrag_bufs(knet_h, 16, 500) < 0) {
+		printf("knet_handle_set_defrag_bufs failed error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((knet_handle_get_defrag_bufs(knet_h, &max_bufs, &expire_msecs) < 0) ||
+	    (max_bufs != 16) || (expire_msecs != 500)) {
+		printf("knet_handle_get_defrag_bufs failed to return the values: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	knet_handle_free(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	test();
+
+	return PASS;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.  All rights reserved.
+ *
+ * This software licensed under GPL-2.0+, LGPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "test-common.h"
+
+static void test(void)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+	uint8_t rx_threads;
+
+	printf("Test knet_handle_get_rx_threads incorrect knet_h\n");
+
+	if ((!knet_handle_get_rx_threads(NULL, &rx_threads)) || (errno != EINVAL)) {
+		printf("knet_handle_get_rx_threads accepted invalid knet_h or returned incorrect error: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_DEBUG);
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_rx_threads with no rx_threads\n");
+	if ((!knet_handle_get_rx_threads(knet_h, NULL)) || (errno != EINVAL)) {
+		printf("knet_handle_get_rx_threads accepted invalid rx_threads or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_rx_threads default value\n");
+	if (knet_handle_get_rx_threads(knet_h, &rx_threads) < 0) {
+		printf("knet_handle_get_rx_threads failed error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (rx_threads != 1) {
+		printf("knet_handle_get_rx_threads returned incorrect default value: %u\n", rx_threads);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_get_rx_threads after knet_handle_set_rx_threads\n");
+	if (knet_handle_set_rx_threads(knet_h, 3) < 0) {
+		printf("knet_handle_set_rx_threads failed error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((knet_handle_get_rx_threads(knet_h, &rx_threads) < 0) || (rx_threads != 3)) {
+		printf("knet_handle_get_rx_threads failed to return the value: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	knet_handle_free(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	test();
+
+	return PASS;
+}
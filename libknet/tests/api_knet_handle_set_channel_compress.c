@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.  All rights reserved.
+ *
+ * This software licensed under GPL-2.0+, LGPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "test-common.h"
+
+static int private_data;
+
+static void sock_notify(void *pvt_data,
+			int datafd,
+			int8_t channel,
+			uint8_t tx_rx,
+			int error,
+			int errorno)
+{
+	return;
+}
+
+static void test(void)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+	int datafd = 0;
+	int8_t channel = 0;
+	struct knet_handle_compress_cfg knet_handle_compress_cfg;
+
+	memset(&knet_handle_compress_cfg, 0, sizeof(struct knet_handle_compress_cfg));
+	strncpy(knet_handle_compress_cfg.compress_model, "zlib", sizeof(knet_handle_compress_cfg.compress_model) - 1);
+	knet_handle_compress_cfg.compress_level = 1;
+
+	printf("Test knet_handle_set_channel_compress incorrect knet_h\n");
+
+	if ((!knet_handle_set_channel_compress(NULL, 0, &knet_handle_compress_cfg)) || (errno != EINVAL)) {
+		printf("knet_handle_set_channel_compress accepted invalid knet_h or returned incorrect error: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_DEBUG);
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_channel_compress with invalid channel\n");
+
+	if ((!knet_handle_set_channel_compress(knet_h, -1, &knet_handle_compress_cfg)) || (errno != EINVAL)) {
+		printf("knet_handle_set_channel_compress accepted invalid channel or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((!knet_handle_set_channel_compress(knet_h, KNET_DATAFD_MAX, &knet_handle_compress_cfg)) || (errno != EINVAL)) {
+		printf("knet_handle_set_channel_compress accepted invalid channel or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_channel_compress with unused channel\n");
+
+	if ((!knet_handle_set_channel_compress(knet_h, 0, &knet_handle_compress_cfg)) || (errno != EINVAL)) {
+		printf("knet_handle_set_channel_compress accepted unused channel or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	if (knet_handle_enable_sock_notify(knet_h, &private_data, sock_notify) < 0) {
+		printf("knet_handle_enable_sock_notify failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	datafd = 0;
+	channel = -1;
+
+	if (knet_handle_add_datafd(knet_h, &datafd, &channel) < 0) {
+		printf("knet_handle_add_datafd failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_channel_compress with auto compress model\n");
+
+	strncpy(knet_handle_compress_cfg.compress_model, "auto", sizeof(knet_handle_compress_cfg.compress_model) - 1);
+
+	if ((!knet_handle_set_channel_compress(knet_h, channel, &knet_handle_compress_cfg)) || (errno != EINVAL)) {
+		printf("knet_handle_set_channel_compress accepted auto compress model or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_channel_compress with invalid compress model\n");
+
+	strncpy(knet_handle_compress_cfg.compress_model, "boh", sizeof(knet_handle_compress_cfg.compress_model) - 1);
+
+	if ((!knet_handle_set_channel_compress(knet_h, channel, &knet_handle_compress_cfg)) || (errno != EINVAL)) {
+		printf("knet_handle_set_channel_compress accepted invalid compress model or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_channel_compress with zlib and excessive compress level\n");
+
+	memset(&knet_handle_compress_cfg, 0, sizeof(struct knet_handle_compress_cfg));
+	strncpy(knet_handle_compress_cfg.compress_model, "zlib", sizeof(knet_handle_compress_cfg.compress_model) - 1);
+	knet_handle_compress_cfg.compress_level = 10;
+
+	if ((!knet_handle_set_channel_compress(knet_h, channel, &knet_handle_compress_cfg)) || (errno != EINVAL)) {
+		printf("knet_handle_set_channel_compress accepted invalid compress level or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_channel_compress with zlib and excessive compress threshold\n");
+
+	knet_handle_compress_cfg.compress_level = 1;
+	knet_handle_compress_cfg.compress_threshold = KNET_MAX_PACKET_SIZE + 1;
+
+	if ((!knet_handle_set_channel_compress(knet_h, channel, &knet_handle_compress_cfg)) || (errno != EINVAL)) {
+		printf("knet_handle_set_channel_compress accepted invalid compress threshold or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_h->channel_compress[channel].enabled) {
+		printf("knet_handle_set_channel_compress failures changed the channel configuration\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_channel_compress with zlib\n");
+
+	knet_handle_compress_cfg.compress_threshold = 0;
+
+	if (knet_handle_set_channel_compress(knet_h, channel, &knet_handle_compress_cfg) < 0) {
+		printf("knet_handle_set_channel_compress failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((!knet_h->channel_compress[channel].enabled) ||
+	    (knet_h->channel_compress[channel].compress_level != 1) ||
+	    (knet_h->channel_compress[channel].compress_threshold != KNET_COMPRESS_THRESHOLD)) {
+		printf("knet_handle_set_channel_compress did not set the channel configuration\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_channel_compress survives handle compress changes\n");
+
+	strncpy(knet_handle_compress_cfg.compress_model, "none", sizeof(knet_handle_compress_cfg.compress_model) - 1);
+
+	if ((knet_handle_compress(knet_h, &knet_handle_compress_cfg) < 0) ||
+	    (!knet_h->channel_compress[channel].enabled)) {
+		printf("knet_handle_compress changed the channel configuration\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_channel_compress remove override\n");
+
+	if ((knet_handle_set_channel_compress(knet_h, channel, NULL) < 0) ||
+	    (knet_h->channel_compress[channel].enabled)) {
+		printf("knet_handle_set_channel_compress failed to remove the override: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_channel_compress override is removed with the datafd\n");
+
+	strncpy(knet_handle_compress_cfg.compress_model, "zlib", sizeof(knet_handle_compress_cfg.compress_model) - 1);
+
+	if (knet_handle_set_channel_compress(knet_h, channel, &knet_handle_compress_cfg) < 0) {
+		printf("knet_handle_set_channel_compress failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((knet_handle_remove_datafd(knet_h, datafd) < 0) ||
+	    (knet_h->channel_compress[channel].enabled)) {
+		printf("knet_handle_remove_datafd did not remove the channel override: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	knet_handle_free(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	struct knet_compress_info compress_list[16];
+	size_t compress_list_entries;
+	size_t i;
+
+	memset(compress_list, 0, sizeof(compress_list));
+
+	if (knet_get_compress_list(compress_list, &compress_list_entries) < 0) {
+		printf("knet_get_compress_list failed: %s\n", strerror(errno));
+		return FAIL;
+	}
+
+	for (i=0; i < compress_list_entries; i++) {
+		if (!strcmp(compress_list[i].name, "zlib")) {
+			test();
+			return PASS;
+		}
+	}
+
+	printf("WARNING: zlib support not builtin the library. Unable to test/verify channel compress API calls\n");
+	return SKIP;
+}
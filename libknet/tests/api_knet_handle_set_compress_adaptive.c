@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.  All rights reserved.
+ *
+ * This software licensed under GPL-2.0+, LGPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "netutils.h"
+#include "test-common.h"
+
+#define TEST_PACKETS 20
+#define TEST_PACKET_SIZE 4096
+
+static int private_data;
+
+static void sock_notify(void *pvt_data,
+			int datafd,
+			int8_t channel,
+			uint8_t tx_rx,
+			int error,
+			int errorno)
+{
+	return;
+}
+
+static void test_cleanup(knet_handle_t knet_h, int *logfds)
+{
+	knet_link_set_enable(knet_h, 1, 0, 0);
+	knet_link_clear_config(knet_h, 1, 0);
+	knet_host_remove(knet_h, 1);
+	knet_handle_free(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+/*
+ * random data does not compress
+ */
+static int send_recv(knet_handle_t knet_h, int datafd, int8_t channel)
+{
+	char send_buff[TEST_PACKET_SIZE];
+	char recv_buff[TEST_PACKET_SIZE];
+	ssize_t recv_len;
+	size_t j;
+	int i;
+
+	for (i = 0; i < TEST_PACKETS; i++) {
+		for (j = 0; j < sizeof(send_buff); j++) {
+			send_buff[j] = random();
+		}
+
+		if (knet_send(knet_h, send_buff, TEST_PACKET_SIZE, channel) != TEST_PACKET_SIZE) {
+			printf("knet_send failed: %s\n", strerror(errno));
+			return -1;
+		}
+
+		if (wait_for_packet(knet_h, 10, datafd)) {
+			printf("Error waiting for packet %d: %s\n", i, strerror(errno));
+			return -1;
+		}
+
+		recv_len = knet_recv(knet_h, recv_buff, TEST_PACKET_SIZE, channel);
+		if (recv_len != TEST_PACKET_SIZE) {
+			printf("knet_recv received only %zd bytes: %s\n", recv_len, strerror(errno));
+			return -1;
+		}
+
+		if (memcmp(recv_buff, send_buff, TEST_PACKET_SIZE)) {
+			printf("recv and send buffers are different!\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static uint64_t get_skipped(knet_handle_t knet_h)
+{
+	struct knet_handle_stats stats;
+
+	if (knet_handle_get_stats(knet_h, &stats, sizeof(stats)) < 0) {
+		printf("knet_handle_get_stats failed: %s\n", strerror(errno));
+		return UINT64_MAX;
+	}
+
+	return stats.tx_compress_skipped_packets;
+}
+
+static void test(void)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+	int datafd = 0;
+	int8_t channel = 0;
+	struct knet_handle_compress_cfg knet_handle_compress_cfg;
+	struct sockaddr_storage lo;
+	uint64_t skipped;
+
+	if (make_local_sockaddr(&lo, 0) < 0) {
+		printf("Unable to convert loopback to sockaddr: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	printf("Test knet_handle_set_compress_adaptive incorrect knet_h\n");
+
+	if ((!knet_handle_set_compress_adaptive(NULL, 1)) || (errno != EINVAL)) {
+		printf("knet_handle_set_compress_adaptive accepted invalid knet_h or returned incorrect error: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_DEBUG);
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_compress_adaptive with 2 (incorrect)\n");
+	if ((!knet_handle_set_compress_adaptive(knet_h, 2)) || (errno != EINVAL)) {
+		printf("knet_handle_set_compress_adaptive accepted invalid value or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_compress_adaptive with 1 (correct)\n");
+	if (knet_handle_set_compress_adaptive(knet_h, 1) < 0) {
+		printf("knet_handle_set_compress_adaptive failed error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_h->compress_adaptive != 1) {
+		printf("knet_handle_set_compress_adaptive failed to set the value\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test adaptive compression with incompressible data\n");
+
+	memset(&knet_handle_compress_cfg, 0, sizeof(struct knet_handle_compress_cfg));
+	strncpy(knet_handle_compress_cfg.compress_model, "zlib", sizeof(knet_handle_compress_cfg.compress_model) - 1);
+	knet_handle_compress_cfg.compress_level = 1;
+	knet_handle_compress_cfg.compress_threshold = 0;
+
+	if (knet_handle_compress(knet_h, &knet_handle_compress_cfg) < 0) {
+		printf("knet_handle_compress failed with correct config: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_handle_enable_sock_notify(knet_h, &private_data, sock_notify) < 0) {
+		printf("knet_handle_enable_sock_notify failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	datafd = 0;
+	channel = -1;
+
+	if (knet_handle_add_datafd(knet_h, &datafd, &channel) < 0) {
+		printf("knet_handle_add_datafd failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_host_add(knet_h, 1) < 0) {
+		printf("knet_host_add failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_link_set_config(knet_h, 1, 0, KNET_TRANSPORT_UDP, &lo, &lo, 0) < 0) {
+		printf("Unable to configure link: %s\n", strerror(errno));
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_link_set_enable(knet_h, 1, 0, 1) < 0) {
+		printf("knet_link_set_enable failed: %s\n", strerror(errno));
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if (knet_handle_setfwd(knet_h, 1) < 0) {
+		printf("knet_handle_setfwd failed: %s\n", strerror(errno));
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if (wait_for_host(knet_h, 1, 10, logfds[0], stdout) < 0) {
+		printf("timeout waiting for host to be reachable");
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if (send_recv(knet_h, datafd, channel) < 0) {
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	/*
+	 * packet 1 is compressed, 2-17 skipped,
+	 * 18 is compressed, 19-20 skipped
+	 */
+	skipped = get_skipped(knet_h);
+	if (skipped != 18) {
+		printf("adaptive compression skipped %" PRIu64 " packets instead of 18\n", skipped);
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_compress_adaptive with 0 (disable) and data\n");
+	if (knet_handle_set_compress_adaptive(knet_h, 0) < 0) {
+		printf("knet_handle_set_compress_adaptive failed error: %s\n", strerror(errno));
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if (send_recv(knet_h, datafd, channel) < 0) {
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	skipped = get_skipped(knet_h);
+	if (skipped != 18) {
+		printf("compression has been skipped with adaptive compression disabled\n");
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	test_cleanup(knet_h, logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	struct knet_compress_info compress_list[16];
+	size_t compress_list_entries;
+	size_t i;
+	int found = 0;
+
+	memset(compress_list, 0, sizeof(compress_list));
+
+	if (knet_get_compress_list(compress_list, &compress_list_entries) < 0) {
+		printf("knet_get_compress_list failed: %s\n", strerror(errno));
+		return FAIL;
+	}
+
+	for (i = 0; i < compress_list_entries; i++) {
+		if (!strcmp(compress_list[i].name, "zlib")) {
+			found = 1;
+		}
+	}
+
+	if (!found) {
+		printf("zlib compression not available. Skipping\n");
+		return SKIP;
+	}
+
+	test();
+
+	return PASS;
+}
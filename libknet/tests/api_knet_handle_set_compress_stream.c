@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.  All rights reserved.
+ *
+ * This software licensed under GPL-2.0+, LGPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "netutils.h"
+#include "test-common.h"
+
+static int private_data;
+
+static void sock_notify(void *pvt_data,
+			int datafd,
+			int8_t channel,
+			uint8_t tx_rx,
+			int error,
+			int errorno)
+{
+	return;
+}
+
+/*
+ * streams are used only for unicast traffic to one host
+ */
+static int dhost_filter(void *pvt_data,
+			const unsigned char *outdata,
+			ssize_t outdata_len,
+			uint8_t tx_rx,
+			knet_node_id_t this_host_id,
+			knet_node_id_t src_host_id,
+			int8_t *dst_channel,
+			knet_node_id_t *dst_host_ids,
+			size_t *dst_host_ids_entries)
+{
+	dst_host_ids[0] = 1;
+	*dst_host_ids_entries = 1;
+	return 0;
+}
+
+static void fill_buff(char *buff, size_t buff_len, int seed)
+{
+	size_t i;
+
+	for (i = 0; i < buff_len; i++) {
+		buff[i] = 'a' + ((i / 16 + seed) % 26);
+	}
+}
+
+static int send_and_check(knet_handle_t knet_h, int logfds[2], int datafd, int8_t channel, int seed)
+{
+	char send_buff[1024];
+	char recv_buff[KNET_MAX_PACKET_SIZE];
+	ssize_t send_len = 0;
+	int recv_len = 0;
+
+	fill_buff(send_buff, sizeof(send_buff), seed);
+
+	send_len = knet_send(knet_h, send_buff, sizeof(send_buff), channel);
+	if (send_len != sizeof(send_buff)) {
+		printf("knet_send failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (wait_for_packet(knet_h, 10, datafd)) {
+		printf("Error waiting for packet: %s\n", strerror(errno));
+		return -1;
+	}
+
+	recv_len = knet_recv(knet_h, recv_buff, KNET_MAX_PACKET_SIZE, channel);
+	if (recv_len != send_len) {
+		printf("knet_recv received only %d bytes: %s (errno: %d)\n", recv_len, strerror(errno), errno);
+		return -1;
+	}
+
+	if (memcmp(recv_buff, send_buff, sizeof(send_buff))) {
+		printf("recv and send buffers are different!\n");
+		return -1;
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	return 0;
+}
+
+static void cleanup(knet_handle_t knet_h, int logfds[2])
+{
+	knet_link_set_enable(knet_h, 1, 0, 0);
+	knet_link_clear_config(knet_h, 1, 0);
+	knet_host_remove(knet_h, 1);
+	knet_handle_free(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+static void test(void)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+	int datafd = 0;
+	int8_t channel = 0;
+	int i;
+	char send_buff[1024];
+	struct knet_channel_stats stats;
+	struct sockaddr_storage lo;
+	struct knet_handle_compress_cfg knet_handle_compress_cfg;
+
+	if (make_local_sockaddr(&lo, 0) < 0) {
+		printf("Unable to convert loopback to sockaddr: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	printf("Test knet_handle_set_compress_stream incorrect knet_h\n");
+
+	if ((!knet_handle_set_compress_stream(NULL, 1)) || (errno != EINVAL)) {
+		printf("knet_handle_set_compress_stream accepted invalid knet_h or returned incorrect error: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_DEBUG);
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_compress_stream with invalid value\n");
+
+	if ((!knet_handle_set_compress_stream(knet_h, 2)) || (errno != EINVAL)) {
+		printf("knet_handle_set_compress_stream accepted invalid value or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_compress_stream enable\n");
+
+	if (knet_handle_set_compress_stream(knet_h, 1) < 0) {
+		printf("knet_handle_set_compress_stream failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_h->compress_stream != 1) {
+		printf("knet_handle_set_compress_stream failed to set the value\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	if (knet_handle_enable_sock_notify(knet_h, &private_data, sock_notify) < 0) {
+		printf("knet_handle_enable_sock_notify failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_handle_enable_filter(knet_h, &private_data, dhost_filter) < 0) {
+		printf("knet_handle_enable_filter failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	datafd = 0;
+	channel = -1;
+
+	if (knet_handle_add_datafd(knet_h, &datafd, &channel) < 0) {
+		printf("knet_handle_add_datafd failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	memset(&knet_handle_compress_cfg, 0, sizeof(struct knet_handle_compress_cfg));
+	strncpy(knet_handle_compress_cfg.compress_model, "zlib", sizeof(knet_handle_compress_cfg.compress_model) - 1);
+	knet_handle_compress_cfg.compress_level = 1;
+	knet_handle_compress_cfg.compress_threshold = 64;
+
+	if (knet_handle_compress(knet_h, &knet_handle_compress_cfg) < 0) {
+		printf("knet_handle_compress failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_host_add(knet_h, 1) < 0) {
+		printf("knet_host_add failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_link_set_config(knet_h, 1, 0, KNET_TRANSPORT_UDP, &lo, &lo, 0) < 0) {
+		printf("Unable to configure link: %s\n", strerror(errno));
+		cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if (knet_link_set_enable(knet_h, 1, 0, 1) < 0) {
+		printf("knet_link_set_enable failed: %s\n", strerror(errno));
+		cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if (knet_handle_setfwd(knet_h, 1) < 0) {
+		printf("knet_handle_setfwd failed: %s\n", strerror(errno));
+		cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if (wait_for_host(knet_h, 1, 10, logfds[0], stdout) < 0) {
+		printf("timeout waiting for host to be reachable");
+		cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_send with stream compression\n");
+
+	for (i = 0; i < 8; i++) {
+		if (send_and_check(knet_h, logfds, datafd, channel, i) < 0) {
+			cleanup(knet_h, logfds);
+			exit(FAIL);
+		}
+	}
+
+	if (knet_handle_get_channel_stats(knet_h, channel, &stats, sizeof(stats)) < 0) {
+		printf("knet_handle_get_channel_stats failed: %s\n", strerror(errno));
+		cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if ((stats.tx_compress_stream_packets != 8) ||
+	    (stats.tx_compress_stream_resets != 1) ||
+	    (stats.rx_compress_stream_packets != 8) ||
+	    (stats.rx_compress_stream_lost != 0)) {
+		printf("stream stats look wrong: tx: %" PRIu64 " resets: %" PRIu64 " rx: %" PRIu64 " lost: %" PRIu64 "\n",
+		       stats.tx_compress_stream_packets, stats.tx_compress_stream_resets,
+		       stats.rx_compress_stream_packets, stats.rx_compress_stream_lost);
+		cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test stream compression recovers from a lost packet\n");
+
+	/*
+	 * make the receiver believe it has missed more packets than
+	 * it can hold, the next packet is dropped and the receiver asks for a reset
+	 */
+	knet_h->host_index[1]->rx_compress_stream[channel].seq -= KNET_COMPRESS_STREAM_REORDER + 1;
+
+	fill_buff(send_buff, sizeof(send_buff), 100);
+	if (knet_send(knet_h, send_buff, sizeof(send_buff), channel) != sizeof(send_buff)) {
+		printf("knet_send failed: %s\n", strerror(errno));
+		cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	usleep(500000);
+
+	if (send_and_check(knet_h, logfds, datafd, channel, 101) < 0) {
+		cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if (knet_handle_get_channel_stats(knet_h, channel, &stats, sizeof(stats)) < 0) {
+		printf("knet_handle_get_channel_stats failed: %s\n", strerror(errno));
+		cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if ((stats.tx_compress_stream_resets != 2) ||
+	    (stats.rx_compress_stream_packets != 9) ||
+	    (stats.rx_compress_stream_lost != 1)) {
+		printf("stream stats look wrong after loss: resets: %" PRIu64 " rx: %" PRIu64 " lost: %" PRIu64 "\n",
+		       stats.tx_compress_stream_resets,
+		       stats.rx_compress_stream_packets, stats.rx_compress_stream_lost);
+		cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_compress_stream disable\n");
+
+	if (knet_handle_set_compress_stream(knet_h, 0) < 0) {
+		printf("knet_handle_set_compress_stream failed: %s\n", strerror(errno));
+		cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if (knet_h->host_index[1]->tx_compress_stream[channel].ctx != NULL) {
+		printf("knet_handle_set_compress_stream did not release the stream\n");
+		cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if (send_and_check(knet_h, logfds, datafd, channel, 200) < 0) {
+		cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if ((knet_handle_get_channel_stats(knet_h, channel, &stats, sizeof(stats)) < 0) ||
+	    (stats.tx_compress_stream_packets != 10)) {
+		printf("packet has been compressed as a stream after disabling it\n");
+		cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	cleanup(knet_h, logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	struct knet_compress_info compress_list[16];
+	size_t compress_list_entries;
+	size_t i;
+
+	memset(compress_list, 0, sizeof(compress_list));
+
+	if (knet_get_compress_list(compress_list, &compress_list_entries) < 0) {
+		printf("knet_get_compress_list failed: %s\n", strerror(errno));
+		return FAIL;
+	}
+
+	for (i=0; i < compress_list_entries; i++) {
+		if (!strcmp(compress_list[i].name, "zlib")) {
+			test();
+			return PASS;
+		}
+	}
+
+	printf("WARNING: zlib support not builtin the library. Unable to test/verify stream compression\n");
+	return SKIP;
+}
@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.  All rights reserved.
+ *
+ * This software licensed under GPL-2.0+, LGPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "netutils.h"
+#include "test-common.h"
+
+#define TEST_PACKETS 16
+
+static int private_data;
+
+static void sock_notify(void *pvt_data,
+			int datafd,
+			int8_t channel,
+			uint8_t tx_rx,
+			int error,
+			int errorno)
+{
+	return;
+}
+
+static void test_cleanup(knet_handle_t knet_h, int *logfds)
+{
+	knet_link_set_enable(knet_h, 1, 0, 0);
+	knet_link_clear_config(knet_h, 1, 0);
+	knet_host_remove(knet_h, 1);
+	knet_handle_free(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+/*
+ * KNET_MAX_PACKET_SIZE is always bigger than the data MTU,
+ * every packet is fragmented
+ */
+static int send_recv(knet_handle_t knet_h, int datafd, int8_t channel)
+{
+	char send_buff[KNET_MAX_PACKET_SIZE];
+	char recv_buff[KNET_MAX_PACKET_SIZE];
+	ssize_t recv_len;
+	int i;
+
+	for (i = 0; i < TEST_PACKETS; i++) {
+		memset(send_buff, i, sizeof(send_buff));
+
+		if (knet_send(knet_h, send_buff, KNET_MAX_PACKET_SIZE, channel) != KNET_MAX_PACKET_SIZE) {
+			printf("knet_send failed: %s\n", strerror(errno));
+			return -1;
+		}
+
+		if (wait_for_packet(knet_h, 10, datafd)) {
+			printf("Error waiting for packet %d: %s\n", i, strerror(errno));
+			return -1;
+		}
+
+		recv_len = knet_recv(knet_h, recv_buff, KNET_MAX_PACKET_SIZE, channel);
+		if (recv_len != KNET_MAX_PACKET_SIZE) {
+			printf("knet_recv received only %zd bytes: %s\n", recv_len, strerror(errno));
+			return -1;
+		}
+
+		if (memcmp(recv_buff, send_buff, KNET_MAX_PACKET_SIZE)) {
+			printf("recv and send buffers are different!\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void test(const char *model)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+	int datafd = 0;
+	int8_t channel = 0;
+	struct knet_handle_crypto_cfg knet_handle_crypto_cfg;
+	struct sockaddr_storage lo;
+
+	if (make_local_sockaddr(&lo, 0) < 0) {
+		printf("Unable to convert loopback to sockaddr: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	printf("Test knet_handle_set_crypto_threads incorrect knet_h\n");
+
+	if ((!knet_handle_set_crypto_threads(NULL, 1)) || (errno != EINVAL)) {
+		printf("knet_handle_set_crypto_threads accepted invalid knet_h or returned incorrect error: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_DEBUG);
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_crypto_threads with KNET_MAX_CRYPTO_THREADS + 1 (incorrect)\n");
+	if ((!knet_handle_set_crypto_threads(knet_h, KNET_MAX_CRYPTO_THREADS + 1)) || (errno != EINVAL)) {
+		printf("knet_handle_set_crypto_threads accepted invalid crypto_threads or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_crypto_threads with 4 (correct)\n");
+	if (knet_handle_set_crypto_threads(knet_h, 4) < 0) {
+		printf("knet_handle_set_crypto_threads failed error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((knet_h->crypto_workers_num != 4) || (!knet_h->crypto_workers[3]) || (knet_h->crypto_workers[4])) {
+		printf("knet_handle_set_crypto_threads failed to start the crypto threads\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test %s encrypted fragments across crypto threads\n", model);
+
+	memset(&knet_handle_crypto_cfg, 0, sizeof(struct knet_handle_crypto_cfg));
+	strncpy(knet_handle_crypto_cfg.crypto_model, model, sizeof(knet_handle_crypto_cfg.crypto_model) - 1);
+	strncpy(knet_handle_crypto_cfg.crypto_cipher_type, "aes128", sizeof(knet_handle_crypto_cfg.crypto_cipher_type) - 1);
+	strncpy(knet_handle_crypto_cfg.crypto_hash_type, "sha1", sizeof(knet_handle_crypto_cfg.crypto_hash_type) - 1);
+	knet_handle_crypto_cfg.private_key_len = 2000;
+
+	if (knet_handle_crypto(knet_h, &knet_handle_crypto_cfg)) {
+		printf("knet_handle_crypto failed with correct config: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_handle_enable_sock_notify(knet_h, &private_data, sock_notify) < 0) {
+		printf("knet_handle_enable_sock_notify failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	datafd = 0;
+	channel = -1;
+
+	if (knet_handle_add_datafd(knet_h, &datafd, &channel) < 0) {
+		printf("knet_handle_add_datafd failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_host_add(knet_h, 1) < 0) {
+		printf("knet_host_add failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_link_set_config(knet_h, 1, 0, KNET_TRANSPORT_UDP, &lo, &lo, 0) < 0) {
+		printf("Unable to configure link: %s\n", strerror(errno));
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_link_set_enable(knet_h, 1, 0, 1) < 0) {
+		printf("knet_link_set_enable failed: %s\n", strerror(errno));
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if (knet_handle_setfwd(knet_h, 1) < 0) {
+		printf("knet_handle_setfwd failed: %s\n", strerror(errno));
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if (wait_for_host(knet_h, 1, 10, logfds[0], stdout) < 0) {
+		printf("timeout waiting for host to be reachable");
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if (send_recv(knet_h, datafd, channel) < 0) {
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_crypto_threads with 0 (disable) and data\n");
+	if (knet_handle_set_crypto_threads(knet_h, 0) < 0) {
+		printf("knet_handle_set_crypto_threads failed error: %s\n", strerror(errno));
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if ((knet_h->crypto_workers_num != 0) || (knet_h->crypto_workers[0])) {
+		printf("knet_handle_set_crypto_threads failed to stop the crypto threads\n");
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if (send_recv(knet_h, datafd, channel) < 0) {
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	test_cleanup(knet_h, logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	struct knet_crypto_info crypto_list[16];
+	size_t crypto_list_entries;
+
+	memset(crypto_list, 0, sizeof(crypto_list));
+
+	if (knet_get_crypto_list(crypto_list, &crypto_list_entries) < 0) {
+		printf("knet_get_crypto_list failed: %s\n", strerror(errno));
+		return FAIL;
+	}
+
+	if (crypto_list_entries == 0) {
+		printf("no crypto modules detected. Skipping\n");
+		return SKIP;
+	}
+
+	test(crypto_list[0].name);
+
+	return PASS;
+}
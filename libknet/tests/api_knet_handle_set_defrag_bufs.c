@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.  All rights reserved.
+ *
+ * This software licensed under GPL-2.0+, LGPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "netutils.h"
+#include "test-common.h"
+
+#define TEST_PACKETS 16
+
+static int private_data;
+
+static void sock_notify(void *pvt_data,
+			int datafd,
+			int8_t channel,
+			uint8_t tx_rx,
+			int error,
+			int errorno)
+{
+	return;
+}
+
+static void test_cleanup(knet_handle_t knet_h, int *logfds)
+{
+	knet_link_set_enable(knet_h, 1, 0, 0);
+	knet_link_clear_config(knet_h, 1, 0);
+	knet_host_remove(knet_h, 1);
+	knet_handle_free(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+/*
+ * KNET_MAX_PACKET_SIZE is always bigger than the data MTU,
+ * every packet is fragmented
+ */
+static int send_recv(knet_handle_t knet_h, int datafd, int8_t channel)
+{
+	char send_buff[KNET_MAX_PACKET_SIZE];
+	char recv_buff[KNET_MAX_PACKET_SIZE];
+	ssize_t recv_len;
+	int i;
+
+	for (i = 0; i < TEST_PACKETS; i++) {
+		memset(send_buff, i, sizeof(send_buff));
+
+		if (knet_send(knet_h, send_buff, KNET_MAX_PACKET_SIZE, channel) != KNET_MAX_PACKET_SIZE) {
+			printf("knet_send failed: %s\n", strerror(errno));
+			return -1;
+		}
+
+		if (wait_for_packet(knet_h, 10, datafd)) {
+			printf("Error waiting for packet %d: %s\n", i, strerror(errno));
+			return -1;
+		}
+
+		recv_len = knet_recv(knet_h, recv_buff, KNET_MAX_PACKET_SIZE, channel);
+		if (recv_len != KNET_MAX_PACKET_SIZE) {
+			printf("knet_recv received only %zd bytes: %s\n", recv_len, strerror(errno));
+			return -1;
+		}
+
+		if (memcmp(recv_buff, send_buff, KNET_MAX_PACKET_SIZE)) {
+			printf("recv and send buffers are different!\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void test(void)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+	int datafd = 0;
+	int8_t channel = 0;
+	struct sockaddr_storage lo;
+
+	if (make_local_sockaddr(&lo, 0) < 0) {
+		printf("Unable to convert loopback to sockaddr: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	printf("Test knet_handle_set_defrag_bufs incorrect knet_h\n");
+
+	if ((!knet_handle_set_defrag_bufs(NULL, 1, 1)) || (errno != EINVAL)) {
+		printf("knet_handle_set_defrag_bufs accepted invalid knet_h or returned incorrect error: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_DEBUG);
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_defrag_bufs with 0 buffers (incorrect)\n");
+	if ((!knet_handle_set_defrag_bufs(knet_h, 0, 1)) || (errno != EINVAL)) {
+		printf("knet_handle_set_defrag_bufs accepted invalid max_bufs or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_defrag_bufs with 0 expire (incorrect)\n");
+	if ((!knet_handle_set_defrag_bufs(knet_h, 1, 0)) || (errno != EINVAL)) {
+		printf("knet_handle_set_defrag_bufs accepted invalid expire_msecs or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_defrag_bufs with 1 buffer (correct)\n");
+	if (knet_handle_set_defrag_bufs(knet_h, 1, 100) < 0) {
+		printf("knet_handle_set_defrag_bufs failed error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((knet_h->defrag_pool_max != 1) || (knet_h->defrag_expire != 100)) {
+		printf("knet_handle_set_defrag_bufs failed to set the values\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test fragmented data with 1 defrag buffer\n");
+
+	if (knet_handle_enable_sock_notify(knet_h, &private_data, sock_notify) < 0) {
+		printf("knet_handle_enable_sock_notify failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	datafd = 0;
+	channel = -1;
+
+	if (knet_handle_add_datafd(knet_h, &datafd, &channel) < 0) {
+		printf("knet_handle_add_datafd failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_host_add(knet_h, 1) < 0) {
+		printf("knet_host_add failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_link_set_config(knet_h, 1, 0, KNET_TRANSPORT_UDP, &lo, &lo, 0) < 0) {
+		printf("Unable to configure link: %s\n", strerror(errno));
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_link_set_enable(knet_h, 1, 0, 1) < 0) {
+		printf("knet_link_set_enable failed: %s\n", strerror(errno));
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if (knet_handle_setfwd(knet_h, 1) < 0) {
+		printf("knet_handle_setfwd failed: %s\n", strerror(errno));
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if (wait_for_host(knet_h, 1, 10, logfds[0], stdout) < 0) {
+		printf("timeout waiting for host to be reachable");
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if (send_recv(knet_h, datafd, channel) < 0) {
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if (knet_h->defrag_pool_allocated > 1) {
+		printf("defrag pool allocated more buffers than configured: %u\n", knet_h->defrag_pool_allocated);
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test fragmented data with default defrag buffers\n");
+	if (knet_handle_set_defrag_bufs(knet_h, KNET_DEFRAG_BUFS_DEFAULT, KNET_DEFRAG_EXPIRE_DEFAULT) < 0) {
+		printf("knet_handle_set_defrag_bufs failed error: %s\n", strerror(errno));
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if (send_recv(knet_h, datafd, channel) < 0) {
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	test_cleanup(knet_h, logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	test();
+
+	return PASS;
+}
@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.  All rights reserved.
+ *
+ * This software licensed under GPL-2.0+, LGPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "netutils.h"
+#include "test-common.h"
+
+static int private_data;
+
+static void sock_notify(void *pvt_data,
+			int datafd,
+			int8_t channel,
+			uint8_t tx_rx,
+			int error,
+			int errorno)
+{
+	return;
+}
+
+static void test_cleanup(knet_handle_t knet_h, int *logfds)
+{
+	knet_link_set_enable(knet_h, 1, 0, 0);
+	knet_link_clear_config(knet_h, 1, 0);
+	knet_host_remove(knet_h, 1);
+	knet_handle_free(knet_h);
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+static int send_recv(knet_handle_t knet_h, int *datafd, int8_t *channel, int channels)
+{
+	char send_buff[KNET_MAX_PACKET_SIZE];
+	char recv_buff[KNET_MAX_PACKET_SIZE];
+	ssize_t send_len;
+	int i;
+
+	for (i = 0; i < channels; i++) {
+		memset(send_buff, i + 1, sizeof(send_buff));
+
+		send_len = knet_send(knet_h, send_buff, KNET_MAX_PACKET_SIZE, channel[i]);
+		if (send_len != KNET_MAX_PACKET_SIZE) {
+			printf("knet_send on channel %d failed: %s\n", channel[i], strerror(errno));
+			return -1;
+		}
+	}
+
+	for (i = 0; i < channels; i++) {
+		memset(send_buff, i + 1, sizeof(send_buff));
+
+		if (wait_for_packet(knet_h, 10, datafd[i])) {
+			printf("Error waiting for packet on channel %d: %s\n", channel[i], strerror(errno));
+			return -1;
+		}
+
+		if (knet_recv(knet_h, recv_buff, KNET_MAX_PACKET_SIZE, channel[i]) != KNET_MAX_PACKET_SIZE) {
+			printf("knet_recv on channel %d failed: %s\n", channel[i], strerror(errno));
+			return -1;
+		}
+
+		if (memcmp(recv_buff, send_buff, KNET_MAX_PACKET_SIZE)) {
+			printf("recv and send buffers are different on channel %d!\n", channel[i]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void test(void)
+{
+	knet_handle_t knet_h;
+	int logfds[2];
+	int datafd[4];
+	int8_t channel[4];
+	int i;
+	struct sockaddr_storage lo;
+
+	if (make_local_sockaddr(&lo, 0) < 0) {
+		printf("Unable to convert loopback to sockaddr: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	printf("Test knet_handle_set_tx_threads incorrect knet_h\n");
+
+	if ((!knet_handle_set_tx_threads(NULL, 1)) || (errno != EINVAL)) {
+		printf("knet_handle_set_tx_threads accepted invalid knet_h or returned incorrect error: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	setup_logpipes(logfds);
+
+	knet_h = knet_handle_start(logfds, KNET_LOG_DEBUG);
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_tx_threads with 0 (incorrect)\n");
+	if ((!knet_handle_set_tx_threads(knet_h, 0)) || (errno != EINVAL)) {
+		printf("knet_handle_set_tx_threads accepted invalid tx_threads or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_tx_threads with KNET_MAX_TX_THREADS + 1 (incorrect)\n");
+	if ((!knet_handle_set_tx_threads(knet_h, KNET_MAX_TX_THREADS + 1)) || (errno != EINVAL)) {
+		printf("knet_handle_set_tx_threads accepted invalid tx_threads or returned incorrect error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_tx_threads with 4 (correct)\n");
+	if (knet_handle_set_tx_threads(knet_h, 4) < 0) {
+		printf("knet_handle_set_tx_threads failed error: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if ((knet_h->tx_workers_num != 4) || (!knet_h->tx_workers[3]) || (knet_h->tx_workers[4])) {
+		printf("knet_handle_set_tx_threads failed to start the TX threads\n");
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test data across TX threads\n");
+
+	if (knet_handle_enable_sock_notify(knet_h, &private_data, sock_notify) < 0) {
+		printf("knet_handle_enable_sock_notify failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	for (i = 0; i < 4; i++) {
+		datafd[i] = 0;
+		channel[i] = -1;
+
+		if (knet_handle_add_datafd(knet_h, &datafd[i], &channel[i]) < 0) {
+			printf("knet_handle_add_datafd failed: %s\n", strerror(errno));
+			knet_handle_free(knet_h);
+			flush_logs(logfds[0], stdout);
+			close_logpipes(logfds);
+			exit(FAIL);
+		}
+
+		if (knet_h->sockfd[channel[i]].tx_worker != channel[i] % 4) {
+			printf("channel %d assigned to the wrong TX thread\n", channel[i]);
+			knet_handle_free(knet_h);
+			flush_logs(logfds[0], stdout);
+			close_logpipes(logfds);
+			exit(FAIL);
+		}
+	}
+
+	if (knet_host_add(knet_h, 1) < 0) {
+		printf("knet_host_add failed: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_link_set_config(knet_h, 1, 0, KNET_TRANSPORT_UDP, &lo, &lo, 0) < 0) {
+		printf("Unable to configure link: %s\n", strerror(errno));
+		knet_host_remove(knet_h, 1);
+		knet_handle_free(knet_h);
+		flush_logs(logfds[0], stdout);
+		close_logpipes(logfds);
+		exit(FAIL);
+	}
+
+	if (knet_link_set_enable(knet_h, 1, 0, 1) < 0) {
+		printf("knet_link_set_enable failed: %s\n", strerror(errno));
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if (knet_handle_setfwd(knet_h, 1) < 0) {
+		printf("knet_handle_setfwd failed: %s\n", strerror(errno));
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if (wait_for_host(knet_h, 1, 10, logfds[0], stdout) < 0) {
+		printf("timeout waiting for host to be reachable");
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if (send_recv(knet_h, datafd, channel, 4) < 0) {
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test knet_handle_set_tx_threads with 1 (shrink) and data\n");
+	if (knet_handle_set_tx_threads(knet_h, 1) < 0) {
+		printf("knet_handle_set_tx_threads failed error: %s\n", strerror(errno));
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if ((knet_h->tx_workers_num != 1) || (knet_h->tx_workers[1])) {
+		printf("knet_handle_set_tx_threads failed to stop the TX threads\n");
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	for (i = 0; i < 4; i++) {
+		if (knet_h->sockfd[channel[i]].tx_worker != 0) {
+			printf("channel %d has not been moved to TX thread 0\n", channel[i]);
+			test_cleanup(knet_h, logfds);
+			exit(FAIL);
+		}
+	}
+
+	if (send_recv(knet_h, datafd, channel, 4) < 0) {
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	test_cleanup(knet_h, logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	test();
+
+	return PASS;
+}
@@ -282,5 +282,13 @@ int main(int argc, char *argv[])
 		test(compress_list[i].name);
 	}
 
+	for (i=0; i < compress_list_entries; i++) {
+		if ((!strcmp(compress_list[i].name, "zlib")) ||
+		    (!strcmp(compress_list[i].name, "lz4"))) {
+			test("auto");
+			break;
+		}
+	}
+
 	return PASS;
 }
@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.  All rights reserved.
+ *
+ * This software licensed under GPL-2.0+, LGPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "libknet.h"
+
+#include "internals.h"
+#include "onwire.h"
+#include "test-common.h"
+
+/*
+ * node 1 runs the current onwire version, node 2 behaves like
+ * an older knet that only knows onwire v1 (short pings, v1 data)
+ */
+
+#define TEST_PACKETS 4
+#define TEST_SEQ_JUMP 20000	/* less than half of the v1 seq_num space */
+#define TEST_SEQ_ROUNDS 8	/* enough to wrap the v1 seq_num twice */
+
+static int private_data;
+
+static void sock_notify(void *pvt_data,
+			int datafd,
+			int8_t channel,
+			uint8_t tx_rx,
+			int error,
+			int errorno)
+{
+	return;
+}
+
+static void test_cleanup(knet_handle_t *knet_h, int *logfds)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (!knet_h[i]) {
+			continue;
+		}
+		knet_link_set_enable(knet_h[i], 2 - i, 0, 0);
+		knet_link_clear_config(knet_h[i], 2 - i, 0);
+		knet_host_remove(knet_h[i], 2 - i);
+		knet_handle_free(knet_h[i]);
+	}
+	flush_logs(logfds[0], stdout);
+	close_logpipes(logfds);
+}
+
+static int send_recv(knet_handle_t src_h, knet_handle_t dst_h, int datafd, int8_t channel, ssize_t size)
+{
+	char send_buff[KNET_MAX_PACKET_SIZE];
+	char recv_buff[KNET_MAX_PACKET_SIZE];
+	ssize_t recv_len;
+	int i;
+
+	for (i = 0; i < TEST_PACKETS; i++) {
+		memset(send_buff, i, sizeof(send_buff));
+
+		if (knet_send(src_h, send_buff, size, channel) != size) {
+			printf("knet_send failed: %s\n", strerror(errno));
+			return -1;
+		}
+
+		if (wait_for_packet(dst_h, 10, datafd)) {
+			printf("Error waiting for packet %d: %s\n", i, strerror(errno));
+			return -1;
+		}
+
+		recv_len = knet_recv(dst_h, recv_buff, KNET_MAX_PACKET_SIZE, channel);
+		if (recv_len != size) {
+			printf("knet_recv received only %zd bytes: %s\n", recv_len, strerror(errno));
+			return -1;
+		}
+
+		if (memcmp(recv_buff, send_buff, size)) {
+			printf("recv and send buffers are different!\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static uint8_t get_onwire_ver(knet_handle_t knet_h)
+{
+	uint8_t onwire_ver;
+
+	pthread_mutex_lock(&knet_h->tx_seq_num_mutex);
+	onwire_ver = knet_h->onwire_ver;
+	pthread_mutex_unlock(&knet_h->tx_seq_num_mutex);
+
+	return onwire_ver;
+}
+
+static void set_onwire_ver_max(knet_handle_t knet_h, uint8_t onwire_ver_max)
+{
+	pthread_mutex_lock(&knet_h->tx_seq_num_mutex);
+	knet_h->onwire_ver_max = onwire_ver_max;
+	pthread_mutex_unlock(&knet_h->tx_seq_num_mutex);
+}
+
+static void jump_tx_seq_num(knet_handle_t knet_h)
+{
+	pthread_mutex_lock(&knet_h->tx_seq_num_mutex);
+	knet_h->tx_seq_num = knet_h->tx_seq_num + TEST_SEQ_JUMP;
+	pthread_mutex_unlock(&knet_h->tx_seq_num_mutex);
+}
+
+static seq_num_t get_rx_seq_num(knet_handle_t knet_h, knet_node_id_t host_id)
+{
+	seq_num_t rx_seq_num;
+	struct knet_host *host = knet_h->host_index[host_id];
+
+	pthread_mutex_lock(&host->rx_mutex);
+	rx_seq_num = host->rx_seq_num;
+	pthread_mutex_unlock(&host->rx_mutex);
+
+	return rx_seq_num;
+}
+
+/*
+ * wait for the handle to send data with onwire_ver
+ */
+static int wait_for_onwire_ver(knet_handle_t knet_h, uint8_t onwire_ver, int seconds, int logfd)
+{
+	int i;
+
+	if (is_memcheck() || is_helgrind()) {
+		seconds = seconds * 16;
+	}
+
+	for (i = 0; i < seconds * 10; i++) {
+		if (get_onwire_ver(knet_h) == onwire_ver) {
+			return 0;
+		}
+		flush_logs(logfd, stdout);
+		usleep(100000);
+	}
+
+	errno = ETIMEDOUT;
+	return -1;
+}
+
+static void test(void)
+{
+	knet_handle_t knet_h[2] = { NULL, NULL };
+	int logfds[2];
+	int datafd[2] = { 0, 0 };
+	int8_t channel[2] = { -1, -1 };
+	struct sockaddr_storage lo[2];
+	int i, round;
+
+	for (i = 0; i < 2; i++) {
+		if (make_local_sockaddr(&lo[i], i) < 0) {
+			printf("Unable to convert loopback to sockaddr: %s\n", strerror(errno));
+			exit(FAIL);
+		}
+	}
+
+	setup_logpipes(logfds);
+
+	for (i = 0; i < 2; i++) {
+		knet_h[i] = knet_handle_new_ex(i + 1, logfds[1], KNET_LOG_DEBUG, 0);
+		if (!knet_h[i]) {
+			printf("knet_handle_new failed: %s\n", strerror(errno));
+			test_cleanup(knet_h, logfds);
+			exit(FAIL);
+		}
+	}
+
+	/*
+	 * before any ping is sent
+	 */
+	set_onwire_ver_max(knet_h[1], KNET_HEADER_VERSION);
+
+	for (i = 0; i < 2; i++) {
+		if (knet_handle_enable_sock_notify(knet_h[i], &private_data, sock_notify) < 0) {
+			printf("knet_handle_enable_sock_notify failed: %s\n", strerror(errno));
+			test_cleanup(knet_h, logfds);
+			exit(FAIL);
+		}
+
+		if (knet_handle_add_datafd(knet_h[i], &datafd[i], &channel[i]) < 0) {
+			printf("knet_handle_add_datafd failed: %s\n", strerror(errno));
+			test_cleanup(knet_h, logfds);
+			exit(FAIL);
+		}
+
+		if (knet_host_add(knet_h[i], 2 - i) < 0) {
+			printf("knet_host_add failed: %s\n", strerror(errno));
+			test_cleanup(knet_h, logfds);
+			exit(FAIL);
+		}
+
+		if (knet_link_set_config(knet_h[i], 2 - i, 0, KNET_TRANSPORT_UDP, &lo[i], &lo[1 - i], 0) < 0) {
+			printf("Unable to configure link: %s\n", strerror(errno));
+			test_cleanup(knet_h, logfds);
+			exit(FAIL);
+		}
+
+		if (knet_link_set_ping_timers(knet_h[i], 2 - i, 0, 200, 2000, 1024) < 0) {
+			printf("knet_link_set_ping_timers failed: %s\n", strerror(errno));
+			test_cleanup(knet_h, logfds);
+			exit(FAIL);
+		}
+
+		if (knet_link_set_enable(knet_h[i], 2 - i, 0, 1) < 0) {
+			printf("knet_link_set_enable failed: %s\n", strerror(errno));
+			test_cleanup(knet_h, logfds);
+			exit(FAIL);
+		}
+
+		if (knet_handle_setfwd(knet_h[i], 1) < 0) {
+			printf("knet_handle_setfwd failed: %s\n", strerror(errno));
+			test_cleanup(knet_h, logfds);
+			exit(FAIL);
+		}
+	}
+
+	for (i = 0; i < 2; i++) {
+		if (wait_for_host(knet_h[i], 2 - i, 10, logfds[0], stdout) < 0) {
+			printf("timeout waiting for host to be reachable\n");
+			test_cleanup(knet_h, logfds);
+			exit(FAIL);
+		}
+	}
+
+	printf("Test data is sent as onwire v1 to a v1 host\n");
+
+	/*
+	 * node 2 pings might arrive after the link is up
+	 */
+	if (wait_for_onwire_ver(knet_h[0], KNET_HEADER_VERSION, 10, logfds[0]) < 0) {
+		printf("node 1 did not switch to onwire v1: %s\n", strerror(errno));
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	pthread_mutex_lock(&knet_h[0]->tx_seq_num_mutex);
+	if (knet_h[0]->host_index[2]->onwire_ver_max != KNET_HEADER_VERSION) {
+		printf("node 2 advertised onwire version %u instead of %u\n",
+		       knet_h[0]->host_index[2]->onwire_ver_max, (unsigned int)KNET_HEADER_VERSION);
+		pthread_mutex_unlock(&knet_h[0]->tx_seq_num_mutex);
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+	pthread_mutex_unlock(&knet_h[0]->tx_seq_num_mutex);
+
+	if (get_onwire_ver(knet_h[1]) != KNET_HEADER_VERSION) {
+		printf("node 2 sends data with onwire version %u\n", get_onwire_ver(knet_h[1]));
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if ((send_recv(knet_h[0], knet_h[1], datafd[1], channel[1], 1024) < 0) ||
+	    (send_recv(knet_h[1], knet_h[0], datafd[0], channel[0], 1024) < 0) ||
+	    (send_recv(knet_h[0], knet_h[1], datafd[1], channel[1], KNET_MAX_PACKET_SIZE) < 0) ||
+	    (send_recv(knet_h[1], knet_h[0], datafd[0], channel[0], KNET_MAX_PACKET_SIZE) < 0)) {
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	printf("Test onwire v1 data across 16 bit seq_num wraps\n");
+
+	for (round = 0; round < TEST_SEQ_ROUNDS; round++) {
+		jump_tx_seq_num(knet_h[0]);
+		jump_tx_seq_num(knet_h[1]);
+
+		if ((send_recv(knet_h[0], knet_h[1], datafd[1], channel[1], 1024) < 0) ||
+		    (send_recv(knet_h[1], knet_h[0], datafd[0], channel[0], KNET_MAX_PACKET_SIZE) < 0)) {
+			printf("Data lost at round %d\n", round);
+			test_cleanup(knet_h, logfds);
+			exit(FAIL);
+		}
+
+		flush_logs(logfds[0], stdout);
+	}
+
+	for (i = 0; i < 2; i++) {
+		if (get_rx_seq_num(knet_h[i], 2 - i) <= 2 * SEQ_ONWIRE_V1_MAX) {
+			printf("node %d did not rebuild the upper seq_num bits: %u\n",
+			       i + 1, get_rx_seq_num(knet_h[i], 2 - i));
+			test_cleanup(knet_h, logfds);
+			exit(FAIL);
+		}
+	}
+
+	printf("Test data is sent as onwire v2 once all hosts support it\n");
+
+	set_onwire_ver_max(knet_h[1], KNET_HEADER_VERSION_MAX);
+
+	if (wait_for_onwire_ver(knet_h[0], KNET_HEADER_VERSION_MAX, 10, logfds[0]) < 0) {
+		printf("node 1 did not switch to onwire version %u: %s\n",
+		       (unsigned int)KNET_HEADER_VERSION_MAX, strerror(errno));
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	if ((send_recv(knet_h[0], knet_h[1], datafd[1], channel[1], 1024) < 0) ||
+	    (send_recv(knet_h[1], knet_h[0], datafd[0], channel[0], 1024) < 0) ||
+	    (send_recv(knet_h[0], knet_h[1], datafd[1], channel[1], KNET_MAX_PACKET_SIZE) < 0)) {
+		test_cleanup(knet_h, logfds);
+		exit(FAIL);
+	}
+
+	flush_logs(logfds[0], stdout);
+
+	test_cleanup(knet_h, logfds);
+}
+
+int main(int argc, char *argv[])
+{
+	test();
+
+	return PASS;
+}
@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.  All rights reserved.
+ *
+ * This software licensed under GPL-2.0+, LGPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "libknet.h"
+
+#include "compress.h"
+#include "internals.h"
+#include "threads_common.h"
+#include "test-common.h"
+
+/*
+ * compress.c is linked in directly, it expects
+ * the lock from handle.c
+ */
+pthread_rwlock_t shlib_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+
+#define TEST_PACKETS 16
+#define TEST_PAYLOAD 1024
+
+struct test_pckt {
+	unsigned char buf[KNET_DATABUFSIZE_COMPRESS];
+	ssize_t len;
+	uint8_t compress_flags;
+	uint8_t stream_seq;
+};
+
+static knet_handle_t knet_h;
+static struct knet_compress_stream tx_stream;
+static struct knet_compress_stream rx_stream;
+static struct test_pckt pckts[TEST_PACKETS];
+static unsigned char payload[TEST_PACKETS][TEST_PAYLOAD];
+static unsigned char buf_out[KNET_DATABUFSIZE_COMPRESS];
+static int delivered;
+
+static void test_cleanup(void)
+{
+	if (get_global_wrlock(knet_h) == 0) {
+		compress_stream_fini(knet_h, &tx_stream, 0);
+		compress_stream_fini(knet_h, &rx_stream, 0);
+		compress_fini(knet_h, 1);
+		pthread_rwlock_unlock(&knet_h->global_rwlock);
+	}
+	knet_handle_free(knet_h);
+}
+
+static int compress_setup(void)
+{
+	struct knet_handle_compress_cfg knet_handle_compress_cfg;
+	const char *models[] = { "zlib", "zstd" };
+	size_t i;
+	int err = -1;
+
+	for (i = 0; i < sizeof(models) / sizeof(models[0]); i++) {
+		memset(&knet_handle_compress_cfg, 0, sizeof(struct knet_handle_compress_cfg));
+		strncpy(knet_handle_compress_cfg.compress_model, models[i], sizeof(knet_handle_compress_cfg.compress_model) - 1);
+		knet_handle_compress_cfg.compress_level = 1;
+		knet_handle_compress_cfg.compress_threshold = 1;
+
+		if (get_global_wrlock(knet_h)) {
+			return -1;
+		}
+		err = compress_cfg(knet_h, &knet_handle_compress_cfg);
+		if ((!err) && (!compress_stream_supported(knet_h, knet_h->compress_model))) {
+			err = -1;
+		}
+		pthread_rwlock_unlock(&knet_h->global_rwlock);
+
+		if (!err) {
+			printf("Using compress model %s\n", models[i]);
+			return 0;
+		}
+	}
+
+	return err;
+}
+
+/*
+ * packets look alike, so each one depends on the history of the previous ones
+ */
+static void compress_packets(void)
+{
+	int i;
+
+	for (i = 0; i < TEST_PACKETS; i++) {
+		memset(payload[i], 'a', TEST_PAYLOAD);
+		snprintf((char *)payload[i], TEST_PAYLOAD, "stream packet %d", i);
+
+		pckts[i].len = KNET_DATABUFSIZE_COMPRESS;
+		if (compress_stream_compress(knet_h, &tx_stream, knet_h->compress_model, knet_h->compress_level,
+					     payload[i], TEST_PAYLOAD, pckts[i].buf, &pckts[i].len,
+					     &pckts[i].compress_flags, &pckts[i].stream_seq) < 0) {
+			printf("Unable to compress packet %d: %s\n", i, strerror(errno));
+			test_cleanup();
+			exit(FAIL);
+		}
+	}
+}
+
+static void check_delivered(ssize_t len)
+{
+	if ((len != TEST_PAYLOAD) || (memcmp(buf_out, payload[delivered], TEST_PAYLOAD))) {
+		printf("Packet %d delivered out of order or corrupted\n", delivered);
+		test_cleanup();
+		exit(FAIL);
+	}
+	delivered++;
+}
+
+/*
+ * same logic as the RX thread: deliver the packet if it decompresses,
+ * then every held packet that is now next in line
+ */
+static int recv_packet(int i, int *resync)
+{
+	ssize_t len = KNET_DATABUFSIZE_COMPRESS;
+	int err, savederrno;
+
+	err = compress_stream_decompress(knet_h, &rx_stream, pckts[i].compress_flags, pckts[i].stream_seq,
+					 pckts[i].buf, pckts[i].len, buf_out, &len, resync);
+	if (err) {
+		return err;
+	}
+	check_delivered(len);
+
+	while (1) {
+		len = KNET_DATABUFSIZE_COMPRESS;
+		err = compress_stream_decompress_held(knet_h, &rx_stream, buf_out, &len, resync);
+		if (err) {
+			savederrno = errno;
+			if (savederrno == ENOENT) {
+				return 0;
+			}
+			errno = savederrno;
+			return err;
+		}
+		check_delivered(len);
+	}
+}
+
+static void expect_recv(int i, int expected_errno)
+{
+	int err, resync = 0;
+
+	err = recv_packet(i, &resync);
+	if (((!expected_errno) && (err)) ||
+	    ((expected_errno) && ((!err) || (errno != expected_errno)))) {
+		printf("Packet %d: expected %s got %s\n", i,
+		       expected_errno ? strerror(expected_errno) : "success",
+		       err ? strerror(errno) : "success");
+		test_cleanup();
+		exit(FAIL);
+	}
+}
+
+static void test(void)
+{
+	int i, err, resync = 0;
+
+	compress_packets();
+
+	printf("Test in order packets\n");
+
+	expect_recv(0, 0);
+	expect_recv(1, 0);
+
+	printf("Test packets received out of order are held and delivered in order\n");
+
+	expect_recv(3, EINPROGRESS);
+	expect_recv(4, EINPROGRESS);
+	expect_recv(2, 0);
+	if (delivered != 5) {
+		printf("Held packets have not been delivered: %d\n", delivered);
+		test_cleanup();
+		exit(FAIL);
+	}
+
+	printf("Test duplicated packets are dropped\n");
+
+	expect_recv(6, EINPROGRESS);
+	expect_recv(6, EALREADY);
+	expect_recv(4, EALREADY);
+
+	printf("Test a full reorder window\n");
+
+	expect_recv(7, EINPROGRESS);
+	expect_recv(8, EINPROGRESS);
+	expect_recv(9, EINPROGRESS);
+	expect_recv(5, 0);
+	if (delivered != 10) {
+		printf("Held packets have not been delivered: %d\n", delivered);
+		test_cleanup();
+		exit(FAIL);
+	}
+
+	printf("Test a packet lost beyond the reorder window\n");
+
+	err = recv_packet(10 + KNET_COMPRESS_STREAM_REORDER + 1, &resync);
+	if ((!err) || (errno == EINPROGRESS) || (errno == EALREADY) || (!resync)) {
+		printf("Lost packet was not detected\n");
+		test_cleanup();
+		exit(FAIL);
+	}
+
+	for (i = 10; i < TEST_PACKETS; i++) {
+		if (!recv_packet(i, &resync)) {
+			printf("Packet %d decompressed with a broken history\n", i);
+			test_cleanup();
+			exit(FAIL);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int logfd;
+
+	logfd = start_logging(stdout);
+
+	knet_h = knet_handle_new(1, logfd, KNET_LOG_DEBUG);
+	if (!knet_h) {
+		printf("Unable to knet_handle_new: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	/*
+	 * this compress.c is not the one in libknet.so
+	 */
+	if (compress_init(knet_h) < 0) {
+		printf("Unable to init compress: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		exit(FAIL);
+	}
+
+	if (compress_setup() < 0) {
+		printf("No compress model with stream support available\n");
+		test_cleanup();
+		exit(SKIP);
+	}
+
+	test();
+
+	test_cleanup();
+
+	return PASS;
+}
@@ -82,6 +82,7 @@ static void print_help(void)
 	printf("                                           Example: -c nss:aes128:sha1\n");
 	printf(" -z [implementation]:[level]:[threshold]   compress configuration. (default disabled)\n");
 	printf("                                           Example: -z zlib:5:100\n");
+	printf("                                           Use auto:0:100 to let knet pick model and level\n");
 	printf(" -p [active|passive|rr]                    (default: passive)\n");
 	printf(" -P [UDP|SCTP]                             (default: UDP) protocol (transport) to use for all links\n");
 	printf(" -t [nodeid]                               This nodeid (required)\n");
@@ -962,6 +963,7 @@ static void display_stats(int level)
 		printf("[stat]: ------------\n");
 		if (compresscfg) {
 			printf("[stat]:  tx_uncompressed_packets: %" PRIu64 "\n", handle_stats.tx_uncompressed_packets);
+			printf("[stat]:  tx_compress_skipped_packets: %" PRIu64 "\n", handle_stats.tx_compress_skipped_packets);
 			printf("[stat]:  tx_compressed_packets: %" PRIu64 "\n", handle_stats.tx_compressed_packets);
 			printf("[stat]:  tx_compressed_original_bytes: %" PRIu64 "\n", handle_stats.tx_compressed_original_bytes);
 			printf("[stat]:  tx_compressed_size_bytes: %" PRIu64 "\n", handle_stats.tx_compressed_size_bytes );
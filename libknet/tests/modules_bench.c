@@ -0,0 +1,548 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.  All rights reserved.
+ *
+ * This software licensed under GPL-2.0+, LGPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/uio.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#include "libknet.h"
+
+#include "compress.h"
+#include "crypto.h"
+#include "internals.h"
+#include "threads_common.h"
+#include "test-common.h"
+
+/*
+ * compress.c and crypto.c are linked in directly, they expect
+ * the lock from handle.c
+ */
+pthread_rwlock_t shlib_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+
+#define OUTPUT_CSV  0
+#define OUTPUT_JSON 1
+
+#define TEST_CRYPTO   1
+#define TEST_COMPRESS 2
+
+static knet_handle_t knet_h;
+static int output = OUTPUT_CSV;
+static int tests = TEST_CRYPTO | TEST_COMPRESS;
+static const char *model_filter = NULL;
+static size_t bytes_per_run = 4 * 1024 * 1024;
+static int results = 0;
+
+static const size_t payload_sizes[] = { 64, 256, 1024, 4096, 16384, 65536, 0 };
+
+/*
+ * bits of entropy per payload byte: 0 is all zeros,
+ * 8 is random data
+ */
+static const int payload_entropy[] = { 0, 2, 4, 8, -1 };
+
+static const char *crypto_ciphers[] = {
+	"none", "aes128", "aes192", "aes256", "3des",
+	"aes128-gcm", "aes192-gcm", "aes256-gcm", "chacha20-p1305", NULL
+};
+
+static const char *crypto_hashes[] = {
+	"none", "md5", "sha1", "sha256", "sha384", "sha512", NULL
+};
+
+/*
+ * invalid levels are rejected by compress_cfg, so every model
+ * is tried with all of them
+ */
+static const int compress_levels[] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 11, 12, 15, 19, 22, 999, -1
+};
+
+static unsigned char payload[KNET_MAX_PACKET_SIZE];
+static unsigned char buf_out[KNET_DATABUFSIZE_CRYPT];
+static unsigned char buf_back[KNET_DATABUFSIZE_CRYPT];
+
+struct bench_result {
+	const char *type;
+	const char *model;
+	int model_id;
+	const char *cipher;
+	const char *hash;
+	int level;
+	const char *op;
+	size_t size;
+	int entropy;
+	unsigned long iterations;
+	double ns_op;
+	double cycles_byte;
+	ssize_t out_size;
+};
+
+static void print_help(void)
+{
+	printf("modules_bench usage:\n");
+	printf(" -h                                        print this help (no really)\n");
+	printf(" -d                                        enable debug logs (default INFO)\n");
+	printf(" -t [crypto|compress]                      only benchmark crypto or compress modules (default: both)\n");
+	printf(" -m [model]                                only benchmark the given crypto or compress model\n");
+	printf(" -f [csv|json]                             output format (default: csv)\n");
+	printf(" -b [bytes]                                payload bytes processed for each measurement (default: 4194304)\n");
+	printf("\n");
+	printf("cycles_per_byte is measured with the TSC and is reported only on x86.\n");
+	printf("ratio is output size / payload size.\n");
+}
+
+static void fill_payload(size_t size, int entropy)
+{
+	size_t i;
+	unsigned int seed = 42;
+	unsigned char mask = (unsigned char)((1 << entropy) - 1);
+
+	for (i = 0; i < size; i++) {
+		payload[i] = (unsigned char)rand_r(&seed) & mask;
+	}
+}
+
+static unsigned long get_iterations(size_t size)
+{
+	unsigned long iterations = bytes_per_run / size;
+
+	if (iterations < 16) {
+		iterations = 16;
+	}
+	return iterations;
+}
+
+static uint64_t get_cycles(void)
+{
+#ifdef HAVE_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static uint64_t get_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000llu) + ts.tv_nsec;
+}
+
+static void print_header(void)
+{
+	if (output == OUTPUT_JSON) {
+		printf("[\n");
+	} else {
+		printf("type,model,cipher,hash,level,op,size,entropy_bits,iterations,ns_per_op,cycles_per_byte,out_size,ratio\n");
+	}
+}
+
+static void print_footer(void)
+{
+	if (output == OUTPUT_JSON) {
+		printf("\n]\n");
+	}
+}
+
+static void print_result(struct bench_result *res)
+{
+	double ratio = (double)res->out_size / (double)res->size;
+
+	if (output == OUTPUT_JSON) {
+		printf("%s  {\"type\": \"%s\", \"model\": \"%s\", ", results ? ",\n" : "", res->type, res->model);
+		if (res->cipher) {
+			printf("\"cipher\": \"%s\", \"hash\": \"%s\", ", res->cipher, res->hash);
+		} else {
+			printf("\"level\": %d, ", res->level);
+		}
+		printf("\"op\": \"%s\", \"size\": %zu, \"entropy_bits\": %d, \"iterations\": %lu, \"ns_per_op\": %.1f, ",
+		       res->op, res->size, res->entropy, res->iterations, res->ns_op);
+#ifdef HAVE_TSC
+		printf("\"cycles_per_byte\": %.3f, ", res->cycles_byte);
+#else
+		printf("\"cycles_per_byte\": null, ");
+#endif
+		printf("\"out_size\": %zd, \"ratio\": %.4f}", res->out_size, ratio);
+	} else {
+		printf("%s,%s,", res->type, res->model);
+		if (res->cipher) {
+			printf("%s,%s,,", res->cipher, res->hash);
+		} else {
+			printf(",,%d,", res->level);
+		}
+		printf("%s,%zu,%d,%lu,%.1f,", res->op, res->size, res->entropy, res->iterations, res->ns_op);
+#ifdef HAVE_TSC
+		printf("%.3f,", res->cycles_byte);
+#else
+		printf(",");
+#endif
+		printf("%zd,%.4f\n", res->out_size, ratio);
+	}
+	results++;
+	fflush(stdout);
+}
+
+static void record(struct bench_result *res, const char *op, unsigned long iterations,
+		   uint64_t ns, uint64_t cycles, ssize_t out_size)
+{
+	res->op = op;
+	res->iterations = iterations;
+	res->ns_op = (double)ns / (double)iterations;
+	res->cycles_byte = (double)cycles / ((double)iterations * (double)res->size);
+	res->out_size = out_size;
+	print_result(res);
+}
+
+static int skip_model(const char *model)
+{
+	if ((model_filter) && (strcmp(model_filter, model))) {
+		return 1;
+	}
+	return 0;
+}
+
+static int crypto_setup(const char *model, const char *cipher, const char *hash)
+{
+	struct knet_handle_crypto_cfg knet_handle_crypto_cfg;
+	int err;
+
+	memset(&knet_handle_crypto_cfg, 0, sizeof(struct knet_handle_crypto_cfg));
+	strncpy(knet_handle_crypto_cfg.crypto_model, model, sizeof(knet_handle_crypto_cfg.crypto_model) - 1);
+	strncpy(knet_handle_crypto_cfg.crypto_cipher_type, cipher, sizeof(knet_handle_crypto_cfg.crypto_cipher_type) - 1);
+	strncpy(knet_handle_crypto_cfg.crypto_hash_type, hash, sizeof(knet_handle_crypto_cfg.crypto_hash_type) - 1);
+	memset(knet_handle_crypto_cfg.private_key, 0x55, KNET_MIN_KEY_LEN);
+	knet_handle_crypto_cfg.private_key_len = KNET_MIN_KEY_LEN;
+
+	if (get_global_wrlock(knet_h)) {
+		return -1;
+	}
+	err = crypto_init(knet_h, &knet_handle_crypto_cfg);
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+
+	return err;
+}
+
+static void crypto_teardown(void)
+{
+	if (get_global_wrlock(knet_h)) {
+		return;
+	}
+	crypto_fini(knet_h);
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+}
+
+static int bench_crypto_one(struct bench_result *res)
+{
+	struct iovec iov_in;
+	ssize_t out_len = 0, back_len = 0;
+	unsigned long i, iterations = get_iterations(res->size);
+	uint64_t start_ns, start_cycles;
+
+	iov_in.iov_base = payload;
+	iov_in.iov_len = res->size;
+
+	start_ns = get_ns();
+	start_cycles = get_cycles();
+	for (i = 0; i < iterations; i++) {
+		if (crypto_encrypt_and_signv(knet_h, &iov_in, 1, buf_out, &out_len) < 0) {
+			fprintf(stderr, "%s/%s/%s: unable to encrypt %zu bytes\n", res->model, res->cipher, res->hash, res->size);
+			return -1;
+		}
+	}
+	record(res, "encrypt", iterations, get_ns() - start_ns, get_cycles() - start_cycles, out_len);
+
+	start_ns = get_ns();
+	start_cycles = get_cycles();
+	for (i = 0; i < iterations; i++) {
+		if (crypto_authenticate_and_decrypt(knet_h, buf_out, out_len, buf_back, &back_len) < 0) {
+			fprintf(stderr, "%s/%s/%s: unable to decrypt %zu bytes\n", res->model, res->cipher, res->hash, res->size);
+			return -1;
+		}
+	}
+	record(res, "decrypt", iterations, get_ns() - start_ns, get_cycles() - start_cycles, back_len);
+
+	if ((back_len != (ssize_t)res->size) || (memcmp(payload, buf_back, res->size))) {
+		fprintf(stderr, "%s/%s/%s: decrypted data does not match\n", res->model, res->cipher, res->hash);
+		return -1;
+	}
+
+	/*
+	 * zero copy path used by TX/RX in hash only mode
+	 */
+	if (!crypto_is_hash_only(knet_h)) {
+		return 0;
+	}
+
+	start_ns = get_ns();
+	start_cycles = get_cycles();
+	for (i = 0; i < iterations; i++) {
+		if (crypto_signv(knet_h, &iov_in, 1, buf_back) < 0) {
+			fprintf(stderr, "%s/%s/%s: unable to sign %zu bytes\n", res->model, res->cipher, res->hash, res->size);
+			return -1;
+		}
+	}
+	record(res, "signv", iterations, get_ns() - start_ns, get_cycles() - start_cycles, res->size + knet_h->sec_hash_size);
+
+	start_ns = get_ns();
+	start_cycles = get_cycles();
+	for (i = 0; i < iterations; i++) {
+		if (crypto_authenticate(knet_h, buf_out, out_len, &back_len) < 0) {
+			fprintf(stderr, "%s/%s/%s: unable to authenticate %zu bytes\n", res->model, res->cipher, res->hash, res->size);
+			return -1;
+		}
+	}
+	record(res, "authenticate", iterations, get_ns() - start_ns, get_cycles() - start_cycles, back_len);
+
+	return 0;
+}
+
+static int bench_crypto(void)
+{
+	struct knet_crypto_info crypto_list[16];
+	size_t crypto_list_entries = 0, m;
+	struct bench_result res;
+	int c, h, s, e;
+
+	memset(crypto_list, 0, sizeof(crypto_list));
+	if (knet_get_crypto_list(crypto_list, &crypto_list_entries) < 0) {
+		fprintf(stderr, "knet_get_crypto_list failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	for (m = 0; m < crypto_list_entries; m++) {
+		if (skip_model(crypto_list[m].name)) {
+			continue;
+		}
+		for (c = 0; crypto_ciphers[c] != NULL; c++) {
+			for (h = 0; crypto_hashes[h] != NULL; h++) {
+				if ((!strcmp(crypto_ciphers[c], "none")) && (!strcmp(crypto_hashes[h], "none"))) {
+					continue;
+				}
+				if (crypto_setup(crypto_list[m].name, crypto_ciphers[c], crypto_hashes[h]) < 0) {
+					continue;
+				}
+				memset(&res, 0, sizeof(struct bench_result));
+				res.type = "crypto";
+				res.model = crypto_list[m].name;
+				res.cipher = crypto_ciphers[c];
+				res.hash = crypto_hashes[h];
+				for (s = 0; payload_sizes[s] != 0; s++) {
+					for (e = 0; payload_entropy[e] >= 0; e++) {
+						res.size = payload_sizes[s];
+						res.entropy = payload_entropy[e];
+						fill_payload(res.size, res.entropy);
+						if (bench_crypto_one(&res) < 0) {
+							crypto_teardown();
+							return -1;
+						}
+					}
+				}
+				crypto_teardown();
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int compress_setup(const char *model, int level)
+{
+	struct knet_handle_compress_cfg knet_handle_compress_cfg;
+	int err;
+
+	memset(&knet_handle_compress_cfg, 0, sizeof(struct knet_handle_compress_cfg));
+	strncpy(knet_handle_compress_cfg.compress_model, model, sizeof(knet_handle_compress_cfg.compress_model) - 1);
+	knet_handle_compress_cfg.compress_level = level;
+	knet_handle_compress_cfg.compress_threshold = 1;
+
+	if (get_global_wrlock(knet_h)) {
+		return -1;
+	}
+	compress_fini(knet_h, 0);
+	err = compress_cfg(knet_h, &knet_handle_compress_cfg);
+	pthread_rwlock_unlock(&knet_h->global_rwlock);
+
+	return err;
+}
+
+static int bench_compress_one(struct bench_result *res)
+{
+	ssize_t out_len = 0, back_len = 0;
+	unsigned long i, iterations = get_iterations(res->size);
+	uint64_t start_ns, start_cycles;
+
+	start_ns = get_ns();
+	start_cycles = get_cycles();
+	for (i = 0; i < iterations; i++) {
+		out_len = KNET_DATABUFSIZE_COMPRESS;
+		if (compress(knet_h, res->model_id, res->level, payload, res->size, buf_out, &out_len) < 0) {
+			fprintf(stderr, "%s/%d: unable to compress %zu bytes\n", res->model, res->level, res->size);
+			return -1;
+		}
+	}
+	record(res, "compress", iterations, get_ns() - start_ns, get_cycles() - start_cycles, out_len);
+
+	start_ns = get_ns();
+	start_cycles = get_cycles();
+	for (i = 0; i < iterations; i++) {
+		back_len = KNET_DATABUFSIZE_COMPRESS;
+		if (decompress(knet_h, res->model_id, buf_out, out_len, buf_back, &back_len) < 0) {
+			fprintf(stderr, "%s/%d: unable to decompress %zu bytes\n", res->model, res->level, res->size);
+			return -1;
+		}
+	}
+	record(res, "decompress", iterations, get_ns() - start_ns, get_cycles() - start_cycles, back_len);
+
+	if ((back_len != (ssize_t)res->size) || (memcmp(payload, buf_back, res->size))) {
+		fprintf(stderr, "%s/%d: decompressed data does not match\n", res->model, res->level);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int bench_compress(void)
+{
+	struct knet_compress_info compress_list[16];
+	size_t compress_list_entries = 0, m;
+	struct bench_result res;
+	int l, s, e;
+
+	memset(compress_list, 0, sizeof(compress_list));
+	if (knet_get_compress_list(compress_list, &compress_list_entries) < 0) {
+		fprintf(stderr, "knet_get_compress_list failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	for (m = 0; m < compress_list_entries; m++) {
+		if (skip_model(compress_list[m].name)) {
+			continue;
+		}
+		for (l = 0; compress_levels[l] >= 0; l++) {
+			if (compress_setup(compress_list[m].name, compress_levels[l]) < 0) {
+				continue;
+			}
+			memset(&res, 0, sizeof(struct bench_result));
+			res.type = "compress";
+			res.model = compress_list[m].name;
+			res.model_id = knet_h->compress_model;
+			res.level = compress_levels[l];
+			for (s = 0; payload_sizes[s] != 0; s++) {
+				for (e = 0; payload_entropy[e] >= 0; e++) {
+					res.size = payload_sizes[s];
+					res.entropy = payload_entropy[e];
+					fill_payload(res.size, res.entropy);
+					if (bench_compress_one(&res) < 0) {
+						return -1;
+					}
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int logfd, rv;
+	uint8_t debug = KNET_LOG_INFO;
+	int err = 0;
+
+	while ((rv = getopt(argc, argv, "hdt:m:f:b:")) != EOF) {
+		switch(rv) {
+			case 'h':
+				print_help();
+				exit(PASS);
+				break;
+			case 'd':
+				debug = KNET_LOG_DEBUG;
+				break;
+			case 't':
+				if (!strcmp(optarg, "crypto")) {
+					tests = TEST_CRYPTO;
+				} else if (!strcmp(optarg, "compress")) {
+					tests = TEST_COMPRESS;
+				} else {
+					printf("Error: -t can only be crypto or compress\n");
+					exit(FAIL);
+				}
+				break;
+			case 'm':
+				model_filter = optarg;
+				break;
+			case 'f':
+				if (!strcmp(optarg, "csv")) {
+					output = OUTPUT_CSV;
+				} else if (!strcmp(optarg, "json")) {
+					output = OUTPUT_JSON;
+				} else {
+					printf("Error: -f can only be csv or json\n");
+					exit(FAIL);
+				}
+				break;
+			case 'b':
+				bytes_per_run = strtoul(optarg, NULL, 10);
+				if (!bytes_per_run) {
+					printf("Error: -b requires a positive number of bytes\n");
+					exit(FAIL);
+				}
+				break;
+			default:
+				break;
+		}
+	}
+
+	logfd = start_logging(stderr);
+
+	knet_h = knet_handle_new(1, logfd, debug);
+	if (!knet_h) {
+		fprintf(stderr, "Unable to knet_handle_new: %s\n", strerror(errno));
+		exit(FAIL);
+	}
+
+	/*
+	 * this compress.c is not the one in libknet.so
+	 */
+	if (compress_init(knet_h) < 0) {
+		fprintf(stderr, "Unable to init compress: %s\n", strerror(errno));
+		knet_handle_free(knet_h);
+		exit(FAIL);
+	}
+
+	print_header();
+
+	if ((tests & TEST_CRYPTO) && (bench_crypto() < 0)) {
+		err = 1;
+	}
+
+	if ((!err) && (tests & TEST_COMPRESS) && (bench_compress() < 0)) {
+		err = 1;
+	}
+
+	print_footer();
+
+	if (get_global_wrlock(knet_h) == 0) {
+		compress_fini(knet_h, 1);
+		pthread_rwlock_unlock(&knet_h->global_rwlock);
+	}
+
+	knet_handle_free(knet_h);
+
+	return err ? FAIL : PASS;
+}
@@ -0,0 +1,317 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.  All rights reserved.
+ *
+ * This software licensed under GPL-2.0+, LGPL-2.0+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "libknet.h"
+
+#include "host.h"
+#include "internals.h"
+#include "test-common.h"
+
+/*
+ * compress.c is linked in for host.c, it expects
+ * the lock from handle.c
+ */
+pthread_rwlock_t shlib_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+
+#define PATTERN_INORDER 0
+#define PATTERN_DUP     1
+#define PATTERN_REORDER 2
+#define PATTERN_JUMP    3
+#define PATTERN_MAX     4
+
+static const char *pattern_names[PATTERN_MAX] = { "inorder", "dup", "reorder", "jump" };
+
+static unsigned long ops = 10000000;
+
+/*
+ * byte per seq_num implementation used before the bitset,
+ * kept here as reference for semantics and speed
+ */
+struct ref_host {
+	char circular_buffer[KNET_DEDUP_WINDOW_DEFAULT];
+	char circular_buffer_defrag[KNET_DEDUP_WINDOW_DEFAULT];
+	seq_num_t rx_seq_num;
+};
+
+static int ref_seq_num_lookup(struct ref_host *host, seq_num_t seq_num, int defrag_buf)
+{
+	size_t i, j;
+	seq_num_t seq_dist;
+	char *dst_cbuf = host->circular_buffer;
+	char *dst_cbuf_defrag = host->circular_buffer_defrag;
+	seq_num_t *dst_seq_num = &host->rx_seq_num;
+
+	if (seq_num < *dst_seq_num) {
+		seq_dist =  (SEQ_MAX - seq_num) + *dst_seq_num;
+	} else {
+		seq_dist = *dst_seq_num - seq_num;
+	}
+
+	j = seq_num % KNET_DEDUP_WINDOW_DEFAULT;
+
+	if (seq_dist < KNET_DEDUP_WINDOW_DEFAULT) {
+		if (!defrag_buf) {
+			return (dst_cbuf[j] == 0) ? 1 : 0;
+		} else {
+			return (dst_cbuf_defrag[j] == 0) ? 1 : 0;
+		}
+	} else if (seq_dist <= SEQ_MAX - KNET_DEDUP_WINDOW_DEFAULT) {
+		memset(dst_cbuf, 0, KNET_DEDUP_WINDOW_DEFAULT);
+		memset(dst_cbuf_defrag, 0, KNET_DEDUP_WINDOW_DEFAULT);
+		*dst_seq_num = seq_num;
+	}
+
+	i = (*dst_seq_num + 1) % KNET_DEDUP_WINDOW_DEFAULT;
+
+	if (i > j) {
+		memset(dst_cbuf + i, 0, KNET_DEDUP_WINDOW_DEFAULT - i);
+		memset(dst_cbuf, 0, j + 1);
+		memset(dst_cbuf_defrag + i, 0, KNET_DEDUP_WINDOW_DEFAULT - i);
+		memset(dst_cbuf_defrag, 0, j + 1);
+	} else {
+		memset(dst_cbuf + i, 0, j - i + 1);
+		memset(dst_cbuf_defrag + i, 0, j - i + 1);
+	}
+
+	*dst_seq_num = seq_num;
+
+	return 1;
+}
+
+static void ref_seq_num_set(struct ref_host *host, seq_num_t seq_num, int defrag_buf)
+{
+	if (!defrag_buf) {
+		host->circular_buffer[seq_num % KNET_DEDUP_WINDOW_DEFAULT] = 1;
+	} else {
+		host->circular_buffer_defrag[seq_num % KNET_DEDUP_WINDOW_DEFAULT] = 1;
+	}
+}
+
+static void print_help(void)
+{
+	printf("seqnum_bench usage:\n");
+	printf(" -h                                        print this help (no really)\n");
+	printf(" -n [ops]                                  lookups per pattern (default: 10000000)\n");
+	printf("\n");
+	printf("Every pattern is first run through both implementations and the results\n");
+	printf("are compared, then each implementation is timed on its own.\n");
+	printf("patterns: inorder (one link), dup (every packet received twice),\n");
+	printf("reorder (packets late up to 64 seq nums), jump (random seq nums).\n");
+	printf("All patterns but jump also check the onwire v1 seq_num rebuild.\n");
+}
+
+static seq_num_t *gen_pattern(int pattern)
+{
+	seq_num_t *seqs;
+	seq_num_t seq = 0;
+	unsigned int seed = 42;
+	unsigned long i;
+
+	seqs = malloc(ops * sizeof(seq_num_t));
+	if (!seqs) {
+		return NULL;
+	}
+
+	for (i = 0; i < ops; i++) {
+		switch (pattern) {
+			case PATTERN_INORDER:
+				seqs[i] = seq++;
+				break;
+			case PATTERN_DUP:
+				seqs[i] = seq;
+				if (i & 1) {
+					seq++;
+				}
+				break;
+			case PATTERN_REORDER:
+				seqs[i] = seq++ - (rand_r(&seed) % 64);
+				break;
+			case PATTERN_JUMP:
+				seqs[i] = (seq_num_t)rand_r(&seed);
+				break;
+		}
+	}
+
+	return seqs;
+}
+
+/*
+ * empty dedup window of KNET_DEDUP_WINDOW_DEFAULT packets
+ */
+static int host_reset(struct knet_host *host)
+{
+	uint64_t *cbuf;
+
+	cbuf = _cbuffers_alloc(KNET_DEDUP_WINDOW_DEFAULT);
+	if (!cbuf) {
+		printf("Unable to allocate memory for dedup buffers\n");
+		return -1;
+	}
+	_cbuffers_install(host, cbuf, KNET_DEDUP_WINDOW_DEFAULT);
+	host->rx_seq_num = 0;
+
+	return 0;
+}
+
+/*
+ * lookup + set on success, like the RX path does.
+ * Unless seq_nums are random, onwire v1 hosts must be able to
+ * rebuild them from the lower 16 bits.
+ */
+static int verify(const seq_num_t *seqs, struct knet_host *host, struct ref_host *ref, int pattern)
+{
+	unsigned long i;
+	int defrag, res, ref_res;
+	seq_num_t extended;
+
+	for (i = 0; i < ops; i++) {
+		if (pattern != PATTERN_JUMP) {
+			extended = _seq_num_extend(host, seqs[i] & SEQ_ONWIRE_V1_MAX);
+			if (extended != seqs[i]) {
+				printf("Extend mismatch at op %lu seq %u: got %u\n", i, seqs[i], extended);
+				return -1;
+			}
+		}
+		defrag = (seqs[i] & 0x100) ? 1 : 0;
+		res = _seq_num_lookup(NULL, host, seqs[i], defrag, 0);
+		ref_res = ref_seq_num_lookup(ref, seqs[i], defrag);
+		if (res != ref_res) {
+			printf("Mismatch at op %lu seq %u defrag %d: bitset %d reference %d\n",
+			       i, seqs[i], defrag, res, ref_res);
+			return -1;
+		}
+		if (res) {
+			_seq_num_set(host, seqs[i], defrag);
+			ref_seq_num_set(ref, seqs[i], defrag);
+		}
+	}
+
+	return 0;
+}
+
+static uint64_t get_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000llu) + ts.tv_nsec;
+}
+
+static double bench_bitset(const seq_num_t *seqs, struct knet_host *host)
+{
+	unsigned long i;
+	uint64_t start;
+
+	start = get_ns();
+	for (i = 0; i < ops; i++) {
+		if (_seq_num_lookup(NULL, host, seqs[i], 0, 0)) {
+			_seq_num_set(host, seqs[i], 0);
+		}
+	}
+	return (double)(get_ns() - start) / ops;
+}
+
+static double bench_ref(const seq_num_t *seqs, struct ref_host *ref)
+{
+	unsigned long i;
+	uint64_t start;
+
+	start = get_ns();
+	for (i = 0; i < ops; i++) {
+		if (ref_seq_num_lookup(ref, seqs[i], 0)) {
+			ref_seq_num_set(ref, seqs[i], 0);
+		}
+	}
+	return (double)(get_ns() - start) / ops;
+}
+
+int main(int argc, char *argv[])
+{
+	int rv, pattern;
+	struct knet_host *host;
+	struct ref_host *ref;
+	seq_num_t *seqs;
+	double ns_bitset, ns_ref;
+	int err = 0;
+
+	while ((rv = getopt(argc, argv, "hn:")) != EOF) {
+		switch(rv) {
+			case 'h':
+				print_help();
+				exit(PASS);
+				break;
+			case 'n':
+				ops = strtoul(optarg, NULL, 10);
+				if (!ops) {
+					printf("Error: -n requires a positive number of ops\n");
+					exit(FAIL);
+				}
+				break;
+			default:
+				break;
+		}
+	}
+
+	host = calloc(1, sizeof(struct knet_host));
+	ref = malloc(sizeof(struct ref_host));
+	if ((!host) || (!ref)) {
+		printf("Unable to allocate memory for hosts\n");
+		exit(FAIL);
+	}
+
+	printf("pattern,window_bytes_bitset,window_bytes_reference,ns_op_bitset,ns_op_reference\n");
+
+	for (pattern = 0; pattern < PATTERN_MAX; pattern++) {
+		seqs = gen_pattern(pattern);
+		if (!seqs) {
+			printf("Unable to allocate memory for pattern\n");
+			err = 1;
+			break;
+		}
+
+		memset(ref, 0, sizeof(struct ref_host));
+		if ((host_reset(host) < 0) ||
+		    (verify(seqs, host, ref, pattern) < 0)) {
+			free(seqs);
+			err = 1;
+			break;
+		}
+
+		if (host_reset(host) < 0) {
+			free(seqs);
+			err = 1;
+			break;
+		}
+		ns_bitset = bench_bitset(seqs, host);
+
+		memset(ref, 0, sizeof(struct ref_host));
+		ns_ref = bench_ref(seqs, ref);
+
+		printf("%s,%zu,%zu,%.2f,%.2f\n",
+		       pattern_names[pattern],
+		       (size_t)host->cbuffer_size / 4,
+		       sizeof(ref->circular_buffer) + sizeof(ref->circular_buffer_defrag),
+		       ns_bitset, ns_ref);
+
+		free(seqs);
+	}
+
+	free(host->circular_buffer);
+	free(host);
+	free(ref);
+
+	return err ? FAIL : PASS;
+}
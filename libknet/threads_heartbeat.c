@@ -15,7 +15,9 @@
 #include <pthread.h>
 #include <time.h>
 
+#include "compress.h"
 #include "crypto.h"
+#include "host.h"
 #include "links.h"
 #include "logging.h"
 #include "transports.h"
@@ -66,7 +68,12 @@ static void _handle_check_each(knet_handle_t knet_h, struct knet_host *dst_host,
 			log_debug(knet_h, KNET_SUB_HEARTBEAT, "Unable to get seq mutex lock");
 			return;
 		}
-		knet_h->pingbuf->khp_ping_seq_num = htons(knet_h->tx_seq_num);
+		knet_h->pingbuf->khp_ping_seq_num = htons(knet_h->tx_seq_num & SEQ_ONWIRE_V1_MAX);
+		knet_h->pingbuf->khp_ping_seq_num_hi = htons(knet_h->tx_seq_num >> 16);
+		knet_h->pingbuf->khp_ping_onwire_ver = knet_h->onwire_ver_max;
+		if (knet_h->onwire_ver_max < KNET_HEADER_VERSION_V2) {
+			outlen = KNET_HEADER_PING_V1_SIZE;
+		}
 		pthread_mutex_unlock(&knet_h->tx_seq_num_mutex);
 		knet_h->pingbuf->khp_ping_timed = timed;
 
@@ -181,10 +188,31 @@ static void _adjust_pong_timeouts(knet_handle_t knet_h)
 	pthread_mutex_unlock(&knet_h->backoff_mutex);
 }
 
+/*
+ * give back to the pool the reassembly buffers of hosts
+ * that stopped sending fragments
+ */
+static void _expire_defrag_bufs(knet_handle_t knet_h)
+{
+	struct knet_host *host;
+
+	for (host = knet_h->host_head; host != NULL; host = host->next) {
+		if (pthread_mutex_lock(&host->rx_mutex)) {
+			log_debug(knet_h, KNET_SUB_HEARTBEAT, "Unable to get host %u RX mutex lock", host->host_id);
+			continue;
+		}
+		_defrag_bufs_release(knet_h, host, 1);
+		pthread_mutex_unlock(&host->rx_mutex);
+	}
+
+	_defrag_pool_trim(knet_h);
+}
+
 void *_handle_heartbt_thread(void *data)
 {
 	knet_handle_t knet_h = (knet_handle_t) data;
 	int i = 1;
+	int compress_check;
 
 	set_thread_status(knet_h, KNET_THREAD_HB, KNET_THREAD_RUNNING);
 
@@ -195,6 +223,7 @@ void *_handle_heartbt_thread(void *data)
 
 	while (!shutdown_in_progress(knet_h)) {
 		usleep(KNET_THREADS_TIMERES);
+		compress_check = 0;
 
 		if (pthread_rwlock_rdlock(&knet_h->global_rwlock) != 0) {
 			log_debug(knet_h, KNET_SUB_HEARTBEAT, "Unable to get read lock");
@@ -206,6 +235,8 @@ void *_handle_heartbt_thread(void *data)
 		 */
 		if ((i % (1000000 / KNET_THREADS_TIMERES)) == 0) {
 			_adjust_pong_timeouts(knet_h);
+			_expire_defrag_bufs(knet_h);
+			compress_check = 1;
 			i = 1;
 		} else {
 			i++;
@@ -214,6 +245,13 @@ void *_handle_heartbt_thread(void *data)
 		_send_pings(knet_h, 1);
 
 		pthread_rwlock_unlock(&knet_h->global_rwlock);
+
+		/*
+		 * compress_auto_check might need to switch to write lock
+		 */
+		if (compress_check) {
+			compress_auto_check(knet_h);
+		}
 	}
 
 	set_thread_status(knet_h, KNET_THREAD_HB, KNET_THREAD_STOPPED);
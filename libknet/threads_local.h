@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.  All rights reserved.
+ *
+ * This software licensed under GPL-2.0+, LGPL-2.0+
+ */
+
+#ifndef __KNET_THREADS_LOCAL_H__
+#define __KNET_THREADS_LOCAL_H__
+
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+
+/*
+ * per thread private data.
+ *
+ * TX and RX can run on more than one thread per handle, so any
+ * state that cannot be shared between them (compress work memory,
+ * cipher contexts, etc.) must be allocated per thread.
+ *
+ * data is allocated on first use by each thread via alloc_fn and
+ * released via free_fn when the thread exits (workers stopped by
+ * knet_handle_set_*_threads, application threads using knet_send_sync).
+ * It is also tracked internally, so that threads_local_fini can release
+ * the data of the threads that are still running.
+ *
+ * This header is also used by the modules, hence everything is inline.
+ */
+
+struct threads_local;
+
+struct threads_local_entry {
+	void *data;
+	struct threads_local *tl;
+	struct threads_local_entry *prev;
+	struct threads_local_entry *next;
+};
+
+struct threads_local {
+	pthread_key_t key;
+	pthread_mutex_t mutex;
+	struct threads_local_entry *head;
+	void *(*alloc_fn) (void *private_data);
+	void (*free_fn) (void *data);
+	void *private_data;
+};
+
+/*
+ * pthread key destructor, invoked on thread exit
+ */
+static inline void threads_local_release(void *value)
+{
+	struct threads_local_entry *entry = value;
+	struct threads_local *tl = entry->tl;
+
+	pthread_mutex_lock(&tl->mutex);
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		tl->head = entry->next;
+	}
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	}
+	pthread_mutex_unlock(&tl->mutex);
+
+	tl->free_fn(entry->data);
+	free(entry);
+}
+
+static inline int threads_local_init(struct threads_local *tl,
+				     void *(*alloc_fn) (void *private_data),
+				     void (*free_fn) (void *data),
+				     void *private_data)
+{
+	int savederrno = 0;
+
+	savederrno = pthread_key_create(&tl->key, threads_local_release);
+	if (savederrno) {
+		errno = savederrno;
+		return -1;
+	}
+
+	savederrno = pthread_mutex_init(&tl->mutex, NULL);
+	if (savederrno) {
+		pthread_key_delete(tl->key);
+		errno = savederrno;
+		return -1;
+	}
+
+	tl->head = NULL;
+	tl->alloc_fn = alloc_fn;
+	tl->free_fn = free_fn;
+	tl->private_data = private_data;
+
+	return 0;
+}
+
+/*
+ * returns NULL and errno set on error
+ */
+static inline void *threads_local_get(struct threads_local *tl)
+{
+	struct threads_local_entry *entry;
+	int savederrno = 0;
+
+	entry = pthread_getspecific(tl->key);
+	if (entry) {
+		return entry->data;
+	}
+
+	entry = malloc(sizeof(struct threads_local_entry));
+	if (!entry) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	entry->data = tl->alloc_fn(tl->private_data);
+	if (!entry->data) {
+		savederrno = errno;
+		free(entry);
+		errno = savederrno;
+		return NULL;
+	}
+
+	entry->tl = tl;
+	entry->prev = NULL;
+
+	savederrno = pthread_setspecific(tl->key, entry);
+	if (savederrno) {
+		tl->free_fn(entry->data);
+		free(entry);
+		errno = savederrno;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&tl->mutex);
+	entry->next = tl->head;
+	if (tl->head) {
+		tl->head->prev = entry;
+	}
+	tl->head = entry;
+	pthread_mutex_unlock(&tl->mutex);
+
+	return entry->data;
+}
+
+/*
+ * must be invoked when no other thread can access tl anymore.
+ * Deleting the key first makes sure that threads exiting
+ * later on won't run threads_local_release on tl.
+ */
+static inline void threads_local_fini(struct threads_local *tl)
+{
+	struct threads_local_entry *entry, *next;
+
+	pthread_key_delete(tl->key);
+
+	pthread_mutex_lock(&tl->mutex);
+	entry = tl->head;
+	while (entry) {
+		next = entry->next;
+		tl->free_fn(entry->data);
+		free(entry);
+		entry = next;
+	}
+	tl->head = NULL;
+	pthread_mutex_unlock(&tl->mutex);
+
+	pthread_mutex_destroy(&tl->mutex);
+}
+
+#endif
@@ -34,6 +34,7 @@ static int _handle_check_link_pmtud(knet_handle_t knet_h, struct knet_host *dst_
 			      * needs to be adjusted for crypto
 			      */
 	size_t pad_len;	     /* crypto packet pad size, needs to move into crypto.c callbacks */
+	size_t crypto_overhead; /* fixed crypto overhead (hash + salt + block) */
 	ssize_t len;	     /* len of what we were able to sendto onwire */
 
 	struct timespec ts;
@@ -96,29 +97,35 @@ restart:
 
 	if (knet_h->crypto_instance) {
 
+		crypto_overhead = knet_h->sec_hash_size + knet_h->sec_salt_size + knet_h->sec_block_size;
+
 		if (knet_h->sec_block_size) {
 			pad_len = knet_h->sec_block_size - (data_len % knet_h->sec_block_size);
 			if (pad_len == knet_h->sec_block_size) {
 				pad_len = 0;
 			}
 			data_len = data_len + pad_len;
-		}
 
-		data_len = data_len + (knet_h->sec_hash_size + knet_h->sec_salt_size + knet_h->sec_block_size);
+			data_len = data_len + crypto_overhead;
 
-		if (knet_h->sec_block_size) {
 			while (data_len + overhead_len >= max_mtu_len) {
 				data_len = data_len - knet_h->sec_block_size;
 			}
-		}
 
-		if (dst_link->last_bad_mtu) {
-			while (data_len + overhead_len >= dst_link->last_bad_mtu) {
-				data_len = data_len - (knet_h->sec_hash_size + knet_h->sec_salt_size + knet_h->sec_block_size);
+			if (dst_link->last_bad_mtu) {
+				while (data_len + overhead_len >= dst_link->last_bad_mtu) {
+					data_len = data_len - crypto_overhead;
+				}
 			}
 		}
 
-		if (data_len < (knet_h->sec_hash_size + knet_h->sec_salt_size + knet_h->sec_block_size) + 1) {
+		/*
+		 * without padding (hash only or AEAD) the crypto overhead
+		 * is fixed, so we can shrink the payload instead and
+		 * probe exactly onwire_len
+		 */
+
+		if (data_len < crypto_overhead + 1) {
 			log_debug(knet_h, KNET_SUB_PMTUD, "Aborting PMTUD process: link mtu smaller than crypto header detected (link might have been disconnected)");
 			return -1;
 		}
@@ -128,7 +135,7 @@ restart:
 
 		if (crypto_encrypt_and_sign(knet_h,
 					    (const unsigned char *)knet_h->pmtudbuf,
-					    data_len - (knet_h->sec_hash_size + knet_h->sec_salt_size + knet_h->sec_block_size),
+					    data_len - crypto_overhead,
 					    knet_h->pmtudbuf_crypt,
 					    (ssize_t *)&data_len) < 0) {
 			log_debug(knet_h, KNET_SUB_PMTUD, "Unable to crypto pmtud packet");
@@ -166,9 +173,9 @@ restart:
 		return -1;
 	}
 
-	savederrno = pthread_mutex_lock(&knet_h->tx_mutex);
+	savederrno = pthread_rwlock_wrlock(&knet_h->tx_rwlock);
 	if (savederrno) {
-		log_err(knet_h, KNET_SUB_PMTUD, "Unable to get TX mutex lock: %s", strerror(savederrno));
+		log_err(knet_h, KNET_SUB_PMTUD, "Unable to get TX write lock: %s", strerror(savederrno));
 		return -1;
 	}
 retry:
@@ -197,7 +204,7 @@ retry:
 	switch(err) {
 		case -1: /* unrecoverable error */
 			log_debug(knet_h, KNET_SUB_PMTUD, "Unable to send pmtu packet (sendto): %d %s", savederrno, strerror(savederrno));
-			pthread_mutex_unlock(&knet_h->tx_mutex);
+			pthread_rwlock_unlock(&knet_h->tx_rwlock);
 			pthread_mutex_unlock(&knet_h->pmtud_mutex);
 			dst_link->status.stats.tx_pmtu_errors++;
 			return -1;
@@ -209,7 +216,7 @@ retry:
 			break;
 	}
 
-	pthread_mutex_unlock(&knet_h->tx_mutex);
+	pthread_rwlock_unlock(&knet_h->tx_rwlock);
 
 	if (len != (ssize_t )data_len) {
 		if (savederrno == EMSGSIZE) {
@@ -476,6 +483,7 @@ void *_handle_pmtud_link_thread(void *data)
 	int link_idx;
 	unsigned int min_mtu, have_mtu;
 	unsigned int lower_mtu;
+	unsigned int max_onwire;
 	int link_has_mtu;
 	int force_run = 0;
 
@@ -513,6 +521,7 @@ void *_handle_pmtud_link_thread(void *data)
 		lower_mtu = KNET_PMTUD_SIZE_V4;
 		min_mtu = KNET_PMTUD_SIZE_V4 - KNET_HEADER_ALL_SIZE - knet_h->sec_header_size;
 		have_mtu = 0;
+		max_onwire = 0;
 
 		for (dst_host = knet_h->host_head; dst_host != NULL; dst_host = dst_host->next) {
 			for (link_idx = 0; link_idx < KNET_MAX_LINK; link_idx++) {
@@ -535,6 +544,9 @@ void *_handle_pmtud_link_thread(void *data)
 					if (min_mtu < lower_mtu) {
 						lower_mtu = min_mtu;
 					}
+					if (dst_link->status.mtu + dst_link->status.proto_overhead > max_onwire) {
+						max_onwire = dst_link->status.mtu + dst_link->status.proto_overhead;
+					}
 				}
 			}
 		}
@@ -549,6 +561,14 @@ void *_handle_pmtud_link_thread(void *data)
 								knet_h->data_mtu);
 				}
 			}
+			/*
+			 * RX workers resize their receive rings on their own
+			 * (see _rx_ring_resize in threads_rx.c)
+			 */
+			if (knet_h->rx_bufsize != max_onwire) {
+				knet_h->rx_bufsize = max_onwire;
+				log_debug(knet_h, KNET_SUB_PMTUD, "RX buffers size changed to: %u", knet_h->rx_bufsize);
+			}
 		}
 out_unlock:
 		pthread_rwlock_unlock(&knet_h->global_rwlock);
@@ -10,9 +10,13 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
 #include <pthread.h>
 
 #include "compat.h"
@@ -58,25 +62,38 @@ static inline int timecmp(struct timespec a, struct timespec b)
 
 /*
  * this functions needs to return an index (0 to 7)
- * to a knet_host_defrag_buf. (-1 on errors)
+ * to a knet_host_defrag_buf in defrag_bufs. (-1 on errors)
+ *
+ * trusted is 0 for fragments that are not authenticated yet
+ * (encrypt-then-fragment), they must not touch the seq_num state.
  */
 
-static int find_pckt_defrag_buf(knet_handle_t knet_h, struct knet_header *inbuf)
+static int find_pckt_defrag_buf(knet_handle_t knet_h, struct knet_host *src_host,
+				struct knet_host_defrag_buf *defrag_bufs, seq_num_t seq_num, int trusted)
 {
-	struct knet_host *src_host = knet_h->host_index[inbuf->kh_node];
 	int i, oldest;
 
+	/*
+	 * give back to the pool the buffers of packets that
+	 * will never be completed
+	 */
+	_defrag_bufs_release(knet_h, src_host, 1);
+
 	/*
 	 * check if there is a buffer already in use handling the same seq_num
 	 */
 	for (i = 0; i < KNET_MAX_LINK; i++) {
-		if (src_host->defrag_buf[i].in_use) {
-			if (src_host->defrag_buf[i].pckt_seq == inbuf->khp_data_seq_num) {
+		if (defrag_bufs[i].in_use) {
+			if (defrag_bufs[i].pckt_seq == seq_num) {
 				return i;
 			}
 		}
 	}
 
+	if (!trusted) {
+		goto find_free;
+	}
+
 	/*
 	 * If there is no buffer that's handling the current seq_num
 	 * either it's new or it's been reclaimed already.
@@ -84,7 +101,7 @@ static int find_pckt_defrag_buf(knet_handle_t knet_h, struct knet_header *inbuf)
 	 * buffer. If the pckt has been seen before, the buffer expired (ETIME)
 	 * and there is no point to try to defrag it again.
 	 */
-	if (!_seq_num_lookup(src_host, inbuf->khp_data_seq_num, 1, 0)) {
+	if (!_seq_num_lookup(knet_h, src_host, seq_num, 1, 0)) {
 		errno = ETIME;
 		return -1;
 	}
@@ -92,13 +109,14 @@ static int find_pckt_defrag_buf(knet_handle_t knet_h, struct knet_header *inbuf)
 	/*
 	 * register the pckt as seen
 	 */
-	_seq_num_set(src_host, inbuf->khp_data_seq_num, 1);
+	_seq_num_set(src_host, seq_num, 1);
 
+find_free:
 	/*
 	 * see if there is a free buffer
 	 */
 	for (i = 0; i < KNET_MAX_LINK; i++) {
-		if (!src_host->defrag_buf[i].in_use) {
+		if (!defrag_bufs[i].in_use) {
 			return i;
 		}
 	}
@@ -107,25 +125,44 @@ static int find_pckt_defrag_buf(knet_handle_t knet_h, struct knet_header *inbuf)
 	 * at this point, there are no free buffers, the pckt is new
 	 * and we need to reclaim a buffer, and we will take the one
 	 * with the oldest timestamp. It's as good as any.
+	 * The pool buffer stays with the host.
 	 */
 
 	oldest = 0;
 
 	for (i = 0; i < KNET_MAX_LINK; i++) {
-		if (timecmp(src_host->defrag_buf[i].last_update, src_host->defrag_buf[oldest].last_update) < 0) {
+		if (timecmp(defrag_bufs[i].last_update, defrag_bufs[oldest].last_update) < 0) {
 			oldest = i;
 		}
 	}
-	src_host->defrag_buf[oldest].in_use = 0;
+	defrag_bufs[oldest].in_use = 0;
 	return oldest;
 }
 
-static int pckt_defrag(knet_handle_t knet_h, struct knet_header *inbuf, ssize_t *len)
+static void pckt_defrag_drop(knet_handle_t knet_h, struct knet_host_defrag_buf *defrag_buf)
 {
+	_defrag_pool_put(knet_h, defrag_buf->chunk);
+	memset(defrag_buf, 0, sizeof(struct knet_host_defrag_buf));
+}
+
+/*
+ * on completion returns 0, *len is the size of the reassembled packet
+ * and iov/iovcnt describe where it is stored in *chunk: the last fragment
+ * is not moved in place when it has been received first (see below).
+ * The buffer is detached from the host and the caller must give it back
+ * to the pool with _defrag_pool_put when done.
+ */
+static int pckt_defrag(knet_handle_t knet_h, struct knet_header *inbuf,
+		       struct knet_host_defrag_buf *defrag_bufs, seq_num_t seq_num, int trusted,
+		       ssize_t *len, struct knet_defrag_chunk **chunk, struct iovec *iov, int *iovcnt)
+{
+	struct knet_host *src_host = knet_h->host_index[inbuf->kh_node];
 	struct knet_host_defrag_buf *defrag_buf;
+	struct knet_defrag_chunk *defrag_chunk;
 	int defrag_buf_idx;
+	size_t frag_offset;
 
-	defrag_buf_idx = find_pckt_defrag_buf(knet_h, inbuf);
+	defrag_buf_idx = find_pckt_defrag_buf(knet_h, src_host, defrag_bufs, seq_num, trusted);
 	if (defrag_buf_idx < 0) {
 		if (errno == ETIME) {
 			log_debug(knet_h, KNET_SUB_RX, "Defrag buffer expired");
@@ -133,15 +170,25 @@ static int pckt_defrag(knet_handle_t knet_h, struct knet_header *inbuf, ssize_t
 		return 1;
 	}
 
-	defrag_buf = &knet_h->host_index[inbuf->kh_node]->defrag_buf[defrag_buf_idx];
+	defrag_buf = &defrag_bufs[defrag_buf_idx];
 
 	/*
 	 * if the buf is not is use, then make sure it's clean
+	 * and it has memory to store the fragments
 	 */
 	if (!defrag_buf->in_use) {
+		defrag_chunk = defrag_buf->chunk;
+		if (!defrag_chunk) {
+			defrag_chunk = _defrag_pool_get(knet_h);
+			if (!defrag_chunk) {
+				log_debug(knet_h, KNET_SUB_RX, "Unable to get a defrag buffer: %s", strerror(errno));
+				return 1;
+			}
+		}
 		memset(defrag_buf, 0, sizeof(struct knet_host_defrag_buf));
+		defrag_buf->chunk = defrag_chunk;
 		defrag_buf->in_use = 1;
-		defrag_buf->pckt_seq = inbuf->khp_data_seq_num;
+		defrag_buf->pckt_seq = seq_num;
 	}
 
 	/*
@@ -177,7 +224,7 @@ static int pckt_defrag(knet_handle_t knet_h, struct knet_header *inbuf, ssize_t
 		 */
 		if (!defrag_buf->frag_size) {
 			defrag_buf->last_first = 1;
-			memmove(defrag_buf->buf + (KNET_MAX_PACKET_SIZE - *len),
+			memmove(defrag_buf->chunk->buf + (sizeof(defrag_buf->chunk->buf) - *len),
 			       inbuf->khp_data_userdata,
 			       *len);
 		}
@@ -185,8 +232,23 @@ static int pckt_defrag(knet_handle_t knet_h, struct knet_header *inbuf, ssize_t
 		defrag_buf->frag_size = *len;
 	}
 
-	memmove(defrag_buf->buf + ((inbuf->khp_data_frag_seq - 1) * defrag_buf->frag_size),
-	       inbuf->khp_data_userdata, *len);
+	/*
+	 * the last fragment received first stays where it is
+	 * and the other fragments must not overwrite it
+	 */
+	if ((!defrag_buf->last_first) ||
+	    (inbuf->khp_data_frag_seq != inbuf->khp_data_frag_num)) {
+		frag_offset = (inbuf->khp_data_frag_seq - 1) * defrag_buf->frag_size;
+		if (frag_offset + *len > sizeof(defrag_buf->chunk->buf) -
+					 (defrag_buf->last_first ? defrag_buf->last_frag_size : 0)) {
+			log_debug(knet_h, KNET_SUB_RX, "Fragment does not fit in the defrag buffer");
+			pckt_defrag_drop(knet_h, defrag_buf);
+			return 1;
+		}
+
+		memmove(defrag_buf->chunk->buf + frag_offset,
+		       inbuf->khp_data_userdata, *len);
+	}
 
 	defrag_buf->frag_recv++;
 	defrag_buf->frag_map[inbuf->khp_data_frag_seq] = 1;
@@ -195,47 +257,390 @@ static int pckt_defrag(knet_handle_t knet_h, struct knet_header *inbuf, ssize_t
 	 * check if we received all the fragments
 	 */
 	if (defrag_buf->frag_recv == inbuf->khp_data_frag_num) {
-		/*
-		 * special case the last pckt
-		 */
-
-		if (defrag_buf->last_first) {
-			memmove(defrag_buf->buf + ((inbuf->khp_data_frag_num - 1) * defrag_buf->frag_size),
-			        defrag_buf->buf + (KNET_MAX_PACKET_SIZE - defrag_buf->last_frag_size),
-				defrag_buf->last_frag_size);
-		}
-
 		/*
 		 * recalculate packet lenght
 		 */
 
 		*len = ((inbuf->khp_data_frag_num - 1) * defrag_buf->frag_size) + defrag_buf->last_frag_size;
 
+		if ((size_t)*len > sizeof(defrag_buf->chunk->buf)) {
+			log_debug(knet_h, KNET_SUB_RX, "Reassembled packet is too big");
+			pckt_defrag_drop(knet_h, defrag_buf);
+			return 1;
+		}
+
 		/*
-		 * copy the pckt back in the user data
+		 * special case the last pckt, it's still at the end of the buffer
 		 */
-		memmove(inbuf->khp_data_userdata, defrag_buf->buf, *len);
+		iov[0].iov_base = defrag_buf->chunk->buf;
+		if (defrag_buf->last_first) {
+			iov[0].iov_len = (inbuf->khp_data_frag_num - 1) * defrag_buf->frag_size;
+			iov[1].iov_base = defrag_buf->chunk->buf + (sizeof(defrag_buf->chunk->buf) - defrag_buf->last_frag_size);
+			iov[1].iov_len = defrag_buf->last_frag_size;
+			*iovcnt = 2;
+		} else {
+			iov[0].iov_len = *len;
+			*iovcnt = 1;
+		}
 
 		/*
-		 * free this buffer
+		 * hand over the buffer to the caller and free this slot
 		 */
-		defrag_buf->in_use = 0;
+		*chunk = defrag_buf->chunk;
+		memset(defrag_buf, 0, sizeof(struct knet_host_defrag_buf));
+
 		return 0;
 	}
 
 	return 1;
 }
 
-static void _parse_recv_from_links(knet_handle_t knet_h, int sockfd, const struct knet_mmsghdr *msg)
+/*
+ * make a reassembled packet contiguous, for the few users
+ * that cannot handle a scattered one
+ */
+static void pckt_defrag_flatten(struct iovec *iov, int *iovcnt)
+{
+	if (*iovcnt > 1) {
+		memmove((char *)iov[0].iov_base + iov[0].iov_len, iov[1].iov_base, iov[1].iov_len);
+		iov[0].iov_len += iov[1].iov_len;
+		*iovcnt = 1;
+	}
+}
+
+/*
+ * full seq_num of a data packet, see onwire.h. Needs the host rx_mutex.
+ */
+static seq_num_t _seq_num_rx(struct knet_host *src_host, const struct knet_header *inbuf)
+{
+	if (inbuf->kh_version >= KNET_HEADER_VERSION_V2) {
+		return ((seq_num_t)ntohs(inbuf->kh_seq_num_hi) << 16) | ntohs(inbuf->khp_data_seq_num);
+	}
+
+	return _seq_num_extend(src_host, ntohs(inbuf->khp_data_seq_num));
+}
+
+/*
+ * encrypt-then-fragment (see threads_tx.c). With crypto enabled, every
+ * other packet on the wire is encrypted as a whole and starts with
+ * random data (salt/nonce). Checking all the fields that have a fixed
+ * value in a fragment header makes a false positive (a dropped packet)
+ * extremely unlikely.
+ */
+static int _is_crypt_frag(const struct knet_header *inbuf, ssize_t len)
+{
+	if (len <= (ssize_t)KNET_HEADER_DATA_SIZE) {
+		return 0;
+	}
+
+	return ((inbuf->kh_version >= KNET_HEADER_VERSION) &&
+		(inbuf->kh_version <= KNET_HEADER_VERSION_MAX) &&
+		(inbuf->kh_type == KNET_HEADER_TYPE_CRYPT_FRAG) &&
+		((inbuf->kh_version >= KNET_HEADER_VERSION_V2) || (inbuf->kh_seq_num_hi == 0)) &&
+		(inbuf->khp_data_compress == 0) &&
+		(inbuf->khp_data_stream_seq == 0) &&
+		(inbuf->khp_data_bcast == 0) &&
+		(inbuf->khp_data_channel == 0) &&
+		(inbuf->khp_data_frag_num > 1) &&
+		(inbuf->khp_data_frag_seq > 0) &&
+		(inbuf->khp_data_frag_seq <= inbuf->khp_data_frag_num));
+}
+
+/*
+ * returns 0 when the packet has been reassembled, authenticated and decrypted
+ * into worker->recv_from_links_buf_decrypt, 1 if more fragments are
+ * needed or the packet has been dropped.
+ *
+ * Only the encrypted header is trusted, the cleartext one is used for
+ * reassembly only and must match it. Fragments are kept apart from the
+ * authenticated ones (crypt_defrag_buf) and do not change the seq_num state,
+ * dedup is done by the caller on the decrypted packet.
+ */
+static int _crypt_frag_defrag(knet_handle_t knet_h, struct knet_rx_worker *worker,
+			      struct knet_header *inbuf, ssize_t *len, uint64_t *crypt_time)
+{
+	struct knet_host *src_host;
+	struct knet_header *outbuf = (struct knet_header *)worker->recv_from_links_buf_decrypt;
+	struct timespec start_time;
+	struct timespec end_time;
+	knet_node_id_t src_node;
+	seq_num_t seq_num;
+	uint8_t onwire_ver = inbuf->kh_version;
+	uint16_t seq_num_lo = inbuf->khp_data_seq_num, seq_num_hi = inbuf->kh_seq_num_hi; /* network order */
+	struct knet_defrag_chunk *defrag_chunk;
+	struct iovec defrag_iov[2];
+	int defrag_iovcnt;
+	ssize_t defrag_len, outlen;
+	int err;
+
+	src_node = ntohs(inbuf->kh_node);
+	src_host = knet_h->host_index[src_node];
+	if (src_host == NULL) {  /* host not found */
+		log_debug(knet_h, KNET_SUB_RX, "Unable to find source host for this fragment");
+		return 1;
+	}
+
+	/*
+	 * pckt_defrag works in host byte order
+	 */
+	inbuf->kh_node = src_node;
+
+	if (pthread_mutex_lock(&src_host->rx_mutex) != 0) {
+		log_debug(knet_h, KNET_SUB_RX, "Unable to get host %u RX mutex lock", src_host->host_id);
+		return 1;
+	}
+
+	/*
+	 * skip the packets we have delivered already (active links),
+	 * without updating the window
+	 */
+	if (_seq_num_seen(src_host, _seq_num_rx(src_host, inbuf))) {
+		pthread_mutex_unlock(&src_host->rx_mutex);
+		return 1;
+	}
+
+	/*
+	 * reassembly key only, as sent
+	 */
+	seq_num = ((seq_num_t)ntohs(seq_num_hi) << 16) | ntohs(seq_num_lo);
+
+	defrag_len = *len - KNET_HEADER_DATA_SIZE;
+	if (pckt_defrag(knet_h, inbuf, src_host->crypt_defrag_buf, seq_num, 0,
+			&defrag_len, &defrag_chunk, defrag_iov, &defrag_iovcnt)) {
+		pthread_mutex_unlock(&src_host->rx_mutex);
+		return 1;
+	}
+
+	/*
+	 * the reassembled packet is ours now, no need to hold
+	 * the other RX workers while decrypting it
+	 */
+	pthread_mutex_unlock(&src_host->rx_mutex);
+
+	pckt_defrag_flatten(defrag_iov, &defrag_iovcnt);
+
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	err = crypto_authenticate_and_decrypt(knet_h,
+					      (unsigned char *)defrag_iov[0].iov_base,
+					      defrag_len,
+					      worker->recv_from_links_buf_decrypt,
+					      &outlen);
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+
+	_defrag_pool_put(knet_h, defrag_chunk);
+
+	if (err < 0) {
+		log_debug(knet_h, KNET_SUB_RX, "Unable to decrypt/auth reassembled packet");
+		return 1;
+	}
+
+	timespec_diff(start_time, end_time, crypt_time);
+
+	if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+		if (*crypt_time < knet_h->stats.rx_crypt_time_min) {
+			knet_h->stats.rx_crypt_time_min = *crypt_time;
+		}
+		if (*crypt_time > knet_h->stats.rx_crypt_time_max) {
+			knet_h->stats.rx_crypt_time_max = *crypt_time;
+		}
+		pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+	}
+
+	if ((outlen < (ssize_t)(KNET_HEADER_DATA_SIZE + 1)) ||
+	    (outlen > (ssize_t)(KNET_MAX_PACKET_SIZE + KNET_HEADER_DATA_SIZE)) ||
+	    (outbuf->kh_version != onwire_ver) ||
+	    ((outbuf->kh_type != KNET_HEADER_TYPE_DATA) && (outbuf->kh_type != KNET_HEADER_TYPE_HOST_INFO)) ||
+	    (ntohs(outbuf->kh_node) != src_node) ||
+	    (outbuf->khp_data_seq_num != seq_num_lo) ||
+	    (outbuf->kh_seq_num_hi != seq_num_hi) ||
+	    (outbuf->khp_data_frag_num != 1)) {
+		log_debug(knet_h, KNET_SUB_RX, "Reassembled packet does not match its fragments");
+		return 1;
+	}
+
+	*len = outlen;
+
+	return 0;
+}
+
+/*
+ * ask src_host to reset the compress stream of channel (see compress_stream_decompress).
+ * Data packets do not carry the link they have been sent from, use the
+ * best link we have towards src_host. Requests are rate limited and
+ * repeated by the caller as long as the stream is out of sync, errors
+ * are not fatal.
+ */
+static void _send_compress_resync(knet_handle_t knet_h, struct knet_rx_worker *worker, struct knet_host *src_host, int8_t channel)
+{
+	struct knet_header resync;
+	struct knet_link *dst_link;
+	unsigned char *outbuf = (unsigned char *)&resync;
+	ssize_t outlen = KNET_HEADER_DATA_SIZE, len;
+
+	if (!src_host->active_link_entries) {
+		return;
+	}
+
+	dst_link = &src_host->link[src_host->active_links[0]];
+
+	memset(&resync, 0, sizeof(struct knet_header));
+	resync.kh_version = KNET_HEADER_VERSION;
+	resync.kh_type = KNET_HEADER_TYPE_COMPRESS_RESYNC;
+	resync.kh_node = htons(knet_h->host_id);
+	resync.khp_data_channel = channel;
+
+	if (knet_h->crypto_instance) {
+		if (crypto_encrypt_and_sign(knet_h,
+					    (const unsigned char *)&resync,
+					    KNET_HEADER_DATA_SIZE,
+					    worker->recv_from_links_buf_crypt,
+					    &outlen) < 0) {
+			log_debug(knet_h, KNET_SUB_RX, "Unable to encrypt compress resync packet");
+			return;
+		}
+		outbuf = worker->recv_from_links_buf_crypt;
+	}
+
+	len = sendto(dst_link->outsock, outbuf, outlen, MSG_DONTWAIT | MSG_NOSIGNAL,
+		     (struct sockaddr *) &dst_link->dst_addr,
+		     sizeof(struct sockaddr_storage));
+	if (len != outlen) {
+		log_debug(knet_h, KNET_SUB_RX, "Unable to send compress resync to host %u: %s",
+			  src_host->host_id, strerror(errno));
+		return;
+	}
+
+	log_debug(knet_h, KNET_SUB_RX, "Asked host %u to reset compress stream for channel %d",
+		  src_host->host_id, channel);
+}
+
+/*
+ * write a data packet to the application socket of the channel.
+ * Invoked without the host rx_mutex.
+ */
+static void _deliver_data(knet_handle_t knet_h, knet_node_id_t src_host_id, int8_t channel,
+			  struct iovec *iov_out, int iovcnt_out, ssize_t datalen)
+{
+	knet_node_id_t dst_host_ids[KNET_MAX_HOST];
+	size_t dst_host_ids_entries = 0;
+	size_t host_idx;
+	int bcast, found = 0;
+	ssize_t outlen;
+
+	if (knet_h->dst_host_filter_fn) {
+		pckt_defrag_flatten(iov_out, &iovcnt_out);
+
+		bcast = knet_h->dst_host_filter_fn(
+				knet_h->dst_host_filter_fn_private_data,
+				(const unsigned char *)iov_out[0].iov_base,
+				datalen,
+				KNET_NOTIFY_RX,
+				knet_h->host_id,
+				src_host_id,
+				&channel,
+				dst_host_ids,
+				&dst_host_ids_entries);
+		if (bcast < 0) {
+			log_debug(knet_h, KNET_SUB_RX, "Error from dst_host_filter_fn: %d", bcast);
+			return;
+		}
+
+		if ((!bcast) && (!dst_host_ids_entries)) {
+			log_debug(knet_h, KNET_SUB_RX, "Message is unicast but no dst_host_ids_entries");
+			return;
+		}
+
+		/* check if we are dst for this packet */
+		if (!bcast) {
+			if (dst_host_ids_entries > KNET_MAX_HOST) {
+				log_debug(knet_h, KNET_SUB_RX, "dst_host_filter_fn returned too many destinations");
+				return;
+			}
+			for (host_idx = 0; host_idx < dst_host_ids_entries; host_idx++) {
+				if (dst_host_ids[host_idx] == knet_h->host_id) {
+					found = 1;
+					break;
+				}
+			}
+			if (!found) {
+				log_debug(knet_h, KNET_SUB_RX, "Packet is not for us");
+				return;
+			}
+		}
+	}
+
+	if (!knet_h->sockfd[channel].in_use) {
+		log_debug(knet_h, KNET_SUB_RX,
+			  "received packet for channel %d but there is no local sock connected",
+			  channel);
+		return;
+	}
+
+	outlen = writev(knet_h->sockfd[channel].sockfd[knet_h->sockfd[channel].is_created], iov_out, iovcnt_out);
+	if (outlen <= 0) {
+		knet_h->sock_notify_fn(knet_h->sock_notify_fn_private_data,
+				       knet_h->sockfd[channel].sockfd[0],
+				       channel,
+				       KNET_NOTIFY_RX,
+				       outlen,
+				       errno);
+	}
+}
+
+/*
+ * deliver the stream packets that were received out of order
+ * and are now next in line (see compress_stream_decompress)
+ */
+static void _deliver_stream_held(knet_handle_t knet_h, struct knet_rx_worker *worker, struct knet_host *src_host, int8_t channel)
+{
+	struct iovec iov_out;
+	ssize_t outlen;
+	int err, savederrno, resync;
+
+	while (1) {
+		outlen = KNET_DATABUFSIZE_COMPRESS;
+
+		if (pthread_mutex_lock(&src_host->rx_mutex) != 0) {
+			log_debug(knet_h, KNET_SUB_RX, "Unable to get host %u RX mutex lock", src_host->host_id);
+			return;
+		}
+		err = compress_stream_decompress_held(knet_h, &src_host->rx_compress_stream[channel],
+						      worker->recv_from_links_buf_decompress,
+						      &outlen, &resync);
+		savederrno = errno;
+		pthread_mutex_unlock(&src_host->rx_mutex);
+
+		if (err) {
+			if ((savederrno != ENOENT) && (savederrno != EALREADY) &&
+			    (!pthread_mutex_lock(&knet_h->handle_stats_mutex))) {
+				knet_h->channel_stats[channel].rx_compress_stream_lost++;
+				pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+			}
+			if (resync) {
+				_send_compress_resync(knet_h, worker, src_host, channel);
+			}
+			return;
+		}
+
+		if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+			knet_h->channel_stats[channel].rx_compress_stream_packets++;
+			knet_h->channel_stats[channel].rx_compress_stream_reordered++;
+			pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+		}
+
+		iov_out.iov_base = worker->recv_from_links_buf_decompress;
+		iov_out.iov_len = outlen;
+		_deliver_data(knet_h, src_host->host_id, channel, &iov_out, 1, outlen);
+	}
+}
+
+static void _parse_recv_from_links(knet_handle_t knet_h, struct knet_rx_worker *worker, int sockfd, const struct knet_mmsghdr *msg)
 {
 	int err = 0, savederrno = 0;
 	ssize_t outlen;
 	struct knet_host *src_host;
 	struct knet_link *src_link;
 	unsigned long long latency_last;
-	knet_node_id_t dst_host_ids[KNET_MAX_HOST];
-	size_t dst_host_ids_entries = 0;
-	int bcast = 1;
 	int was_decrypted = 0;
 	uint64_t crypt_time = 0;
 	struct timespec recvtime;
@@ -243,38 +648,66 @@ static void _parse_recv_from_links(knet_handle_t knet_h, int sockfd, const struc
 	unsigned char *outbuf = (unsigned char *)msg->msg_hdr.msg_iov->iov_base;
 	ssize_t len = msg->msg_len;
 	struct knet_hostinfo *knet_hostinfo;
-	struct iovec iov_out[1];
+	struct iovec iov_out[2];
+	int iovcnt_out = 1;
 	int8_t channel;
 	struct sockaddr_storage pckt_src;
-	seq_num_t recv_seq_num;
+	seq_num_t seq_num, recv_seq_num;
+	uint16_t recv_seq_num_lo;
 	int wipe_bufs = 0;
+	struct knet_defrag_chunk *defrag_chunk = NULL;
+	int resync = 0;
 
-	if (knet_h->crypto_instance) {
+	if ((knet_h->crypto_instance) && (knet_h->encrypt_then_fragment) &&
+	    (_is_crypt_frag(inbuf, len))) {
+		if (_crypt_frag_defrag(knet_h, worker, inbuf, &len, &crypt_time)) {
+			return;
+		}
+		inbuf = (struct knet_header *)worker->recv_from_links_buf_decrypt;
+		was_decrypted++;
+	} else if (knet_h->crypto_instance) {
 		struct timespec start_time;
 		struct timespec end_time;
 
 
+		/*
+		 * in hash only mode the packet is verified in place
+		 * and there is nothing to copy
+		 */
 		clock_gettime(CLOCK_MONOTONIC, &start_time);
-		if (crypto_authenticate_and_decrypt(knet_h,
-						    (unsigned char *)inbuf,
-						    len,
-						    knet_h->recv_from_links_buf_decrypt,
-						    &outlen) < 0) {
-			log_debug(knet_h, KNET_SUB_RX, "Unable to decrypt/auth packet");
-			return;
+		if (crypto_is_hash_only(knet_h)) {
+			if (crypto_authenticate(knet_h,
+						(unsigned char *)inbuf,
+						len,
+						&outlen) < 0) {
+				log_debug(knet_h, KNET_SUB_RX, "Unable to auth packet");
+				return;
+			}
+		} else {
+			if (crypto_authenticate_and_decrypt(knet_h,
+							    (unsigned char *)inbuf,
+							    len,
+							    worker->recv_from_links_buf_decrypt,
+							    &outlen) < 0) {
+				log_debug(knet_h, KNET_SUB_RX, "Unable to decrypt/auth packet");
+				return;
+			}
+			inbuf = (struct knet_header *)worker->recv_from_links_buf_decrypt;
 		}
 		clock_gettime(CLOCK_MONOTONIC, &end_time);
 		timespec_diff(start_time, end_time, &crypt_time);
 
-		if (crypt_time < knet_h->stats.rx_crypt_time_min) {
-			knet_h->stats.rx_crypt_time_min = crypt_time;
-		}
-		if (crypt_time > knet_h->stats.rx_crypt_time_max) {
-			knet_h->stats.rx_crypt_time_max = crypt_time;
+		if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+			if (crypt_time < knet_h->stats.rx_crypt_time_min) {
+				knet_h->stats.rx_crypt_time_min = crypt_time;
+			}
+			if (crypt_time > knet_h->stats.rx_crypt_time_max) {
+				knet_h->stats.rx_crypt_time_max = crypt_time;
+			}
+			pthread_mutex_unlock(&knet_h->handle_stats_mutex);
 		}
 
 		len = outlen;
-		inbuf = (struct knet_header *)knet_h->recv_from_links_buf_decrypt;
 		was_decrypted++;
 	}
 
@@ -283,7 +716,8 @@ static void _parse_recv_from_links(knet_handle_t knet_h, int sockfd, const struc
 		return;
 	}
 
-	if (inbuf->kh_version != KNET_HEADER_VERSION) {
+	if ((inbuf->kh_version < KNET_HEADER_VERSION) ||
+	    (inbuf->kh_version > KNET_HEADER_VERSION_MAX)) {
 		log_debug(knet_h, KNET_SUB_RX, "Packet version does not match");
 		return;
 	}
@@ -295,6 +729,15 @@ static void _parse_recv_from_links(knet_handle_t knet_h, int sockfd, const struc
 		return;
 	}
 
+	/*
+	 * from here on we touch the per host state, that can be shared
+	 * between RX workers. Serialize on the host.
+	 */
+	if (pthread_mutex_lock(&src_host->rx_mutex) != 0) {
+		log_debug(knet_h, KNET_SUB_RX, "Unable to get host %u RX mutex lock", src_host->host_id);
+		return;
+	}
+
 	src_link = NULL;
 
 	src_link = src_host->link +
@@ -345,7 +788,7 @@ static void _parse_recv_from_links(knet_handle_t knet_h, int sockfd, const struc
 			log_debug(knet_h, KNET_SUB_RX, "Source host %u not reachable yet", src_host->host_id);
 			//return;
 		}
-		inbuf->khp_data_seq_num = ntohs(inbuf->khp_data_seq_num);
+		seq_num = _seq_num_rx(src_host, inbuf);
 		channel = inbuf->khp_data_channel;
 		src_host->got_data = 1;
 
@@ -354,13 +797,20 @@ static void _parse_recv_from_links(knet_handle_t knet_h, int sockfd, const struc
 			src_link->status.stats.rx_data_bytes += len;
 		}
 
-		if (!_seq_num_lookup(src_host, inbuf->khp_data_seq_num, 0, 0)) {
+		if (!_seq_num_lookup(knet_h, src_host, seq_num, 0, 0)) {
 			if (src_host->link_handler_policy != KNET_LINK_POLICY_ACTIVE) {
 				log_debug(knet_h, KNET_SUB_RX, "Packet has already been delivered");
 			}
-			return;
+			goto out_unlock;
 		}
 
+		/*
+		 * iov_out points to the user data, that can be
+		 * in the packet, in a defrag buffer or in the decompress buffer
+		 */
+		iov_out[0].iov_base = (void *) inbuf->khp_data_userdata;
+		iov_out[0].iov_len = len - KNET_HEADER_DATA_SIZE;
+
 		if (inbuf->khp_data_frag_num > 1) {
 			/*
 			 * len as received from the socket also includes extra stuff
@@ -369,9 +819,18 @@ static void _parse_recv_from_links(knet_handle_t knet_h, int sockfd, const struc
 			 * defragging
 			 */
 			len = len - KNET_HEADER_DATA_SIZE;
-			if (pckt_defrag(knet_h, inbuf, &len)) {
-				return;
+			if (pckt_defrag(knet_h, inbuf, src_host->defrag_buf, seq_num, 1,
+					&len, &defrag_chunk, iov_out, &iovcnt_out)) {
+				goto out_unlock;
 			}
+			if (len > KNET_MAX_PACKET_SIZE) {
+				log_debug(knet_h, KNET_SUB_RX, "Reassembled packet is too big");
+				goto out_unlock;
+			}
+			/*
+			 * the pckt is delivered from the defrag buffer,
+			 * that goes back to the pool once we are done
+			 */
 			len = len + KNET_HEADER_DATA_SIZE;
 		}
 
@@ -381,130 +840,138 @@ static void _parse_recv_from_links(knet_handle_t knet_h, int sockfd, const struc
 			struct timespec end_time;
 			uint64_t compress_time;
 
+			pckt_defrag_flatten(iov_out, &iovcnt_out);
+
 			clock_gettime(CLOCK_MONOTONIC, &start_time);
-			err = decompress(knet_h, inbuf->khp_data_compress,
-					 (const unsigned char *)inbuf->khp_data_userdata,
-					 len - KNET_HEADER_DATA_SIZE,
-					 knet_h->recv_from_links_buf_decompress,
-					 &decmp_outlen);
+			if (inbuf->khp_data_compress & KNET_COMPRESS_STREAM) {
+				if ((inbuf->kh_type != KNET_HEADER_TYPE_DATA) ||
+				    (inbuf->khp_data_channel < 0) ||
+				    (inbuf->khp_data_channel >= KNET_DATAFD_MAX)) {
+					log_debug(knet_h, KNET_SUB_RX, "Received invalid compress stream packet");
+					goto out_unlock;
+				}
+				err = compress_stream_decompress(knet_h,
+								 &src_host->rx_compress_stream[inbuf->khp_data_channel],
+								 inbuf->khp_data_compress,
+								 inbuf->khp_data_stream_seq,
+								 (const unsigned char *)iov_out[0].iov_base,
+								 len - KNET_HEADER_DATA_SIZE,
+								 worker->recv_from_links_buf_decompress,
+								 &decmp_outlen,
+								 &resync);
+				if (err) {
+					/*
+					 * packets out of sync cannot be decompressed,
+					 * they are counted and dropped without flooding the logs
+					 */
+					if ((errno != EALREADY) && (errno != EINPROGRESS) &&
+					    (!pthread_mutex_lock(&knet_h->handle_stats_mutex))) {
+						knet_h->channel_stats[inbuf->khp_data_channel].rx_compress_stream_lost++;
+						pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+					}
+					if (resync) {
+						pthread_mutex_unlock(&src_host->rx_mutex);
+						_send_compress_resync(knet_h, worker, src_host, inbuf->khp_data_channel);
+						goto out;
+					}
+					goto out_unlock;
+				}
+			} else {
+				err = decompress(knet_h, inbuf->khp_data_compress,
+						 (const unsigned char *)iov_out[0].iov_base,
+						 len - KNET_HEADER_DATA_SIZE,
+						 worker->recv_from_links_buf_decompress,
+						 &decmp_outlen);
+			}
 			if (!err) {
 				/* Collect stats */
 				clock_gettime(CLOCK_MONOTONIC, &end_time);
 				timespec_diff(start_time, end_time, &compress_time);
 
-				if (compress_time < knet_h->stats.rx_compress_time_min) {
-					knet_h->stats.rx_compress_time_min = compress_time;
-				}
-				if (compress_time > knet_h->stats.rx_compress_time_max) {
-					knet_h->stats.rx_compress_time_max = compress_time;
-				}
-				knet_h->stats.rx_compress_time_ave =
-					(knet_h->stats.rx_compress_time_ave * knet_h->stats.rx_compressed_packets +
-					 compress_time) / (knet_h->stats.rx_compressed_packets+1);
+				if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+					if (compress_time < knet_h->stats.rx_compress_time_min) {
+						knet_h->stats.rx_compress_time_min = compress_time;
+					}
+					if (compress_time > knet_h->stats.rx_compress_time_max) {
+						knet_h->stats.rx_compress_time_max = compress_time;
+					}
+					knet_h->stats.rx_compress_time_ave =
+						(knet_h->stats.rx_compress_time_ave * knet_h->stats.rx_compressed_packets +
+						 compress_time) / (knet_h->stats.rx_compressed_packets+1);
 
-				knet_h->stats.rx_compressed_packets++;
-				knet_h->stats.rx_compressed_original_bytes += decmp_outlen;
-				knet_h->stats.rx_compressed_size_bytes += len - KNET_HEADER_SIZE;
+					knet_h->stats.rx_compressed_packets++;
+					knet_h->stats.rx_compressed_original_bytes += decmp_outlen;
+					knet_h->stats.rx_compressed_size_bytes += len - KNET_HEADER_SIZE;
 
-				memmove(inbuf->khp_data_userdata, knet_h->recv_from_links_buf_decompress, decmp_outlen);
+					if ((inbuf->khp_data_channel >= 0) &&
+					    (inbuf->khp_data_channel < KNET_DATAFD_MAX)) {
+						struct knet_channel_stats *channel_stats = &knet_h->channel_stats[inbuf->khp_data_channel];
+
+						if (compress_time < channel_stats->rx_compress_time_min) {
+							channel_stats->rx_compress_time_min = compress_time;
+						}
+						if (compress_time > channel_stats->rx_compress_time_max) {
+							channel_stats->rx_compress_time_max = compress_time;
+						}
+						channel_stats->rx_compress_time_ave =
+							(channel_stats->rx_compress_time_ave * channel_stats->rx_compressed_packets +
+							 compress_time) / (channel_stats->rx_compressed_packets+1);
+
+						channel_stats->rx_compressed_packets++;
+						channel_stats->rx_compressed_original_bytes += decmp_outlen;
+						channel_stats->rx_compressed_size_bytes += len - KNET_HEADER_SIZE;
+						if (inbuf->khp_data_compress & KNET_COMPRESS_STREAM) {
+							channel_stats->rx_compress_stream_packets++;
+						}
+					}
+					pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+				}
+
+				iov_out[0].iov_base = worker->recv_from_links_buf_decompress;
+				iov_out[0].iov_len = decmp_outlen;
 				len = decmp_outlen + KNET_HEADER_DATA_SIZE;
 			} else {
 				log_warn(knet_h, KNET_SUB_COMPRESS, "Unable to decompress packet (%d): %s",
 					 err, strerror(errno));
-				return;
+				goto out_unlock;
 			}
 		}
 
+		/*
+		 * seq_num, defrag and compress stream state are up to date.
+		 * The packet is marked as seen before the host lock is released,
+		 * so that a copy coming from another link is not delivered twice.
+		 * Delivery happens without the host lock.
+		 */
+		_seq_num_set(src_host, seq_num, 0);
+		pthread_mutex_unlock(&src_host->rx_mutex);
+
 		if (inbuf->kh_type == KNET_HEADER_TYPE_DATA) {
 			if (knet_h->enabled != 1) /* data forward is disabled */
-				break;
+				goto out;
 
 			/* Only update the crypto overhead for data packets. Mainly to be
 			   consistent with TX */
-			knet_h->stats.rx_crypt_time_ave =
-				(knet_h->stats.rx_crypt_time_ave * knet_h->stats.rx_crypt_packets +
-				 crypt_time) / (knet_h->stats.rx_crypt_packets+1);
-			knet_h->stats.rx_crypt_packets++;
-
-			if (knet_h->dst_host_filter_fn) {
-				size_t host_idx;
-				int found = 0;
-
-				bcast = knet_h->dst_host_filter_fn(
-						knet_h->dst_host_filter_fn_private_data,
-						(const unsigned char *)inbuf->khp_data_userdata,
-						len - KNET_HEADER_DATA_SIZE,
-						KNET_NOTIFY_RX,
-						knet_h->host_id,
-						inbuf->kh_node,
-						&channel,
-						dst_host_ids,
-						&dst_host_ids_entries);
-				if (bcast < 0) {
-					log_debug(knet_h, KNET_SUB_RX, "Error from dst_host_filter_fn: %d", bcast);
-					return;
-				}
-
-				if ((!bcast) && (!dst_host_ids_entries)) {
-					log_debug(knet_h, KNET_SUB_RX, "Message is unicast but no dst_host_ids_entries");
-					return;
-				}
-
-				/* check if we are dst for this packet */
-				if (!bcast) {
-					if (dst_host_ids_entries > KNET_MAX_HOST) {
-						log_debug(knet_h, KNET_SUB_RX, "dst_host_filter_fn returned too many destinations");
-						return;
-					}
-					for (host_idx = 0; host_idx < dst_host_ids_entries; host_idx++) {
-						if (dst_host_ids[host_idx] == knet_h->host_id) {
-							found = 1;
-							break;
-						}
-					}
-					if (!found) {
-						log_debug(knet_h, KNET_SUB_RX, "Packet is not for us");
-						return;
-					}
-				}
+			if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+				knet_h->stats.rx_crypt_time_ave =
+					(knet_h->stats.rx_crypt_time_ave * knet_h->stats.rx_crypt_packets +
+					 crypt_time) / (knet_h->stats.rx_crypt_packets+1);
+				knet_h->stats.rx_crypt_packets++;
+				pthread_mutex_unlock(&knet_h->handle_stats_mutex);
 			}
-		}
 
-		if (inbuf->kh_type == KNET_HEADER_TYPE_DATA) {
-			if (!knet_h->sockfd[channel].in_use) {
-				log_debug(knet_h, KNET_SUB_RX,
-					  "received packet for channel %d but there is no local sock connected",
-					  channel);
-				return;
-			}
-
-			memset(iov_out, 0, sizeof(iov_out));
-			iov_out[0].iov_base = (void *) inbuf->khp_data_userdata;
-			iov_out[0].iov_len = len - KNET_HEADER_DATA_SIZE;
+			_deliver_data(knet_h, inbuf->kh_node, channel, iov_out, iovcnt_out,
+				      len - KNET_HEADER_DATA_SIZE);
 
-			outlen = writev(knet_h->sockfd[channel].sockfd[knet_h->sockfd[channel].is_created], iov_out, 1);
-			if (outlen <= 0) {
-				knet_h->sock_notify_fn(knet_h->sock_notify_fn_private_data,
-						       knet_h->sockfd[channel].sockfd[0],
-						       channel,
-						       KNET_NOTIFY_RX,
-						       outlen,
-						       errno);
-				return;
-			}
-			if ((size_t)outlen == iov_out[0].iov_len) {
-				_seq_num_set(src_host, inbuf->khp_data_seq_num, 0);
+			if (inbuf->khp_data_compress & KNET_COMPRESS_STREAM) {
+				_deliver_stream_held(knet_h, worker, src_host, inbuf->khp_data_channel);
 			}
 		} else { /* HOSTINFO */
-			knet_hostinfo = (struct knet_hostinfo *)inbuf->khp_data_userdata;
+			pckt_defrag_flatten(iov_out, &iovcnt_out);
+			knet_hostinfo = (struct knet_hostinfo *)iov_out[0].iov_base;
 			if (knet_hostinfo->khi_bcast == KNET_HOSTINFO_UCAST) {
-				bcast = 0;
 				knet_hostinfo->khi_dst_node_id = ntohs(knet_hostinfo->khi_dst_node_id);
 			}
-			if (!_seq_num_lookup(src_host, inbuf->khp_data_seq_num, 0, 0)) {
-				return;
-			}
-			_seq_num_set(src_host, inbuf->khp_data_seq_num, 0);
 			switch(knet_hostinfo->khi_type) {
 				case KNET_HOSTINFO_TYPE_LINK_UP_DOWN:
 					break;
@@ -515,12 +982,47 @@ static void _parse_recv_from_links(knet_handle_t knet_h, int sockfd, const struc
 					break;
 			}
 		}
+		goto out;
+	case KNET_HEADER_TYPE_COMPRESS_RESYNC:
+		channel = inbuf->khp_data_channel;
+		if ((len < (ssize_t)KNET_HEADER_DATA_SIZE) ||
+		    (channel < 0) || (channel >= KNET_DATAFD_MAX)) {
+			log_debug(knet_h, KNET_SUB_RX, "Received invalid compress resync packet");
+			break;
+		}
+		log_debug(knet_h, KNET_SUB_RX, "Host %u asked to reset compress stream for channel %d",
+			  src_host->host_id, channel);
+		compress_stream_request_reset(&src_host->tx_compress_stream[channel]);
 		break;
 	case KNET_HEADER_TYPE_PING:
-		outlen = KNET_HEADER_PING_SIZE;
+		if (len < (ssize_t)KNET_HEADER_PING_V1_SIZE) {
+			log_debug(knet_h, KNET_SUB_RX, "Received invalid ping packet");
+			break;
+		}
+		/*
+		 * the pong is as long as the ping, so that older
+		 * versions get back exactly what they sent
+		 */
+		outlen = len;
 		inbuf->kh_type = KNET_HEADER_TYPE_PONG;
 		inbuf->kh_node = htons(knet_h->host_id);
-		recv_seq_num = ntohs(inbuf->khp_ping_seq_num);
+		/*
+		 * seq_num 0 is never used for data, it means the sender
+		 * did not send any data since it started
+		 */
+		recv_seq_num_lo = ntohs(inbuf->khp_ping_seq_num);
+		if (len >= (ssize_t)KNET_HEADER_PING_SIZE) {
+			recv_seq_num = ((seq_num_t)ntohs(inbuf->khp_ping_seq_num_hi) << 16) | recv_seq_num_lo;
+			_host_set_onwire_ver(knet_h, src_host, inbuf->khp_ping_onwire_ver);
+			/*
+			 * seq_num_hi is echoed with the lower bits,
+			 * the version is the one we support
+			 */
+			inbuf->khp_ping_onwire_ver = KNET_HEADER_VERSION_MAX;
+		} else {
+			recv_seq_num = recv_seq_num_lo ? _seq_num_extend(src_host, recv_seq_num_lo) : 0;
+			_host_set_onwire_ver(knet_h, src_host, KNET_HEADER_VERSION);
+		}
 		src_link->status.stats.rx_ping_packets++;
 		src_link->status.stats.rx_ping_bytes += len;
 
@@ -547,7 +1049,7 @@ static void _parse_recv_from_links(knet_handle_t knet_h, int sockfd, const struc
 					wipe_bufs = 1;
 				}
 			}
-			_seq_num_lookup(src_host, recv_seq_num, 0, wipe_bufs);
+			_seq_num_lookup(knet_h, src_host, recv_seq_num, 0, wipe_bufs);
 		} else {
 			/*
 			 * pings always arrives in bursts over all the link
@@ -558,22 +1060,30 @@ static void _parse_recv_from_links(knet_handle_t knet_h, int sockfd, const struc
 				src_host->timed_rx_seq_num = recv_seq_num;
 
 				if (recv_seq_num == 0) {
-					_seq_num_lookup(src_host, recv_seq_num, 0, 1);
+					_seq_num_lookup(knet_h, src_host, recv_seq_num, 0, 1);
 				}
 			}
 		}
 
+		/*
+		 * the pong is sent without the host lock
+		 */
+		pthread_mutex_unlock(&src_host->rx_mutex);
+
 		if (knet_h->crypto_instance) {
 			if (crypto_encrypt_and_sign(knet_h,
 						    (const unsigned char *)inbuf,
 						    len,
-						    knet_h->recv_from_links_buf_crypt,
+						    worker->recv_from_links_buf_crypt,
 						    &outlen) < 0) {
 				log_debug(knet_h, KNET_SUB_RX, "Unable to encrypt pong packet");
-				break;
+				goto out;
+			}
+			outbuf = worker->recv_from_links_buf_crypt;
+			if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+				knet_h->stats_extra.tx_crypt_pong_packets++;
+				pthread_mutex_unlock(&knet_h->handle_stats_mutex);
 			}
-			outbuf = knet_h->recv_from_links_buf_crypt;
-			knet_h->stats_extra.tx_crypt_pong_packets++;
 		}
 
 retry_pong:
@@ -590,19 +1100,28 @@ retry_pong:
 						  src_link->outsock, errno, strerror(errno),
 						  src_link->status.src_ipaddr, src_link->status.src_port,
 						  src_link->status.dst_ipaddr, src_link->status.dst_port);
-					src_link->status.stats.tx_pong_errors++;
+					if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+						src_link->status.stats.tx_pong_errors++;
+						pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+					}
 					break;
 				case 0: /* ignore error and continue */
 					break;
 				case 1: /* retry to send those same data */
-					src_link->status.stats.tx_pong_retries++;
+					if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+						src_link->status.stats.tx_pong_retries++;
+						pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+					}
 					goto retry_pong;
 					break;
 			}
 		}
-		src_link->status.stats.tx_pong_packets++;
-		src_link->status.stats.tx_pong_bytes += outlen;
-		break;
+		if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+			src_link->status.stats.tx_pong_packets++;
+			src_link->status.stats.tx_pong_bytes += outlen;
+			pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+		}
+		goto out;
 	case KNET_HEADER_TYPE_PONG:
 		src_link->status.stats.rx_pong_packets++;
 		src_link->status.stats.rx_pong_bytes += len;
@@ -651,23 +1170,31 @@ retry_pong:
 		inbuf->kh_type = KNET_HEADER_TYPE_PMTUD_REPLY;
 		inbuf->kh_node = htons(knet_h->host_id);
 
+		/*
+		 * the reply takes tx_rwlock, never with the host lock held
+		 */
+		pthread_mutex_unlock(&src_host->rx_mutex);
+
 		if (knet_h->crypto_instance) {
 			if (crypto_encrypt_and_sign(knet_h,
 						    (const unsigned char *)inbuf,
 						    len,
-						    knet_h->recv_from_links_buf_crypt,
+						    worker->recv_from_links_buf_crypt,
 						    &outlen) < 0) {
 				log_debug(knet_h, KNET_SUB_RX, "Unable to encrypt PMTUd reply packet");
-				break;
+				goto out;
+			}
+			outbuf = worker->recv_from_links_buf_crypt;
+			if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+				knet_h->stats_extra.tx_crypt_pmtu_reply_packets++;
+				pthread_mutex_unlock(&knet_h->handle_stats_mutex);
 			}
-			outbuf = knet_h->recv_from_links_buf_crypt;
-			knet_h->stats_extra.tx_crypt_pmtu_reply_packets++;
 		}
 
-		savederrno = pthread_mutex_lock(&knet_h->tx_mutex);
+		savederrno = pthread_rwlock_wrlock(&knet_h->tx_rwlock);
 		if (savederrno) {
-			log_err(knet_h, KNET_SUB_RX, "Unable to get TX mutex lock: %s", strerror(savederrno));
-			goto out_pmtud;
+			log_err(knet_h, KNET_SUB_RX, "Unable to get TX write lock: %s", strerror(savederrno));
+			goto out;
 		}
 retry_pmtud:
 		len = sendto(src_link->outsock, outbuf, outlen, MSG_DONTWAIT | MSG_NOSIGNAL,
@@ -684,20 +1211,28 @@ retry_pmtud:
 						  src_link->status.src_ipaddr, src_link->status.src_port,
 						  src_link->status.dst_ipaddr, src_link->status.dst_port);
 
-					src_link->status.stats.tx_pmtu_errors++;
+					if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+						src_link->status.stats.tx_pmtu_errors++;
+						pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+					}
 					break;
 				case 0: /* ignore error and continue */
-					src_link->status.stats.tx_pmtu_errors++;
+					if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+						src_link->status.stats.tx_pmtu_errors++;
+						pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+					}
 					break;
 				case 1: /* retry to send those same data */
-					src_link->status.stats.tx_pmtu_retries++;
+					if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+						src_link->status.stats.tx_pmtu_retries++;
+						pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+					}
 					goto retry_pmtud;
 					break;
 			}
 		}
-		pthread_mutex_unlock(&knet_h->tx_mutex);
-out_pmtud:
-		break;
+		pthread_rwlock_unlock(&knet_h->tx_rwlock);
+		goto out;
 	case KNET_HEADER_TYPE_PMTUD_REPLY:
 		src_link->status.stats.rx_pmtu_packets++;
 		src_link->status.stats.rx_pmtu_bytes += len;
@@ -710,40 +1245,285 @@ out_pmtud:
 		pthread_mutex_unlock(&knet_h->pmtud_mutex);
 		break;
 	default:
+		break;
+	}
+
+out_unlock:
+	pthread_mutex_unlock(&src_host->rx_mutex);
+out:
+	if (defrag_chunk) {
+		_defrag_pool_put(knet_h, defrag_chunk);
+	}
+}
+
+static void _rearm_recv_from_links_sock(knet_handle_t knet_h, int sockfd)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(struct epoll_event));
+	ev.events = KNET_RX_EPOLL_EVENTS;
+	ev.data.fd = sockfd;
+
+	/*
+	 * ENOENT is normal if the transport has removed the socket
+	 * from the epoll pool while handling an error
+	 */
+	if ((epoll_ctl(knet_h->recv_from_links_epollfd, EPOLL_CTL_MOD, sockfd, &ev)) &&
+	    (errno != ENOENT)) {
+		log_debug(knet_h, KNET_SUB_RX, "Unable to re-arm sock %d in epoll pool: %s",
+			  sockfd, strerror(errno));
+	}
+}
+
+/*
+ * must be invoked in global read lock context
+ */
+#ifdef UDP_GRO
+/*
+ * room for the UDP_GRO segment size
+ */
+#define KNET_RX_CMSG_SIZE CMSG_SPACE(sizeof(int))
+
+/*
+ * returns the size of the segments coalesced by UDP GRO in this
+ * message or 0 if the message contains only one packet
+ */
+static unsigned int _get_rx_segment_size(const struct knet_mmsghdr *msg)
+{
+	struct cmsghdr *cmsg;
+	int segment_size;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg->msg_hdr); cmsg != NULL; cmsg = CMSG_NXTHDR((struct msghdr *)&msg->msg_hdr, cmsg)) {
+		if ((cmsg->cmsg_level == IPPROTO_UDP) && (cmsg->cmsg_type == UDP_GRO)) {
+			memmove(&segment_size, CMSG_DATA(cmsg), sizeof(int));
+			if ((segment_size > 0) && ((unsigned int)segment_size < msg->msg_len)) {
+				return segment_size;
+			}
+			return 0;
+		}
+	}
+
+	return 0;
+}
+#endif
+
+static void _parse_rx_segments(knet_handle_t knet_h, struct knet_rx_worker *worker, int sockfd, const struct knet_mmsghdr *msg)
+{
+#ifdef UDP_GRO
+	struct knet_mmsghdr seg_msg;
+	struct iovec seg_iov;
+	unsigned int segment_size, offset;
+
+	segment_size = _get_rx_segment_size(msg);
+	if (!segment_size) {
+		_parse_recv_from_links(knet_h, worker, sockfd, msg);
 		return;
 	}
+
+	/*
+	 * the kernel coalesced several packets from the same source
+	 * into one buffer. All segments have segment_size length,
+	 * except the last one that can be shorter.
+	 *
+	 * _parse_recv_from_links can write a full reassembled or
+	 * decompressed packet back into the receive buffer, so each
+	 * segment is parsed from a buffer of its own.
+	 */
+	memmove(&seg_msg, msg, sizeof(struct knet_mmsghdr));
+	seg_iov.iov_base = worker->recv_from_links_buf_segment;
+	seg_msg.msg_hdr.msg_iov = &seg_iov;
+	seg_msg.msg_hdr.msg_iovlen = 1;
+
+	for (offset = 0; offset < msg->msg_len; offset += segment_size) {
+		seg_msg.msg_len = msg->msg_len - offset;
+		if (seg_msg.msg_len > segment_size) {
+			seg_msg.msg_len = segment_size;
+		}
+		seg_iov.iov_len = seg_msg.msg_len;
+		memmove(worker->recv_from_links_buf_segment,
+			(unsigned char *)msg->msg_hdr.msg_iov->iov_base + offset,
+			seg_msg.msg_len);
+		_parse_recv_from_links(knet_h, worker, sockfd, &seg_msg);
+	}
+#else
+	_parse_recv_from_links(knet_h, worker, sockfd, msg);
+#endif
+}
+
+/*
+ * UDP datagrams are received in the ring slots, anything bigger than
+ * a slot spills over into the oversize buffer given to the message.
+ * Other transports (SCTP reassembles short reads in place) get the
+ * whole oversize buffer.
+ */
+static void _rx_iov_setup(struct knet_rx_worker *worker, struct knet_mmsghdr *msg, int i, unsigned char *oversize, uint8_t transport)
+{
+	uint32_t slot = worker->recv_ring_slot;
+	struct iovec *iov = msg->msg_hdr.msg_iov;
+
+	if ((transport == KNET_TRANSPORT_UDP) && (slot < (KNET_DATABUFSIZE))) {
+		iov[0].iov_base = worker->recv_from_links_ring + ((size_t)i * slot);
+		iov[0].iov_len = slot;
+		iov[1].iov_base = oversize + slot;
+		iov[1].iov_len = (KNET_DATABUFSIZE) - slot;
+		msg->msg_hdr.msg_iovlen = 2;
+	} else {
+		iov[0].iov_base = oversize;
+		iov[0].iov_len = KNET_DATABUFSIZE;
+		msg->msg_hdr.msg_iovlen = 1;
+	}
 }
 
-static void _handle_recv_from_links(knet_handle_t knet_h, int sockfd, struct knet_mmsghdr *msg)
+/*
+ * move a datagram that did not fit in its ring slot
+ * in one piece in the oversize buffer.
+ * returns 1 if the message holds on to its oversize buffer
+ */
+static int _rx_oversize_fixup(struct knet_mmsghdr *msg)
 {
-	int err, savederrno;
-	int i, msg_recv, transport;
+	struct iovec *iov = msg->msg_hdr.msg_iov;
+	unsigned char *oversize;
+
+	if (msg->msg_hdr.msg_iovlen < 2) {
+		return 1;
+	}
+
+	if (msg->msg_len <= iov[0].iov_len) {
+		return 0;
+	}
+
+	oversize = (unsigned char *)iov[1].iov_base - iov[0].iov_len;
+	memmove(oversize, iov[0].iov_base, iov[0].iov_len);
+	iov[0].iov_base = oversize;
+	iov[0].iov_len = KNET_DATABUFSIZE;
+	msg->msg_hdr.msg_iovlen = 1;
+
+	return 1;
+}
+
+/*
+ * every message handed to recvmmsg needs an oversize buffer of its own,
+ * since we can't know in advance which datagrams will spill.
+ * The batch is read in chunks of as many messages as we have free
+ * oversize buffers, messages that did not spill give theirs back.
+ * The batch stops when the socket is drained or we run out of
+ * oversize buffers, the rest is picked up after the socket is re-armed.
+ *
+ * returns the number of messages received or recvmmsg return code
+ * if the first chunk failed (errno is set)
+ */
+static int _rx_recvmmsg(struct knet_rx_worker *worker, int sockfd, struct knet_mmsghdr *msg, uint8_t transport)
+{
+	int i, vlen, chunk_recv, savederrno;
+	int msg_recv = 0;
+	int oversize_free = KNET_RX_OVERSIZE_BUFS;
+	uint8_t oversize_pool[KNET_RX_OVERSIZE_BUFS];
+	uint8_t oversize_idx[KNET_RX_OVERSIZE_BUFS];
+
+	for (i = 0; i < KNET_RX_OVERSIZE_BUFS; i++) {
+		oversize_pool[i] = i;
+	}
+
+	do {
+		vlen = PCKT_RX_BUFS - msg_recv;
+		if (vlen > oversize_free) {
+			vlen = oversize_free;
+		}
+
+		for (i = 0; i < vlen; i++) {
+			oversize_idx[i] = oversize_pool[--oversize_free];
+			_rx_iov_setup(worker, &msg[msg_recv + i], msg_recv + i,
+				      worker->recv_from_links_buf_oversize + ((size_t)oversize_idx[i] * (KNET_DATABUFSIZE)),
+				      transport);
+			/*
+			 * reset msg_namelen to buffer size because after recvmmsg
+			 * each msg_namelen will contain sizeof sockaddr_in or sockaddr_in6
+			 * (same for msg_controllen)
+			 */
+			msg[msg_recv + i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+#ifdef UDP_GRO
+			msg[msg_recv + i].msg_hdr.msg_controllen = KNET_RX_CMSG_SIZE;
+#endif
+		}
+
+		chunk_recv = _recvmmsg(sockfd, &msg[msg_recv], vlen, MSG_DONTWAIT | MSG_NOSIGNAL);
+		savederrno = errno;
+
+		for (i = 0; i < vlen; i++) {
+			if ((i < chunk_recv) && (_rx_oversize_fixup(&msg[msg_recv + i]))) {
+				continue;
+			}
+			oversize_pool[oversize_free++] = oversize_idx[i];
+		}
+
+		if (chunk_recv <= 0) {
+			/*
+			 * errors after the first chunk are recorded on the socket
+			 * and handled on the next run
+			 */
+			if (!msg_recv) {
+				errno = savederrno;
+				return chunk_recv;
+			}
+			break;
+		}
+
+		msg_recv = msg_recv + chunk_recv;
+	} while ((chunk_recv == vlen) && (msg_recv < PCKT_RX_BUFS) && (oversize_free));
 
-	if (pthread_rwlock_rdlock(&knet_h->global_rwlock) != 0) {
-		log_debug(knet_h, KNET_SUB_RX, "Unable to get global read lock");
+	return msg_recv;
+}
+
+/*
+ * check if PMTUd changed the size of the packets we can receive
+ * and resize the ring. On failure we keep going with the current one.
+ */
+static void _rx_ring_resize(knet_handle_t knet_h, struct knet_rx_worker *worker)
+{
+	uint32_t slot;
+	unsigned char *ring;
+
+	slot = (knet_h->rx_bufsize + KNET_RX_SLOT_ALIGN - 1) & ~(KNET_RX_SLOT_ALIGN - 1);
+	if (slot > (KNET_DATABUFSIZE)) {
+		slot = KNET_DATABUFSIZE;
+	}
+
+	if (slot == worker->recv_ring_slot) {
+		return;
+	}
+
+	ring = malloc((size_t)PCKT_RX_BUFS * slot);
+	if (!ring) {
+		log_debug(knet_h, KNET_SUB_RX, "Unable to allocate memory for RX worker %u ring: %s",
+			  worker->worker_id, strerror(errno));
 		return;
 	}
 
+	free(worker->recv_from_links_ring);
+	worker->recv_from_links_ring = ring;
+	worker->recv_ring_slot = slot;
+
+	log_debug(knet_h, KNET_SUB_RX, "RX worker %u ring slots set to %u bytes",
+		  worker->worker_id, slot);
+}
+
+static void _handle_recv_from_links(knet_handle_t knet_h, struct knet_rx_worker *worker, int sockfd, struct knet_mmsghdr *msg)
+{
+	int err, savederrno;
+	int i, msg_recv, transport;
+	uint8_t is_data[PCKT_RX_BUFS];
+
 	if (_is_valid_fd(knet_h, sockfd) < 1) {
 		/*
 		 * this is normal if a fd got an event and before we grab the read lock
 		 * and the link is removed by another thread
 		 */
-		goto exit_unlock;
+		return;
 	}
 
 	transport = knet_h->knet_transport_fd_tracker[sockfd].transport;
 
-	/*
-	 * reset msg_namelen to buffer size because after recvmmsg
-	 * each msg_namelen will contain sizeof sockaddr_in or sockaddr_in6
-	 */
-
-	for (i = 0; i < PCKT_RX_BUFS; i++) {
-		msg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
-	}
-
-	msg_recv = _recvmmsg(sockfd, &msg[0], PCKT_RX_BUFS, MSG_DONTWAIT | MSG_NOSIGNAL);
+	msg_recv = _rx_recvmmsg(worker, sockfd, msg, transport);
 	savederrno = errno;
 
 	/*
@@ -772,9 +1552,20 @@ static void _handle_recv_from_links(knet_handle_t knet_h, int sockfd, struct kne
 
 	if (msg_recv <= 0) {
 		transport_rx_sock_error(knet_h, transport, sockfd, msg_recv, savederrno);
-		goto exit_unlock;
+		_rearm_recv_from_links_sock(knet_h, sockfd);
+		return;
 	}
 
+	/*
+	 * the socket is re-armed only once the whole batch has been
+	 * delivered. Another worker reading the next batch from the
+	 * same socket in the meantime could deliver packets from the
+	 * same host and link out of order.
+	 * Transports also keep per socket state while parsing
+	 * (see SCTP short reads).
+	 */
+	memset(is_data, 0, sizeof(is_data));
+
 	for (i = 0; i < msg_recv; i++) {
 		err = transport_rx_is_data(knet_h, transport, sockfd, &msg[i]);
 
@@ -786,66 +1577,227 @@ static void _handle_recv_from_links(knet_handle_t knet_h, int sockfd, struct kne
 		switch(err) {
 			case -1: /* on error */
 				log_debug(knet_h, KNET_SUB_RX, "Transport reported error parsing packet");
-				goto exit_unlock;
+				goto exit_parse;
 				break;
 			case 0: /* packet is not data and we should continue the packet process loop */
 				log_debug(knet_h, KNET_SUB_RX, "Transport reported no data, continue");
 				break;
 			case 1: /* packet is not data and we should STOP the packet process loop */
 				log_debug(knet_h, KNET_SUB_RX, "Transport reported no data, stop");
-				goto exit_unlock;
+				goto exit_parse;
 				break;
 			case 2: /* packet is data and should be parsed as such */
-				_parse_recv_from_links(knet_h, sockfd, &msg[i]);
+				is_data[i] = 1;
 				break;
 		}
 	}
 
-exit_unlock:
-	pthread_rwlock_unlock(&knet_h->global_rwlock);
+exit_parse:
+	for (i = 0; i < msg_recv; i++) {
+		if (is_data[i]) {
+			_parse_rx_segments(knet_h, worker, sockfd, &msg[i]);
+		}
+	}
+
+	_rearm_recv_from_links_sock(knet_h, sockfd);
 }
 
-void *_handle_recv_from_links_thread(void *data)
+static void *_handle_recv_from_links_thread(void *data)
 {
 	int i, nev;
-	knet_handle_t knet_h = (knet_handle_t) data;
+	struct knet_rx_worker *worker = (struct knet_rx_worker *) data;
+	knet_handle_t knet_h = worker->knet_h;
 	struct epoll_event events[KNET_EPOLL_MAX_EVENTS];
 	struct sockaddr_storage address[PCKT_RX_BUFS];
 	struct knet_mmsghdr msg[PCKT_RX_BUFS];
-	struct iovec iov_in[PCKT_RX_BUFS];
+#ifdef UDP_GRO
+	uint64_t cmsg_in[PCKT_RX_BUFS][(KNET_RX_CMSG_SIZE + sizeof(uint64_t) - 1) / sizeof(uint64_t)];
+#endif
 
-	set_thread_status(knet_h, KNET_THREAD_RX, KNET_THREAD_RUNNING);
+	if (!worker->worker_id) {
+		set_thread_status(knet_h, KNET_THREAD_RX, KNET_THREAD_RUNNING);
+	}
 
 	memset(&msg, 0, sizeof(msg));
 
 	for (i = 0; i < PCKT_RX_BUFS; i++) {
-		iov_in[i].iov_base = (void *)knet_h->recv_from_links_buf[i];
-		iov_in[i].iov_len = KNET_DATABUFSIZE;
-
 		memset(&msg[i].msg_hdr, 0, sizeof(struct msghdr));
 
 		msg[i].msg_hdr.msg_name = &address[i];
 		msg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
-		msg[i].msg_hdr.msg_iov = &iov_in[i];
-		msg[i].msg_hdr.msg_iovlen = 1;
+		msg[i].msg_hdr.msg_iov = worker->recv_iov[i];
+#ifdef UDP_GRO
+		msg[i].msg_hdr.msg_control = cmsg_in[i];
+		msg[i].msg_hdr.msg_controllen = KNET_RX_CMSG_SIZE;
+#endif
 	}
 
 	while (!shutdown_in_progress(knet_h)) {
 		nev = epoll_wait(knet_h->recv_from_links_epollfd, events, KNET_EPOLL_MAX_EVENTS, KNET_THREADS_TIMERES / 1000);
 
-		/*
-		 * we use timeout to detect if thread is shutting down
-		 */
-		if (nev == 0) {
+		if (pthread_rwlock_rdlock(&knet_h->global_rwlock) != 0) {
+			log_debug(knet_h, KNET_SUB_RX, "Unable to get global read lock");
+			/*
+			 * sockets are oneshot, give them back to the other workers
+			 */
+			for (i = 0; i < nev; i++) {
+				_rearm_recv_from_links_sock(knet_h, events[i].data.fd);
+			}
 			continue;
 		}
 
+		_rx_ring_resize(knet_h, worker);
+
+		/*
+		 * events must be handled (and sockets re-armed)
+		 * before checking if the worker is being removed
+		 * from the pool.
+		 */
 		for (i = 0; i < nev; i++) {
-			_handle_recv_from_links(knet_h, events[i].data.fd, msg);
+			_handle_recv_from_links(knet_h, worker, events[i].data.fd, msg);
 		}
+
+		if (worker->stop) {
+			pthread_rwlock_unlock(&knet_h->global_rwlock);
+			break;
+		}
+
+		pthread_rwlock_unlock(&knet_h->global_rwlock);
 	}
 
-	set_thread_status(knet_h, KNET_THREAD_RX, KNET_THREAD_STOPPED);
+	if (!worker->worker_id) {
+		set_thread_status(knet_h, KNET_THREAD_RX, KNET_THREAD_STOPPED);
+	}
 
 	return NULL;
 }
+
+/*
+ * RX workers pool management
+ */
+
+static void _rx_worker_free(struct knet_rx_worker *worker)
+{
+	free(worker->recv_from_links_ring);
+	free(worker->recv_from_links_buf_oversize);
+	free(worker->recv_from_links_buf_crypt);
+	free(worker->recv_from_links_buf_decrypt);
+	free(worker->recv_from_links_buf_decompress);
+	free(worker->recv_from_links_buf_segment);
+	free(worker);
+}
+
+int _rx_worker_start(knet_handle_t knet_h, uint8_t worker_id)
+{
+	int savederrno = 0;
+	struct knet_rx_worker *worker;
+
+	worker = malloc(sizeof(struct knet_rx_worker));
+	if (!worker) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_RX, "Unable to allocate memory for RX worker %u: %s",
+			worker_id, strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+	memset(worker, 0, sizeof(struct knet_rx_worker));
+
+	worker->knet_h = knet_h;
+	worker->worker_id = worker_id;
+
+	_rx_ring_resize(knet_h, worker);
+	if (!worker->recv_from_links_ring) {
+		savederrno = ENOMEM;
+		log_err(knet_h, KNET_SUB_RX, "Unable to allocate memory for link to datafd ring: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+
+	/*
+	 * no memset here, pages are committed only if a datagram
+	 * does not fit in the ring
+	 */
+	worker->recv_from_links_buf_oversize = malloc((size_t)KNET_RX_OVERSIZE_BUFS * (KNET_DATABUFSIZE));
+	if (!worker->recv_from_links_buf_oversize) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_RX, "Unable to allocate memory for link to datafd oversize buffer: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+
+	worker->recv_from_links_buf_decrypt = malloc(KNET_DATABUFSIZE_CRYPT);
+	if (!worker->recv_from_links_buf_decrypt) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_CRYPTO, "Unable to allocate memory for crypto link to datafd buffer: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+	memset(worker->recv_from_links_buf_decrypt, 0, KNET_DATABUFSIZE_CRYPT);
+
+	worker->recv_from_links_buf_crypt = malloc(KNET_DATABUFSIZE_CRYPT);
+	if (!worker->recv_from_links_buf_crypt) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_CRYPTO, "Unable to allocate memory for crypto link to datafd buffer: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+	memset(worker->recv_from_links_buf_crypt, 0, KNET_DATABUFSIZE_CRYPT);
+
+	worker->recv_from_links_buf_decompress = malloc(KNET_DATABUFSIZE_COMPRESS);
+	if (!worker->recv_from_links_buf_decompress) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_RX, "Unable to allocate memory for decompress buffer: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+	memset(worker->recv_from_links_buf_decompress, 0, KNET_DATABUFSIZE_COMPRESS);
+
+	worker->recv_from_links_buf_segment = malloc(KNET_DATABUFSIZE);
+	if (!worker->recv_from_links_buf_segment) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_RX, "Unable to allocate memory for segment buffer: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+	memset(worker->recv_from_links_buf_segment, 0, KNET_DATABUFSIZE);
+
+	savederrno = pthread_create(&worker->thread, 0,
+				    _handle_recv_from_links_thread, (void *) worker);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_RX, "Unable to start link to datafd thread %u: %s",
+			worker_id, strerror(savederrno));
+		goto exit_fail;
+	}
+
+	knet_h->rx_workers[worker_id] = worker;
+
+	log_debug(knet_h, KNET_SUB_RX, "RX worker %u started", worker_id);
+
+	return 0;
+
+exit_fail:
+	_rx_worker_free(worker);
+	errno = savederrno;
+	return -1;
+}
+
+/*
+ * the worker must have been flagged to stop, or the handle must be
+ * shutting down, and this must be invoked without holding global_rwlock.
+ */
+void _rx_worker_stop(knet_handle_t knet_h, uint8_t worker_id)
+{
+	void *retval;
+	struct knet_rx_worker *worker = knet_h->rx_workers[worker_id];
+
+	if (!worker) {
+		return;
+	}
+
+	pthread_join(worker->thread, &retval);
+
+	knet_h->rx_workers[worker_id] = NULL;
+	_rx_worker_free(worker);
+
+	log_debug(knet_h, KNET_SUB_RX, "RX worker %u stopped", worker_id);
+}
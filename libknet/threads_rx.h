@@ -10,6 +10,9 @@
 #ifndef __KNET_THREADS_RX_H__
 #define __KNET_THREADS_RX_H__
 
-void *_handle_recv_from_links_thread(void *data);
+#include "internals.h"
+
+int _rx_worker_start(knet_handle_t knet_h, uint8_t worker_id);
+void _rx_worker_stop(knet_handle_t knet_h, uint8_t worker_id);
 
 #endif
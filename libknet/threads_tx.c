@@ -10,10 +10,14 @@
 #include "config.h"
 
 #include <math.h>
+#include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
 #include <errno.h>
 
 #include "compat.h"
@@ -28,66 +32,181 @@
 #include "threads_heartbeat.h"
 #include "threads_tx.h"
 #include "netutils.h"
+#include "common.h"
 
 /*
  * SEND
  */
 
-static int _dispatch_to_links(knet_handle_t knet_h, struct knet_host *dst_host, struct knet_mmsghdr *msg, int msgs_to_send)
+#ifdef UDP_SEGMENT
+/*
+ * kernel limits for one GSO send: max number of segments and
+ * max UDP payload, leaving room for IP/UDP headers and options
+ */
+#define KNET_GSO_MAX_SEGMENTS 64
+#define KNET_GSO_MAX_BYTES (UINT16_MAX - 1024)
+
+static size_t _msg_len(const struct knet_mmsghdr *msg)
 {
-	int link_idx, msg_idx, sent_msgs, prev_sent, progress;
-	int err = 0, savederrno = 0;
+	size_t len = 0;
 	unsigned int i;
-	struct knet_mmsghdr *cur;
-	struct knet_link *cur_link;
 
-	for (link_idx = 0; link_idx < dst_host->active_link_entries; link_idx++) {
-		sent_msgs = 0;
-		prev_sent = 0;
-		progress = 1;
+	/* Cast for Linux/BSD compatibility */
+	for (i = 0; i < (unsigned int)msg->msg_hdr.msg_iovlen; i++) {
+		len += msg->msg_hdr.msg_iov[i].iov_len;
+	}
 
-		cur_link = &dst_host->link[dst_host->active_links[link_idx]];
+	return len;
+}
 
-		if (cur_link->transport_type == KNET_TRANSPORT_LOOPBACK) {
-			continue;
+/*
+ * send runs of equally sized fragments (the last one can be shorter)
+ * as one UDP GSO super packet and let the kernel split them.
+ *
+ * returns the number of messages sent. The caller takes care of
+ * the remaining ones (if any) with the regular path, including
+ * error handling and retries.
+ */
+static int _dispatch_gso_to_link(knet_handle_t knet_h, struct knet_link *cur_link, struct knet_mmsghdr *msg, int msgs_to_send)
+{
+	struct msghdr gso_msg;
+	struct iovec iov_out[KNET_GSO_MAX_SEGMENTS * KNET_TX_IOVCNT_MAX];
+	uint64_t cmsg_out[(CMSG_SPACE(sizeof(uint16_t)) + sizeof(uint64_t) - 1) / sizeof(uint64_t)];
+	struct cmsghdr *cmsg;
+	size_t segment_size, len, total_len;
+	unsigned int iovcnt, i;
+	int sent_msgs = 0, batch;
+	uint16_t gso_size;
+
+	while (sent_msgs < msgs_to_send - 1) {
+		segment_size = _msg_len(&msg[sent_msgs]);
+		total_len = 0;
+		iovcnt = 0;
+		batch = 0;
+
+		while ((sent_msgs + batch < msgs_to_send) && (batch < KNET_GSO_MAX_SEGMENTS)) {
+			len = _msg_len(&msg[sent_msgs + batch]);
+			if ((len > segment_size) ||
+			    (total_len + len > KNET_GSO_MAX_BYTES) ||
+			    (iovcnt + (unsigned int)msg[sent_msgs + batch].msg_hdr.msg_iovlen > KNET_GSO_MAX_SEGMENTS * KNET_TX_IOVCNT_MAX)) {
+				break;
+			}
+			for (i = 0; i < (unsigned int)msg[sent_msgs + batch].msg_hdr.msg_iovlen; i++) {
+				iov_out[iovcnt++] = msg[sent_msgs + batch].msg_hdr.msg_iov[i];
+			}
+			total_len += len;
+			batch++;
+			/*
+			 * only the last segment can be shorter
+			 */
+			if (len < segment_size) {
+				break;
+			}
 		}
 
-		msg_idx = 0;
-		while (msg_idx < msgs_to_send) {
-			msg[msg_idx].msg_hdr.msg_name = &cur_link->dst_addr;
+		if (batch < 2) {
+			break;
+		}
 
-			/* Cast for Linux/BSD compatibility */
-			for (i=0; i<(unsigned int)msg[msg_idx].msg_hdr.msg_iovlen; i++) {
-				cur_link->status.stats.tx_data_bytes += msg[msg_idx].msg_hdr.msg_iov[i].iov_len;
+		memset(&gso_msg, 0, sizeof(struct msghdr));
+		memset(cmsg_out, 0, sizeof(cmsg_out));
+		gso_msg.msg_name = msg[sent_msgs].msg_hdr.msg_name;
+		gso_msg.msg_namelen = msg[sent_msgs].msg_hdr.msg_namelen;
+		gso_msg.msg_iov = iov_out;
+		gso_msg.msg_iovlen = iovcnt;
+		gso_msg.msg_control = cmsg_out;
+		gso_msg.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+
+		gso_size = segment_size;
+		cmsg = CMSG_FIRSTHDR(&gso_msg);
+		cmsg->cmsg_level = IPPROTO_UDP;
+		cmsg->cmsg_type = UDP_SEGMENT;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+		memmove(CMSG_DATA(cmsg), &gso_size, sizeof(uint16_t));
+
+		if (sendmsg(cur_link->outsock, &gso_msg, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+			/*
+			 * kernel or device without UDP GSO support, stop trying
+			 * on this link. Anything else is handled by the regular path.
+			 */
+			if ((errno == EIO) || (errno == EINVAL) ||
+			    (errno == ENOPROTOOPT) || (errno == EOPNOTSUPP)) {
+				log_debug(knet_h, KNET_SUB_TX, "UDP GSO not supported on link %s:%s (%u): %s. Disabling",
+					  cur_link->status.dst_ipaddr,
+					  cur_link->status.dst_port,
+					  cur_link->link_id,
+					  strerror(errno));
+				cur_link->tx_gso_disabled = 1;
 			}
-			cur_link->status.stats.tx_data_packets++;
-			msg_idx++;
+			break;
 		}
 
-retry:
-		cur = &msg[prev_sent];
+		sent_msgs += batch;
+	}
+
+	return sent_msgs;
+}
+#endif
+
+/*
+ * TX fan-out.
+ *
+ * the same packet is often sent to several destinations (broadcast)
+ * that share the same socket (UDP reuses one socket per local address).
+ * Instead of one send loop per destination, messages are queued per
+ * outsock, each with its own msg_name, and sent with as few _sendmmsg
+ * calls as possible. The payload (iov) is prepared only once and shared.
+ *
+ * the queues live in the TX worker and are flushed before
+ * _parse_recv_from_sock returns.
+ */
+
+static int _flush_fanout(knet_handle_t knet_h, struct knet_tx_fanout *fanout)
+{
+	int sent_msgs, prev_sent, progress, msgs_to_send;
+	int err = 0, savederrno = 0;
+	struct knet_mmsghdr *cur;
+	struct knet_link *cur_link;
+
+	msgs_to_send = fanout->msgs;
+	prev_sent = 0;
+	progress = 1;
 
-		sent_msgs = _sendmmsg(dst_host->link[dst_host->active_links[link_idx]].outsock,
+	while (prev_sent < msgs_to_send) {
+		cur = &fanout->msg[prev_sent];
+		cur_link = fanout->link[prev_sent];
+
+		sent_msgs = _sendmmsg(fanout->outsock,
 				      &cur[0], msgs_to_send - prev_sent, MSG_DONTWAIT | MSG_NOSIGNAL);
 		savederrno = errno;
 
-		err = transport_tx_sock_error(knet_h, dst_host->link[dst_host->active_links[link_idx]].transport_type, dst_host->link[dst_host->active_links[link_idx]].outsock, sent_msgs, savederrno);
+		err = transport_tx_sock_error(knet_h, fanout->transport_type, fanout->outsock, sent_msgs, savederrno);
 		switch(err) {
 			case -1: /* unrecoverable error */
-				cur_link->status.stats.tx_data_errors++;
+				if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+					cur_link->status.stats.tx_data_errors++;
+					pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+				}
 				goto out_unlock;
 				break;
 			case 0: /* ignore error and continue */
 				break;
 			case 1: /* retry to send those same data */
-				cur_link->status.stats.tx_data_retries++;
-				goto retry;
+				if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+					cur_link->status.stats.tx_data_retries++;
+					pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+				}
+				continue;
 				break;
 		}
 
+		if (sent_msgs < 0) {
+			break;
+		}
+
 		prev_sent = prev_sent + sent_msgs;
 
-		if ((sent_msgs >= 0) && (prev_sent < msgs_to_send)) {
+		if (prev_sent < msgs_to_send) {
 			if ((sent_msgs) || (progress)) {
 				if (sent_msgs) {
 					progress = 1;
@@ -95,14 +214,13 @@ retry:
 					progress = 0;
 				}
 #ifdef DEBUG
-				log_debug(knet_h, KNET_SUB_TX, "Unable to send all (%d/%d) data packets to host %s (%u) link %s:%s (%u)",
-					  sent_msgs, msg_idx,
-					  dst_host->name, dst_host->host_id,
-					  dst_host->link[dst_host->active_links[link_idx]].status.dst_ipaddr,
-					  dst_host->link[dst_host->active_links[link_idx]].status.dst_port,
-					  dst_host->link[dst_host->active_links[link_idx]].link_id);
+				log_debug(knet_h, KNET_SUB_TX, "Unable to send all (%d/%d) data packets to link %s:%s (%u)",
+					  prev_sent, msgs_to_send,
+					  cur_link->status.dst_ipaddr,
+					  cur_link->status.dst_port,
+					  cur_link->link_id);
 #endif
-				goto retry;
+				continue;
 			}
 			if (!progress) {
 				savederrno = EAGAIN;
@@ -110,26 +228,417 @@ retry:
 				goto out_unlock;
 			}
 		}
+	}
 
-		if ((dst_host->link_handler_policy == KNET_LINK_POLICY_RR) &&
-		    (dst_host->active_link_entries > 1)) {
-			uint8_t cur_link_id = dst_host->active_links[0];
+out_unlock:
+	fanout->msgs = 0;
+	errno = savederrno;
+	return err;
+}
 
-			memmove(&dst_host->active_links[0], &dst_host->active_links[1], KNET_MAX_LINK - 1);
-			dst_host->active_links[dst_host->active_link_entries - 1] = cur_link_id;
+/*
+ * flush all pending queues, even if one fails.
+ * returns the first error
+ */
+static int _flush_all_fanouts(knet_handle_t knet_h, struct knet_tx_worker *worker)
+{
+	int i;
+	int err = 0, savederrno = 0;
+
+	for (i = 0; i < KNET_TX_FANOUT_SOCKS; i++) {
+		if (!worker->fanout[i].msgs) {
+			continue;
+		}
+		if ((_flush_fanout(knet_h, &worker->fanout[i]) < 0) && (!err)) {
+			savederrno = errno;
+			err = -1;
+		}
+	}
 
+	errno = savederrno;
+	return err;
+}
+
+static int _queue_to_fanout(knet_handle_t knet_h, struct knet_tx_worker *worker, struct knet_link *cur_link, struct knet_mmsghdr *msg, int msgs_to_send)
+{
+	struct knet_tx_fanout *fanout = NULL;
+	int i, msg_idx;
+	int err = 0, savederrno = 0;
+
+	for (i = 0; i < KNET_TX_FANOUT_SOCKS; i++) {
+		if (!worker->fanout[i].msgs) {
+			if (!fanout) {
+				fanout = &worker->fanout[i];
+			}
+			continue;
+		}
+		if (worker->fanout[i].outsock == cur_link->outsock) {
+			fanout = &worker->fanout[i];
 			break;
 		}
 	}
 
-out_unlock:
+	/*
+	 * more sockets in use than queues, make room
+	 */
+	if (!fanout) {
+		fanout = &worker->fanout[0];
+		if (_flush_fanout(knet_h, fanout) < 0) {
+			savederrno = errno;
+			err = -1;
+		}
+	}
+
+	if (!fanout->msgs) {
+		fanout->outsock = cur_link->outsock;
+		fanout->transport_type = cur_link->transport_type;
+	}
+
+	for (msg_idx = 0; msg_idx < msgs_to_send; msg_idx++) {
+		if (fanout->msgs == KNET_TX_FANOUT_MSGS) {
+			if ((_flush_fanout(knet_h, fanout) < 0) && (!err)) {
+				savederrno = errno;
+				err = -1;
+			}
+		}
+		memmove(&fanout->msg[fanout->msgs], &msg[msg_idx], sizeof(struct knet_mmsghdr));
+		fanout->link[fanout->msgs] = cur_link;
+		fanout->msgs++;
+	}
+
 	errno = savederrno;
 	return err;
 }
 
-static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t channel, int is_sync)
+static int _dispatch_to_links(knet_handle_t knet_h, struct knet_tx_worker *worker, struct knet_host *dst_host, struct knet_mmsghdr *msg, int msgs_to_send)
 {
-	size_t outlen, frag_len;
+	int link_idx, msg_idx, prev_sent;
+	int err = 0, savederrno = 0;
+	unsigned int i;
+	struct knet_link *cur_link;
+	uint8_t active_links[KNET_MAX_LINK];
+	uint8_t active_link_entries;
+	uint64_t tx_data_bytes;
+
+	/*
+	 * multiple TX workers can send to the same host at the same time.
+	 * take a copy of the active links and do the RR rotation
+	 * upfront, in locked context.
+	 */
+	savederrno = pthread_mutex_lock(&knet_h->handle_stats_mutex);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_TX, "Unable to get stats mutex lock: %s",
+			strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+
+	active_link_entries = dst_host->active_link_entries;
+	memmove(active_links, dst_host->active_links, KNET_MAX_LINK);
+
+	if ((dst_host->link_handler_policy == KNET_LINK_POLICY_RR) &&
+	    (dst_host->active_link_entries > 1)) {
+		uint8_t cur_link_id = dst_host->active_links[0];
+
+		memmove(&dst_host->active_links[0], &dst_host->active_links[1], KNET_MAX_LINK - 1);
+		dst_host->active_links[dst_host->active_link_entries - 1] = cur_link_id;
+
+		active_link_entries = 1;
+	}
+
+	pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+
+	for (link_idx = 0; link_idx < active_link_entries; link_idx++) {
+		prev_sent = 0;
+
+		cur_link = &dst_host->link[active_links[link_idx]];
+
+		if (cur_link->transport_type == KNET_TRANSPORT_LOOPBACK) {
+			continue;
+		}
+
+		tx_data_bytes = 0;
+		msg_idx = 0;
+		while (msg_idx < msgs_to_send) {
+			msg[msg_idx].msg_hdr.msg_name = &cur_link->dst_addr;
+
+			/* Cast for Linux/BSD compatibility */
+			for (i=0; i<(unsigned int)msg[msg_idx].msg_hdr.msg_iovlen; i++) {
+				tx_data_bytes += msg[msg_idx].msg_hdr.msg_iov[i].iov_len;
+			}
+			msg_idx++;
+		}
+
+		if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+			cur_link->status.stats.tx_data_bytes += tx_data_bytes;
+			cur_link->status.stats.tx_data_packets += msgs_to_send;
+			pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+		}
+
+#ifdef UDP_SEGMENT
+		if ((cur_link->transport_type == KNET_TRANSPORT_UDP) &&
+		    (msgs_to_send > 1) &&
+		    (!cur_link->tx_gso_disabled)) {
+			prev_sent = _dispatch_gso_to_link(knet_h, cur_link, msg, msgs_to_send);
+			if (prev_sent == msgs_to_send) {
+				continue;
+			}
+		}
+#endif
+
+		if (_queue_to_fanout(knet_h, worker, cur_link, &msg[prev_sent], msgs_to_send - prev_sent) < 0) {
+			savederrno = errno;
+			err = -1;
+		}
+	}
+
+	errno = savederrno;
+	return err;
+}
+
+/*
+ * encrypt one fragment, iov[0] is replaced with the encrypted buffer.
+ *
+ * With zero_copy set, in hash only mode the data is not copied,
+ * the hash is computed over the iovecs into buf_crypt and appended
+ * as iov[iovcnt] instead.
+ */
+static int _encrypt_frag(knet_handle_t knet_h, struct iovec *iov, int iovcnt, unsigned char *buf_crypt, int zero_copy)
+{
+	struct timespec start_time;
+	struct timespec end_time;
+	uint64_t crypt_time;
+	size_t outlen, uncrypted_frag_size;
+	int hash_only = zero_copy && crypto_is_hash_only(knet_h);
+	int j;
+
+	uncrypted_frag_size = 0;
+	for (j=0; j < iovcnt; j++) {
+		uncrypted_frag_size += iov[j].iov_len;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	if (hash_only) {
+		if (crypto_signv(knet_h, iov, iovcnt, buf_crypt) < 0) {
+			log_debug(knet_h, KNET_SUB_TX, "Unable to sign packet");
+			return -1;
+		}
+		outlen = uncrypted_frag_size + knet_h->sec_hash_size;
+	} else if (crypto_encrypt_and_signv(
+			knet_h,
+			iov, iovcnt,
+			buf_crypt,
+			(ssize_t *)&outlen) < 0) {
+		log_debug(knet_h, KNET_SUB_TX, "Unable to encrypt packet");
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	timespec_diff(start_time, end_time, &crypt_time);
+
+	if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+		if (crypt_time < knet_h->stats.tx_crypt_time_min) {
+			knet_h->stats.tx_crypt_time_min = crypt_time;
+		}
+		if (crypt_time > knet_h->stats.tx_crypt_time_max) {
+			knet_h->stats.tx_crypt_time_max = crypt_time;
+		}
+		knet_h->stats.tx_crypt_time_ave =
+			(knet_h->stats.tx_crypt_time_ave * knet_h->stats.tx_crypt_packets +
+			 crypt_time) / (knet_h->stats.tx_crypt_packets+1);
+
+		knet_h->stats.tx_crypt_byte_overhead += (outlen - uncrypted_frag_size);
+		knet_h->stats.tx_crypt_packets++;
+		pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+	}
+
+	if (hash_only) {
+		iov[iovcnt].iov_base = buf_crypt;
+		iov[iovcnt].iov_len = knet_h->sec_hash_size;
+	} else {
+		iov[0].iov_base = buf_crypt;
+		iov[0].iov_len = outlen;
+	}
+
+	return 0;
+}
+
+/*
+ * must be invoked with crypto_jobs_mutex held and job->next_frag < job->frag_num.
+ * The mutex is released while encrypting.
+ */
+static void _crypto_job_step(knet_handle_t knet_h, struct knet_crypto_job *job)
+{
+	struct knet_crypto_job **prev;
+	uint8_t frag_idx;
+	int err;
+
+	frag_idx = job->next_frag;
+	job->next_frag++;
+
+	/*
+	 * all fragments have been picked up, nobody else needs to see the job
+	 */
+	if (job->next_frag == job->frag_num) {
+		for (prev = &knet_h->crypto_jobs; *prev; prev = &(*prev)->next) {
+			if (*prev == job) {
+				*prev = job->next;
+				break;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&knet_h->crypto_jobs_mutex);
+
+	err = _encrypt_frag(knet_h, job->iov_out[frag_idx], job->iovcnt, job->buf_crypt[frag_idx], 1);
+
+	pthread_mutex_lock(&knet_h->crypto_jobs_mutex);
+
+	if (err) {
+		job->err = -1;
+	}
+	job->done_frags++;
+	if (job->done_frags == job->frag_num) {
+		pthread_cond_signal(&job->done_cond);
+	}
+}
+
+/*
+ * encrypt all fragments of a message. If crypto workers are available
+ * the fragments are shared between them and the caller, otherwise they
+ * are encrypted serially. crypto_workers_num is read without locking,
+ * the caller always encrypts any fragment not picked up by a worker.
+ */
+static int _encrypt_frags(knet_handle_t knet_h, struct iovec iov_out[][KNET_TX_IOVCNT_MAX], int iovcnt,
+			  unsigned char **buf_crypt, uint8_t frag_num)
+{
+	struct knet_crypto_job job;
+	struct knet_crypto_job **tail;
+	uint8_t frag_idx;
+
+	if ((!knet_h->crypto_workers_num) || (frag_num < 2) ||
+	    (pthread_cond_init(&job.done_cond, NULL))) {
+		for (frag_idx = 0; frag_idx < frag_num; frag_idx++) {
+			if (_encrypt_frag(knet_h, iov_out[frag_idx], iovcnt, buf_crypt[frag_idx], 1) < 0) {
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	job.iov_out = iov_out;
+	job.iovcnt = iovcnt;
+	job.buf_crypt = buf_crypt;
+	job.frag_num = frag_num;
+	job.next_frag = 0;
+	job.done_frags = 0;
+	job.err = 0;
+	job.next = NULL;
+
+	pthread_mutex_lock(&knet_h->crypto_jobs_mutex);
+
+	for (tail = &knet_h->crypto_jobs; *tail; tail = &(*tail)->next);
+	*tail = &job;
+	pthread_cond_broadcast(&knet_h->crypto_jobs_cond);
+
+	while (job.next_frag < job.frag_num) {
+		_crypto_job_step(knet_h, &job);
+	}
+
+	while (job.done_frags < job.frag_num) {
+		pthread_cond_wait(&job.done_cond, &knet_h->crypto_jobs_mutex);
+	}
+
+	pthread_mutex_unlock(&knet_h->crypto_jobs_mutex);
+
+	pthread_cond_destroy(&job.done_cond);
+
+	return job.err;
+}
+
+/*
+ * encrypt-then-fragment: the whole packet is encrypted once and the
+ * result is split in KNET_HEADER_TYPE_CRYPT_FRAG fragments, each with
+ * a cleartext header that is only used for reassembly. The receiver
+ * authenticates and decrypts the reassembled packet.
+ *
+ * returns the number of messages to send, or -1 on error.
+ */
+static int _encrypt_then_fragment(knet_handle_t knet_h, struct knet_tx_worker *worker,
+				  struct knet_header *inbuf, size_t inlen, unsigned int temp_data_mtu,
+				  struct iovec iov_out[][KNET_TX_IOVCNT_MAX], int *iovcnt_out)
+{
+	unsigned char *crypt_buf = worker->send_to_links_buf_crypt[0];
+	struct knet_header *frag_hdr;
+	struct iovec iov_crypt[1];
+	size_t crypt_len, frag_mtu, frag_len;
+	unsigned int frag_num;
+	uint8_t frag_idx;
+
+	inbuf->khp_data_frag_num = 1;
+
+	iov_crypt[0].iov_base = (void *)inbuf;
+	iov_crypt[0].iov_len = inlen + KNET_HEADER_DATA_SIZE;
+
+	/*
+	 * the encrypted packet is split below, it has to be contiguous
+	 */
+	if (_encrypt_frag(knet_h, iov_crypt, 1, crypt_buf, 0) < 0) {
+		return -1;
+	}
+	crypt_len = iov_crypt[0].iov_len;
+
+	/*
+	 * fragments don't carry any crypto overhead of their own
+	 */
+	frag_mtu = temp_data_mtu + knet_h->sec_header_size;
+	frag_num = ceil((float)crypt_len / frag_mtu);
+
+	if (frag_num == 1) {
+		iov_out[0][0] = iov_crypt[0];
+		*iovcnt_out = 1;
+		return 1;
+	}
+
+	if (frag_num > PCKT_FRAG_MAX) {
+		log_debug(knet_h, KNET_SUB_TX, "Encrypted packet needs too many fragments: %u", frag_num);
+		return -1;
+	}
+
+	frag_len = crypt_len;
+
+	for (frag_idx = 0; frag_idx < frag_num; frag_idx++) {
+		frag_hdr = worker->send_to_links_buf[frag_idx];
+
+		frag_hdr->kh_version = inbuf->kh_version;
+		frag_hdr->kh_type = KNET_HEADER_TYPE_CRYPT_FRAG;
+		frag_hdr->kh_seq_num_hi = inbuf->kh_seq_num_hi;
+		frag_hdr->khp_data_seq_num = inbuf->khp_data_seq_num;
+		frag_hdr->khp_data_frag_num = frag_num;
+		frag_hdr->khp_data_bcast = 0;
+		frag_hdr->khp_data_channel = 0;
+		frag_hdr->khp_data_compress = 0;
+		frag_hdr->khp_data_stream_seq = 0;
+
+		iov_out[frag_idx][0].iov_base = (void *)frag_hdr;
+		iov_out[frag_idx][0].iov_len = KNET_HEADER_DATA_SIZE;
+		iov_out[frag_idx][1].iov_base = crypt_buf + (frag_mtu * frag_idx);
+		if (frag_len > frag_mtu) {
+			iov_out[frag_idx][1].iov_len = frag_mtu;
+		} else {
+			iov_out[frag_idx][1].iov_len = frag_len;
+		}
+
+		frag_len = frag_len - iov_out[frag_idx][1].iov_len;
+	}
+
+	*iovcnt_out = 2;
+
+	return frag_num;
+}
+
+static int _parse_recv_from_sock(knet_handle_t knet_h, struct knet_tx_worker *worker, size_t inlen, int8_t channel, int is_sync)
+{
+	size_t frag_len;
 	struct knet_host *dst_host;
 	knet_node_id_t dst_host_ids_temp[KNET_MAX_HOST];
 	size_t dst_host_ids_entries_temp = 0;
@@ -137,7 +646,7 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 	size_t dst_host_ids_entries = 0;
 	int bcast = 1;
 	struct knet_hostinfo *knet_hostinfo;
-	struct iovec iov_out[PCKT_FRAG_MAX][2];
+	struct iovec iov_out[PCKT_FRAG_MAX][KNET_TX_IOVCNT_MAX];
 	int iovcnt_out = 2;
 	uint8_t frag_idx;
 	unsigned int temp_data_mtu;
@@ -147,15 +656,22 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 	int savederrno = 0;
 	int err = 0;
 	seq_num_t tx_seq_num;
+	seq_num_t forced_ping_interval;
 	struct knet_mmsghdr msg[PCKT_FRAG_MAX];
 	int msgs_to_send, msg_idx;
 	unsigned int i;
-	int j;
 	int send_local = 0;
 	int data_compressed = 0;
-	size_t uncrypted_frag_size;
+	int compress_skipped = 0;
+	struct knet_compress_adaptive *compress_adaptive = NULL;
+	int compress_model, compress_level;
+	size_t compress_threshold;
+	struct knet_channel_stats *channel_stats = NULL;
+	struct knet_compress_stream *compress_stream = NULL;
+	uint8_t stream_compress = 0, stream_seq = 0;
+	int crypt_done = 0;
 
-	inbuf = knet_h->recv_from_sock_buf;
+	inbuf = worker->recv_from_sock_buf;
 
 	if ((knet_h->enabled != 1) &&
 	    (inbuf->kh_type != KNET_HEADER_TYPE_HOST_INFO)) { /* data forward is disabled */
@@ -228,19 +744,28 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 					err = write(knet_h->sockfd[channel].sockfd[knet_h->sockfd[channel].is_created], buf, buflen);
 					if (err < 0) {
 						log_err(knet_h, KNET_SUB_TRANSP_LOOPBACK, "send local failed. error=%s\n", strerror(errno));
-						local_link->status.stats.tx_data_errors++;
+						if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+							local_link->status.stats.tx_data_errors++;
+							pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+						}
 					}
 					if (err > 0 && err < buflen) {
 						log_debug(knet_h, KNET_SUB_TRANSP_LOOPBACK, "send local incomplete=%d bytes of %zu\n", err, inlen);
-						local_link->status.stats.tx_data_retries++;
+						if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+							local_link->status.stats.tx_data_retries++;
+							pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+						}
 						buf += err;
 						buflen -= err;
 						usleep(KNET_THREADS_TIMERES / 16);
 						goto local_retry;
 					}
 					if (err == buflen) {
-						local_link->status.stats.tx_data_packets++;
-						local_link->status.stats.tx_data_bytes += inlen;
+						if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+							local_link->status.stats.tx_data_packets++;
+							local_link->status.stats.tx_data_bytes += inlen;
+							pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+						}
 					}
 				}
 			}
@@ -335,18 +860,57 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 	}
 
 	/*
-	 * compress data
+	 * compress data, channels can override the handle configuration
 	 */
-	if ((knet_h->compress_model > 0) && (inlen > knet_h->compress_threshold)) {
+	compress_model = knet_h->compress_model;
+	compress_level = knet_h->compress_level;
+	compress_threshold = knet_h->compress_threshold;
+
+	if ((channel >= 0) && (channel < KNET_DATAFD_MAX)) {
+		channel_stats = &knet_h->channel_stats[channel];
+		if (knet_h->channel_compress[channel].enabled) {
+			compress_model = knet_h->channel_compress[channel].compress_model;
+			compress_level = knet_h->channel_compress[channel].compress_level;
+			compress_threshold = knet_h->channel_compress[channel].compress_threshold;
+		}
+	}
+
+	/*
+	 * unicast data for a single host can be compressed as a stream,
+	 * with the history kept per destination host and channel
+	 */
+	if ((knet_h->compress_stream) &&
+	    (inbuf->kh_type == KNET_HEADER_TYPE_DATA) &&
+	    (!bcast) && (dst_host_ids_entries == 1) &&
+	    (channel_stats) &&
+	    (compress_stream_supported(knet_h, compress_model))) {
+		compress_stream = &knet_h->host_index[dst_host_ids[0]]->tx_compress_stream[channel];
+	}
+
+	if ((compress_model > 0) && (inlen > compress_threshold)) {
+		if ((channel >= 0) && (channel < KNET_DATAFD_MAX)) {
+			compress_adaptive = &worker->compress_adaptive[channel];
+		}
+		compress_skipped = compress_adaptive_skip(knet_h, compress_adaptive);
+	}
+
+	if ((compress_model > 0) && (inlen > compress_threshold) && (!compress_skipped)) {
 		size_t cmp_outlen = KNET_DATABUFSIZE_COMPRESS;
 		struct timespec start_time;
 		struct timespec end_time;
 		uint64_t compress_time;
 
 		clock_gettime(CLOCK_MONOTONIC, &start_time);
-		err = compress(knet_h,
-			       (const unsigned char *)inbuf->khp_data_userdata, inlen,
-			       knet_h->send_to_links_buf_compress, (ssize_t *)&cmp_outlen);
+		if (compress_stream) {
+			err = compress_stream_compress(knet_h, compress_stream, compress_model, compress_level,
+						       (const unsigned char *)inbuf->khp_data_userdata, inlen,
+						       worker->send_to_links_buf_compress, (ssize_t *)&cmp_outlen,
+						       &stream_compress, &stream_seq);
+		} else {
+			err = compress(knet_h, compress_model, compress_level,
+				       (const unsigned char *)inbuf->khp_data_userdata, inlen,
+				       worker->send_to_links_buf_compress, (ssize_t *)&cmp_outlen);
+		}
 		if (err < 0) {
 			log_warn(knet_h, KNET_SUB_COMPRESS, "Compression failed (%d): %s", err, strerror(errno));
 		} else {
@@ -354,29 +918,78 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 			clock_gettime(CLOCK_MONOTONIC, &end_time);
 			timespec_diff(start_time, end_time, &compress_time);
 
-	                if (compress_time < knet_h->stats.tx_compress_time_min) {
-				knet_h->stats.tx_compress_time_min = compress_time;
-			}
-			if (compress_time > knet_h->stats.tx_compress_time_max) {
-				knet_h->stats.tx_compress_time_max = compress_time;
+			if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+				if (compress_time < knet_h->stats.tx_compress_time_min) {
+					knet_h->stats.tx_compress_time_min = compress_time;
+				}
+				if (compress_time > knet_h->stats.tx_compress_time_max) {
+					knet_h->stats.tx_compress_time_max = compress_time;
+				}
+				knet_h->stats.tx_compress_time_ave =
+					(unsigned long long)(knet_h->stats.tx_compress_time_ave * knet_h->stats.tx_compressed_packets +
+					 compress_time) / (knet_h->stats.tx_compressed_packets+1);
+
+				knet_h->stats.tx_compressed_packets++;
+				knet_h->stats.tx_compressed_original_bytes += inlen;
+				knet_h->stats.tx_compressed_size_bytes += cmp_outlen;
+				knet_h->compress_auto_state.compress_time += compress_time;
+
+				if (channel_stats) {
+					if (compress_time < channel_stats->tx_compress_time_min) {
+						channel_stats->tx_compress_time_min = compress_time;
+					}
+					if (compress_time > channel_stats->tx_compress_time_max) {
+						channel_stats->tx_compress_time_max = compress_time;
+					}
+					channel_stats->tx_compress_time_ave =
+						(unsigned long long)(channel_stats->tx_compress_time_ave * channel_stats->tx_compressed_packets +
+						 compress_time) / (channel_stats->tx_compressed_packets+1);
+
+					channel_stats->tx_compressed_packets++;
+					channel_stats->tx_compressed_original_bytes += inlen;
+					channel_stats->tx_compressed_size_bytes += cmp_outlen;
+					if (compress_stream) {
+						channel_stats->tx_compress_stream_packets++;
+						if (stream_compress & KNET_COMPRESS_STREAM_RESET) {
+							channel_stats->tx_compress_stream_resets++;
+						}
+					}
+				}
+				pthread_mutex_unlock(&knet_h->handle_stats_mutex);
 			}
-			knet_h->stats.tx_compress_time_ave =
-				(unsigned long long)(knet_h->stats.tx_compress_time_ave * knet_h->stats.tx_compressed_packets +
-				 compress_time) / (knet_h->stats.tx_compressed_packets+1);
 
-			knet_h->stats.tx_compressed_packets++;
-			knet_h->stats.tx_compressed_original_bytes += inlen;
-			knet_h->stats.tx_compressed_size_bytes += cmp_outlen;
+			compress_adaptive_update(knet_h, compress_adaptive, inlen, cmp_outlen);
 
 			if (cmp_outlen < inlen) {
-				memmove(inbuf->khp_data_userdata, knet_h->send_to_links_buf_compress, cmp_outlen);
+				memmove(inbuf->khp_data_userdata, worker->send_to_links_buf_compress, cmp_outlen);
 				inlen = cmp_outlen;
 				data_compressed = 1;
+			} else if (compress_stream) {
+				/*
+				 * the receiver will not see this data,
+				 * the history has to start again
+				 */
+				compress_stream_invalidate(compress_stream);
 			}
 		}
 	}
-	if ((knet_h->compress_model > 0) && (inlen <= knet_h->compress_threshold)) {
-		knet_h->stats.tx_uncompressed_packets++;
+	if ((compress_model > 0) && (inlen <= compress_threshold)) {
+		if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+			knet_h->stats.tx_uncompressed_packets++;
+			if (channel_stats) {
+				channel_stats->tx_uncompressed_packets++;
+			}
+			pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+		}
+	}
+	if (compress_skipped) {
+		if (!pthread_mutex_lock(&knet_h->handle_stats_mutex)) {
+			knet_h->stats.tx_compress_skipped_packets++;
+			if (channel_stats) {
+				channel_stats->tx_compress_skipped_packets++;
+			}
+			pthread_mutex_unlock(&knet_h->handle_stats_mutex);
+		}
 	}
 
 	/*
@@ -389,10 +1002,15 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 	inbuf->khp_data_bcast = bcast;
 	inbuf->khp_data_frag_num = ceil((float)inlen / temp_data_mtu);
 	inbuf->khp_data_channel = channel;
-	if (data_compressed) {
-		inbuf->khp_data_compress = knet_h->compress_model;
+	if ((data_compressed) && (compress_stream)) {
+		inbuf->khp_data_compress = stream_compress;
+		inbuf->khp_data_stream_seq = stream_seq;
+	} else if (data_compressed) {
+		inbuf->khp_data_compress = compress_model;
+		inbuf->khp_data_stream_seq = 0;
 	} else {
 		inbuf->khp_data_compress = 0;
+		inbuf->khp_data_stream_seq = 0;
 	}
 
 	if (pthread_mutex_lock(&knet_h->tx_seq_num_mutex)) {
@@ -403,21 +1021,30 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 	/*
 	 * force seq_num 0 to detect a node that has crashed and rejoining
 	 * the knet instance. seq_num 0 will clear the buffers in the RX
-	 * thread
+	 * thread. Onwire v1 hosts only see the lower 16 bits, skip
+	 * all the seq_nums that look like 0 to them.
 	 */
-	if (knet_h->tx_seq_num == 0) {
+	if ((knet_h->tx_seq_num & SEQ_ONWIRE_V1_MAX) == 0) {
 		knet_h->tx_seq_num++;
 	}
 	/*
 	 * cache the value in locked context
 	 */
 	tx_seq_num = knet_h->tx_seq_num;
-	inbuf->khp_data_seq_num = htons(knet_h->tx_seq_num);
+	inbuf->kh_version = knet_h->onwire_ver;
+	inbuf->khp_data_seq_num = htons(tx_seq_num & SEQ_ONWIRE_V1_MAX);
+	if (knet_h->onwire_ver >= KNET_HEADER_VERSION_V2) {
+		inbuf->kh_seq_num_hi = htons(tx_seq_num >> 16);
+		forced_ping_interval = SEQ_MAX / 8;
+	} else {
+		inbuf->kh_seq_num_hi = 0;
+		forced_ping_interval = SEQ_ONWIRE_V1_MAX / 8;
+	}
 	pthread_mutex_unlock(&knet_h->tx_seq_num_mutex);
 
 	/*
-	 * forcefully broadcast a ping to all nodes every SEQ_MAX / 8
-	 * pckts.
+	 * forcefully broadcast a ping to all nodes every 1/8th of the
+	 * onwire seq_num space (16 bits in v1, 32 bits in v2) pckts.
 	 * this solves 2 problems:
 	 * 1) on TX socket overloads we generate extra pings to keep links alive
 	 * 2) in 3+ nodes setup, where all the traffic is flowing between node 1 and 2,
@@ -426,16 +1053,29 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 	 *    rollover of the circular buffer
 	 */
 
-	if (tx_seq_num % (SEQ_MAX / 8) == 0) {
+	if (tx_seq_num % forced_ping_interval == 0) {
 		_send_pings(knet_h, 0);
 	}
 
-	if (inbuf->khp_data_frag_num > 1) {
+	if ((knet_h->crypto_instance) && (knet_h->encrypt_then_fragment) &&
+	    (inbuf->khp_data_frag_num > 1)) {
+		msgs_to_send = _encrypt_then_fragment(knet_h, worker, inbuf, inlen, temp_data_mtu,
+						      iov_out, &iovcnt_out);
+		if (msgs_to_send < 0) {
+			savederrno = ECHILD;
+			err = -1;
+			goto out_unlock;
+		}
+		/*
+		 * already encrypted
+		 */
+		crypt_done = 1;
+	} else if (inbuf->khp_data_frag_num > 1) {
 		while (frag_idx < inbuf->khp_data_frag_num) {
 			/*
 			 * set the iov_base
 			 */
-			iov_out[frag_idx][0].iov_base = (void *)knet_h->send_to_links_buf[frag_idx];
+			iov_out[frag_idx][0].iov_base = (void *)worker->send_to_links_buf[frag_idx];
 			iov_out[frag_idx][0].iov_len = KNET_HEADER_DATA_SIZE;
 			iov_out[frag_idx][1].iov_base = inbuf->khp_data_userdata + (temp_data_mtu * frag_idx);
 
@@ -451,12 +1091,15 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 			/*
 			 * copy the frag info on all buffers
 			 */
-			knet_h->send_to_links_buf[frag_idx]->kh_type = inbuf->kh_type;
-			knet_h->send_to_links_buf[frag_idx]->khp_data_seq_num = inbuf->khp_data_seq_num;
-			knet_h->send_to_links_buf[frag_idx]->khp_data_frag_num = inbuf->khp_data_frag_num;
-			knet_h->send_to_links_buf[frag_idx]->khp_data_bcast = inbuf->khp_data_bcast;
-			knet_h->send_to_links_buf[frag_idx]->khp_data_channel = inbuf->khp_data_channel;
-			knet_h->send_to_links_buf[frag_idx]->khp_data_compress = inbuf->khp_data_compress;
+			worker->send_to_links_buf[frag_idx]->kh_version = inbuf->kh_version;
+			worker->send_to_links_buf[frag_idx]->kh_type = inbuf->kh_type;
+			worker->send_to_links_buf[frag_idx]->kh_seq_num_hi = inbuf->kh_seq_num_hi;
+			worker->send_to_links_buf[frag_idx]->khp_data_seq_num = inbuf->khp_data_seq_num;
+			worker->send_to_links_buf[frag_idx]->khp_data_frag_num = inbuf->khp_data_frag_num;
+			worker->send_to_links_buf[frag_idx]->khp_data_bcast = inbuf->khp_data_bcast;
+			worker->send_to_links_buf[frag_idx]->khp_data_channel = inbuf->khp_data_channel;
+			worker->send_to_links_buf[frag_idx]->khp_data_compress = inbuf->khp_data_compress;
+			worker->send_to_links_buf[frag_idx]->khp_data_stream_seq = inbuf->khp_data_stream_seq;
 
 			frag_len = frag_len - temp_data_mtu;
 			frag_idx++;
@@ -468,55 +1111,27 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 		iovcnt_out = 1;
 	}
 
-	if (knet_h->crypto_instance) {
-		struct timespec start_time;
-		struct timespec end_time;
-		uint64_t crypt_time;
-
-		frag_idx = 0;
-		while (frag_idx < inbuf->khp_data_frag_num) {
-			clock_gettime(CLOCK_MONOTONIC, &start_time);
-			if (crypto_encrypt_and_signv(
-					knet_h,
-					iov_out[frag_idx], iovcnt_out,
-					knet_h->send_to_links_buf_crypt[frag_idx],
-					(ssize_t *)&outlen) < 0) {
-				log_debug(knet_h, KNET_SUB_TX, "Unable to encrypt packet");
-				savederrno = ECHILD;
-				err = -1;
-				goto out_unlock;
-			}
-			clock_gettime(CLOCK_MONOTONIC, &end_time);
-			timespec_diff(start_time, end_time, &crypt_time);
-
-	                if (crypt_time < knet_h->stats.tx_crypt_time_min) {
-				knet_h->stats.tx_crypt_time_min = crypt_time;
-			}
-			if (crypt_time > knet_h->stats.tx_crypt_time_max) {
-				knet_h->stats.tx_crypt_time_max = crypt_time;
-			}
-			knet_h->stats.tx_crypt_time_ave =
-				(knet_h->stats.tx_crypt_time_ave * knet_h->stats.tx_crypt_packets +
-				 crypt_time) / (knet_h->stats.tx_crypt_packets+1);
-
-			uncrypted_frag_size = 0;
-			for (j=0; j < iovcnt_out; j++) {
-				uncrypted_frag_size += iov_out[frag_idx][j].iov_len;
-			}
-			knet_h->stats.tx_crypt_byte_overhead += (outlen - uncrypted_frag_size);
-			knet_h->stats.tx_crypt_packets++;
+	if (!crypt_done) {
+		msgs_to_send = inbuf->khp_data_frag_num;
+	}
 
-			iov_out[frag_idx][0].iov_base = knet_h->send_to_links_buf_crypt[frag_idx];
-			iov_out[frag_idx][0].iov_len = outlen;
-			frag_idx++;
+	if ((knet_h->crypto_instance) && (!crypt_done)) {
+		if (_encrypt_frags(knet_h, iov_out, iovcnt_out,
+				   worker->send_to_links_buf_crypt,
+				   inbuf->khp_data_frag_num) < 0) {
+			savederrno = ECHILD;
+			err = -1;
+			goto out_unlock;
+		}
+		if (crypto_is_hash_only(knet_h)) {
+			iovcnt_out++;
+		} else {
+			iovcnt_out = 1;
 		}
-		iovcnt_out = 1;
 	}
 
 	memset(&msg, 0, sizeof(msg));
 
-	msgs_to_send = inbuf->khp_data_frag_num;
-
 	msg_idx = 0;
 
 	while (msg_idx < msgs_to_send) {
@@ -530,25 +1145,39 @@ static int _parse_recv_from_sock(knet_handle_t knet_h, size_t inlen, int8_t chan
 		for (host_idx = 0; host_idx < dst_host_ids_entries; host_idx++) {
 			dst_host = knet_h->host_index[dst_host_ids[host_idx]];
 
-			err = _dispatch_to_links(knet_h, dst_host, &msg[0], msgs_to_send);
+			err = _dispatch_to_links(knet_h, worker, dst_host, &msg[0], msgs_to_send);
 			savederrno = errno;
 			if (err) {
-				goto out_unlock;
+				break;
 			}
 		}
 	} else {
 		for (dst_host = knet_h->host_head; dst_host != NULL; dst_host = dst_host->next) {
 			if (dst_host->status.reachable) {
-				err = _dispatch_to_links(knet_h, dst_host, &msg[0], msgs_to_send);
+				err = _dispatch_to_links(knet_h, worker, dst_host, &msg[0], msgs_to_send);
 				savederrno = errno;
 				if (err) {
-					goto out_unlock;
+					break;
 				}
 			}
 		}
 	}
 
+	/*
+	 * always flush, nothing can be left queued for the next packet
+	 */
+	if ((_flush_all_fanouts(knet_h, worker) < 0) && (!err)) {
+		savederrno = errno;
+		err = -1;
+	}
+
 out_unlock:
+	/*
+	 * a stream packet that has not been sent leaves a hole in the stream
+	 */
+	if ((err) && (data_compressed) && (compress_stream)) {
+		compress_stream_invalidate(compress_stream);
+	}
 	errno = savederrno;
 	return err;
 }
@@ -556,6 +1185,7 @@ out_unlock:
 int knet_send_sync(knet_handle_t knet_h, const char *buff, const size_t buff_len, const int8_t channel)
 {
 	int savederrno = 0, err = 0;
+	struct knet_tx_worker *worker;
 
 	if (!knet_h) {
 		errno = EINVAL;
@@ -601,21 +1231,36 @@ int knet_send_sync(knet_handle_t knet_h, const char *buff, const size_t buff_len
 		goto out;
 	}
 
-	savederrno = pthread_mutex_lock(&knet_h->tx_mutex);
+	/*
+	 * use the buffers of the worker that owns the channel
+	 * to preserve ordering with data read from the datafd
+	 */
+	worker = knet_h->tx_workers[knet_h->sockfd[channel].tx_worker];
+
+	savederrno = pthread_rwlock_rdlock(&knet_h->tx_rwlock);
 	if (savederrno) {
-		log_err(knet_h, KNET_SUB_TX, "Unable to get TX mutex lock: %s",
+		log_err(knet_h, KNET_SUB_TX, "Unable to get TX read lock: %s",
 			strerror(savederrno));
 		err = -1;
 		goto out;
 	}
 
-	knet_h->recv_from_sock_buf->kh_type = KNET_HEADER_TYPE_DATA;
-	memmove(knet_h->recv_from_sock_buf->khp_data_userdata, buff, buff_len);
-	err = _parse_recv_from_sock(knet_h, buff_len, channel, 1);
-	savederrno = errno;
+	savederrno = pthread_mutex_lock(&worker->buf_mutex);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_TX, "Unable to get TX buffers mutex lock: %s",
+			strerror(savederrno));
+		err = -1;
+		goto out_tx;
+	}
 
-	pthread_mutex_unlock(&knet_h->tx_mutex);
+	worker->recv_from_sock_buf->kh_type = KNET_HEADER_TYPE_DATA;
+	memmove(worker->recv_from_sock_buf->khp_data_userdata, buff, buff_len);
+	err = _parse_recv_from_sock(knet_h, worker, buff_len, channel, 1);
+	savederrno = errno;
 
+	pthread_mutex_unlock(&worker->buf_mutex);
+out_tx:
+	pthread_rwlock_unlock(&knet_h->tx_rwlock);
 out:
 	pthread_rwlock_unlock(&knet_h->global_rwlock);
 
@@ -623,7 +1268,7 @@ out:
 	return err;
 }
 
-static void _handle_send_to_links(knet_handle_t knet_h, struct msghdr *msg, int sockfd, int8_t channel, int type)
+static void _handle_send_to_links(knet_handle_t knet_h, struct knet_tx_worker *worker, struct msghdr *msg, int sockfd, int8_t channel, int type)
 {
 	ssize_t inlen = 0;
 	int savederrno = 0, docallback = 0;
@@ -647,8 +1292,8 @@ static void _handle_send_to_links(knet_handle_t knet_h, struct msghdr *msg, int
 		goto out;
 	}
 
-	knet_h->recv_from_sock_buf->kh_type = type;
-	_parse_recv_from_sock(knet_h, inlen, channel, 0);
+	worker->recv_from_sock_buf->kh_type = type;
+	_parse_recv_from_sock(knet_h, worker, inlen, channel, 0);
 
 out:
 	if (inlen < 0) {
@@ -656,7 +1301,7 @@ out:
 
 		memset(&ev, 0, sizeof(struct epoll_event));
 
-		if (epoll_ctl(knet_h->send_to_links_epollfd,
+		if (epoll_ctl(worker->epollfd,
 			      EPOLL_CTL_DEL, knet_h->sockfd[channel].sockfd[knet_h->sockfd[channel].is_created], &ev)) {
 			log_err(knet_h, KNET_SUB_TX, "Unable to del datafd %d from linkfd epoll pool: %s",
 				knet_h->sockfd[channel].sockfd[0], strerror(savederrno));
@@ -676,20 +1321,23 @@ out:
 	}
 }
 
-void *_handle_send_to_links_thread(void *data)
+static void *_handle_send_to_links_thread(void *data)
 {
-	knet_handle_t knet_h = (knet_handle_t) data;
-	struct epoll_event events[KNET_EPOLL_MAX_EVENTS];
+	struct knet_tx_worker *worker = (struct knet_tx_worker *) data;
+	knet_handle_t knet_h = worker->knet_h;
+	struct epoll_event events[KNET_EPOLL_MAX_EVENTS + 1]; /* see _tx_worker_start */
 	int i, nev, type;
 	int8_t channel;
 	struct iovec iov_in;
 	struct msghdr msg;
 	struct sockaddr_storage address;
 
-	set_thread_status(knet_h, KNET_THREAD_TX, KNET_THREAD_RUNNING);
+	if (!worker->worker_id) {
+		set_thread_status(knet_h, KNET_THREAD_TX, KNET_THREAD_RUNNING);
+	}
 
 	memset(&iov_in, 0, sizeof(iov_in));
-	iov_in.iov_base = (void *)knet_h->recv_from_sock_buf->khp_data_userdata;
+	iov_in.iov_base = (void *)worker->recv_from_sock_buf->khp_data_userdata;
 	iov_in.iov_len = KNET_MAX_PACKET_SIZE;
 
 	memset(&msg, 0, sizeof(struct msghdr));
@@ -698,28 +1346,27 @@ void *_handle_send_to_links_thread(void *data)
 	msg.msg_iov = &iov_in;
 	msg.msg_iovlen = 1;
 
-	knet_h->recv_from_sock_buf->kh_version = KNET_HEADER_VERSION;
-	knet_h->recv_from_sock_buf->khp_data_frag_seq = 0;
-	knet_h->recv_from_sock_buf->kh_node = htons(knet_h->host_id);
-
-	for (i = 0; i < PCKT_FRAG_MAX; i++) {
-		knet_h->send_to_links_buf[i]->kh_version = KNET_HEADER_VERSION;
-		knet_h->send_to_links_buf[i]->khp_data_frag_seq = i + 1;
-		knet_h->send_to_links_buf[i]->kh_node = htons(knet_h->host_id);
-	}
-
 	while (!shutdown_in_progress(knet_h)) {
-		nev = epoll_wait(knet_h->send_to_links_epollfd, events, KNET_EPOLL_MAX_EVENTS + 1, KNET_THREADS_TIMERES / 1000);
+		nev = epoll_wait(worker->epollfd, events, KNET_EPOLL_MAX_EVENTS + 1, KNET_THREADS_TIMERES / 1000);
+
+		if (pthread_rwlock_rdlock(&knet_h->global_rwlock) != 0) {
+			log_debug(knet_h, KNET_SUB_TX, "Unable to get read lock");
+			continue;
+		}
 
 		/*
-		 * we use timeout to detect if thread is shutting down
+		 * worker is being removed from the pool
 		 */
-		if (nev == 0) {
-			continue;
+		if (worker->stop) {
+			pthread_rwlock_unlock(&knet_h->global_rwlock);
+			break;
 		}
 
-		if (pthread_rwlock_rdlock(&knet_h->global_rwlock) != 0) {
-			log_debug(knet_h, KNET_SUB_TX, "Unable to get read lock");
+		/*
+		 * we use timeout to detect if thread is shutting down
+		 */
+		if (nev <= 0) {
+			pthread_rwlock_unlock(&knet_h->global_rwlock);
 			continue;
 		}
 
@@ -739,18 +1386,368 @@ void *_handle_send_to_links_thread(void *data)
 					log_debug(knet_h, KNET_SUB_TX, "No available channels");
 					continue; /* channel not found */
 				}
+				/*
+				 * channel has been moved to another worker
+				 * while we were waiting on epoll
+				 */
+				if (knet_h->sockfd[channel].tx_worker != worker->worker_id) {
+					continue;
+				}
+			}
+			if (pthread_rwlock_rdlock(&knet_h->tx_rwlock) != 0) {
+				log_debug(knet_h, KNET_SUB_TX, "Unable to get TX read lock");
+				continue;
 			}
-			if (pthread_mutex_lock(&knet_h->tx_mutex) != 0) {
-				log_debug(knet_h, KNET_SUB_TX, "Unable to get mutex lock");
+			if (pthread_mutex_lock(&worker->buf_mutex) != 0) {
+				log_debug(knet_h, KNET_SUB_TX, "Unable to get TX buffers mutex lock");
+				pthread_rwlock_unlock(&knet_h->tx_rwlock);
 				continue;
 			}
-			_handle_send_to_links(knet_h, &msg, events[i].data.fd, channel, type);
-			pthread_mutex_unlock(&knet_h->tx_mutex);
+			_handle_send_to_links(knet_h, worker, &msg, events[i].data.fd, channel, type);
+			pthread_mutex_unlock(&worker->buf_mutex);
+			pthread_rwlock_unlock(&knet_h->tx_rwlock);
 		}
 		pthread_rwlock_unlock(&knet_h->global_rwlock);
 	}
 
-	set_thread_status(knet_h, KNET_THREAD_TX, KNET_THREAD_STOPPED);
+	if (!worker->worker_id) {
+		set_thread_status(knet_h, KNET_THREAD_TX, KNET_THREAD_STOPPED);
+	}
 
 	return NULL;
 }
+
+/*
+ * TX workers pool management
+ */
+
+static void _tx_worker_free(struct knet_tx_worker *worker)
+{
+	int i;
+
+	for (i = 0; i < PCKT_FRAG_MAX; i++) {
+		free(worker->send_to_links_buf[i]);
+		free(worker->send_to_links_buf_crypt[i]);
+	}
+	free(worker->send_to_links_buf_compress);
+	free(worker->recv_from_sock_buf);
+	free(worker->fanout);
+
+	if (worker->epollfd >= 0) {
+		close(worker->epollfd);
+	}
+
+	pthread_mutex_destroy(&worker->buf_mutex);
+	free(worker);
+}
+
+static void *_handle_crypto_thread(void *data)
+{
+	struct knet_crypto_worker *worker = (struct knet_crypto_worker *)data;
+	knet_handle_t knet_h = worker->knet_h;
+
+	pthread_mutex_lock(&knet_h->crypto_jobs_mutex);
+
+	while (!worker->stop) {
+		if (!knet_h->crypto_jobs) {
+			pthread_cond_wait(&knet_h->crypto_jobs_cond, &knet_h->crypto_jobs_mutex);
+			continue;
+		}
+		_crypto_job_step(knet_h, knet_h->crypto_jobs);
+	}
+
+	pthread_mutex_unlock(&knet_h->crypto_jobs_mutex);
+
+	return NULL;
+}
+
+int _crypto_worker_start(knet_handle_t knet_h, uint8_t worker_id)
+{
+	int savederrno = 0;
+	struct knet_crypto_worker *worker;
+
+	worker = malloc(sizeof(struct knet_crypto_worker));
+	if (!worker) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_TX, "Unable to allocate memory for crypto worker %u: %s",
+			worker_id, strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+	memset(worker, 0, sizeof(struct knet_crypto_worker));
+
+	worker->knet_h = knet_h;
+	worker->worker_id = worker_id;
+
+	savederrno = pthread_create(&worker->thread, 0,
+				    _handle_crypto_thread, (void *) worker);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_TX, "Unable to start crypto thread %u: %s",
+			worker_id, strerror(savederrno));
+		free(worker);
+		errno = savederrno;
+		return -1;
+	}
+
+	knet_h->crypto_workers[worker_id] = worker;
+
+	log_debug(knet_h, KNET_SUB_TX, "Crypto worker %u started", worker_id);
+
+	return 0;
+}
+
+/*
+ * jobs in progress are not affected, the submitting TX worker
+ * encrypts any fragment that has not been picked up yet.
+ */
+void _crypto_worker_stop(knet_handle_t knet_h, uint8_t worker_id)
+{
+	void *retval;
+	struct knet_crypto_worker *worker = knet_h->crypto_workers[worker_id];
+
+	if (!worker) {
+		return;
+	}
+
+	pthread_mutex_lock(&knet_h->crypto_jobs_mutex);
+	worker->stop = 1;
+	pthread_cond_broadcast(&knet_h->crypto_jobs_cond);
+	pthread_mutex_unlock(&knet_h->crypto_jobs_mutex);
+
+	pthread_join(worker->thread, &retval);
+
+	knet_h->crypto_workers[worker_id] = NULL;
+	free(worker);
+
+	log_debug(knet_h, KNET_SUB_TX, "Crypto worker %u stopped", worker_id);
+}
+
+uint8_t _tx_worker_by_channel(knet_handle_t knet_h, int8_t channel)
+{
+	return channel % knet_h->tx_workers_num;
+}
+
+int _tx_worker_start(knet_handle_t knet_h, uint8_t worker_id)
+{
+	int savederrno = 0;
+	int i;
+	size_t bufsize;
+	struct knet_tx_worker *worker;
+	struct epoll_event ev;
+
+	worker = malloc(sizeof(struct knet_tx_worker));
+	if (!worker) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_TX, "Unable to allocate memory for TX worker %u: %s",
+			worker_id, strerror(savederrno));
+		errno = savederrno;
+		return -1;
+	}
+	memset(worker, 0, sizeof(struct knet_tx_worker));
+
+	worker->knet_h = knet_h;
+	worker->worker_id = worker_id;
+	worker->epollfd = -1;
+
+	savederrno = pthread_mutex_init(&worker->buf_mutex, NULL);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_TX, "Unable to initialize TX worker %u buffers mutex: %s",
+			worker_id, strerror(savederrno));
+		free(worker);
+		errno = savederrno;
+		return -1;
+	}
+
+	for (i = 0; i < PCKT_FRAG_MAX; i++) {
+		bufsize = ceil((float)KNET_MAX_PACKET_SIZE / (i + 1)) + KNET_HEADER_ALL_SIZE;
+		worker->send_to_links_buf[i] = malloc(bufsize);
+		if (!worker->send_to_links_buf[i]) {
+			savederrno = errno;
+			log_err(knet_h, KNET_SUB_TX, "Unable to allocate memory datafd to link buffer: %s",
+				strerror(savederrno));
+			goto exit_fail;
+		}
+		memset(worker->send_to_links_buf[i], 0, bufsize);
+		worker->send_to_links_buf[i]->kh_version = KNET_HEADER_VERSION;
+		worker->send_to_links_buf[i]->khp_data_frag_seq = i + 1;
+		worker->send_to_links_buf[i]->kh_node = htons(knet_h->host_id);
+	}
+
+	for (i = 0; i < PCKT_FRAG_MAX; i++) {
+		bufsize = ceil((float)KNET_MAX_PACKET_SIZE / (i + 1)) + KNET_HEADER_ALL_SIZE + KNET_DATABUFSIZE_CRYPT_PAD;
+		worker->send_to_links_buf_crypt[i] = malloc(bufsize);
+		if (!worker->send_to_links_buf_crypt[i]) {
+			savederrno = errno;
+			log_err(knet_h, KNET_SUB_TX, "Unable to allocate memory for crypto datafd to link buffer: %s",
+				strerror(savederrno));
+			goto exit_fail;
+		}
+		memset(worker->send_to_links_buf_crypt[i], 0, bufsize);
+	}
+
+	worker->recv_from_sock_buf = malloc(KNET_DATABUFSIZE);
+	if (!worker->recv_from_sock_buf) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_TX, "Unable to allocate memory for app to datafd buffer: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+	memset(worker->recv_from_sock_buf, 0, KNET_DATABUFSIZE);
+	worker->recv_from_sock_buf->kh_version = KNET_HEADER_VERSION;
+	worker->recv_from_sock_buf->khp_data_frag_seq = 0;
+	worker->recv_from_sock_buf->kh_node = htons(knet_h->host_id);
+
+	worker->send_to_links_buf_compress = malloc(KNET_DATABUFSIZE_COMPRESS);
+	if (!worker->send_to_links_buf_compress) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_TX, "Unable to allocate memory for compress buffer: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+	memset(worker->send_to_links_buf_compress, 0, KNET_DATABUFSIZE_COMPRESS);
+
+	worker->fanout = malloc(sizeof(struct knet_tx_fanout) * KNET_TX_FANOUT_SOCKS);
+	if (!worker->fanout) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_TX, "Unable to allocate memory for fan-out queues: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+	memset(worker->fanout, 0, sizeof(struct knet_tx_fanout) * KNET_TX_FANOUT_SOCKS);
+
+	/*
+	 * even if the kernel does dynamic allocation with epoll_ctl
+	 * we need to reserve one extra for host to host communication
+	 */
+	worker->epollfd = epoll_create(KNET_EPOLL_MAX_EVENTS + 1);
+	if (worker->epollfd < 0) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_TX, "Unable to create epoll datafd to link fd: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+
+	if (_fdset_cloexec(worker->epollfd)) {
+		savederrno = errno;
+		log_err(knet_h, KNET_SUB_TX, "Unable to set CLOEXEC on datafd to link epoll fd: %s",
+			strerror(savederrno));
+		goto exit_fail;
+	}
+
+	if (!worker_id) {
+		memset(&ev, 0, sizeof(struct epoll_event));
+		ev.events = EPOLLIN;
+		ev.data.fd = knet_h->hostsockfd[0];
+
+		if (epoll_ctl(worker->epollfd,
+			      EPOLL_CTL_ADD, knet_h->hostsockfd[0], &ev)) {
+			savederrno = errno;
+			log_err(knet_h, KNET_SUB_TX, "Unable to add hostsockfd[0] to epoll pool: %s",
+				strerror(savederrno));
+			goto exit_fail;
+		}
+	}
+
+	savederrno = pthread_create(&worker->thread, 0,
+				    _handle_send_to_links_thread, (void *) worker);
+	if (savederrno) {
+		log_err(knet_h, KNET_SUB_TX, "Unable to start datafd to link thread %u: %s",
+			worker_id, strerror(savederrno));
+		goto exit_fail;
+	}
+
+	knet_h->tx_workers[worker_id] = worker;
+
+	log_debug(knet_h, KNET_SUB_TX, "TX worker %u started", worker_id);
+
+	return 0;
+
+exit_fail:
+	_tx_worker_free(worker);
+	errno = savederrno;
+	return -1;
+}
+
+/*
+ * the worker must have been flagged to stop, or the handle must be
+ * shutting down, and this must be invoked without holding global_rwlock.
+ */
+void _tx_worker_stop(knet_handle_t knet_h, uint8_t worker_id)
+{
+	void *retval;
+	struct knet_tx_worker *worker = knet_h->tx_workers[worker_id];
+
+	if (!worker) {
+		return;
+	}
+
+	pthread_join(worker->thread, &retval);
+
+	knet_h->tx_workers[worker_id] = NULL;
+	_tx_worker_free(worker);
+
+	log_debug(knet_h, KNET_SUB_TX, "TX worker %u stopped", worker_id);
+}
+
+/*
+ * must be invoked in global write lock context, after
+ * knet_h->tx_workers_num has been updated.
+ */
+int _tx_workers_reshard(knet_handle_t knet_h)
+{
+	int err = 0, savederrno = 0;
+	int8_t channel;
+	uint8_t old_worker, new_worker;
+	int sockfd;
+	struct epoll_event ev;
+
+	for (channel = 0; channel < KNET_DATAFD_MAX; channel++) {
+		if (!knet_h->sockfd[channel].in_use) {
+			continue;
+		}
+
+		old_worker = knet_h->sockfd[channel].tx_worker;
+		new_worker = _tx_worker_by_channel(knet_h, channel);
+
+		if (old_worker == new_worker) {
+			continue;
+		}
+
+		knet_h->sockfd[channel].tx_worker = new_worker;
+
+		/*
+		 * socket has already been removed from epoll
+		 */
+		if (knet_h->sockfd[channel].has_error) {
+			continue;
+		}
+
+		sockfd = knet_h->sockfd[channel].sockfd[knet_h->sockfd[channel].is_created];
+
+		memset(&ev, 0, sizeof(struct epoll_event));
+		epoll_ctl(knet_h->tx_workers[old_worker]->epollfd, EPOLL_CTL_DEL, sockfd, &ev);
+
+		memset(&ev, 0, sizeof(struct epoll_event));
+		ev.events = EPOLLIN;
+		ev.data.fd = sockfd;
+
+		if (epoll_ctl(knet_h->tx_workers[new_worker]->epollfd, EPOLL_CTL_ADD, sockfd, &ev)) {
+			savederrno = errno;
+			err = -1;
+			log_err(knet_h, KNET_SUB_TX, "Unable to move datafd %d to TX worker %u: %s",
+				knet_h->sockfd[channel].sockfd[0], new_worker, strerror(savederrno));
+			/*
+			 * same as a read error, the application can still
+			 * remove the datafd safely
+			 */
+			knet_h->sockfd[channel].has_error = 1;
+			continue;
+		}
+
+		log_debug(knet_h, KNET_SUB_TX, "Channel %d moved from TX worker %u to %u",
+			  channel, old_worker, new_worker);
+	}
+
+	errno = savederrno;
+	return err;
+}
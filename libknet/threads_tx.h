@@ -10,6 +10,13 @@
 #ifndef __KNET_THREADS_TX_H__
 #define __KNET_THREADS_TX_H__
 
-void *_handle_send_to_links_thread(void *data);
+#include "internals.h"
+
+int _tx_worker_start(knet_handle_t knet_h, uint8_t worker_id);
+void _tx_worker_stop(knet_handle_t knet_h, uint8_t worker_id);
+uint8_t _tx_worker_by_channel(knet_handle_t knet_h, int8_t channel);
+int _tx_workers_reshard(knet_handle_t knet_h);
+int _crypto_worker_start(knet_handle_t knet_h, uint8_t worker_id);
+void _crypto_worker_stop(knet_handle_t knet_h, uint8_t worker_id);
 
 #endif
@@ -583,7 +583,7 @@ static void _handle_connected_sctp(knet_handle_t knet_h, int connect_sock)
 	kn_link->outsock = info->connect_sock;
 
 	memset(&ev, 0, sizeof(struct epoll_event));
-	ev.events = EPOLLIN;
+	ev.events = KNET_RX_EPOLL_EVENTS;
 	ev.data.fd = connect_sock;
 	if (epoll_ctl(knet_h->recv_from_links_epollfd, EPOLL_CTL_ADD, connect_sock, &ev)) {
 		log_err(knet_h, KNET_SUB_TRANSP_SCTP, "Unable to add connected socket to epoll pool: %s",
@@ -780,7 +780,7 @@ static void _handle_incoming_sctp(knet_handle_t knet_h, int listen_sock)
 	}
 
 	memset(&ev, 0, sizeof(struct epoll_event));
-	ev.events = EPOLLIN;
+	ev.events = KNET_RX_EPOLL_EVENTS;
 	ev.data.fd = new_fd;
 	if (epoll_ctl(knet_h->recv_from_links_epollfd, EPOLL_CTL_ADD, new_fd, &ev)) {
 		savederrno = errno;
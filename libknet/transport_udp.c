@@ -17,6 +17,7 @@
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <netinet/ip_icmp.h>
+#include <netinet/udp.h>
 #if defined (IP_RECVERR) || defined (IPV6_RECVERR)
 #include <linux/errqueue.h>
 #endif
@@ -117,6 +118,21 @@ int udp_transport_link_set_config(knet_handle_t knet_h, struct knet_link *kn_lin
 #else
 	log_debug(knet_h, KNET_SUB_TRANSP_UDP, "IPV6_RECVERR not available in this build/platform");
 #endif
+#ifdef UDP_GRO
+	/*
+	 * GRO is an optimization, older kernels can return ENOPROTOOPT
+	 * and we can live without it
+	 */
+	value = 1;
+	if (setsockopt(sock, IPPROTO_UDP, UDP_GRO, &value, sizeof(value)) < 0) {
+		log_debug(knet_h, KNET_SUB_TRANSP_UDP, "Unable to enable UDP_GRO on socket: %i: %s",
+			  sock, strerror(errno));
+	} else {
+		log_debug(knet_h, KNET_SUB_TRANSP_UDP, "UDP_GRO enabled on socket: %i", sock);
+	}
+#else
+	log_debug(knet_h, KNET_SUB_TRANSP_UDP, "UDP_GRO not available in this build/platform");
+#endif
 
 	if (bind(sock, (struct sockaddr *)&kn_link->src_addr, sockaddr_len(&kn_link->src_addr))) {
 		savederrno = errno;
@@ -127,7 +143,7 @@ int udp_transport_link_set_config(knet_handle_t knet_h, struct knet_link *kn_lin
 	}
 
 	memset(&ev, 0, sizeof(struct epoll_event));
-	ev.events = EPOLLIN;
+	ev.events = KNET_RX_EPOLL_EVENTS;
 	ev.data.fd = sock;
 
 	if (epoll_ctl(knet_h->recv_from_links_epollfd, EPOLL_CTL_ADD, sock, &ev)) {